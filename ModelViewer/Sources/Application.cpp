@@ -47,6 +47,27 @@ bool UpdateApplication(IApplication& app)
     return !app.IsDone();
 }
 
+// Frame count of "-headless [frames count]" on the command line, 0 without it.
+static UINT32 GetHeadlessFramesCount()
+{
+    constexpr UINT32 defaultFramesCount = 1000;
+
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    UINT32 framesCount = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (wcscmp(argv[i], L"-headless") == 0)
+        {
+            framesCount = i + 1 < argc ? static_cast<UINT32>(wcstoul(argv[i + 1], nullptr, 10)) : 0;
+            framesCount = framesCount > 0 ? framesCount : defaultFramesCount;
+            break;
+        }
+    }
+    LocalFree(argv);
+    return framesCount;
+}
+
 void TerminateApplication(IApplication& app)
 {
     app.Cleanup();
@@ -70,6 +91,11 @@ int RunApplication(IApplication& app, const wchar_t* className, HINSTANCE hInst,
     Microsoft::WRL::Wrappers::RoInitializeWrapper InitializeWinRT(RO_INIT_MULTITHREADED);
     //ASSERT(InitializeWinRT, "Windows runtime was not initialize.");
 
+    if (UINT32 headlessFramesCount = GetHeadlessFramesCount())
+    {
+        return RunHeadlessApplication(app, headlessFramesCount);
+    }
+
     RAWINPUTDEVICE Rid[2];
 
     Rid[0].usUsagePage = 0x01;          // HID_USAGE_PAGE_GENERIC
@@ -138,6 +164,43 @@ int RunApplication(IApplication& app, const wchar_t* className, HINSTANCE hInst,
     return 0;
 }
 
+int RunHeadlessApplication(IApplication& app, UINT32 aFramesCount)
+{
+    constexpr double frameTime = 1.0 / 60.0;
+    constexpr int mouseStepPerFrame = 4;
+
+    g_App = &app;
+    Graphics::InitializeNull();
+    app.Startup();
+
+    UINT32 framesCount = 0;
+    while (framesCount < aFramesCount && !app.IsDone())
+    {
+        framesCount += app.IsLoading() ? 0 : 1;
+        app.OnMouseMoved(mouseStepPerFrame, 0);
+        app.Update(frameTime);
+        app.RenderScene();
+        Graphics::Present();
+    }
+
+    TerminateApplication(app);
+    Graphics::Shutdown();
+    return 0;
+}
+
+bool IsBenchmarkRun(void)
+{
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    bool isBenchmarkRun = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        isBenchmarkRun |= wcscmp(argv[i], L"-benchmark") == 0;
+    }
+    LocalFree(argv);
+    return isBenchmarkRun;
+}
+
 bool IApplication::IsDone(void)
 {
     return false;
@@ -11,6 +11,8 @@ public:
     virtual void Startup(void) = 0;
     virtual void Cleanup(void) = 0;
     virtual bool IsDone(void);
+    // Headless runs only start counting frames when loading is done.
+    virtual bool IsLoading(void) { return false; }
     virtual void Update(double deltaT) = 0;
     virtual void RenderScene(void) = 0;
     virtual void OnResize(int width, int height) {}
@@ -21,10 +23,23 @@ public:
 extern HWND g_hWnd;
 
 int RunApplication(IApplication& app, const wchar_t* className, HINSTANCE hInst, int nCmdShow);
+// Runs app without a window on the null graphics backend, see Graphics::InitializeNull. Frames have a fixed time step
+// and the mouse turns the camera at a fixed rate. Runs until loading is done, then aFramesCount more frames. Used by
+// RunApplication when the command line has "-headless [frames count]".
+int RunHeadlessApplication(IApplication& app, UINT32 aFramesCount);
+
+// The Benchmark application, see Benchmark.cpp. CREATE_APPLICATION runs it instead of app_class when the command
+// line has "-benchmark".
+IApplication& GetBenchmarkApplication(void);
+bool IsBenchmarkRun(void);
 
 #define CREATE_APPLICATION( app_class ) \
     int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE /*hPrevInstance*/, _In_ LPWSTR /*lpCmdLine*/, _In_ int nCmdShow) \
     { \
+        if (IsBenchmarkRun()) \
+        { \
+            return RunApplication( GetBenchmarkApplication(), L"Benchmark", hInstance, nCmdShow ); \
+        } \
         app_class app;\
         return RunApplication( app, L#app_class, hInstance, nCmdShow ); \
     }
\ No newline at end of file
@@ -0,0 +1,1405 @@
+#include "pch.h"
+#include "Application.h"
+#include "Model.h"
+#include "Material.h"
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "RenderQueue.h"
+#include "Texture.h"
+#include "UploadBatch.h"
+#include "DirectXTex.h"
+#include "BoundingVolumeHierarchy.h"
+#include "CommandListPool.h"
+#include "OcclusionCulling.h"
+#include "RangeAllocator.h"
+#include "RayPicking.h"
+#include "Residency.h"
+#include "VertexCompression.h"
+#include "VirtualTexturing.h"
+#include "Utility.h"
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <execution>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <thread>
+
+// CPU-side benchmarks, run instead of the viewer when the command line has "-benchmark". Results go to the debug
+// output.
+class Benchmark : public IApplication
+{
+    bool mIsDone = false;
+
+    void RunSceneLoadBenchmark();
+    void RunTextureLoadBenchmark();
+    void RunCullingBenchmark();
+    void RunPickingBenchmark();
+    void RunOcclusionBenchmark();
+    void RunRecordingBenchmark();
+    void RunResidencyBenchmark();
+    void RunVirtualTexturingBenchmark();
+    void RunTexturePackingBenchmark();
+    void RunVertexCompressionBenchmark();
+    void RunMeshletBenchmark();
+    void RunRangeAllocatorBenchmark();
+    void RunRenderQueueBenchmark();
+
+public:
+
+    void Startup(void) override;
+    void Cleanup(void) override { GeometryArena::Shutdown(); }
+    void Update(double deltaT) override {}
+    void RenderScene(void) override {}
+    bool IsDone() override { return mIsDone; }
+};
+
+IApplication& GetBenchmarkApplication(void)
+{
+    static Benchmark benchmark;
+    return benchmark;
+}
+
+template<typename Function>
+static double MeasureMilliseconds(Function&& aFunction)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    aFunction();
+    std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - startTime;
+    return duration.count();
+}
+
+void Benchmark::Startup(void)
+{
+    RunSceneLoadBenchmark();
+    RunTextureLoadBenchmark();
+    RunCullingBenchmark();
+    RunPickingBenchmark();
+    RunOcclusionBenchmark();
+    RunRecordingBenchmark();
+    RunResidencyBenchmark();
+    RunVirtualTexturingBenchmark();
+    RunTexturePackingBenchmark();
+    RunVertexCompressionBenchmark();
+    RunMeshletBenchmark();
+    RunRangeAllocatorBenchmark();
+    RunRenderQueueBenchmark();
+    mIsDone = true;
+}
+
+// Loads every .obj under Scenes/ without a mesh cache (cold) and with it (warm). The first load of each scene is
+// only a warm-up that decodes the textures, so both measured loads hit the texture register and the numbers
+// compare the geometry paths only.
+void Benchmark::RunSceneLoadBenchmark()
+{
+    for (const auto& entry : std::filesystem::recursive_directory_iterator("../../Scenes"))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != ".obj")
+        {
+            continue;
+        }
+
+        std::string path = entry.path().generic_string();
+        std::filesystem::path cachePath = entry.path();
+        cachePath += ".meshcache";
+
+        Model warmUp(path);
+
+        std::filesystem::remove(cachePath);
+        double coldTime = MeasureMilliseconds([&path]() { Model model(path); });
+        double warmTime = MeasureMilliseconds([&path]() { Model model(path); });
+
+        Utility::Printf("Scene load benchmark: %s cold %.2f ms, warm %.2f ms, speedup %.1fx", path.c_str(), coldTime, warmTime, coldTime / warmTime);
+    }
+}
+
+// Loads the textures of every scene directory twice, the way the loader did before and the way it does now: decoded
+// one after another with a submit and fence wait per texture, and decoded on the worker pool with all uploads in
+// one batch. A warm-up decode first cooks missing textures and brings the files into the file cache, so both runs
+// read cooked DDS files from memory. The cooked images are also compared with decoding the sources with WIC.
+void Benchmark::RunTextureLoadBenchmark()
+{
+    for (const auto& sceneEntry : std::filesystem::directory_iterator("../../Scenes"))
+    {
+        if (!sceneEntry.is_directory())
+        {
+            continue;
+        }
+
+        std::vector<std::wstring> paths;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(sceneEntry.path()))
+        {
+            std::filesystem::path extension = entry.path().extension();
+            if (entry.is_regular_file() && (extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".bmp" || extension == ".tif"))
+            {
+                paths.push_back(std::filesystem::absolute(entry.path()).wstring());
+            }
+        }
+        if (paths.empty())
+        {
+            continue;
+        }
+
+        std::vector<std::unique_ptr<DirectX::ScratchImage>> images(paths.size());
+        std::vector<size_t> indices(paths.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        auto decodeAll = [&]()
+        {
+            std::for_each(std::execution::par, indices.begin(), indices.end(), [&](size_t aIndex) { images[aIndex] = Texture::Decode(paths[aIndex], aiTextureType_DIFFUSE); });
+        };
+        decodeAll();
+        std::vector<DirectX::ScratchImage> sourceImages(paths.size());
+        double sourceDecodeTime = MeasureMilliseconds([&]()
+        {
+            std::for_each(std::execution::par, indices.begin(), indices.end(), [&](size_t aIndex) { DirectX::LoadFromWICFile(paths[aIndex].c_str(), DirectX::WIC_FLAGS_NONE, nullptr, sourceImages[aIndex]); });
+        });
+        double cookedDecodeTime = MeasureMilliseconds(decodeAll);
+
+        UINT64 sizeInBytes = 0;
+        UINT64 sourceSizeInBytes = 0;
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            sizeInBytes += images[i] ? images[i]->GetPixelsSize() : 0;
+            sourceSizeInBytes += sourceImages[i].GetPixelsSize();
+        }
+        Utility::Printf("Texture cache benchmark: %s source decode %.2f ms for %llu MB, cooked load %.2f ms for %llu MB with mips, %.1fx smaller",
+            sceneEntry.path().generic_string().c_str(), sourceDecodeTime, sourceSizeInBytes / (1024 * 1024), cookedDecodeTime, sizeInBytes / (1024 * 1024), double(sourceSizeInBytes) / double(sizeInBytes));
+
+        UINT64 submitsCount = Graphics::g_BackendStatistics.Submits;
+        double serialTime = MeasureMilliseconds([&]()
+        {
+            for (const std::wstring& path : paths)
+            {
+                std::unique_ptr<DirectX::ScratchImage> image = Texture::Decode(path, aiTextureType_DIFFUSE);
+                if (image)
+                {
+                    Texture::CreateTexture(path, image.get());
+                }
+            }
+        });
+        UINT64 serialSubmitsCount = Graphics::g_BackendStatistics.Submits - submitsCount;
+
+        submitsCount = Graphics::g_BackendStatistics.Submits;
+        double parallelTime = MeasureMilliseconds([&]()
+        {
+            decodeAll();
+            UploadBatch uploadBatch;
+            for (size_t i = 0; i < paths.size(); ++i)
+            {
+                if (images[i])
+                {
+                    Texture::CreateTexture(paths[i], images[i].get(), &uploadBatch);
+                }
+            }
+        });
+        UINT64 parallelSubmitsCount = Graphics::g_BackendStatistics.Submits - submitsCount;
+
+        Utility::Printf("Texture load benchmark: %s %zu textures, %llu MB, serial %.2f ms with %llu fence waits, parallel batched %.2f ms with %llu fence waits, speedup %.1fx",
+            sceneEntry.path().generic_string().c_str(), paths.size(), sizeInBytes / (1024 * 1024), serialTime, serialSubmitsCount, parallelTime, parallelSubmitsCount, serialTime / parallelTime);
+    }
+}
+
+struct CullingBound
+{
+    DirectX::XMFLOAT3 Center;
+    DirectX::XMFLOAT3 Extents;
+    float Radius;
+};
+
+// Baseline for the culling benchmark, one bound at a time in array-of-structures layout with an early out per plane.
+static void CullScalar(const FrustumCulling::Frustum& aFrustum, const std::vector<CullingBound>& aBounds, std::vector<UINT32>& aVisibleIndices)
+{
+    aVisibleIndices.clear();
+    for (UINT32 i = 0; i < aBounds.size(); ++i)
+    {
+        const CullingBound& bound = aBounds[i];
+        bool isVisible = true;
+        for (const DirectX::XMFLOAT4& plane : aFrustum.Planes)
+        {
+            float distance = (plane.x * bound.Center.x + plane.y * bound.Center.y) + (plane.z * bound.Center.z + plane.w);
+            float boxRadius = std::abs(plane.x) * bound.Extents.x + std::abs(plane.y) * bound.Extents.y + std::abs(plane.z) * bound.Extents.z;
+            if (distance + std::min(boxRadius, bound.Radius) < 0.0f)
+            {
+                isVisible = false;
+                break;
+            }
+        }
+
+        if (isVisible)
+        {
+            aVisibleIndices.push_back(i);
+        }
+    }
+}
+
+// Culls 256k random bounds spread around a camera, the best of several runs is reported for the scalar baseline,
+// the flat SIMD kernel and the bounding volume hierarchy, and all of them have to agree on the visible set.
+void Benchmark::RunCullingBenchmark()
+{
+    constexpr UINT32 boundsCount = 256 * 1024;
+    constexpr UINT32 runsCount = 20;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+    std::uniform_real_distribution<float> size(0.5f, 20.0f);
+
+    std::vector<CullingBound> bounds(boundsCount);
+    FrustumCulling::BoundsList boundsList;
+    for (CullingBound& bound : bounds)
+    {
+        bound.Center = DirectX::XMFLOAT3(position(random), position(random), position(random));
+        bound.Extents = DirectX::XMFLOAT3(size(random), size(random), size(random));
+        bound.Radius = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMLoadFloat3(&bound.Extents)));
+        boundsList.Add(bound.Center, bound.Extents, bound.Radius);
+    }
+
+    DirectX::XMMATRIX view = DirectX::XMMatrixLookAtLH(DirectX::XMVectorSet(0.0f, 0.0f, -200.0f, 1.0f), DirectX::XMVectorSet(300.0f, 100.0f, 500.0f, 1.0f), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    DirectX::XMMATRIX projection = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(45.0f), 16.0f / 9.0f, 10.0f, 10000.0f);
+    FrustumCulling::Frustum frustum = FrustumCulling::ExtractFrustum(DirectX::XMMatrixMultiply(view, projection));
+
+    BoundingVolumeHierarchy hierarchy;
+    double buildTime = MeasureMilliseconds([&]() { hierarchy.Build(boundsList); });
+    double refitTime = MeasureMilliseconds([&]() { hierarchy.Refit(boundsList); });
+
+    std::vector<UINT32> scalarVisible;
+    std::vector<UINT32> simdVisible;
+    std::vector<UINT32> hierarchyVisible;
+    double scalarTime = DBL_MAX;
+    double simdTime = DBL_MAX;
+    double hierarchyTime = DBL_MAX;
+    for (UINT32 run = 0; run < runsCount; ++run)
+    {
+        scalarTime = std::min(scalarTime, MeasureMilliseconds([&]() { CullScalar(frustum, bounds, scalarVisible); }));
+        simdTime = std::min(simdTime, MeasureMilliseconds([&]() { FrustumCulling::Cull(frustum, boundsList, simdVisible); }));
+        hierarchyTime = std::min(hierarchyTime, MeasureMilliseconds([&]() { hierarchy.CullFrustum(frustum, hierarchyVisible); }));
+    }
+
+    std::sort(hierarchyVisible.begin(), hierarchyVisible.end());
+    ASSERT(scalarVisible == simdVisible, "SIMD culling disagrees with the scalar reference.");
+    ASSERT(scalarVisible == hierarchyVisible, "Hierarchy culling disagrees with the scalar reference.");
+    Utility::Printf("Culling benchmark: %u bounds, %zu visible, scalar %.3f ms, SIMD %.3f ms, speedup %.1fx", boundsCount, simdVisible.size(), scalarTime, simdTime, scalarTime / simdTime);
+    Utility::Printf("Culling benchmark: hierarchy of %u nodes built in %.2f ms, refit in %.2f ms, culled in %.3f ms", hierarchy.GetNodesCount(), buildTime, refitTime, hierarchyTime);
+}
+
+// Baseline for the picking benchmark, every triangle is tested with the same Moller-Trumbore test as the SIMD kernel.
+static bool IntersectScalar(const std::vector<DirectX::XMFLOAT3>& aPositions, const std::vector<UINT32>& aIndices, const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, RayPicking::TriangleHit& aHit)
+{
+    DirectX::XMVECTOR origin = DirectX::XMLoadFloat3(&aOrigin);
+    DirectX::XMVECTOR direction = DirectX::XMLoadFloat3(&aDirection);
+    aHit.Distance = FLT_MAX;
+    for (UINT32 triangle = 0; triangle < aIndices.size() / 3; ++triangle)
+    {
+        DirectX::XMVECTOR vertex0 = DirectX::XMLoadFloat3(&aPositions[aIndices[triangle * 3]]);
+        DirectX::XMVECTOR edge1 = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&aPositions[aIndices[triangle * 3 + 1]]), vertex0);
+        DirectX::XMVECTOR edge2 = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&aPositions[aIndices[triangle * 3 + 2]]), vertex0);
+        DirectX::XMVECTOR p = DirectX::XMVector3Cross(direction, edge2);
+        float determinant = DirectX::XMVectorGetX(DirectX::XMVector3Dot(edge1, p));
+        if (std::abs(determinant) <= 1e-12f)
+        {
+            continue;
+        }
+
+        DirectX::XMVECTOR s = DirectX::XMVectorSubtract(origin, vertex0);
+        DirectX::XMVECTOR q = DirectX::XMVector3Cross(s, edge1);
+        float inverseDeterminant = 1.0f / determinant;
+        float u = DirectX::XMVectorGetX(DirectX::XMVector3Dot(s, p)) * inverseDeterminant;
+        float v = DirectX::XMVectorGetX(DirectX::XMVector3Dot(direction, q)) * inverseDeterminant;
+        float distance = DirectX::XMVectorGetX(DirectX::XMVector3Dot(edge2, q)) * inverseDeterminant;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance >= 0.0f && distance < aHit.Distance)
+        {
+            aHit = { distance, triangle, u, v };
+        }
+    }
+    return aHit.Distance < FLT_MAX;
+}
+
+// Casts random rays at a 128k triangle height field, checks a few hundred of them against the brute force baseline and
+// reports the throughput of the hierarchy. Then casts rays from the middle of Sponza through Model::Pick, which goes
+// through the instance hierarchy and builds the triangle hierarchies of the meshes it reaches.
+void Benchmark::RunPickingBenchmark()
+{
+    constexpr UINT32 gridSize = 256;
+    constexpr UINT32 checkedRaysCount = 256;
+    constexpr UINT32 raysCount = 100000;
+
+    std::vector<DirectX::XMFLOAT3> positions;
+    std::vector<UINT32> indices;
+    for (UINT32 z = 0; z <= gridSize; ++z)
+    {
+        for (UINT32 x = 0; x <= gridSize; ++x)
+        {
+            positions.emplace_back(static_cast<float>(x), 5.0f * std::sin(x * 0.1f) * std::cos(z * 0.13f), static_cast<float>(z));
+        }
+    }
+    for (UINT32 z = 0; z < gridSize; ++z)
+    {
+        for (UINT32 x = 0; x < gridSize; ++x)
+        {
+            UINT32 corner = z * (gridSize + 1) + x;
+            indices.insert(indices.end(), { corner, corner + gridSize + 1, corner + 1, corner + 1, corner + gridSize + 1, corner + gridSize + 2 });
+        }
+    }
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> position(0.0f, static_cast<float>(gridSize));
+    std::uniform_real_distribution<float> slope(-1.0f, 1.0f);
+    auto makeRay = [&](DirectX::XMFLOAT3& aOrigin, DirectX::XMFLOAT3& aDirection)
+    {
+        aOrigin = DirectX::XMFLOAT3(position(random), 30.0f, position(random));
+        DirectX::XMStoreFloat3(&aDirection, DirectX::XMVector3Normalize(DirectX::XMVectorSet(slope(random), -1.0f, slope(random), 0.0f)));
+    };
+
+    RayPicking::TriangleMesh mesh{ std::vector<DirectX::XMFLOAT3>(positions), std::vector<UINT32>(indices) };
+    RayPicking::TriangleHit hit;
+    double buildTime = MeasureMilliseconds([&]() { mesh.Intersect(DirectX::XMFLOAT3(0.0f, 30.0f, 0.0f), DirectX::XMFLOAT3(0.0f, -1.0f, 0.0f), FLT_MAX, hit); });
+
+    double scalarTime = 0.0;
+    for (UINT32 i = 0; i < checkedRaysCount; ++i)
+    {
+        DirectX::XMFLOAT3 origin, direction;
+        makeRay(origin, direction);
+        RayPicking::TriangleHit scalarHit;
+        bool isScalarHit = false;
+        scalarTime += MeasureMilliseconds([&]() { isScalarHit = IntersectScalar(positions, indices, origin, direction, scalarHit); });
+        bool isHit = mesh.Intersect(origin, direction, FLT_MAX, hit);
+        ASSERT(isHit == isScalarHit && (!isHit || std::abs(hit.Distance - scalarHit.Distance) <= 1e-3f * scalarHit.Distance), "Ray picking disagrees with the scalar reference.");
+    }
+
+    UINT32 hitsCount = 0;
+    double hierarchyTime = MeasureMilliseconds([&]()
+    {
+        for (UINT32 i = 0; i < raysCount; ++i)
+        {
+            DirectX::XMFLOAT3 origin, direction;
+            makeRay(origin, direction);
+            hitsCount += mesh.Intersect(origin, direction, FLT_MAX, hit) ? 1 : 0;
+        }
+    });
+    Utility::Printf("Picking benchmark: %u triangles, hierarchy built in %.2f ms, scalar %.3f ms per ray, hierarchy %.2f us per ray, %.2f Mrays/s, %u hits",
+        mesh.GetTrianglesCount(), buildTime, scalarTime / checkedRaysCount, hierarchyTime * 1000.0 / raysCount, raysCount / hierarchyTime / 1000.0, hitsCount);
+
+    Model sponza("../../Scenes/sponza/sponza.obj");
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    auto castRays = [&](UINT32 aRaysCount)
+    {
+        UINT32 picksCount = 0;
+        for (UINT32 i = 0; i < aRaysCount; ++i)
+        {
+            DirectX::XMFLOAT3 rayDirection;
+            DirectX::XMStoreFloat3(&rayDirection, DirectX::XMVector3Normalize(DirectX::XMVectorSet(direction(random), direction(random), direction(random), 0.0f)));
+            PickResult pick;
+            picksCount += sponza.Pick(DirectX::XMFLOAT3(0.0f, 300.0f, 0.0f), rayDirection, pick) ? 1 : 0;
+        }
+        return picksCount;
+    };
+
+    // The first rays build the triangle hierarchies of every mesh they reach.
+    double firstPicksTime = MeasureMilliseconds([&]() { castRays(1000); });
+    UINT32 picksCount = 0;
+    double picksTime = MeasureMilliseconds([&]() { picksCount = castRays(raysCount); });
+    Utility::Printf("Picking benchmark: Sponza first 1000 picks %.2f ms with lazy builds, then %.2f us per pick, %.2f Mrays/s, %u hits",
+        firstPicksTime, picksTime * 1000.0 / raysCount, raysCount / picksTime / 1000.0, picksCount);
+}
+
+// Checks that a wall hides the box behind it and not the one in front of it, then times rasterizing a 32k triangle wall
+// and testing 64k random bounds against it. Then culls Sponza from a few viewpoints with and without occlusion
+// culling, the occluders are picked by Model when it loads.
+void Benchmark::RunOcclusionBenchmark()
+{
+    constexpr UINT32 gridSize = 128;
+    constexpr UINT32 boundsCount = 64 * 1024;
+    constexpr UINT32 runsCount = 20;
+
+    DirectX::XMMATRIX view = DirectX::XMMatrixLookAtLH(DirectX::XMVectorSet(0.0f, 0.0f, -50.0f, 1.0f), DirectX::XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    DirectX::XMMATRIX projection = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(60.0f), 16.0f / 9.0f, 1.0f, 1000.0f);
+    DirectX::XMMATRIX viewProjection = DirectX::XMMatrixMultiply(view, projection);
+
+    OcclusionCulling::OcclusionBuffer buffer(320, 180);
+    std::vector<DirectX::XMFLOAT3> wallPositions = { { -20.0f, -20.0f, 0.0f }, { 20.0f, -20.0f, 0.0f }, { 20.0f, 20.0f, 0.0f }, { -20.0f, 20.0f, 0.0f } };
+    std::vector<UINT32> wallIndices = { 0, 1, 2, 0, 2, 3 };
+    buffer.RenderOccluder(wallPositions, wallIndices, viewProjection);
+    ASSERT(!buffer.IsVisible(DirectX::XMFLOAT3(0.0f, 0.0f, 10.0f), DirectX::XMFLOAT3(2.0f, 2.0f, 2.0f), viewProjection), "A box behind the wall is visible.");
+    ASSERT(buffer.IsVisible(DirectX::XMFLOAT3(0.0f, 0.0f, -10.0f), DirectX::XMFLOAT3(2.0f, 2.0f, 2.0f), viewProjection), "A box in front of the wall is occluded.");
+    ASSERT(buffer.IsVisible(DirectX::XMFLOAT3(19.0f, 0.0f, 10.0f), DirectX::XMFLOAT3(3.0f, 2.0f, 2.0f), viewProjection), "A box sticking out behind the wall is occluded.");
+
+    std::vector<DirectX::XMFLOAT3> positions;
+    std::vector<UINT32> indices;
+    for (UINT32 y = 0; y <= gridSize; ++y)
+    {
+        for (UINT32 x = 0; x <= gridSize; ++x)
+        {
+            positions.emplace_back(-40.0f + 80.0f * x / gridSize, -40.0f + 80.0f * y / gridSize, 0.3f * std::sin(x * 0.3f));
+        }
+    }
+    for (UINT32 y = 0; y < gridSize; ++y)
+    {
+        for (UINT32 x = 0; x < gridSize; ++x)
+        {
+            UINT32 corner = y * (gridSize + 1) + x;
+            indices.insert(indices.end(), { corner, corner + gridSize + 1, corner + 1, corner + 1, corner + gridSize + 1, corner + gridSize + 2 });
+        }
+    }
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+    FrustumCulling::BoundsList bounds;
+    std::vector<UINT32> allIndices(boundsCount);
+    for (UINT32 i = 0; i < boundsCount; ++i)
+    {
+        DirectX::XMFLOAT3 extents(size(random), size(random), size(random));
+        bounds.Add(DirectX::XMFLOAT3(position(random), position(random), position(random) + 60.0f), extents, DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMLoadFloat3(&extents))));
+        allIndices[i] = i;
+    }
+
+    std::vector<UINT32> visibleIndices;
+    double rasterTime = DBL_MAX;
+    double testTime = DBL_MAX;
+    for (UINT32 run = 0; run < runsCount; ++run)
+    {
+        rasterTime = std::min(rasterTime, MeasureMilliseconds([&]() { buffer.Clear(); buffer.RenderOccluder(positions, indices, viewProjection); }));
+        visibleIndices = allIndices;
+        testTime = std::min(testTime, MeasureMilliseconds([&]() { buffer.Cull(bounds, visibleIndices, viewProjection); }));
+    }
+    Utility::Printf("Occlusion benchmark: %zu triangles rasterized in %.3f ms, %u bounds tested in %.3f ms, %zu visible",
+        indices.size() / 3, rasterTime, boundsCount, testTime, visibleIndices.size());
+
+    Model sponza("../../Scenes/sponza/sponza.obj");
+    const DirectX::XMVECTOR viewpoints[][2] = {
+        { DirectX::XMVectorSet(-1200.0f, 150.0f, 0.0f, 1.0f), DirectX::XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f) },
+        { DirectX::XMVectorSet(0.0f, 150.0f, 0.0f, 1.0f), DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) },
+        { DirectX::XMVectorSet(0.0f, 150.0f, 400.0f, 1.0f), DirectX::XMVectorSet(-1.0f, 0.0f, 0.0f, 0.0f) },
+        { DirectX::XMVectorSet(1000.0f, 600.0f, -300.0f, 1.0f), DirectX::XMVectorSet(-1.0f, -0.3f, 0.3f, 0.0f) },
+    };
+    projection = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(45.0f), 16.0f / 9.0f, 10.0f, 10000.0f);
+    for (const auto& [eye, direction] : viewpoints)
+    {
+        viewProjection = DirectX::XMMatrixMultiply(DirectX::XMMatrixLookToLH(eye, direction, DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)), projection);
+        double frustumTime = DBL_MAX;
+        double occlusionTime = DBL_MAX;
+        UINT32 frustumVisibleCount = 0;
+        UINT32 occlusionVisibleCount = 0;
+        for (UINT32 run = 0; run < runsCount; ++run)
+        {
+            sponza.SetOcclusionCullingEnabled(false);
+            frustumTime = std::min(frustumTime, MeasureMilliseconds([&]() { sponza.Cull(viewProjection); }));
+            frustumVisibleCount = sponza.GetVisibleInstancesCount();
+            sponza.SetOcclusionCullingEnabled(true);
+            occlusionTime = std::min(occlusionTime, MeasureMilliseconds([&]() { sponza.Cull(viewProjection); }));
+            occlusionVisibleCount = sponza.GetVisibleInstancesCount();
+        }
+
+        DirectX::XMFLOAT3 eyePosition;
+        DirectX::XMStoreFloat3(&eyePosition, eye);
+        Utility::Printf("Occlusion benchmark: Sponza from (%.0f, %.0f, %.0f) frustum culling keeps %u instances in %.3f ms, occlusion culling %u in %.3f ms",
+            eyePosition.x, eyePosition.y, eyePosition.z, frustumVisibleCount, frustumTime, occlusionVisibleCount, occlusionTime);
+    }
+}
+
+// Stands in for a command list, it keeps the commands instead of encoding them for the GPU.
+struct MockCommandList
+{
+    struct Command
+    {
+        UINT32 Type;
+        UINT32 Value;
+    };
+
+    std::vector<Command> Commands;
+};
+
+// Checks that the partition covers every draw in order with balanced ranges, and that lists recorded in parallel and
+// concatenated in list order give the same commands as one list recorded on one thread. Then compares the recording
+// times of one and of all worker lists for a million mock draws.
+void Benchmark::RunRecordingBenchmark()
+{
+    constexpr UINT32 maxListsCount = CommandListPool::sMaxListsCount;
+    constexpr UINT32 minDrawsPerList = 64;
+    constexpr UINT32 drawsCount = 1000000;
+    constexpr UINT32 runsCount = 10;
+
+    for (UINT32 itemsCount : { 0u, 1u, 63u, 64u, 200u, 1000u, 100003u })
+    {
+        std::vector<ParallelRecording::Range> ranges = ParallelRecording::Partition(itemsCount, maxListsCount, minDrawsPerList);
+        ASSERT(ranges.size() <= maxListsCount && (itemsCount == 0) == ranges.empty(), "Wrong number of ranges.");
+        UINT32 next = 0;
+        for (const ParallelRecording::Range& range : ranges)
+        {
+            ASSERT(range.First == next && range.Count > 0 && range.Count + 1 >= ranges.front().Count, "Ranges are not contiguous or not balanced.");
+            ASSERT(ranges.size() == 1 || range.Count >= minDrawsPerList, "Range is smaller than the minimum.");
+            next += range.Count;
+        }
+        ASSERT(next == itemsCount, "Ranges do not cover every item.");
+    }
+
+    // A draw is a few state changes and the draw itself, state that the previous draw of the list already set is
+    // skipped like in Model::Render.
+    auto recordDraws = [](MockCommandList& aList, const ParallelRecording::Range& aRange)
+    {
+        aList.Commands.clear();
+        aList.Commands.push_back({ 0, aRange.First });
+        UINT32 boundMaterial = UINT32_MAX;
+        for (UINT32 draw = aRange.First; draw < aRange.First + aRange.Count; ++draw)
+        {
+            UINT32 material = static_cast<UINT32>(Utility::HashMemory(&draw, sizeof(draw)) % 16);
+            if (material != boundMaterial)
+            {
+                aList.Commands.push_back({ 1, material });
+                boundMaterial = material;
+            }
+            aList.Commands.push_back({ 2, draw });
+            aList.Commands.push_back({ 3, draw });
+        }
+    };
+    auto flatten = [](std::span<const MockCommandList> aLists)
+    {
+        std::vector<UINT32> draws;
+        for (const MockCommandList& list : aLists)
+        {
+            for (const MockCommandList::Command& command : list.Commands)
+            {
+                if (command.Type == 3)
+                {
+                    draws.push_back(command.Value);
+                }
+            }
+        }
+        return draws;
+    };
+
+    std::vector<MockCommandList> serialLists(1);
+    std::vector<MockCommandList> parallelLists(maxListsCount);
+    std::vector<ParallelRecording::Range> serialRanges = ParallelRecording::Partition(drawsCount, 1, minDrawsPerList);
+    std::vector<ParallelRecording::Range> parallelRanges = ParallelRecording::Partition(drawsCount, maxListsCount, minDrawsPerList);
+    double serialTime = DBL_MAX;
+    double parallelTime = DBL_MAX;
+    for (UINT32 run = 0; run < runsCount; ++run)
+    {
+        serialTime = std::min(serialTime, MeasureMilliseconds([&]() { ParallelRecording::Record(std::span<MockCommandList>(serialLists), std::span<const ParallelRecording::Range>(serialRanges), recordDraws); }));
+        parallelTime = std::min(parallelTime, MeasureMilliseconds([&]() { ParallelRecording::Record(std::span<MockCommandList>(parallelLists), std::span<const ParallelRecording::Range>(parallelRanges), recordDraws); }));
+    }
+
+    std::vector<UINT32> serialDraws = flatten(serialLists);
+    std::vector<UINT32> parallelDraws = flatten(std::span<const MockCommandList>(parallelLists.data(), parallelRanges.size()));
+    ASSERT(serialDraws.size() == drawsCount && serialDraws == parallelDraws, "Parallel recording changed the draw order.");
+    for (UINT32 i = 0; i < parallelRanges.size(); ++i)
+    {
+        ASSERT(parallelLists[i].Commands.front().Type == 0 && parallelLists[i].Commands[1].Type == 1, "A list does not set its own state.");
+    }
+
+    Utility::Printf("Recording benchmark: %u mock draws, 1 list %.2f ms, %zu lists %.2f ms, speedup %.1fx on %u hardware threads",
+        drawsCount, serialTime, parallelRanges.size(), parallelTime, serialTime / parallelTime, std::thread::hardware_concurrency());
+}
+
+// Checks the eviction order of the residency tracker on a few resources, then drives it with a simulated budget: 4096
+// resources of 64 KB to 16 MB, a budget of 40% of their size and a working set that slides over them like a camera
+// moving through a scene. Every frame the working set has to be resident and the rest within the budget.
+void Benchmark::RunResidencyBenchmark()
+{
+    {
+        Residency::Tracker tracker;
+        std::vector<UINT32> evicted;
+        UINT32 a = tracker.Add(10, 0), b = tracker.Add(10, 0), c = tracker.Add(10, 0), d = tracker.Add(10, 0);
+        tracker.MarkUsed(a, 1);
+        tracker.MarkUsed(c, 1);
+        tracker.Evict(25, 1, evicted);
+        ASSERT(evicted == std::vector<UINT32>({ b, d }) && tracker.GetResidentBytes() == 20 && tracker.GetEvictedBytes() == 20, "Least recently used resources were not evicted first.");
+        ASSERT(tracker.MarkUsed(b, 2) && !tracker.MarkUsed(c, 2) && tracker.GetResidentBytes() == 30, "Evicted resource was not restored.");
+        evicted.clear();
+        tracker.Evict(0, 2, evicted);
+        ASSERT(evicted == std::vector<UINT32>({ a }) && tracker.IsResident(b) && tracker.IsResident(c), "Resource used in the current frame was evicted.");
+        tracker.Remove(d);
+        tracker.Remove(a);
+        ASSERT(tracker.GetResourcesCount() == 2 && tracker.GetEvictedBytes() == 0 && tracker.Add(5, 2) == a, "Removed resources are still counted.");
+    }
+
+    constexpr UINT32 resourcesCount = 4096;
+    constexpr UINT32 workingSetCount = 512;
+    constexpr UINT32 framesCount = 2000;
+    std::mt19937 random(7);
+    std::uniform_int_distribution<UINT64> sizeDistribution(1, 256);
+
+    Residency::Tracker tracker;
+    std::vector<UINT32> handles(resourcesCount);
+    std::vector<UINT64> sizes(resourcesCount);
+    UINT64 totalBytes = 0;
+    for (UINT32 i = 0; i < resourcesCount; ++i)
+    {
+        sizes[i] = sizeDistribution(random) * 64 * 1024;
+        handles[i] = tracker.Add(sizes[i], 0);
+        totalBytes += sizes[i];
+    }
+    UINT64 budgetInBytes = totalBytes * 2 / 5;
+
+    UINT64 restoresCount = 0;
+    UINT64 evictionsCount = 0;
+    UINT64 restoredBytes = 0;
+    std::vector<UINT32> evicted;
+    std::vector<UINT64> frameUsed(resourcesCount, UINT64_MAX);
+    double time = MeasureMilliseconds([&]()
+    {
+        for (UINT64 frame = 1; frame <= framesCount; ++frame)
+        {
+            // The window moves by a few resources per frame and a tenth of the set is scattered over the scene.
+            UINT32 first = static_cast<UINT32>(frame * 3) % resourcesCount;
+            for (UINT32 i = 0; i < workingSetCount; ++i)
+            {
+                UINT32 index = i < workingSetCount * 9 / 10 ? (first + i) % resourcesCount : static_cast<UINT32>(random() % resourcesCount);
+                frameUsed[index] = frame;
+                if (tracker.MarkUsed(handles[index], frame))
+                {
+                    ++restoresCount;
+                    restoredBytes += sizes[index];
+                }
+            }
+
+            evicted.clear();
+            tracker.Evict(budgetInBytes, frame, evicted);
+            evictionsCount += evicted.size();
+            for (UINT32 handle : evicted)
+            {
+                ASSERT(frameUsed[handle] != frame, "Resource of the working set was evicted.");
+            }
+        }
+    });
+
+    UINT64 residentBytes = 0;
+    for (UINT32 i = 0; i < resourcesCount; ++i)
+    {
+        ASSERT(tracker.IsResident(handles[i]) || frameUsed[i] != framesCount, "Working set is not resident.");
+        residentBytes += tracker.IsResident(handles[i]) ? sizes[i] : 0;
+    }
+    ASSERT(residentBytes == tracker.GetResidentBytes() && residentBytes + tracker.GetEvictedBytes() == totalBytes, "Residency accounting is off.");
+    ASSERT(residentBytes <= budgetInBytes, "Resident resources exceed the budget.");
+
+    Utility::Printf("Residency benchmark: %u resources, %llu MB in a %llu MB budget, %u frames in %.2f ms (%.2f us per frame), %.1f evictions and %.1f restores (%.1f MB) per frame",
+        resourcesCount, totalBytes >> 20, budgetInBytes >> 20, framesCount, time, time * 1000.0 / framesCount, evictionsCount / double(framesCount), restoresCount / double(framesCount), restoredBytes / (1024.0 * 1024.0 * framesCount));
+}
+
+// Checks the tile file layout, the page table fallbacks and the tile cache on small cases, then drives a page table
+// and cache per texture with a simulated camera: 64 virtual textures of 4096 x 4096, one atlas of 1024 slots and a
+// window of visible textures that slides over them, each seen at a distance that changes its mip. Every frame at
+// most 32 missing tiles come in, coarse first, and every page table entry has to point at a slot that holds its tile.
+void Benchmark::RunVirtualTexturingBenchmark()
+{
+    using namespace VirtualTexturing;
+
+    {
+        // Every 8 byte block of the synthetic BC1 mips holds its own coordinates.
+        constexpr UINT32 width = 300, height = 200, mipsCount = 3;
+        std::vector<std::vector<BYTE>> mipData(mipsCount);
+        std::vector<MipBlocks> mips(mipsCount);
+        for (UINT32 mip = 0; mip < mipsCount; ++mip)
+        {
+            UINT32 blocksCountX = ((width >> mip) + 3) / 4, blocksCountY = ((height >> mip) + 3) / 4;
+            mipData[mip].resize(blocksCountX * blocksCountY * 8);
+            for (UINT32 y = 0; y < blocksCountY; ++y)
+            {
+                for (UINT32 x = 0; x < blocksCountX; ++x)
+                {
+                    BYTE* block = &mipData[mip][(y * blocksCountX + x) * 8];
+                    block[0] = static_cast<BYTE>(mip);
+                    block[1] = static_cast<BYTE>(x);
+                    block[2] = static_cast<BYTE>(y);
+                }
+            }
+            mips[mip] = { mipData[mip].data(), width >> mip, height >> mip, blocksCountX * 8 };
+        }
+
+        std::wstring path = (std::filesystem::temp_directory_path() / L"ModelViewerBenchmark.tiles").wstring();
+        TileFile file;
+        ASSERT(TileFile::Write(path, DXGI_FORMAT_BC1_UNORM, width, height, mips) && file.Open(path), "Failed to write tile file.");
+        ASSERT(file.GetMipsCount() == mipsCount && file.GetTileSizeInBytes() == 34 * 34 * 8 && file.GetTileRowPitch() == 34 * 8, "Tile file header is wrong.");
+        auto blockAt = [&file](UINT32 aMip, UINT32 aTileX, UINT32 aTileY, UINT32 aX, UINT32 aY)
+        {
+            const BYTE* block = file.GetTile(aMip, aTileX, aTileY) + aY * file.GetTileRowPitch() + aX * 8;
+            return std::array<UINT32, 3>{ block[0], block[1], block[2] };
+        };
+        ASSERT((blockAt(0, 1, 0, 1, 1) == std::array<UINT32, 3>{ 0, 32, 0 }), "Tile does not start at its first texel.");
+        ASSERT((blockAt(0, 1, 0, 0, 0) == std::array<UINT32, 3>{ 0, 31, 49 }), "Tile border does not wrap.");
+        ASSERT((blockAt(0, 2, 1, 33, 33) == std::array<UINT32, 3>{ 0, 21, 14 }), "Tile beyond the mip edge does not wrap.");
+        ASSERT((blockAt(2, 0, 0, 1, 1) == std::array<UINT32, 3>{ 2, 0, 0 }), "Coarsest tile is misplaced.");
+        file = TileFile();
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+    {
+        PageTable table(300, 200, 3);
+        ASSERT(table.GetEntriesCountX(0) == 4 && table.GetEntriesCountY(0) == 2 && table.GetEntriesCountX(1) == 2 && table.GetEntriesCountY(2) == 1, "Page table mips do not hold the tile grids.");
+        ASSERT(table.Update() && table.GetEntry(0, 2, 1) == sInvalidEntry && !table.Update(), "Empty page table has entries.");
+        table.SetSlot(2, 0, 0, 7);
+        table.SetSlot(1, 1, 0, 3);
+        table.Update();
+        ASSERT(table.GetEntry(0, 0, 1) == PageTable::PackEntry(7, 2) && table.GetEntry(0, 2, 1) == PageTable::PackEntry(3, 1) && table.GetEntry(1, 1, 0) == PageTable::PackEntry(3, 1), "Page table does not fall back to the nearest resident parent.");
+        table.SetSlot(0, 2, 1, 5);
+        table.SetSlot(1, 1, 0, sInvalidSlot);
+        table.Update();
+        ASSERT(table.GetEntry(0, 2, 1) == PageTable::PackEntry(5, 0) && table.GetEntry(0, 3, 0) == PageTable::PackEntry(7, 2), "Page table does not follow its slots.");
+    }
+
+    {
+        TileCache cache(4);
+        UINT64 evicted = 0;
+        UINT32 a = cache.Allocate(1, 1, evicted), b = cache.Allocate(2, 1, evicted), c = cache.Allocate(3, 1, evicted), d = cache.Allocate(4, 1, evicted);
+        ASSERT(a != b && c != d && evicted == sInvalidTile && cache.Allocate(5, 1, evicted) == sInvalidSlot, "Tile cache took a slot used in the current frame.");
+        cache.Pin(d);
+        ASSERT(cache.Find(1, 2) == a && cache.Find(3, 2) == c && cache.Find(6, 2) == sInvalidSlot, "Tile cache lost a tile.");
+        ASSERT(cache.Allocate(5, 2, evicted) == b && evicted == 2 && cache.Find(2, 2) == sInvalidSlot, "Least recently used tile was not evicted first.");
+        ASSERT(cache.Allocate(6, 3, evicted) == a && evicted == 1 && cache.Allocate(7, 3, evicted) == c && cache.Allocate(8, 3, evicted) == b, "Tile cache evicted out of order.");
+        ASSERT(cache.Allocate(9, 4, evicted) == a && cache.Find(4, 4) == d && cache.GetUsedSlotsCount() == 4, "Pinned tile was evicted.");
+    }
+
+    constexpr UINT32 texturesCount = 64;
+    constexpr UINT32 textureSize = 4096;
+    constexpr UINT32 visibleCount = 6;
+    constexpr UINT32 slotsCount = 1024;
+    constexpr UINT32 maxUploadsPerFrame = 32;
+    constexpr UINT32 framesCount = 2000;
+    UINT32 mipsCount = 1;
+    while (GetTilesCount(textureSize, mipsCount - 1) > 1)
+    {
+        ++mipsCount;
+    }
+
+    TileCache cache(slotsCount);
+    std::vector<PageTable> tables;
+    for (UINT32 i = 0; i < texturesCount; ++i)
+    {
+        tables.emplace_back(textureSize, textureSize, mipsCount);
+        UINT64 evicted = 0;
+        UINT32 slot = cache.Allocate(TileId{ i, mipsCount - 1, 0, 0 }.Pack(), 0, evicted);
+        cache.Pin(slot);
+        tables[i].SetSlot(mipsCount - 1, 0, 0, slot);
+    }
+
+    UINT64 requestedCount = 0, uploadedCount = 0, evictedCount = 0, pageTableUpdates = 0;
+    std::vector<UINT64> requests, missing;
+    double time = MeasureMilliseconds([&]()
+    {
+        for (UINT64 frame = 1; frame <= framesCount; ++frame)
+        {
+            // A screen's worth of texels: the nearest texture in the window gets its mip 1 over the half of it that is
+            // in view, the others are further away and coarser.
+            requests.clear();
+            UINT32 first = static_cast<UINT32>(frame / 20) % texturesCount;
+            for (UINT32 i = 0; i < visibleCount; ++i)
+            {
+                UINT32 texture = (first + i) % texturesCount;
+                UINT32 firstMip = std::min(1 + i, mipsCount - 1);
+                for (UINT32 mip = firstMip; mip < mipsCount; ++mip)
+                {
+                    UINT32 tilesCount = GetTilesCount(textureSize, mip);
+                    UINT32 offset = static_cast<UINT32>(frame % 40) * tilesCount / 80;
+                    for (UINT32 y = 0; y < (tilesCount + 1) / 2; ++y)
+                    {
+                        for (UINT32 x = 0; x < (tilesCount + 1) / 2; ++x)
+                        {
+                            requests.push_back(TileId{ texture, mip, (offset + x) % tilesCount, y }.Pack());
+                        }
+                    }
+                }
+            }
+
+            std::sort(requests.begin(), requests.end());
+            requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+            requestedCount += requests.size();
+            missing.clear();
+            for (UINT64 tile : requests)
+            {
+                if (cache.Find(tile, frame) == sInvalidSlot)
+                {
+                    missing.push_back(tile);
+                }
+            }
+            std::stable_sort(missing.begin(), missing.end(), [](UINT64 aLeft, UINT64 aRight) { return TileId::Unpack(aLeft).Mip > TileId::Unpack(aRight).Mip; });
+
+            UINT32 uploadsCount = 0;
+            for (UINT64 tile : missing)
+            {
+                UINT64 evicted = sInvalidTile;
+                UINT32 slot = uploadsCount < maxUploadsPerFrame ? cache.Allocate(tile, frame, evicted) : sInvalidSlot;
+                if (slot == sInvalidSlot)
+                {
+                    break;
+                }
+                if (evicted != sInvalidTile)
+                {
+                    TileId evictedId = TileId::Unpack(evicted);
+                    tables[evictedId.Texture].SetSlot(evictedId.Mip, evictedId.X, evictedId.Y, sInvalidSlot);
+                    ++evictedCount;
+                }
+                TileId id = TileId::Unpack(tile);
+                tables[id.Texture].SetSlot(id.Mip, id.X, id.Y, slot);
+                ++uploadsCount;
+            }
+            uploadedCount += uploadsCount;
+
+            for (PageTable& table : tables)
+            {
+                pageTableUpdates += table.Update() ? 1 : 0;
+            }
+        }
+    });
+
+    for (UINT32 texture = 0; texture < texturesCount; ++texture)
+    {
+        for (UINT32 mip = 0; mip < mipsCount; ++mip)
+        {
+            for (UINT32 y = 0; y < GetTilesCount(textureSize, mip); ++y)
+            {
+                for (UINT32 x = 0; x < GetTilesCount(textureSize, mip); ++x)
+                {
+                    UINT32 entry = tables[texture].GetEntry(mip, x, y);
+                    ASSERT(entry != sInvalidEntry, "Page table entry has no fallback.");
+                    TileId tile = TileId::Unpack(cache.GetTile(PageTable::GetEntrySlot(entry)));
+                    ASSERT(tile.Texture == texture && tile.Mip == PageTable::GetEntryMip(entry) && tile.Mip >= mip && tile.X == x >> (tile.Mip - mip) && tile.Y == y >> (tile.Mip - mip), "Page table entry points at the wrong tile.");
+                }
+            }
+        }
+    }
+
+    Utility::Printf("Virtual texturing benchmark: %u textures of %u x %u, %u slots, %u frames in %.2f ms (%.2f us per frame), %.0f tiles requested, %.1f uploaded and %.1f evicted per frame, %.1f page table updates per frame",
+        texturesCount, textureSize, textureSize, slotsCount, framesCount, time, time * 1000.0 / framesCount, requestedCount / double(framesCount), uploadedCount / double(framesCount), evictedCount / double(framesCount), pageTableUpdates / double(framesCount));
+}
+
+// Packs 240 synthetic textures of 64 to 1024 texels in three formats, checks the groups and the slices, then adds 64
+// materials with a diffuse, specular and normal texture each and records 4096 sorted draws of them. Materials that
+// only use the same arrays share a descriptor table, the draws are counted in table switches with and without that.
+void Benchmark::RunTexturePackingBenchmark()
+{
+    constexpr UINT32 texturesCount = 240;
+    constexpr UINT32 materialsCount = 64;
+    constexpr UINT32 drawsCount = 4096;
+    constexpr DXGI_FORMAT formats[] = { DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_BC5_UNORM };
+    constexpr UINT32 sizes[] = { 64, 128, 256, 512, 1024 };
+
+    std::vector<DirectX::ScratchImage> images(texturesCount);
+    std::vector<const DirectX::ScratchImage*> imagePointers(texturesCount);
+    std::vector<std::wstring> paths(texturesCount);
+    for (UINT32 i = 0; i < texturesCount; ++i)
+    {
+        UINT32 size = sizes[i / _countof(formats) % _countof(sizes)];
+        ASSERT_HRESULT(images[i].Initialize2D(formats[i % _countof(formats)], size, size, 1, static_cast<size_t>(std::log2(size)) - 1), "Failed to create image.");
+        imagePointers[i] = &images[i];
+        paths[i] = L"Benchmark\\Packed\\" + std::to_wstring(i) + L".dds";
+    }
+
+    std::vector<std::vector<uint32_t>> groups = Texture::GroupForPacking(imagePointers);
+    std::vector<bool> isGrouped(texturesCount, false);
+    for (const std::vector<uint32_t>& group : groups)
+    {
+        ASSERT(group.size() > 1 && group.size() <= Texture::sMaxArraySize, "Wrong texture array size.");
+        for (uint32_t index : group)
+        {
+            const DirectX::TexMetadata& metadata = images[index].GetMetadata();
+            const DirectX::TexMetadata& firstMetadata = images[group.front()].GetMetadata();
+            ASSERT(!isGrouped[index] && metadata.format == firstMetadata.format && metadata.width == firstMetadata.width && metadata.mipLevels == firstMetadata.mipLevels, "Texture is packed twice or with a different layout.");
+            isGrouped[index] = true;
+        }
+    }
+    for (UINT32 i = 0; i < texturesCount; ++i)
+    {
+        ASSERT(isGrouped[i] == (images[i].GetMetadata().width <= Texture::sMaxPackedSize), "Small texture is not packed or a large one is.");
+    }
+
+    std::vector<Texture*> textures(texturesCount, nullptr);
+    UINT64 resourcesCount = Graphics::g_BackendStatistics.ResourcesCount;
+    double packTime = MeasureMilliseconds([&]()
+    {
+        UploadBatch uploadBatch;
+        for (const std::vector<uint32_t>& group : groups)
+        {
+            std::vector<std::wstring> groupPaths;
+            std::vector<const DirectX::ScratchImage*> groupImages;
+            for (uint32_t index : group)
+            {
+                groupPaths.push_back(paths[index]);
+                groupImages.push_back(imagePointers[index]);
+            }
+            std::vector<Texture*> arrayTextures = Texture::CreateTextureArray(groupPaths, groupImages, uploadBatch);
+            for (size_t i = 0; i < group.size(); ++i)
+            {
+                textures[group[i]] = arrayTextures[i];
+                ASSERT(arrayTextures[i]->GetArraySlice() == i && arrayTextures[i]->GetArrayTexture() == arrayTextures[0]->GetArrayTexture(), "Wrong texture array slice.");
+            }
+        }
+        for (UINT32 i = 0; i < texturesCount; ++i)
+        {
+            if (!textures[i])
+            {
+                textures[i] = Texture::CreateTexture(paths[i], imagePointers[i], &uploadBatch);
+            }
+        }
+    });
+    UINT64 packedResourcesCount = Graphics::g_BackendStatistics.ResourcesCount - resourcesCount;
+
+    // Material i uses the three formats of one size, the small sizes have one array per format so all materials of
+    // such a size can share a table, the large textures are not packed.
+    MaterialID firstMaterialID = Materials::GetMaterialCount();
+    std::set<UINT32> descriptorTables;
+    for (UINT32 i = 0; i < materialsCount; ++i)
+    {
+        UINT32 first = (i % _countof(sizes) + (i / _countof(sizes)) % 16 * _countof(sizes)) * _countof(formats);
+        std::vector<Texture*> materialTextures(MATERIAL_TEXTURES_COUNT, nullptr);
+        materialTextures[aiTextureType_DIFFUSE - 1] = textures[first];
+        materialTextures[aiTextureType_SPECULAR - 1] = textures[first + 1];
+        materialTextures[aiTextureType_NORMALS - 1] = textures[first + 2];
+        MaterialParams params;
+        params.HasDiffuseTexture = params.HasSpecularTexture = params.HasNormalTexture = true;
+        MaterialID materialID = Materials::AddMaterial(std::move(params), std::move(materialTextures), "Packed");
+        descriptorTables.insert(Materials::GetDescriptorTable(materialID));
+
+        const MaterialParams& addedParams = Materials::GetMaterialParams()[materialID];
+        for (aiTextureType type : { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_NORMALS })
+        {
+            ASSERT(((addedParams.TextureSlices >> ((type - 1) * 4)) & 0xf) == Materials::GetTextures(materialID)[type - 1]->GetArraySlice(), "Wrong texture slice in the material.");
+        }
+    }
+    for (MaterialID a = firstMaterialID; a < firstMaterialID + materialsCount; ++a)
+    {
+        for (MaterialID b = firstMaterialID; b < a; ++b)
+        {
+            bool isSameViews = true;
+            for (UINT32 slot = 0; slot < MATERIAL_TEXTURES_COUNT; ++slot)
+            {
+                const Texture* textureA = Materials::GetTextures(a)[slot];
+                const Texture* textureB = Materials::GetTextures(b)[slot];
+                isSameViews = isSameViews && (textureA ? textureA->GetArrayTexture() : nullptr) == (textureB ? textureB->GetArrayTexture() : nullptr);
+            }
+            ASSERT(isSameViews == (Materials::GetDescriptorTable(a) == Materials::GetDescriptorTable(b)), "Materials with the same views do not share a descriptor table.");
+        }
+    }
+
+    // Table switches of sorted opaque draws, when every material has its own table and with the shared ones.
+    std::mt19937 random(7);
+    auto countTableSwitches = [&](bool aShareTables)
+    {
+        RenderQueue queue;
+        for (UINT32 i = 0; i < drawsCount; ++i)
+        {
+            MaterialID materialID = firstMaterialID + random() % materialsCount;
+            UINT32 table = aShareTables ? Materials::GetDescriptorTable(materialID) : materialID;
+            queue.Add(RenderQueue::MakeKey(RenderQueue::Pass::Opaque, 0, table, materialID, static_cast<float>(random() % 1000)), aShareTables ? table : materialID);
+        }
+        queue.Sort();
+        UINT32 switchesCount = 0;
+        UINT32 boundTable = UINT32_MAX;
+        for (const RenderQueue::Draw& draw : queue.GetDraws())
+        {
+            switchesCount += draw.Index != boundTable;
+            boundTable = draw.Index;
+        }
+        return switchesCount;
+    };
+    UINT32 ownTableSwitches = countTableSwitches(false);
+    UINT32 sharedTableSwitches = countTableSwitches(true);
+
+    Utility::Printf("Texture packing benchmark: %u textures in %llu resources, packed in %.2f ms, %u materials in %zu descriptor tables, %u draws with %u table switches instead of %u",
+        texturesCount, packedResourcesCount, packTime, materialsCount, descriptorTables.size(), drawsCount, sharedTableSwitches, ownTableSwitches);
+}
+
+// Encodes a million synthetic vertices: the corners and random points of wide bounds that are flat along z,
+// axis-aligned, random and zero tangent frames, and texture coordinates far outside [0, 1]. Every decoded position
+// has to be within half a quantization step, every direction within the octahedral error and every texture
+// coordinate within half a half float step of its source.
+void Benchmark::RunVertexCompressionBenchmark()
+{
+    constexpr UINT32 verticesCount = 1 << 20;
+    constexpr float maxNormalAngle = 1e-4f;
+    const DirectX::XMFLOAT3 minimum(-5000.0f, 0.25f, 12.0f);
+    const DirectX::XMFLOAT3 extent(10000.0f, 0.001f, 0.0f);
+    const DirectX::XMFLOAT3 axes[] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, -1.0f } };
+
+    auto dot = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; };
+    auto cross = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); };
+    auto normalize = [&](const DirectX::XMFLOAT3& aVector)
+    {
+        float length = std::sqrt(dot(aVector, aVector));
+        return DirectX::XMFLOAT3(aVector.x / length, aVector.y / length, aVector.z / length);
+    };
+    // Unlike acos of the dot product this stays accurate for the small angles of the bounds.
+    auto angle = [&](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b)
+    {
+        DirectX::XMFLOAT3 normal = cross(a, b);
+        return std::atan2(std::sqrt(dot(normal, normal)), dot(a, b));
+    };
+
+    // Every fourth vertex has an axis-aligned frame, a zero frame and two random frames, the bitangent sign alternates.
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unitDistribution(0.0f, 1.0f);
+    std::uniform_real_distribution<float> directionDistribution(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> texCoordDistribution(-64.0f, 64.0f);
+    std::vector<Vertex> vertices(verticesCount);
+    for (UINT32 i = 0; i < verticesCount; ++i)
+    {
+        Vertex& vertex = vertices[i];
+        DirectX::XMFLOAT3 position = i < 8 ? DirectX::XMFLOAT3(static_cast<float>(i & 1), static_cast<float>((i >> 1) & 1), static_cast<float>(i >> 2)) :
+            DirectX::XMFLOAT3(unitDistribution(random), unitDistribution(random), unitDistribution(random));
+        vertex.position = DirectX::XMFLOAT3(minimum.x + position.x * extent.x, minimum.y + position.y * extent.y, minimum.z + position.z * extent.z);
+
+        switch (i % 4)
+        {
+        case 0:
+            vertex.normal = axes[i / 4 % 6];
+            vertex.tangent = axes[(i / 4 + 1) % 6];
+            break;
+        case 1:
+            vertex.normal = vertex.tangent = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+            break;
+        default:
+            vertex.normal = normalize(DirectX::XMFLOAT3(directionDistribution(random), directionDistribution(random), directionDistribution(random) + 1e-3f));
+            vertex.tangent = normalize(cross(vertex.normal, DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)));
+            break;
+        }
+        float bitangentSign = (i / 2) % 2 ? -1.0f : 1.0f;
+        DirectX::XMFLOAT3 bitangent = cross(vertex.normal, vertex.tangent);
+        vertex.bitangent = DirectX::XMFLOAT3(bitangent.x * bitangentSign, bitangent.y * bitangentSign, bitangent.z * bitangentSign);
+
+        vertex.texCoord = i < 8 ? DirectX::XMFLOAT2(i & 1 ? 65504.0f : -65504.0f, i & 2 ? 1e-6f : 0.0f) : DirectX::XMFLOAT2(texCoordDistribution(random), texCoordDistribution(random));
+    }
+
+    std::vector<CompactVertex> compactVertices;
+    MeshConstants meshConstants;
+    double encodeTime = MeasureMilliseconds([&]() { meshConstants = VertexCompression::EncodeMesh(vertices, compactVertices); });
+
+    // Positions lose half a step of their axis and the rounding of the dequantization, texture coordinates half a
+    // step of the half float exponent they fall in.
+    auto positionError = [](float aMin, float aExtent) { return aExtent * 0.5f / 65535.0f + 4.0f * FLT_EPSILON * std::max(std::abs(aMin), std::abs(aMin + aExtent)); };
+    const float positionErrors[3] = { positionError(minimum.x, extent.x), positionError(minimum.y, extent.y), positionError(minimum.z, extent.z) };
+    for (UINT32 i = 0; i < verticesCount; ++i)
+    {
+        const Vertex& source = vertices[i];
+        Vertex decoded = VertexCompression::DecodeVertex(compactVertices[i], meshConstants);
+
+        ASSERT(std::abs(decoded.position.x - source.position.x) <= positionErrors[0] && std::abs(decoded.position.y - source.position.y) <= positionErrors[1] &&
+            std::abs(decoded.position.z - source.position.z) <= positionErrors[2], "Position out of the error bound.");
+
+        ASSERT(std::abs(dot(decoded.normal, decoded.normal) - 1.0f) < 1e-4f && std::abs(dot(decoded.tangent, decoded.tangent) - 1.0f) < 1e-4f, "Direction is not normalized.");
+        if (i % 4 == 1)
+        {
+            ASSERT(decoded.normal.z > 0.9999f && decoded.tangent.z > 0.9999f, "Zero direction does not decode to the default one.");
+        }
+        else
+        {
+            ASSERT(angle(decoded.normal, source.normal) <= maxNormalAngle && angle(decoded.tangent, source.tangent) <= maxNormalAngle, "Direction out of the error bound.");
+            ASSERT(angle(decoded.bitangent, source.bitangent) <= 2.0f * maxNormalAngle, "Bitangent out of the error bound.");
+        }
+
+        for (UINT32 component = 0; component < 2; ++component)
+        {
+            float texCoord = component ? source.texCoord.y : source.texCoord.x;
+            float decodedTexCoord = component ? decoded.texCoord.y : decoded.texCoord.x;
+            ASSERT(std::abs(decodedTexCoord - texCoord) <= std::max(std::abs(texCoord), std::ldexp(1.0f, -14)) * std::ldexp(1.0f, -11), "Texture coordinate out of the error bound.");
+        }
+    }
+
+    VertexCompression::RoundTripError error = VertexCompression::MeasureRoundTripError(vertices, compactVertices, meshConstants);
+    Utility::Printf("Vertex compression benchmark: %u vertices encoded in %.2f ms, %zu to %zu bytes, max error position %g, normal %g rad, bitangent %g rad, uv %g",
+        verticesCount, encodeTime, verticesCount * sizeof(Vertex), compactVertices.size() * sizeof(CompactVertex), error.MaxPositionError, error.MaxNormalAngle, error.MaxBitangentAngle, error.MaxTexCoordError);
+}
+
+// Checks the meshlets of one mesh: the limits, that their index ranges cover every triangle once and in order, that
+// the boxes and spheres contain their vertices and that the normal cones hold every triangle that has a facing.
+static void CheckMeshlets(std::span<const Vertex> aVertices, std::span<const UINT32> aIndices, std::span<const Meshlet> aMeshlets)
+{
+    auto subtract = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); };
+    auto dot = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; };
+    auto cross = [](const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b) { return DirectX::XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); };
+
+    UINT32 indexOffset = 0;
+    std::set<UINT32> meshletVertices;
+    for (const Meshlet& meshlet : aMeshlets)
+    {
+        ASSERT(meshlet.IndexOffset == indexOffset && meshlet.IndicesCount > 0 && meshlet.IndicesCount % 3 == 0, "Meshlets do not cover every triangle once.");
+        ASSERT(meshlet.VerticesCount <= MeshletBuilder::sMaxVertices && meshlet.IndicesCount / 3 <= MeshletBuilder::sMaxTriangles, "Meshlet exceeds its limits.");
+        indexOffset += meshlet.IndicesCount;
+
+        meshletVertices.clear();
+        meshletVertices.insert(aIndices.begin() + meshlet.IndexOffset, aIndices.begin() + meshlet.IndexOffset + meshlet.IndicesCount);
+        ASSERT(meshletVertices.size() == meshlet.VerticesCount, "Wrong meshlet vertices count.");
+
+        float tolerance = 1e-5f * (meshlet.Radius + std::max({ std::abs(meshlet.Center.x), std::abs(meshlet.Center.y), std::abs(meshlet.Center.z) }));
+        for (UINT32 vertex : meshletVertices)
+        {
+            const DirectX::XMFLOAT3& position = aVertices[vertex].position;
+            ASSERT(position.x >= meshlet.AabbMin.x && position.y >= meshlet.AabbMin.y && position.z >= meshlet.AabbMin.z &&
+                position.x <= meshlet.AabbMax.x && position.y <= meshlet.AabbMax.y && position.z <= meshlet.AabbMax.z, "Vertex outside of the meshlet box.");
+            DirectX::XMFLOAT3 offset = subtract(position, meshlet.Center);
+            ASSERT(std::sqrt(dot(offset, offset)) <= meshlet.Radius + tolerance, "Vertex outside of the meshlet sphere.");
+        }
+
+        ASSERT(std::abs(dot(meshlet.ConeAxis, meshlet.ConeAxis) - 1.0f) < 1e-5f, "Cone axis is not normalized.");
+        ASSERT(meshlet.ConeCutoff >= 0.0f && meshlet.ConeCutoff <= 1.0f, "Cone cutoff out of range.");
+        if (meshlet.ConeCutoff < 1.0f)
+        {
+            for (UINT32 i = meshlet.IndexOffset; i < meshlet.IndexOffset + meshlet.IndicesCount; i += 3)
+            {
+                const DirectX::XMFLOAT3& a = aVertices[aIndices[i]].position;
+                DirectX::XMFLOAT3 normal = cross(subtract(aVertices[aIndices[i + 1]].position, a), subtract(aVertices[aIndices[i + 2]].position, a));
+                float length = std::sqrt(dot(normal, normal));
+                float cosine = dot(normal, meshlet.ConeAxis) / length;
+                ASSERT(length <= FLT_MIN || (cosine > 0.0f && std::sqrt(std::max(1.0f - cosine * cosine, 0.0f)) <= meshlet.ConeCutoff + 1e-4f), "Triangle outside of the meshlet cone.");
+            }
+        }
+    }
+    ASSERT(indexOffset == aIndices.size(), "Meshlets do not cover every triangle once.");
+}
+
+// Builds and checks the meshlets of a 512 x 512 quad height field with a few degenerate triangles, in row order and
+// after the vertex cache optimization, then the meshlets of every mesh of Sponza as the importer prepares them.
+void Benchmark::RunMeshletBenchmark()
+{
+    constexpr UINT32 gridSize = 512;
+    MeshData grid;
+    grid.Vertices.resize((gridSize + 1) * (gridSize + 1));
+    for (UINT32 y = 0; y <= gridSize; ++y)
+    {
+        for (UINT32 x = 0; x <= gridSize; ++x)
+        {
+            Vertex& vertex = grid.Vertices[y * (gridSize + 1) + x];
+            vertex = {};
+            vertex.position = DirectX::XMFLOAT3(static_cast<float>(x), std::sin(x * 0.05f) * std::cos(y * 0.07f) * 20.0f, static_cast<float>(y));
+        }
+    }
+    for (UINT32 y = 0; y < gridSize; ++y)
+    {
+        for (UINT32 x = 0; x < gridSize; ++x)
+        {
+            UINT32 corner = y * (gridSize + 1) + x;
+            grid.Indices.insert(grid.Indices.end(), { corner, corner + gridSize + 1, corner + 1, corner + 1, corner + gridSize + 1, corner + gridSize + 2 });
+            if ((x + y) % 97 == 0)
+            {
+                grid.Indices.insert(grid.Indices.end(), { corner, corner, corner + 1 });
+            }
+        }
+    }
+
+    std::vector<Meshlet> meshlets;
+    double gridTime = MeasureMilliseconds([&]() { meshlets = MeshletBuilder::Build(grid.Vertices, grid.Indices); });
+    CheckMeshlets(grid.Vertices, grid.Indices, meshlets);
+    MeshletBuilder::Statistics gridStatistics;
+    gridStatistics.Add(meshlets);
+
+    MeshOptimizer::OptimizeMesh(grid);
+    meshlets = MeshletBuilder::Build(grid.Vertices, grid.Indices);
+    CheckMeshlets(grid.Vertices, grid.Indices, meshlets);
+    MeshletBuilder::Statistics optimizedGridStatistics;
+    optimizedGridStatistics.Add(meshlets);
+
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile("../../Scenes/sponza/sponza.obj", aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_ConvertToLeftHanded);
+    ASSERT(scene, "Failed to import Sponza.");
+    MeshletBuilder::Statistics sceneStatistics;
+    double sceneTime = 0.0;
+    for (unsigned int meshIndex = 0; meshIndex < scene->mNumMeshes; ++meshIndex)
+    {
+        const aiMesh* sourceMesh = scene->mMeshes[meshIndex];
+        MeshData mesh;
+        mesh.Vertices.resize(sourceMesh->mNumVertices, Vertex{});
+        for (unsigned int i = 0; i < sourceMesh->mNumVertices; ++i)
+        {
+            mesh.Vertices[i].position = DirectX::XMFLOAT3(sourceMesh->mVertices[i].x, sourceMesh->mVertices[i].y, sourceMesh->mVertices[i].z);
+        }
+        for (unsigned int i = 0; i < sourceMesh->mNumFaces; ++i)
+        {
+            if (sourceMesh->mFaces[i].mNumIndices == 3)
+            {
+                mesh.Indices.insert(mesh.Indices.end(), sourceMesh->mFaces[i].mIndices, sourceMesh->mFaces[i].mIndices + 3);
+            }
+        }
+        MeshOptimizer::OptimizeMesh(mesh);
+
+        sceneTime += MeasureMilliseconds([&]() { mesh.Meshlets = MeshletBuilder::Build(mesh.Vertices, mesh.Indices); });
+        CheckMeshlets(mesh.Vertices, mesh.Indices, mesh.Meshlets);
+        sceneStatistics.Add(mesh.Meshlets);
+    }
+
+    Utility::Printf("Meshlet benchmark: grid of %zu triangles in %.2f ms, Sponza %u meshes in %.2f ms", grid.Indices.size() / 3, gridTime, scene->mNumMeshes, sceneTime);
+    gridStatistics.Print("the grid in row order");
+    optimizedGridStatistics.Print("the optimized grid");
+    sceneStatistics.Print("Sponza");
+}
+
+// Checks allocation, coalescing, alignment, running out of space and reuse after fragmentation on small cases, then
+// times a million random allocations and frees of a 256 MB range with mixed alignments. Every allocation is checked
+// against the live ones, and freeing everything at the end has to leave one free range.
+void Benchmark::RunRangeAllocatorBenchmark()
+{
+    RangeAllocator allocator(1024);
+    ASSERT(allocator.Allocate(100) == 0 && allocator.Allocate(200) == 100, "Allocations are not packed from the start.");
+    ASSERT(allocator.GetFreeSizeInBytes() == 724 && allocator.GetFreeRangesCount() == 1, "Wrong free size.");
+    allocator.Free(0, 100);
+    ASSERT(allocator.GetFreeRangesCount() == 2 && allocator.GetLargestFreeRange() == 724, "Freed range is merged with a used one.");
+    allocator.Free(100, 200);
+    ASSERT(allocator.GetFreeRangesCount() == 1 && allocator.GetLargestFreeRange() == 1024, "Freed range is not merged with both neighbours.");
+
+    // The padding in front of an aligned allocation stays free and takes the next small allocation.
+    RangeAllocator alignedAllocator(1000);
+    ASSERT(alignedAllocator.Allocate(10) == 0 && alignedAllocator.Allocate(64, 48) == 48, "Allocation is not aligned.");
+    ASSERT(alignedAllocator.GetFreeRangesCount() == 2 && alignedAllocator.GetFreeSizeInBytes() == 1000 - 10 - 64, "Alignment padding is lost.");
+    ASSERT(alignedAllocator.Allocate(30) == 10, "Best fit does not use the alignment padding.");
+
+    RangeAllocator fullAllocator(100);
+    ASSERT(fullAllocator.Allocate(101) == RangeAllocator::sInvalidOffset, "Allocation larger than the allocator succeeds.");
+    ASSERT(fullAllocator.Allocate(1) == 0 && fullAllocator.Allocate(99, 2) == RangeAllocator::sInvalidOffset, "Aligned allocation past the end succeeds.");
+    ASSERT(fullAllocator.Allocate(99) == 1 && fullAllocator.Allocate(1) == RangeAllocator::sInvalidOffset && fullAllocator.GetFreeSizeInBytes() == 0, "Allocation from a full allocator succeeds.");
+
+    // Every other block freed leaves half of the space free in holes that only fit blocks of the same size.
+    RangeAllocator fragmentedAllocator(1024);
+    for (UINT64 i = 0; i < 16; ++i)
+    {
+        ASSERT(fragmentedAllocator.Allocate(64) == i * 64, "Allocations are not packed from the start.");
+    }
+    for (UINT64 i = 0; i < 16; i += 2)
+    {
+        fragmentedAllocator.Free(i * 64, 64);
+    }
+    ASSERT(fragmentedAllocator.GetFreeSizeInBytes() == 512 && fragmentedAllocator.GetLargestFreeRange() == 64, "Holes are merged with used blocks.");
+    ASSERT(fragmentedAllocator.Allocate(128) == RangeAllocator::sInvalidOffset, "Allocation spans a used block.");
+    UINT64 reusedOffset = fragmentedAllocator.Allocate(64);
+    ASSERT(reusedOffset != RangeAllocator::sInvalidOffset && reusedOffset % 128 == 0, "Hole is not reused.");
+    for (UINT64 i = 0; i < 16; ++i)
+    {
+        if (i % 2 == 1 || i * 64 == reusedOffset)
+        {
+            fragmentedAllocator.Free(i * 64, 64);
+        }
+    }
+    ASSERT(fragmentedAllocator.GetFreeRangesCount() == 1 && fragmentedAllocator.Allocate(1024) == 0, "Holes are not merged back.");
+
+    // The random operations are checked as they run and recorded, then replayed on a new allocator for the timing.
+    struct Operation
+    {
+        UINT64 Offset;
+        UINT64 Size;
+        UINT64 Alignment;       // 0 for a free
+    };
+    constexpr UINT64 sizeInBytes = 256ull * 1024 * 1024;
+    constexpr UINT32 operationsCount = 1 << 20;
+    constexpr UINT64 alignments[] = { 1, 4, 16, 256, 768, 65536 };
+    std::mt19937 random(11);
+    std::uniform_int_distribution<UINT64> sizeDistribution(1, 256 * 1024);
+    RangeAllocator randomAllocator(sizeInBytes);
+    std::map<UINT64, UINT64> allocations;     // offset -> size
+    std::vector<UINT64> offsets;
+    std::vector<Operation> operations;
+    operations.reserve(operationsCount);
+    UINT32 failedCount = 0;
+    for (UINT32 i = 0; i < operationsCount; ++i)
+    {
+        // Allocations win until the range is mostly used, then frees and allocations balance out.
+        bool isAllocation = offsets.empty() || random() % 100 < (randomAllocator.GetFreeSizeInBytes() > sizeInBytes / 4 ? 70u : 45u);
+        if (!isAllocation)
+        {
+            size_t index = random() % offsets.size();
+            auto allocation = allocations.find(offsets[index]);
+            offsets[index] = offsets.back();
+            offsets.pop_back();
+            randomAllocator.Free(allocation->first, allocation->second);
+            operations.push_back({ allocation->first, allocation->second, 0 });
+            allocations.erase(allocation);
+            continue;
+        }
+
+        UINT64 size = sizeDistribution(random);
+        UINT64 alignment = alignments[random() % _countof(alignments)];
+        UINT64 offset = randomAllocator.Allocate(size, alignment);
+        operations.push_back({ offset, size, alignment });
+        if (offset == RangeAllocator::sInvalidOffset)
+        {
+            ++failedCount;
+            continue;
+        }
+
+        ASSERT(offset % alignment == 0 && offset + size <= sizeInBytes, "Allocation is not aligned or out of range.");
+        auto next = allocations.lower_bound(offset);
+        ASSERT(next == allocations.end() || offset + size <= next->first, "Allocation overlaps the next one.");
+        ASSERT(next == allocations.begin() || std::prev(next)->first + std::prev(next)->second <= offset, "Allocation overlaps the previous one.");
+        allocations.emplace(offset, size);
+        offsets.push_back(offset);
+    }
+
+    UINT64 usedSize = 0;
+    for (const auto& [offset, size] : allocations)
+    {
+        usedSize += size;
+    }
+    ASSERT(randomAllocator.GetFreeSizeInBytes() == sizeInBytes - usedSize, "Wrong free size.");
+    size_t freeRangesCount = randomAllocator.GetFreeRangesCount();
+    for (const auto& [offset, size] : allocations)
+    {
+        randomAllocator.Free(offset, size);
+    }
+    ASSERT(randomAllocator.GetFreeRangesCount() == 1 && randomAllocator.GetLargestFreeRange() == sizeInBytes, "Freeing everything does not merge back into one range.");
+
+    RangeAllocator replayAllocator(sizeInBytes);
+    UINT32 mismatchesCount = 0;
+    double randomTime = MeasureMilliseconds([&]()
+    {
+        for (const Operation& operation : operations)
+        {
+            if (operation.Alignment == 0)
+            {
+                replayAllocator.Free(operation.Offset, operation.Size);
+            }
+            else
+            {
+                mismatchesCount += replayAllocator.Allocate(operation.Size, operation.Alignment) != operation.Offset;
+            }
+        }
+    });
+    ASSERT(mismatchesCount == 0, "Replayed allocations differ.");
+
+    Utility::Printf("Range allocator benchmark: %u operations in %.2f ms, %u allocations failed, %zu live allocations in %zu free ranges at the end",
+        operationsCount, randomTime, failedCount, allocations.size(), freeRangesCount);
+}
+
+// Sorts 50k random draws of both passes with the radix sort of RenderQueue and with std::stable_sort on the key, the
+// best of several runs is reported and both have to give the same order, including the order of equal keys.
+void Benchmark::RunRenderQueueBenchmark()
+{
+    constexpr UINT32 drawsCount = 50000;
+    constexpr UINT32 runsCount = 20;
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> depthDistribution(0.1f, 1000.0f);
+    std::vector<RenderQueue::Draw> draws(drawsCount);
+    for (UINT32 i = 0; i < drawsCount; ++i)
+    {
+        RenderQueue::Pass pass = random() % 8 == 0 ? RenderQueue::Pass::Transparent : RenderQueue::Pass::Opaque;
+        draws[i] = { RenderQueue::MakeKey(pass, random() % 4, random() % 64, random() % 1024, depthDistribution(random)), i };
+    }
+
+    RenderQueue queue;
+    double radixTime = DBL_MAX;
+    for (UINT32 run = 0; run < runsCount; ++run)
+    {
+        queue.Clear();
+        for (const RenderQueue::Draw& draw : draws)
+        {
+            queue.Add(draw.Key, draw.Index);
+        }
+        radixTime = std::min(radixTime, MeasureMilliseconds([&]() { queue.Sort(); }));
+    }
+
+    std::vector<RenderQueue::Draw> sortedDraws;
+    double stableSortTime = DBL_MAX;
+    for (UINT32 run = 0; run < runsCount; ++run)
+    {
+        sortedDraws = draws;
+        stableSortTime = std::min(stableSortTime, MeasureMilliseconds([&]()
+        {
+            std::stable_sort(sortedDraws.begin(), sortedDraws.end(), [](const RenderQueue::Draw& a, const RenderQueue::Draw& b) { return a.Key < b.Key; });
+        }));
+    }
+
+    const std::vector<RenderQueue::Draw>& radixDraws = queue.GetDraws();
+    ASSERT(radixDraws.size() == sortedDraws.size(), "Sorted draws are lost.");
+    for (UINT32 i = 0; i < drawsCount; ++i)
+    {
+        ASSERT(radixDraws[i].Key == sortedDraws[i].Key && radixDraws[i].Index == sortedDraws[i].Index, "Radix sort order differs from std::stable_sort.");
+    }
+
+    Utility::Printf("Render queue benchmark: %u draws, radix sort %.3f ms, std::stable_sort %.3f ms, speedup %.1fx", drawsCount, radixTime, stableSortTime, stableSortTime / radixTime);
+}
@@ -0,0 +1,487 @@
+#include "pch.h"
+#include "BoundingVolumeHierarchy.h"
+#include "Utility.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <execution>
+#include <immintrin.h>
+#include <limits>
+
+using namespace DirectX;
+
+static constexpr float sInfinity = std::numeric_limits<float>::infinity();
+
+static float HalfSurfaceArea(const XMFLOAT3& aMin, const XMFLOAT3& aMax)
+{
+    XMFLOAT3 size(aMax.x - aMin.x, aMax.y - aMin.y, aMax.z - aMin.z);
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static void Grow(XMFLOAT3& aMin, XMFLOAT3& aMax, const XMFLOAT3& aOtherMin, const XMFLOAT3& aOtherMax)
+{
+    aMin = XMFLOAT3(std::min(aMin.x, aOtherMin.x), std::min(aMin.y, aOtherMin.y), std::min(aMin.z, aOtherMin.z));
+    aMax = XMFLOAT3(std::max(aMax.x, aOtherMax.x), std::max(aMax.y, aOtherMax.y), std::max(aMax.z, aOtherMax.z));
+}
+
+static float GetAxis(const XMFLOAT3& aVector, UINT32 aAxis)
+{
+    return (&aVector.x)[aAxis];
+}
+
+BoundingVolumeHierarchy::Aabb BoundingVolumeHierarchy::GetPrimitiveBox(const FrustumCulling::BoundsList& aBounds, UINT32 aIndex)
+{
+    XMFLOAT3 center = aBounds.GetCenter(aIndex);
+    XMFLOAT3 extents = aBounds.GetExtents(aIndex);
+    return { XMFLOAT3(center.x - extents.x, center.y - extents.y, center.z - extents.z), XMFLOAT3(center.x + extents.x, center.y + extents.y, center.z + extents.z) };
+}
+
+// Partitions the primitives along the axis with the largest centroid spread at the bin border with the lowest SAH
+// cost and returns the number of primitives on the left. Small ranges and ranges that cannot be binned are split at
+// the median.
+UINT32 BoundingVolumeHierarchy::Split(BuildPrimitive* aBegin, BuildPrimitive* aEnd)
+{
+    UINT32 count = static_cast<UINT32>(aEnd - aBegin);
+
+    XMFLOAT3 centroidMin(sInfinity, sInfinity, sInfinity);
+    XMFLOAT3 centroidMax(-sInfinity, -sInfinity, -sInfinity);
+    for (const BuildPrimitive* primitive = aBegin; primitive != aEnd; ++primitive)
+    {
+        Grow(centroidMin, centroidMax, primitive->Center, primitive->Center);
+    }
+
+    XMFLOAT3 spread(centroidMax.x - centroidMin.x, centroidMax.y - centroidMin.y, centroidMax.z - centroidMin.z);
+    UINT32 axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+    float axisMin = GetAxis(centroidMin, axis);
+    float axisSpread = GetAxis(spread, axis);
+    if (axisSpread <= 0.0f)
+    {
+        return count / 2;
+    }
+
+    // Binning costs more than it gains on the last few levels, where a median split is nearly as good.
+    auto splitAtMedian = [&]()
+    {
+        std::nth_element(aBegin, aBegin + count / 2, aEnd, [axis](const BuildPrimitive& aLeft, const BuildPrimitive& aRight) { return GetAxis(aLeft.Center, axis) < GetAxis(aRight.Center, axis); });
+        return count / 2;
+    };
+    if (count <= sMedianSplitPrimitivesCount)
+    {
+        return splitAtMedian();
+    }
+
+    float scale = sBinsCount / axisSpread;
+    auto getBin = [&](const BuildPrimitive& aPrimitive)
+    {
+        return std::min(static_cast<UINT32>((GetAxis(aPrimitive.Center, axis) - axisMin) * scale), sBinsCount - 1);
+    };
+
+    UINT32 binCounts[sBinsCount] = {};
+    Aabb binBoxes[sBinsCount];
+    for (Aabb& box : binBoxes)
+    {
+        box = { XMFLOAT3(sInfinity, sInfinity, sInfinity), XMFLOAT3(-sInfinity, -sInfinity, -sInfinity) };
+    }
+    for (const BuildPrimitive* primitive = aBegin; primitive != aEnd; ++primitive)
+    {
+        UINT32 bin = getBin(*primitive);
+        ++binCounts[bin];
+        Grow(binBoxes[bin].Min, binBoxes[bin].Max, primitive->Box.Min, primitive->Box.Max);
+    }
+
+    // Costs of the right sides come from a backward sweep, the forward sweep then evaluates every border.
+    float rightCosts[sBinsCount] = {};
+    Aabb rightBox = binBoxes[sBinsCount - 1];
+    UINT32 rightCount = binCounts[sBinsCount - 1];
+    for (UINT32 bin = sBinsCount - 1; bin > 0; --bin)
+    {
+        rightCosts[bin] = rightCount > 0 ? HalfSurfaceArea(rightBox.Min, rightBox.Max) * rightCount : 0.0f;
+        Grow(rightBox.Min, rightBox.Max, binBoxes[bin - 1].Min, binBoxes[bin - 1].Max);
+        rightCount += binCounts[bin - 1];
+    }
+
+    UINT32 bestSplit = 0;
+    float bestCost = sInfinity;
+    Aabb leftBox = binBoxes[0];
+    UINT32 leftCount = 0;
+    for (UINT32 split = 1; split < sBinsCount; ++split)
+    {
+        leftCount += binCounts[split - 1];
+        if (split > 1)
+        {
+            Grow(leftBox.Min, leftBox.Max, binBoxes[split - 1].Min, binBoxes[split - 1].Max);
+        }
+
+        if (leftCount == 0 || leftCount == count)
+        {
+            continue;
+        }
+
+        float cost = HalfSurfaceArea(leftBox.Min, leftBox.Max) * leftCount + rightCosts[split];
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            bestSplit = split;
+        }
+    }
+
+    if (bestSplit == 0)
+    {
+        return splitAtMedian();
+    }
+
+    BuildPrimitive* middle = std::partition(aBegin, aEnd, [&](const BuildPrimitive& aPrimitive) { return getBin(aPrimitive) < bestSplit; });
+    return static_cast<UINT32>(middle - aBegin);
+}
+
+void BoundingVolumeHierarchy::SetChild(Node& aNode, UINT32 aSlot, UINT32 aChild, UINT32 aFirst, UINT32 aCount, const Aabb& aBox, float aRadius)
+{
+    aNode.MinX[aSlot] = aBox.Min.x;
+    aNode.MinY[aSlot] = aBox.Min.y;
+    aNode.MinZ[aSlot] = aBox.Min.z;
+    aNode.MaxX[aSlot] = aBox.Max.x;
+    aNode.MaxY[aSlot] = aBox.Max.y;
+    aNode.MaxZ[aSlot] = aBox.Max.z;
+    aNode.Radius[aSlot] = aRadius;
+    aNode.Children[aSlot] = aChild;
+    aNode.First[aSlot] = aFirst;
+    aNode.Count[aSlot] = aCount;
+}
+
+UINT32 BoundingVolumeHierarchy::BuildNode(const FrustumCulling::BoundsList& aBounds, BuildPrimitive* aPrimitives, UINT32 aFirst, UINT32 aCount, std::vector<Node>& aNodes, Aabb& aBox)
+{
+    // Up to four child ranges, the largest range is split until there are four or all are single primitives.
+    UINT32 firsts[4] = { aFirst };
+    UINT32 counts[4] = { aCount };
+    UINT32 rangesCount = 1;
+    while (rangesCount < 4)
+    {
+        UINT32 largest = static_cast<UINT32>(std::max_element(counts, counts + rangesCount) - counts);
+        if (counts[largest] < 2)
+        {
+            break;
+        }
+
+        UINT32 leftCount = Split(aPrimitives + firsts[largest], aPrimitives + firsts[largest] + counts[largest]);
+        firsts[rangesCount] = firsts[largest] + leftCount;
+        counts[rangesCount] = counts[largest] - leftCount;
+        counts[largest] = leftCount;
+        ++rangesCount;
+    }
+
+    UINT32 nodeIndex = static_cast<UINT32>(aNodes.size());
+    aNodes.emplace_back();
+    for (UINT32 slot = 0; slot < 4; ++slot)
+    {
+        Aabb emptyBox = { XMFLOAT3(sInfinity, sInfinity, sInfinity), XMFLOAT3(-sInfinity, -sInfinity, -sInfinity) };
+        SetChild(aNodes[nodeIndex], slot, sEmptyChild, 0, 0, emptyBox, sInfinity);
+    }
+
+    Aabb boxes[4];
+    UINT32 children[4];
+    if (aCount >= sParallelPrimitivesCount)
+    {
+        // Children are built into their own arrays and appended afterwards, their node indices are moved by the
+        // offset they land at.
+        std::vector<Node> subtrees[4];
+        UINT32 slots[4] = { 0, 1, 2, 3 };
+        std::for_each(std::execution::par, slots, slots + rangesCount, [&](UINT32 aSlot)
+        {
+            if (counts[aSlot] > 1)
+            {
+                BuildNode(aBounds, aPrimitives, firsts[aSlot], counts[aSlot], subtrees[aSlot], boxes[aSlot]);
+            }
+        });
+
+        for (UINT32 slot = 0; slot < rangesCount; ++slot)
+        {
+            UINT32 offset = static_cast<UINT32>(aNodes.size());
+            children[slot] = offset;
+            for (Node& node : subtrees[slot])
+            {
+                for (UINT32& child : node.Children)
+                {
+                    child = child < sPrimitiveChild ? child + offset : child;
+                }
+            }
+            aNodes.insert(aNodes.end(), subtrees[slot].begin(), subtrees[slot].end());
+        }
+    }
+    else
+    {
+        for (UINT32 slot = 0; slot < rangesCount; ++slot)
+        {
+            if (counts[slot] > 1)
+            {
+                children[slot] = BuildNode(aBounds, aPrimitives, firsts[slot], counts[slot], aNodes, boxes[slot]);
+            }
+        }
+    }
+
+    aBox = { XMFLOAT3(sInfinity, sInfinity, sInfinity), XMFLOAT3(-sInfinity, -sInfinity, -sInfinity) };
+    for (UINT32 slot = 0; slot < rangesCount; ++slot)
+    {
+        if (counts[slot] == 1)
+        {
+            const BuildPrimitive& primitive = aPrimitives[firsts[slot]];
+            boxes[slot] = primitive.Box;
+            SetChild(aNodes[nodeIndex], slot, sPrimitiveChild, firsts[slot], 1, boxes[slot], aBounds.GetRadius(primitive.Index));
+        }
+        else
+        {
+            SetChild(aNodes[nodeIndex], slot, children[slot], firsts[slot], counts[slot], boxes[slot], sInfinity);
+        }
+        Grow(aBox.Min, aBox.Max, boxes[slot].Min, boxes[slot].Max);
+    }
+    return nodeIndex;
+}
+
+void BoundingVolumeHierarchy::Build(const FrustumCulling::BoundsList& aBounds)
+{
+    mNodes.clear();
+    mPrimitives.clear();
+    if (aBounds.GetCount() == 0)
+    {
+        return;
+    }
+
+    std::vector<BuildPrimitive> primitives(aBounds.GetCount());
+    for (UINT32 i = 0; i < aBounds.GetCount(); ++i)
+    {
+        primitives[i] = { GetPrimitiveBox(aBounds, i), aBounds.GetCenter(i), i };
+    }
+
+    // Nodes mostly take four children, so there are fewer nodes than half the primitives.
+    mNodes.reserve(aBounds.GetCount() / 2 + 1);
+    Aabb box;
+    BuildNode(aBounds, primitives.data(), 0, aBounds.GetCount(), mNodes, box);
+
+    mPrimitives.resize(primitives.size());
+    std::transform(primitives.begin(), primitives.end(), mPrimitives.begin(), [](const BuildPrimitive& aPrimitive) { return aPrimitive.Index; });
+}
+
+void BoundingVolumeHierarchy::Refit(const FrustumCulling::BoundsList& aBounds)
+{
+    ASSERT(aBounds.GetCount() == mPrimitives.size(), "Refit needs the primitives the hierarchy was built with.");
+
+    // Children always come after their parent, so a backward walk sees every child node before its parent.
+    for (size_t nodeIndex = mNodes.size(); nodeIndex-- > 0;)
+    {
+        Node& node = mNodes[nodeIndex];
+        for (UINT32 slot = 0; slot < 4; ++slot)
+        {
+            if (node.Children[slot] == sPrimitiveChild)
+            {
+                UINT32 primitive = mPrimitives[node.First[slot]];
+                SetChild(node, slot, sPrimitiveChild, node.First[slot], 1, GetPrimitiveBox(aBounds, primitive), aBounds.GetRadius(primitive));
+            }
+            else if (node.Children[slot] != sEmptyChild)
+            {
+                const Node& child = mNodes[node.Children[slot]];
+                Aabb box = { XMFLOAT3(sInfinity, sInfinity, sInfinity), XMFLOAT3(-sInfinity, -sInfinity, -sInfinity) };
+                for (UINT32 childSlot = 0; childSlot < 4; ++childSlot)
+                {
+                    Grow(box.Min, box.Max, XMFLOAT3(child.MinX[childSlot], child.MinY[childSlot], child.MinZ[childSlot]), XMFLOAT3(child.MaxX[childSlot], child.MaxY[childSlot], child.MaxZ[childSlot]));
+                }
+                SetChild(node, slot, node.Children[slot], node.First[slot], node.Count[slot], box, sInfinity);
+            }
+        }
+    }
+}
+
+template<typename Test>
+void BoundingVolumeHierarchy::Query(Test&& aTest, std::vector<UINT32>& aIndices) const
+{
+    aIndices.clear();
+    if (mNodes.empty())
+    {
+        return;
+    }
+
+    std::vector<UINT32> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        const Node& node = mNodes[stack.back()];
+        stack.pop_back();
+
+        auto [overlapMask, insideMask] = aTest(node);
+        for (UINT32 mask = overlapMask; mask != 0; mask &= mask - 1)
+        {
+            UINT32 slot = std::countr_zero(mask);
+            if (node.Children[slot] == sPrimitiveChild)
+            {
+                aIndices.push_back(mPrimitives[node.First[slot]]);
+            }
+            else if (insideMask & (1 << slot))
+            {
+                aIndices.insert(aIndices.end(), mPrimitives.begin() + node.First[slot], mPrimitives.begin() + node.First[slot] + node.Count[slot]);
+            }
+            else
+            {
+                stack.push_back(node.Children[slot]);
+            }
+        }
+    }
+}
+
+void BoundingVolumeHierarchy::CullFrustum(const FrustumCulling::Frustum& aFrustum, std::vector<UINT32>& aIndices) const
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    Query([&](const Node& aNode)
+    {
+        __m128 minX = _mm_load_ps(aNode.MinX), maxX = _mm_load_ps(aNode.MaxX);
+        __m128 minY = _mm_load_ps(aNode.MinY), maxY = _mm_load_ps(aNode.MaxY);
+        __m128 minZ = _mm_load_ps(aNode.MinZ), maxZ = _mm_load_ps(aNode.MaxZ);
+        __m128 centerX = _mm_mul_ps(_mm_add_ps(minX, maxX), half), extentX = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+        __m128 centerY = _mm_mul_ps(_mm_add_ps(minY, maxY), half), extentY = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+        __m128 centerZ = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half), extentZ = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+        __m128 radius = _mm_load_ps(aNode.Radius);
+
+        // Same plane test as the flat kernel, empty children have NaN centers and fail every comparison.
+        __m128 isVisible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        __m128 isInside = isVisible;
+        for (const XMFLOAT4& plane : aFrustum.Planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), centerX), _mm_mul_ps(_mm_set1_ps(plane.y), centerY)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), centerZ), _mm_set1_ps(plane.w)));
+            __m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), extentX), _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), extentY)), _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), extentZ));
+            isVisible = _mm_and_ps(isVisible, _mm_cmpge_ps(_mm_add_ps(distance, _mm_min_ps(boxRadius, radius)), zero));
+            isInside = _mm_and_ps(isInside, _mm_cmpge_ps(_mm_sub_ps(distance, boxRadius), zero));
+        }
+        return std::pair(static_cast<UINT32>(_mm_movemask_ps(isVisible)), static_cast<UINT32>(_mm_movemask_ps(isInside)));
+    }, aIndices);
+}
+
+void BoundingVolumeHierarchy::QueryBox(const XMFLOAT3& aMin, const XMFLOAT3& aMax, std::vector<UINT32>& aIndices) const
+{
+    const __m128 queryMinX = _mm_set1_ps(aMin.x), queryMaxX = _mm_set1_ps(aMax.x);
+    const __m128 queryMinY = _mm_set1_ps(aMin.y), queryMaxY = _mm_set1_ps(aMax.y);
+    const __m128 queryMinZ = _mm_set1_ps(aMin.z), queryMaxZ = _mm_set1_ps(aMax.z);
+    Query([&](const Node& aNode)
+    {
+        __m128 minX = _mm_load_ps(aNode.MinX), maxX = _mm_load_ps(aNode.MaxX);
+        __m128 minY = _mm_load_ps(aNode.MinY), maxY = _mm_load_ps(aNode.MaxY);
+        __m128 minZ = _mm_load_ps(aNode.MinZ), maxZ = _mm_load_ps(aNode.MaxZ);
+
+        __m128 overlaps = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(minX, queryMaxX), _mm_cmpge_ps(maxX, queryMinX)), _mm_and_ps(_mm_cmple_ps(minY, queryMaxY), _mm_cmpge_ps(maxY, queryMinY)));
+        overlaps = _mm_and_ps(overlaps, _mm_and_ps(_mm_cmple_ps(minZ, queryMaxZ), _mm_cmpge_ps(maxZ, queryMinZ)));
+        __m128 isInside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(minX, queryMinX), _mm_cmple_ps(maxX, queryMaxX)), _mm_and_ps(_mm_cmpge_ps(minY, queryMinY), _mm_cmple_ps(maxY, queryMaxY)));
+        isInside = _mm_and_ps(isInside, _mm_and_ps(_mm_cmpge_ps(minZ, queryMinZ), _mm_cmple_ps(maxZ, queryMaxZ)));
+        return std::pair(static_cast<UINT32>(_mm_movemask_ps(overlaps)), static_cast<UINT32>(_mm_movemask_ps(isInside)));
+    }, aIndices);
+}
+
+void BoundingVolumeHierarchy::QuerySphere(const XMFLOAT3& aCenter, float aRadius, std::vector<UINT32>& aIndices) const
+{
+    const __m128 centerX = _mm_set1_ps(aCenter.x);
+    const __m128 centerY = _mm_set1_ps(aCenter.y);
+    const __m128 centerZ = _mm_set1_ps(aCenter.z);
+    const __m128 radiusSquared = _mm_set1_ps(aRadius * aRadius);
+    Query([&](const Node& aNode)
+    {
+        __m128 minX = _mm_load_ps(aNode.MinX), maxX = _mm_load_ps(aNode.MaxX);
+        __m128 minY = _mm_load_ps(aNode.MinY), maxY = _mm_load_ps(aNode.MaxY);
+        __m128 minZ = _mm_load_ps(aNode.MinZ), maxZ = _mm_load_ps(aNode.MaxZ);
+
+        // The closest point of the box decides the overlap, the farthest corner whether the box is inside.
+        __m128 nearX = _mm_sub_ps(_mm_max_ps(minX, _mm_min_ps(centerX, maxX)), centerX);
+        __m128 nearY = _mm_sub_ps(_mm_max_ps(minY, _mm_min_ps(centerY, maxY)), centerY);
+        __m128 nearZ = _mm_sub_ps(_mm_max_ps(minZ, _mm_min_ps(centerZ, maxZ)), centerZ);
+        __m128 nearSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nearX, nearX), _mm_mul_ps(nearY, nearY)), _mm_mul_ps(nearZ, nearZ));
+
+        __m128 farX = _mm_max_ps(_mm_sub_ps(centerX, minX), _mm_sub_ps(maxX, centerX));
+        __m128 farY = _mm_max_ps(_mm_sub_ps(centerY, minY), _mm_sub_ps(maxY, centerY));
+        __m128 farZ = _mm_max_ps(_mm_sub_ps(centerZ, minZ), _mm_sub_ps(maxZ, centerZ));
+        __m128 farSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(farX, farX), _mm_mul_ps(farY, farY)), _mm_mul_ps(farZ, farZ));
+
+        return std::pair(static_cast<UINT32>(_mm_movemask_ps(_mm_cmple_ps(nearSquared, radiusSquared))), static_cast<UINT32>(_mm_movemask_ps(_mm_cmple_ps(farSquared, radiusSquared))));
+    }, aIndices);
+}
+
+float BoundingVolumeHierarchy::IntersectRay(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, RayIntersector aIntersector, void* aContext) const
+{
+    if (mNodes.empty())
+    {
+        return aMaxDistance;
+    }
+
+    // Zero direction components are nudged away from zero, so the slab distances stay finite and never NaN.
+    auto getInverse = [](float aValue) { return 1.0f / (std::abs(aValue) > 1e-20f ? aValue : std::copysign(1e-20f, aValue)); };
+    const __m128 originX = _mm_set1_ps(aOrigin.x), inverseX = _mm_set1_ps(getInverse(aDirection.x));
+    const __m128 originY = _mm_set1_ps(aOrigin.y), inverseY = _mm_set1_ps(getInverse(aDirection.y));
+    const __m128 originZ = _mm_set1_ps(aOrigin.z), inverseZ = _mm_set1_ps(getInverse(aDirection.z));
+    const __m128 zero = _mm_setzero_ps();
+
+    struct StackEntry
+    {
+        UINT32 Node;
+        float Distance;     // where the ray enters the node box
+    };
+    StackEntry stack[256];
+    UINT32 stackSize = 0;
+    stack[stackSize++] = { 0, 0.0f };
+    float maxDistance = aMaxDistance;
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        if (entry.Distance > maxDistance)
+        {
+            continue;
+        }
+
+        const Node& node = mNodes[entry.Node];
+        __m128 minX = _mm_load_ps(node.MinX), maxX = _mm_load_ps(node.MaxX);
+        __m128 minY = _mm_load_ps(node.MinY), maxY = _mm_load_ps(node.MaxY);
+        __m128 minZ = _mm_load_ps(node.MinZ), maxZ = _mm_load_ps(node.MaxZ);
+        __m128 nearX = _mm_mul_ps(_mm_sub_ps(minX, originX), inverseX), farX = _mm_mul_ps(_mm_sub_ps(maxX, originX), inverseX);
+        __m128 nearY = _mm_mul_ps(_mm_sub_ps(minY, originY), inverseY), farY = _mm_mul_ps(_mm_sub_ps(maxY, originY), inverseY);
+        __m128 nearZ = _mm_mul_ps(_mm_sub_ps(minZ, originZ), inverseZ), farZ = _mm_mul_ps(_mm_sub_ps(maxZ, originZ), inverseZ);
+        __m128 entryDistance = _mm_max_ps(_mm_max_ps(_mm_min_ps(nearX, farX), _mm_min_ps(nearY, farY)), _mm_max_ps(_mm_min_ps(nearZ, farZ), zero));
+        __m128 exitDistance = _mm_min_ps(_mm_min_ps(_mm_max_ps(nearX, farX), _mm_max_ps(nearY, farY)), _mm_min_ps(_mm_max_ps(nearZ, farZ), _mm_set1_ps(maxDistance)));
+
+        // Empty children have inverted boxes, which would pass the slab test.
+        __m128 isHit = _mm_and_ps(_mm_cmple_ps(entryDistance, exitDistance), _mm_cmple_ps(minX, maxX));
+        UINT32 hitMask = _mm_movemask_ps(isHit);
+        if (hitMask == 0)
+        {
+            continue;
+        }
+
+        alignas(16) float entryDistances[4];
+        _mm_store_ps(entryDistances, entryDistance);
+
+        // Primitives go first, their hits shorten the ray before the child nodes are pushed.
+        UINT32 primitives[4];
+        UINT32 primitivesCount = 0;
+        StackEntry children[4];
+        UINT32 childrenCount = 0;
+        for (UINT32 mask = hitMask; mask != 0; mask &= mask - 1)
+        {
+            UINT32 slot = std::countr_zero(mask);
+            if (node.Children[slot] == sPrimitiveChild)
+            {
+                primitives[primitivesCount++] = mPrimitives[node.First[slot]];
+            }
+            else
+            {
+                children[childrenCount++] = { node.Children[slot], entryDistances[slot] };
+            }
+        }
+
+        if (primitivesCount > 0)
+        {
+            maxDistance = std::min(maxDistance, aIntersector(aContext, std::span<const UINT32>(primitives, primitivesCount), maxDistance));
+        }
+
+        // The nearest child is pushed last and so visited first.
+        std::sort(children, children + childrenCount, [](const StackEntry& aLeft, const StackEntry& aRight) { return aLeft.Distance > aRight.Distance; });
+        for (UINT32 i = 0; i < childrenCount; ++i)
+        {
+            ASSERT(stackSize < _countof(stack), "Hierarchy is too deep for the ray stack.");
+            stack[stackSize++] = children[i];
+        }
+    }
+    return maxDistance;
+}
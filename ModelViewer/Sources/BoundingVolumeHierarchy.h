@@ -0,0 +1,100 @@
+#pragma once
+
+#include "FrustumCulling.h"
+#include <span>
+
+// Four-wide bounding volume hierarchy over a BoundsList, for culling and range queries that reject whole subtrees.
+//
+// Every node holds the boxes of up to four children in structure-of-arrays layout, so one SSE test checks all of
+// them against a plane. A child is either another node or a single primitive. Primitives below a node are a
+// contiguous range of mPrimitives, so a node that is completely inside a query reports its range without visiting
+// the subtree. Nodes are stored parent first, which lets Refit walk the array backwards.
+//
+// Rays traverse the children nearest first and shrink the search distance with every hit, so boxes behind the
+// nearest hit are skipped.
+//
+// The tree is built top-down with binned SAH. Large ranges build their children in parallel. Refit keeps the
+// topology and only recomputes the boxes, so it suits moving objects until the tree quality degrades and a rebuild
+// pays off.
+class BoundingVolumeHierarchy
+{
+public:
+    static constexpr UINT32 sBinsCount = 16;
+    static constexpr UINT32 sMedianSplitPrimitivesCount = 16;  // smaller ranges skip the SAH binning
+    static constexpr UINT32 sParallelPrimitivesCount = 4096;    // smaller ranges are built on the calling thread
+
+private:
+    static constexpr UINT32 sPrimitiveChild = UINT32_MAX - 1;   // the child is the primitive at First
+    static constexpr UINT32 sEmptyChild = UINT32_MAX;
+
+    struct alignas(16) Node
+    {
+        float MinX[4];
+        float MinY[4];
+        float MinZ[4];
+        float MaxX[4];
+        float MaxY[4];
+        float MaxZ[4];
+        float Radius[4];            // bounding sphere of primitive children, infinity for nodes
+        UINT32 Children[4];         // node index, sPrimitiveChild or sEmptyChild
+        UINT32 First[4];            // first primitive of the child subtree in mPrimitives
+        UINT32 Count[4];
+    };
+
+    struct Aabb
+    {
+        DirectX::XMFLOAT3 Min;
+        DirectX::XMFLOAT3 Max;
+    };
+
+    // Copy of a bound that the build partitions, so splitting reads memory linearly instead of through indices.
+    struct BuildPrimitive
+    {
+        Aabb Box;
+        DirectX::XMFLOAT3 Center;
+        UINT32 Index;
+    };
+
+    std::vector<Node> mNodes;
+    std::vector<UINT32> mPrimitives;     // indices into the BoundsList, grouped by subtree
+
+    static Aabb GetPrimitiveBox(const FrustumCulling::BoundsList& aBounds, UINT32 aIndex);
+    static UINT32 Split(BuildPrimitive* aBegin, BuildPrimitive* aEnd);
+    static UINT32 BuildNode(const FrustumCulling::BoundsList& aBounds, BuildPrimitive* aPrimitives, UINT32 aFirst, UINT32 aCount, std::vector<Node>& aNodes, Aabb& aBox);
+    static void SetChild(Node& aNode, UINT32 aSlot, UINT32 aChild, UINT32 aFirst, UINT32 aCount, const Aabb& aBox, float aRadius);
+
+    // Visits the nodes whose boxes pass aTest. aTest returns the 4-bit masks of the overlapping children and of the
+    // children completely inside the query, inside children have their whole primitive range reported.
+    template<typename Test>
+    void Query(Test&& aTest, std::vector<UINT32>& aIndices) const;
+
+    using RayIntersector = float (*)(void* aContext, std::span<const UINT32> aPrimitives, float aMaxDistance);
+    float IntersectRay(const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, float aMaxDistance, RayIntersector aIntersector, void* aContext) const;
+
+public:
+    void Build(const FrustumCulling::BoundsList& aBounds);
+    // Recomputes the node boxes after the bounds moved, aBounds must hold the same primitives as on Build.
+    void Refit(const FrustumCulling::BoundsList& aBounds);
+
+    // The queries replace aIndices with the indices of the intersecting bounds, in no particular order. The frustum
+    // test matches FrustumCulling::Cull.
+    void CullFrustum(const FrustumCulling::Frustum& aFrustum, std::vector<UINT32>& aIndices) const;
+    void QueryBox(const DirectX::XMFLOAT3& aMin, const DirectX::XMFLOAT3& aMax, std::vector<UINT32>& aIndices) const;
+    void QuerySphere(const DirectX::XMFLOAT3& aCenter, float aRadius, std::vector<UINT32>& aIndices) const;
+
+    // Walks the ray aOrigin + t * aDirection for t in [0, aMaxDistance] and calls aIntersect(primitives, maxDistance)
+    // with the bounds indices of up to four primitives at once whose boxes the ray hits. aIntersect returns the
+    // distance of its nearest hit below maxDistance, or maxDistance without a hit. Returns the nearest distance found,
+    // aMaxDistance if nothing was hit.
+    template<typename Intersect>
+    float IntersectRay(const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, float aMaxDistance, Intersect&& aIntersect) const
+    {
+        return IntersectRay(aOrigin, aDirection, aMaxDistance, [](void* aContext, std::span<const UINT32> aPrimitives, float aMaxDistance)
+        {
+            return (*static_cast<std::remove_reference_t<Intersect>*>(aContext))(aPrimitives, aMaxDistance);
+        }, &aIntersect);
+    }
+
+    UINT32 GetPrimitivesCount() const { return static_cast<UINT32>(mPrimitives.size()); }
+    UINT32 GetNodesCount() const { return static_cast<UINT32>(mNodes.size()); }
+};
@@ -1,59 +1,36 @@
 #include "pch.h"
 #include "Buffer.h"
 #include "Utility.h"
+#include "UploadBatch.h"
 
-Buffer::Buffer(const wchar_t* name, UINT64 elementsCount, UINT64 elementSize, const void* data, D3D12_RESOURCE_STATES stateAfter, D3D12_RESOURCE_FLAGS flags)
+Buffer::Buffer(const wchar_t* name, UINT64 elementsCount, UINT64 elementSize, const void* data, D3D12_RESOURCE_STATES stateAfter, D3D12_RESOURCE_FLAGS flags, UploadBatch* uploadBatch)
     : mSizeInBytes(elementsCount* elementSize)
     , mElementsCount(elementsCount)
     , mElementSizeInBytes(elementSize)
 {
+    ++Graphics::g_BackendStatistics.ResourcesCount;
+    Graphics::g_BackendStatistics.ResourcesBytes += mSizeInBytes;
+
     D3D12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(mSizeInBytes, flags);
-    D3D12_HEAP_PROPERTIES heapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
-    if (SUCCEEDED(Graphics::g_Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_pResource))))
+    if (FAILED(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_DEFAULT, bufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, m_pResource)))
     {
+        Utility::Printf(L"Failed to create buffer resource");
+        return;
+    }
 #ifdef _DEBUG
-        m_pResource->SetName(name);
+    m_pResource->SetName(name);
 #endif
-        m_GpuVirtualAddress = m_pResource->GetGPUVirtualAddress();
-        mFormat = m_pResource->GetDesc().Format;
-
-        if (data)
-        {
-            D3D12_SUBRESOURCE_DATA subresource;
-            subresource.RowPitch = mSizeInBytes;
-            subresource.SlicePitch = subresource.RowPitch;
-            subresource.pData = data;
-
-            Microsoft::WRL::ComPtr<ID3D12Resource> intermediateResource;
-            heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
-            bufferDesc.Flags &= ~D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
-            if (SUCCEEDED(Graphics::g_Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&intermediateResource))))
-            {
-                Graphics::g_GraphicsCommandList->Reset(Graphics::g_GraphicsCommandAllocators[Graphics::g_CurrentBackBufferIndex].Get(), nullptr);
-
-                UpdateSubresources(Graphics::g_GraphicsCommandList.Get(), m_pResource.Get(), intermediateResource.Get(), 0, 0, 1, &subresource);
+    m_GpuVirtualAddress = m_pResource->GetGPUVirtualAddress();
+    mFormat = bufferDesc.Format;
+    TrackResidency(mSizeInBytes);
 
-                CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_pResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, stateAfter);
-                Graphics::g_GraphicsCommandList->ResourceBarrier(1, &barrier);
-
-                Graphics::g_GraphicsCommandList->Close();
-
-                ID3D12CommandList* const commandLists[] = { Graphics::g_GraphicsCommandList.Get() };
-                Graphics::g_GraphicsCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
-
-                Graphics::Flush();
-
-                Utility::Printf(L"Buffer resource created");
-            }
-            else
-            {
-                Utility::Printf(L"Failed to create intermediate buffer resource");
-            }
-        }
-    }
-    else
+    // Without a batch of the caller the data is uploaded with one of its own, which waits for the copy.
+    if (data)
     {
-        Utility::Printf(L"Failed to create buffer resource");
+        UploadBatch ownUploadBatch(mSizeInBytes);
+        UploadBatch& batch = uploadBatch ? *uploadBatch : ownUploadBatch;
+        batch.UploadBuffer(m_pResource.Get(), data, mSizeInBytes);
+        batch.Transition(m_pResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, stateAfter);
     }
 }
 
@@ -70,7 +47,7 @@ void Buffer::CreateSRV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescripto
     CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle;
     srvHandle.InitOffsetted(SRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), offset * Graphics::g_SRVDescriptorSize);
 
-    Graphics::g_Device->CreateShaderResourceView(m_pResource.Get(), &shaderResourceViewDesc, srvHandle);
+    Graphics::GetBackend().CreateShaderResourceView(m_pResource.Get(), shaderResourceViewDesc, srvHandle);
 }
 
 void Buffer::CreateUAV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescriptorHeap, UINT offset) const
@@ -87,5 +64,5 @@ void Buffer::CreateUAV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescripto
     CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle;
     srvHandle.InitOffsetted(SRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), offset * Graphics::g_SRVDescriptorSize);
 
-    Graphics::g_Device->CreateUnorderedAccessView(m_pResource.Get(), nullptr, &unorderedAccessViewDesc, srvHandle);
+    Graphics::GetBackend().CreateUnorderedAccessView(m_pResource.Get(), unorderedAccessViewDesc, srvHandle);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "GPUResource.h"
 
+class UploadBatch;
+
 class Buffer : public GpuResource
 {
 	UINT64 mSizeInBytes = 0;
@@ -10,7 +12,7 @@ class Buffer : public GpuResource
 
 public:
 	Buffer() {}
-	Buffer(const wchar_t* name, UINT64 elementsCount, UINT64 elementSize, const void* data = nullptr, D3D12_RESOURCE_STATES stateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE);
+	Buffer(const wchar_t* name, UINT64 elementsCount, UINT64 elementSize, const void* data = nullptr, D3D12_RESOURCE_STATES stateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE, UploadBatch* uploadBatch = nullptr);
 	UINT64 GetSizeInBytes() const { return mSizeInBytes; }
 	UINT64 GetElementsCount() const { return mElementsCount; }
 	UINT64 GetElementSizeInBytes() const { return mElementSizeInBytes; }
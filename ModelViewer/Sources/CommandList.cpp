@@ -0,0 +1,20 @@
+#include "pch.h"
+#include "CommandList.h"
+
+CommandStatistics& CommandStatistics::operator+=(const CommandStatistics& aOther)
+{
+    Commands += aOther.Commands;
+    Draws += aOther.Draws;
+    Instances += aOther.Instances;
+    Indices += aOther.Indices;
+    PipelineChanges += aOther.PipelineChanges;
+    RootSignatureChanges += aOther.RootSignatureChanges;
+    DescriptorTableChanges += aOther.DescriptorTableChanges;
+    RootConstantsChanges += aOther.RootConstantsChanges;
+    VertexBufferChanges += aOther.VertexBufferChanges;
+    IndexBufferChanges += aOther.IndexBufferChanges;
+    Barriers += aOther.Barriers;
+    Clears += aOther.Clears;
+    CopiedBytes += aOther.CopiedBytes;
+    return *this;
+}
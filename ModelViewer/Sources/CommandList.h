@@ -0,0 +1,294 @@
+#pragma once
+
+#include "pch.h"
+
+// What was recorded into a CommandList. The counts are the same with and without a device, so they can be compared
+// between runs on the null backend and on a GPU.
+struct CommandStatistics
+{
+    UINT64 Commands = 0;
+    UINT64 Draws = 0;
+    UINT64 Instances = 0;
+    UINT64 Indices = 0;
+    UINT64 PipelineChanges = 0;
+    UINT64 RootSignatureChanges = 0;
+    UINT64 DescriptorTableChanges = 0;
+    UINT64 RootConstantsChanges = 0;
+    UINT64 VertexBufferChanges = 0;
+    UINT64 IndexBufferChanges = 0;
+    UINT64 Barriers = 0;
+    UINT64 Clears = 0;
+    UINT64 CopiedBytes = 0;
+
+    CommandStatistics& operator+=(const CommandStatistics& aOther);
+};
+
+// Graphics or compute command list that counts the commands recorded into it. They are forwarded to the native list
+// if there is one, with the null backend there is none and only the statistics are kept. Only the commands the
+// renderer records are wrapped. A CommandList is used by one thread at a time, like the native list.
+class CommandList
+{
+    ID3D12GraphicsCommandList* mList = nullptr;
+    CommandStatistics mStatistics;
+
+public:
+    CommandList() {}
+    explicit CommandList(ID3D12GraphicsCommandList* aList) : mList(aList) {}
+
+    ID3D12GraphicsCommandList* GetNative() const { return mList; }
+    const CommandStatistics& GetStatistics() const { return mStatistics; }
+
+    // Resets aAllocator and reopens the list with it, the GPU must be done with the allocator. The statistics are
+    // kept until ResetStatistics.
+    void Reset(ID3D12CommandAllocator* aAllocator)
+    {
+        if (mList)
+        {
+            aAllocator->Reset();
+            mList->Reset(aAllocator, nullptr);
+        }
+    }
+
+    void Close()
+    {
+        if (mList)
+        {
+            mList->Close();
+        }
+    }
+
+    void ResetStatistics() { mStatistics = {}; }
+
+    void SetPipelineState(ID3D12PipelineState* aPipelineState)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.PipelineChanges;
+        if (mList)
+        {
+            mList->SetPipelineState(aPipelineState);
+        }
+    }
+
+    void SetGraphicsRootSignature(ID3D12RootSignature* aRootSignature)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.RootSignatureChanges;
+        if (mList)
+        {
+            mList->SetGraphicsRootSignature(aRootSignature);
+        }
+    }
+
+    void SetComputeRootSignature(ID3D12RootSignature* aRootSignature)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.RootSignatureChanges;
+        if (mList)
+        {
+            mList->SetComputeRootSignature(aRootSignature);
+        }
+    }
+
+    void SetDescriptorHeaps(UINT aHeapsCount, ID3D12DescriptorHeap* const* aHeaps)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->SetDescriptorHeaps(aHeapsCount, aHeaps);
+        }
+    }
+
+    void SetGraphicsRootDescriptorTable(UINT aRootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE aBaseDescriptor)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.DescriptorTableChanges;
+        if (mList)
+        {
+            mList->SetGraphicsRootDescriptorTable(aRootParameterIndex, aBaseDescriptor);
+        }
+    }
+
+    void SetComputeRootDescriptorTable(UINT aRootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE aBaseDescriptor)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.DescriptorTableChanges;
+        if (mList)
+        {
+            mList->SetComputeRootDescriptorTable(aRootParameterIndex, aBaseDescriptor);
+        }
+    }
+
+    void SetGraphicsRoot32BitConstant(UINT aRootParameterIndex, UINT aValue, UINT aDestOffset)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.RootConstantsChanges;
+        if (mList)
+        {
+            mList->SetGraphicsRoot32BitConstant(aRootParameterIndex, aValue, aDestOffset);
+        }
+    }
+
+    void SetGraphicsRoot32BitConstants(UINT aRootParameterIndex, UINT aValuesCount, const void* aValues, UINT aDestOffset)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.RootConstantsChanges;
+        if (mList)
+        {
+            mList->SetGraphicsRoot32BitConstants(aRootParameterIndex, aValuesCount, aValues, aDestOffset);
+        }
+    }
+
+    void SetComputeRoot32BitConstants(UINT aRootParameterIndex, UINT aValuesCount, const void* aValues, UINT aDestOffset)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.RootConstantsChanges;
+        if (mList)
+        {
+            mList->SetComputeRoot32BitConstants(aRootParameterIndex, aValuesCount, aValues, aDestOffset);
+        }
+    }
+
+    void SetGraphicsRootConstantBufferView(UINT aRootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS aBufferLocation)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->SetGraphicsRootConstantBufferView(aRootParameterIndex, aBufferLocation);
+        }
+    }
+
+    void SetGraphicsRootShaderResourceView(UINT aRootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS aBufferLocation)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->SetGraphicsRootShaderResourceView(aRootParameterIndex, aBufferLocation);
+        }
+    }
+
+    void RSSetViewports(UINT aViewportsCount, const D3D12_VIEWPORT* aViewports)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->RSSetViewports(aViewportsCount, aViewports);
+        }
+    }
+
+    void RSSetScissorRects(UINT aRectsCount, const D3D12_RECT* aRects)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->RSSetScissorRects(aRectsCount, aRects);
+        }
+    }
+
+    void OMSetRenderTargets(UINT aRenderTargetsCount, const D3D12_CPU_DESCRIPTOR_HANDLE* aRenderTargets, BOOL aIsSingleHandle, const D3D12_CPU_DESCRIPTOR_HANDLE* aDepthStencil)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->OMSetRenderTargets(aRenderTargetsCount, aRenderTargets, aIsSingleHandle, aDepthStencil);
+        }
+    }
+
+    void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY aPrimitiveTopology)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->IASetPrimitiveTopology(aPrimitiveTopology);
+        }
+    }
+
+    void IASetVertexBuffers(UINT aStartSlot, UINT aViewsCount, const D3D12_VERTEX_BUFFER_VIEW* aViews)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.VertexBufferChanges;
+        if (mList)
+        {
+            mList->IASetVertexBuffers(aStartSlot, aViewsCount, aViews);
+        }
+    }
+
+    void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* aView)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.IndexBufferChanges;
+        if (mList)
+        {
+            mList->IASetIndexBuffer(aView);
+        }
+    }
+
+    void DrawIndexedInstanced(UINT aIndicesCountPerInstance, UINT aInstancesCount, UINT aStartIndexLocation, INT aBaseVertexLocation, UINT aStartInstanceLocation)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.Draws;
+        mStatistics.Instances += aInstancesCount;
+        mStatistics.Indices += UINT64(aIndicesCountPerInstance) * aInstancesCount;
+        if (mList)
+        {
+            mList->DrawIndexedInstanced(aIndicesCountPerInstance, aInstancesCount, aStartIndexLocation, aBaseVertexLocation, aStartInstanceLocation);
+        }
+    }
+
+    void Dispatch(UINT aThreadGroupsCountX, UINT aThreadGroupsCountY, UINT aThreadGroupsCountZ)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->Dispatch(aThreadGroupsCountX, aThreadGroupsCountY, aThreadGroupsCountZ);
+        }
+    }
+
+    void ResourceBarrier(UINT aBarriersCount, const D3D12_RESOURCE_BARRIER* aBarriers)
+    {
+        ++mStatistics.Commands;
+        mStatistics.Barriers += aBarriersCount;
+        if (mList)
+        {
+            mList->ResourceBarrier(aBarriersCount, aBarriers);
+        }
+    }
+
+    void ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE aRenderTargetView, const FLOAT aColor[4], UINT aRectsCount, const D3D12_RECT* aRects)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.Clears;
+        if (mList)
+        {
+            mList->ClearRenderTargetView(aRenderTargetView, aColor, aRectsCount, aRects);
+        }
+    }
+
+    void ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE aDepthStencilView, D3D12_CLEAR_FLAGS aClearFlags, FLOAT aDepth, UINT8 aStencil, UINT aRectsCount, const D3D12_RECT* aRects)
+    {
+        ++mStatistics.Commands;
+        ++mStatistics.Clears;
+        if (mList)
+        {
+            mList->ClearDepthStencilView(aDepthStencilView, aClearFlags, aDepth, aStencil, aRectsCount, aRects);
+        }
+    }
+
+    void CopyBufferRegion(ID3D12Resource* aDestination, UINT64 aDestinationOffset, ID3D12Resource* aSource, UINT64 aSourceOffset, UINT64 aSizeInBytes)
+    {
+        ++mStatistics.Commands;
+        mStatistics.CopiedBytes += aSizeInBytes;
+        if (mList)
+        {
+            mList->CopyBufferRegion(aDestination, aDestinationOffset, aSource, aSourceOffset, aSizeInBytes);
+        }
+    }
+
+    void CopyTextureRegion(const D3D12_TEXTURE_COPY_LOCATION* aDestination, UINT aDestinationX, UINT aDestinationY, UINT aDestinationZ, const D3D12_TEXTURE_COPY_LOCATION* aSource, const D3D12_BOX* aSourceBox)
+    {
+        ++mStatistics.Commands;
+        if (mList)
+        {
+            mList->CopyTextureRegion(aDestination, aDestinationX, aDestinationY, aDestinationZ, aSource, aSourceBox);
+        }
+    }
+};
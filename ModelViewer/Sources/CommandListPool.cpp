@@ -0,0 +1,83 @@
+#include "pch.h"
+#include "CommandListPool.h"
+#include "Utility.h"
+
+std::vector<ParallelRecording::Range> ParallelRecording::Partition(UINT32 aItemsCount, UINT32 aMaxRanges, UINT32 aMinItemsPerRange)
+{
+    std::vector<Range> ranges;
+    if (aItemsCount == 0 || aMaxRanges == 0)
+    {
+        return ranges;
+    }
+
+    UINT32 rangesCount = std::clamp(aItemsCount / std::max(aMinItemsPerRange, 1u), 1u, aMaxRanges);
+    UINT32 itemsPerRange = aItemsCount / rangesCount;
+    UINT32 largerRangesCount = aItemsCount % rangesCount;
+    UINT32 first = 0;
+    for (UINT32 i = 0; i < rangesCount; ++i)
+    {
+        UINT32 count = itemsPerRange + (i < largerRangesCount ? 1 : 0);
+        ranges.push_back({ first, count });
+        first += count;
+    }
+    return ranges;
+}
+
+void CommandListPool::Initialize(UINT32 aFramesCount, UINT32 aListsCount)
+{
+    ASSERT(aListsCount > 0 && aListsCount <= sMaxListsCount, "Unsupported number of command lists.");
+
+    mFramesCount = aFramesCount;
+    mListsCount = aListsCount;
+    mAllocators.resize(aFramesCount * aListsCount);
+    mLists.resize(aListsCount);
+    mOpenLists.reserve(aListsCount);
+
+    for (Microsoft::WRL::ComPtr<ID3D12CommandAllocator>& allocator : mAllocators)
+    {
+        ASSERT_HRESULT(Graphics::GetBackend().CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, allocator), "Failed to create command allocator.");
+    }
+
+    for (UINT32 i = 0; i < aListsCount; ++i)
+    {
+        ASSERT_HRESULT(Graphics::GetBackend().CreateCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, mAllocators[i].Get(), mLists[i]), "Failed to create command list.");
+    }
+}
+
+std::span<CommandList> CommandListPool::Begin(UINT32 aFrameIndex, UINT32 aCount)
+{
+    ASSERT(aFrameIndex < mFramesCount && aCount <= mListsCount && mOpenLists.empty(), "Command lists are already open or out of range.");
+
+    for (UINT32 i = 0; i < aCount; ++i)
+    {
+        mOpenLists.emplace_back(mLists[i].Get());
+        mOpenLists.back().Reset(mAllocators[aFrameIndex * mListsCount + i].Get());
+    }
+    return mOpenLists;
+}
+
+CommandStatistics CommandListPool::Execute(ID3D12CommandQueue* aCommandQueue, ID3D12CommandList* aFirstList)
+{
+    CommandStatistics statistics;
+    ID3D12CommandList* commandLists[sMaxListsCount + 1];
+    UINT32 commandListsCount = 0;
+    if (aFirstList)
+    {
+        commandLists[commandListsCount++] = aFirstList;
+    }
+    for (CommandList& list : mOpenLists)
+    {
+        list.Close();
+        statistics += list.GetStatistics();
+        if (list.GetNative())
+        {
+            commandLists[commandListsCount++] = list.GetNative();
+        }
+    }
+    mOpenLists.clear();
+
+    // Counted on the null backend too, where there is nothing to execute.
+    ++Graphics::g_BackendStatistics.Submits;
+    Graphics::GetBackend().ExecuteCommandLists(aCommandQueue, std::span(commandLists, commandListsCount));
+    return statistics;
+}
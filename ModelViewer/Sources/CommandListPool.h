@@ -0,0 +1,72 @@
+#pragma once
+
+#include "pch.h"
+#include "CommandList.h"
+#include <algorithm>
+#include <execution>
+#include <span>
+
+// Command lists recorded in parallel. The items of a frame, usually its sorted draws, are split into contiguous
+// ranges and range i is recorded into list i on a worker thread. The lists are then executed in list order with one
+// ExecuteCommandLists call, so the GPU sees the items in the same order as if one thread had recorded them.
+//
+// Every list starts without state, whatever a range relies on has to be set again at its start.
+namespace ParallelRecording
+{
+    struct Range
+    {
+        UINT32 First = 0;
+        UINT32 Count = 0;
+    };
+
+    // Splits aItemsCount items into at most aMaxRanges contiguous ranges whose sizes differ by at most one. Ranges
+    // get at least aMinItemsPerRange items, so small frames use fewer lists. No items give no ranges.
+    std::vector<Range> Partition(UINT32 aItemsCount, UINT32 aMaxRanges, UINT32 aMinItemsPerRange);
+
+    // Calls aRecord(aLists[i], aRanges[i]) for every range in parallel, aLists needs one list per range. The list type
+    // is a template parameter so the partitioning and the ordering can be checked with a recording mock.
+    template<typename List, typename RecordFunction>
+    void Record(std::span<List> aLists, std::span<const Range> aRanges, RecordFunction&& aRecord)
+    {
+        std::vector<UINT32> listIndices(aRanges.size());
+        for (UINT32 i = 0; i < listIndices.size(); ++i)
+        {
+            listIndices[i] = i;
+        }
+        std::for_each(std::execution::par, listIndices.begin(), listIndices.end(), [&](UINT32 aListIndex)
+        {
+            aRecord(aLists[aListIndex], aRanges[aListIndex]);
+        });
+    }
+}
+
+// Direct command lists with one allocator per list and frame in flight. An allocator is only reset when its frame
+// comes around again, after Graphics::Present has waited for the GPU to finish it. With the null backend there are no
+// native lists, the handed out lists only count their commands.
+class CommandListPool
+{
+public:
+    static constexpr UINT32 sMaxListsCount = 16;
+
+private:
+    std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> mAllocators;     // frame * mListsCount + list
+    std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> mLists;
+    std::vector<CommandList> mOpenLists;
+    UINT32 mListsCount = 0;
+    UINT32 mFramesCount = 0;
+
+public:
+    CommandListPool() {}
+    CommandListPool(const CommandListPool&) = delete;
+    CommandListPool& operator=(const CommandListPool&) = delete;
+
+    void Initialize(UINT32 aFramesCount, UINT32 aListsCount);
+
+    // Resets the allocators of aFrameIndex and opens aCount lists, at most GetListsCount().
+    std::span<CommandList> Begin(UINT32 aFrameIndex, UINT32 aCount);
+    // Closes the open lists and executes them after aFirstList, if any, in one call. aFirstList must be closed.
+    // Returns what was recorded into the open lists.
+    CommandStatistics Execute(ID3D12CommandQueue* aCommandQueue, ID3D12CommandList* aFirstList = nullptr);
+
+    UINT32 GetListsCount() const { return mListsCount; }
+};
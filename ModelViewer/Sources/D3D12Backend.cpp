@@ -0,0 +1,123 @@
+#include "pch.h"
+#include "D3D12Backend.h"
+#include "Utility.h"
+
+D3D12Backend::D3D12Backend(Microsoft::WRL::ComPtr<ID3D12Device> aDevice)
+    : mDevice(std::move(aDevice))
+{
+    ASSERT_HRESULT(mDevice.As(&mDevice2), "Failed to receive ID3D12Device2 form ID3D12Device.");
+}
+
+HRESULT D3D12Backend::CreateCommittedResource(D3D12_HEAP_TYPE aHeapType, const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, const D3D12_CLEAR_VALUE* aOptimizedClearValue, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource)
+{
+    CD3DX12_HEAP_PROPERTIES heapProperties(aHeapType);
+    return mDevice->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &aDesc, aInitialState, aOptimizedClearValue, IID_PPV_ARGS(&aResource));
+}
+
+HRESULT D3D12Backend::CreateReservedResource(const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource)
+{
+    return mDevice->CreateReservedResource(&aDesc, aInitialState, nullptr, IID_PPV_ARGS(&aResource));
+}
+
+HRESULT D3D12Backend::CreateHeap(const D3D12_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12Heap>& aHeap)
+{
+    return mDevice->CreateHeap(&aDesc, IID_PPV_ARGS(&aHeap));
+}
+
+UINT64 D3D12Backend::GetAllocationSize(const D3D12_RESOURCE_DESC& aDesc)
+{
+    return mDevice->GetResourceAllocationInfo(0, 1, &aDesc).SizeInBytes;
+}
+
+void D3D12Backend::GetCopyableFootprints(const D3D12_RESOURCE_DESC& aDesc, UINT aFirstSubresource, UINT aSubresourcesCount, UINT64 aBaseOffset, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* aLayouts, UINT* aRowsCounts, UINT64* aRowSizesInBytes, UINT64* aTotalBytes)
+{
+    mDevice->GetCopyableFootprints(&aDesc, aFirstSubresource, aSubresourcesCount, aBaseOffset, aLayouts, aRowsCounts, aRowSizesInBytes, aTotalBytes);
+}
+
+void D3D12Backend::GetResourceTiling(ID3D12Resource* aResource, D3D12_PACKED_MIP_INFO& aPackedMipInfo, std::span<D3D12_SUBRESOURCE_TILING> aSubresourceTilings)
+{
+    UINT tilesCount = 0;
+    D3D12_TILE_SHAPE tileShape = {};
+    UINT subresourceTilingsCount = static_cast<UINT>(aSubresourceTilings.size());
+    mDevice->GetResourceTiling(aResource, &tilesCount, &aPackedMipInfo, &tileShape, &subresourceTilingsCount, 0, aSubresourceTilings.data());
+}
+
+bool D3D12Backend::SupportsTiledResources(void)
+{
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    return SUCCEEDED(mDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options))) && options.TiledResourcesTier != D3D12_TILED_RESOURCES_TIER_NOT_SUPPORTED;
+}
+
+void D3D12Backend::MakeResident(std::span<ID3D12Pageable* const> aObjects)
+{
+    ASSERT_HRESULT(mDevice->MakeResident(static_cast<UINT>(aObjects.size()), aObjects.data()), "Failed to make resource resident.");
+}
+
+void D3D12Backend::Evict(std::span<ID3D12Pageable* const> aObjects)
+{
+    ASSERT_HRESULT(mDevice->Evict(static_cast<UINT>(aObjects.size()), aObjects.data()), "Failed to evict resources.");
+}
+
+D3D_ROOT_SIGNATURE_VERSION D3D12Backend::GetHighestRootSignatureVersion(void)
+{
+    D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+    featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+    if (FAILED(mDevice->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+    {
+        featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+    }
+    return featureData.HighestVersion;
+}
+
+HRESULT D3D12Backend::CreateRootSignature(ID3DBlob* aBlob, Microsoft::WRL::ComPtr<ID3D12RootSignature>& aRootSignature)
+{
+    return mDevice->CreateRootSignature(0, aBlob->GetBufferPointer(), aBlob->GetBufferSize(), IID_PPV_ARGS(&aRootSignature));
+}
+
+HRESULT D3D12Backend::CreatePipelineState(const D3D12_PIPELINE_STATE_STREAM_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12PipelineState>& aPipelineState)
+{
+    return mDevice2->CreatePipelineState(&aDesc, IID_PPV_ARGS(&aPipelineState));
+}
+
+HRESULT D3D12Backend::CreateDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>& aHeap)
+{
+    return mDevice->CreateDescriptorHeap(&aDesc, IID_PPV_ARGS(&aHeap));
+}
+
+void D3D12Backend::CreateShaderResourceView(ID3D12Resource* aResource, const D3D12_SHADER_RESOURCE_VIEW_DESC& aDesc, D3D12_CPU_DESCRIPTOR_HANDLE aDestination)
+{
+    mDevice->CreateShaderResourceView(aResource, &aDesc, aDestination);
+}
+
+void D3D12Backend::CreateUnorderedAccessView(ID3D12Resource* aResource, const D3D12_UNORDERED_ACCESS_VIEW_DESC& aDesc, D3D12_CPU_DESCRIPTOR_HANDLE aDestination)
+{
+    mDevice->CreateUnorderedAccessView(aResource, nullptr, &aDesc, aDestination);
+}
+
+HRESULT D3D12Backend::CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE aType, Microsoft::WRL::ComPtr<ID3D12CommandAllocator>& aAllocator)
+{
+    return mDevice->CreateCommandAllocator(aType, IID_PPV_ARGS(&aAllocator));
+}
+
+HRESULT D3D12Backend::CreateCommandList(D3D12_COMMAND_LIST_TYPE aType, ID3D12CommandAllocator* aAllocator, Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& aList)
+{
+    HRESULT result = mDevice->CreateCommandList(0, aType, aAllocator, nullptr, IID_PPV_ARGS(&aList));
+    return SUCCEEDED(result) ? aList->Close() : result;
+}
+
+void D3D12Backend::ExecuteCommandLists(ID3D12CommandQueue* aQueue, std::span<ID3D12CommandList* const> aLists)
+{
+    if (!aLists.empty())
+    {
+        aQueue->ExecuteCommandLists(static_cast<UINT>(aLists.size()), aLists.data());
+    }
+}
+
+void D3D12Backend::UpdateTileMappings(ID3D12CommandQueue* aQueue, ID3D12Resource* aResource, UINT aSubresource, UINT aTilesCount, ID3D12Heap* aHeap)
+{
+    D3D12_TILED_RESOURCE_COORDINATE coordinate = { 0, 0, 0, aSubresource };
+    D3D12_TILE_REGION_SIZE regionSize = { aTilesCount, FALSE, 0, 0, 0 };
+    D3D12_TILE_RANGE_FLAGS rangeFlags = aHeap ? D3D12_TILE_RANGE_FLAG_NONE : D3D12_TILE_RANGE_FLAG_NULL;
+    UINT heapRangeStartOffset = 0;
+    aQueue->UpdateTileMappings(aResource, 1, &coordinate, &regionSize, aHeap, 1, &rangeFlags, &heapRangeStartOffset, &aTilesCount, D3D12_TILE_MAPPING_FLAG_NONE);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "GraphicsBackend.h"
+
+// Backend of the device created by Graphics::Initialize, every call goes to the device or the queue.
+class D3D12Backend : public IGraphicsBackend
+{
+    Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+    Microsoft::WRL::ComPtr<ID3D12Device2> mDevice2;     // pipeline state streams
+
+public:
+    explicit D3D12Backend(Microsoft::WRL::ComPtr<ID3D12Device> aDevice);
+
+    const char* GetName(void) const override { return "D3D12"; }
+
+    HRESULT CreateCommittedResource(D3D12_HEAP_TYPE aHeapType, const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, const D3D12_CLEAR_VALUE* aOptimizedClearValue, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource) override;
+    HRESULT CreateReservedResource(const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource) override;
+    HRESULT CreateHeap(const D3D12_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12Heap>& aHeap) override;
+    UINT64 GetAllocationSize(const D3D12_RESOURCE_DESC& aDesc) override;
+    void GetCopyableFootprints(const D3D12_RESOURCE_DESC& aDesc, UINT aFirstSubresource, UINT aSubresourcesCount, UINT64 aBaseOffset, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* aLayouts, UINT* aRowsCounts, UINT64* aRowSizesInBytes, UINT64* aTotalBytes) override;
+    void GetResourceTiling(ID3D12Resource* aResource, D3D12_PACKED_MIP_INFO& aPackedMipInfo, std::span<D3D12_SUBRESOURCE_TILING> aSubresourceTilings) override;
+    bool SupportsTiledResources(void) override;
+    void MakeResident(std::span<ID3D12Pageable* const> aObjects) override;
+    void Evict(std::span<ID3D12Pageable* const> aObjects) override;
+
+    D3D_ROOT_SIGNATURE_VERSION GetHighestRootSignatureVersion(void) override;
+    HRESULT CreateRootSignature(ID3DBlob* aBlob, Microsoft::WRL::ComPtr<ID3D12RootSignature>& aRootSignature) override;
+    HRESULT CreatePipelineState(const D3D12_PIPELINE_STATE_STREAM_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12PipelineState>& aPipelineState) override;
+    HRESULT CreateDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>& aHeap) override;
+    void CreateShaderResourceView(ID3D12Resource* aResource, const D3D12_SHADER_RESOURCE_VIEW_DESC& aDesc, D3D12_CPU_DESCRIPTOR_HANDLE aDestination) override;
+    void CreateUnorderedAccessView(ID3D12Resource* aResource, const D3D12_UNORDERED_ACCESS_VIEW_DESC& aDesc, D3D12_CPU_DESCRIPTOR_HANDLE aDestination) override;
+
+    HRESULT CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE aType, Microsoft::WRL::ComPtr<ID3D12CommandAllocator>& aAllocator) override;
+    HRESULT CreateCommandList(D3D12_COMMAND_LIST_TYPE aType, ID3D12CommandAllocator* aAllocator, Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& aList) override;
+    void ExecuteCommandLists(ID3D12CommandQueue* aQueue, std::span<ID3D12CommandList* const> aLists) override;
+    void UpdateTileMappings(ID3D12CommandQueue* aQueue, ID3D12Resource* aResource, UINT aSubresource, UINT aTilesCount, ID3D12Heap* aHeap) override;
+};
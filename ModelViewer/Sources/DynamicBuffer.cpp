@@ -0,0 +1,31 @@
+#include "pch.h"
+#include "DynamicBuffer.h"
+#include "Utility.h"
+
+void DynamicBuffer::Reserve(const wchar_t* aName, UINT64 aSizeInBytes)
+{
+    if (aSizeInBytes <= mSizeInBytes)
+    {
+        return;
+    }
+
+    // Grow geometrically, so a slowly growing instance count does not recreate the buffer every frame.
+    UINT64 sizeInBytes = std::max(aSizeInBytes, mSizeInBytes * 2);
+    sizeInBytes = (sizeInBytes + D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - 1) & ~UINT64(D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - 1);
+
+    ++Graphics::g_BackendStatistics.ResourcesCount;
+    Graphics::g_BackendStatistics.ResourcesBytes += sizeInBytes;
+
+    D3D12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeInBytes);
+    Destroy();
+    ASSERT_HRESULT(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_UPLOAD, bufferDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, m_pResource), "Failed to create dynamic buffer.");
+#ifdef _DEBUG
+    m_pResource->SetName(aName);
+#endif
+
+    CD3DX12_RANGE readRange(0, 0);
+    ASSERT_HRESULT(m_pResource->Map(0, &readRange, reinterpret_cast<void**>(&mCpuAddress)), "Failed to map dynamic buffer.");
+    m_GpuVirtualAddress = m_pResource->GetGPUVirtualAddress();
+    m_UsageState = D3D12_RESOURCE_STATE_GENERIC_READ;
+    mSizeInBytes = sizeInBytes;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "GPUResource.h"
+
+// Buffer in an upload heap that stays mapped, for data the CPU rewrites every frame. The GPU reads it over the bus,
+// so it suits small per-frame data like instance transforms. Graphics::Present waits for the GPU every frame, so
+// the contents can be overwritten in Update without double buffering.
+class DynamicBuffer : public GpuResource
+{
+    BYTE* mCpuAddress = nullptr;
+    UINT64 mSizeInBytes = 0;
+
+public:
+    DynamicBuffer() {}
+
+    // Makes room for at least aSizeInBytes. Growing creates a new resource and drops the previous contents.
+    void Reserve(const wchar_t* aName, UINT64 aSizeInBytes);
+
+    BYTE* GetCpuAddress() const { return mCpuAddress; }
+    UINT64 GetSizeInBytes() const { return mSizeInBytes; }
+};
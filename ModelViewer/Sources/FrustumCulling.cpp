@@ -0,0 +1,176 @@
+#include "pch.h"
+#include "FrustumCulling.h"
+#include "Utility.h"
+#include <bit>
+#include <cmath>
+#include <immintrin.h>
+
+using namespace DirectX;
+
+FrustumCulling::Frustum FrustumCulling::ExtractFrustum(FXMMATRIX aViewProjection)
+{
+    // Clip space is v * M, so the planes are sums and differences of the matrix columns (Gribb and Hartmann).
+    XMMATRIX columns = XMMatrixTranspose(aViewProjection);
+    XMVECTOR planes[6] = {
+        XMVectorAdd(columns.r[3], columns.r[0]),
+        XMVectorSubtract(columns.r[3], columns.r[0]),
+        XMVectorAdd(columns.r[3], columns.r[1]),
+        XMVectorSubtract(columns.r[3], columns.r[1]),
+        columns.r[2],
+        XMVectorSubtract(columns.r[3], columns.r[2])
+    };
+
+    Frustum frustum;
+    for (UINT32 i = 0; i < 6; ++i)
+    {
+        XMStoreFloat4(&frustum.Planes[i], XMPlaneNormalize(planes[i]));
+    }
+    return frustum;
+}
+
+void FrustumCulling::BoundsList::Clear()
+{
+    mCenterX.clear();
+    mCenterY.clear();
+    mCenterZ.clear();
+    mExtentX.clear();
+    mExtentY.clear();
+    mExtentZ.clear();
+    mRadius.clear();
+    mCount = 0;
+}
+
+void FrustumCulling::BoundsList::Add(const XMFLOAT3& aCenter, const XMFLOAT3& aExtents, float aRadius)
+{
+    if (mCount == mCenterX.size())
+    {
+        size_t paddedSize = mCenterX.size() + sPadding;
+        for (std::vector<float>* array : { &mCenterX, &mCenterY, &mCenterZ, &mExtentX, &mExtentY, &mExtentZ, &mRadius })
+        {
+            array->resize(paddedSize, 0.0f);
+        }
+    }
+
+    mCenterX[mCount] = aCenter.x;
+    mCenterY[mCount] = aCenter.y;
+    mCenterZ[mCount] = aCenter.z;
+    mExtentX[mCount] = aExtents.x;
+    mExtentY[mCount] = aExtents.y;
+    mExtentZ[mCount] = aExtents.z;
+    mRadius[mCount] = aRadius;
+    ++mCount;
+}
+
+// Appends the lanes set in aMask, lanes at or past aCount are padding.
+static UINT32* WriteVisibleIndices(UINT32 aMask, UINT32 aFirstIndex, UINT32 aCount, UINT32* aOutput)
+{
+    while (aMask != 0)
+    {
+        UINT32 index = aFirstIndex + std::countr_zero(aMask);
+        if (index >= aCount)
+        {
+            break;
+        }
+        *aOutput++ = index;
+        aMask &= aMask - 1;
+    }
+    return aOutput;
+}
+
+// A bound is outside if it is completely behind one plane. For the AABB the distance that matters is the projection
+// of the extents on the plane normal, |n| . e. Both volumes enclose the object, so the smaller of that and the sphere
+// radius is used.
+static UINT32* CullSse(const FrustumCulling::Frustum& aFrustum, const float* const* aArrays, UINT32 aCount, UINT32* aOutput)
+{
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6], absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+    for (UINT32 i = 0; i < 6; ++i)
+    {
+        const XMFLOAT4& plane = aFrustum.Planes[i];
+        planeX[i] = _mm_set1_ps(plane.x);
+        planeY[i] = _mm_set1_ps(plane.y);
+        planeZ[i] = _mm_set1_ps(plane.z);
+        planeW[i] = _mm_set1_ps(plane.w);
+        absPlaneX[i] = _mm_set1_ps(std::abs(plane.x));
+        absPlaneY[i] = _mm_set1_ps(std::abs(plane.y));
+        absPlaneZ[i] = _mm_set1_ps(std::abs(plane.z));
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    for (UINT32 first = 0; first < aCount; first += 4)
+    {
+        __m128 centerX = _mm_loadu_ps(aArrays[0] + first);
+        __m128 centerY = _mm_loadu_ps(aArrays[1] + first);
+        __m128 centerZ = _mm_loadu_ps(aArrays[2] + first);
+        __m128 extentX = _mm_loadu_ps(aArrays[3] + first);
+        __m128 extentY = _mm_loadu_ps(aArrays[4] + first);
+        __m128 extentZ = _mm_loadu_ps(aArrays[5] + first);
+        __m128 radius = _mm_loadu_ps(aArrays[6] + first);
+
+        __m128 isVisible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (UINT32 i = 0; i < 6; ++i)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[i], centerX), _mm_mul_ps(planeY[i], centerY)), _mm_add_ps(_mm_mul_ps(planeZ[i], centerZ), planeW[i]));
+            __m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absPlaneX[i], extentX), _mm_mul_ps(absPlaneY[i], extentY)), _mm_mul_ps(absPlaneZ[i], extentZ));
+            __m128 reach = _mm_add_ps(distance, _mm_min_ps(boxRadius, radius));
+            isVisible = _mm_and_ps(isVisible, _mm_cmpge_ps(reach, zero));
+        }
+
+        aOutput = WriteVisibleIndices(_mm_movemask_ps(isVisible), first, aCount, aOutput);
+    }
+    return aOutput;
+}
+
+static UINT32* CullAvx(const FrustumCulling::Frustum& aFrustum, const float* const* aArrays, UINT32 aCount, UINT32* aOutput)
+{
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6], absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+    for (UINT32 i = 0; i < 6; ++i)
+    {
+        const XMFLOAT4& plane = aFrustum.Planes[i];
+        planeX[i] = _mm256_set1_ps(plane.x);
+        planeY[i] = _mm256_set1_ps(plane.y);
+        planeZ[i] = _mm256_set1_ps(plane.z);
+        planeW[i] = _mm256_set1_ps(plane.w);
+        absPlaneX[i] = _mm256_set1_ps(std::abs(plane.x));
+        absPlaneY[i] = _mm256_set1_ps(std::abs(plane.y));
+        absPlaneZ[i] = _mm256_set1_ps(std::abs(plane.z));
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    for (UINT32 first = 0; first < aCount; first += 8)
+    {
+        __m256 centerX = _mm256_loadu_ps(aArrays[0] + first);
+        __m256 centerY = _mm256_loadu_ps(aArrays[1] + first);
+        __m256 centerZ = _mm256_loadu_ps(aArrays[2] + first);
+        __m256 extentX = _mm256_loadu_ps(aArrays[3] + first);
+        __m256 extentY = _mm256_loadu_ps(aArrays[4] + first);
+        __m256 extentZ = _mm256_loadu_ps(aArrays[5] + first);
+        __m256 radius = _mm256_loadu_ps(aArrays[6] + first);
+
+        __m256 isVisible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (UINT32 i = 0; i < 6; ++i)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[i], centerX), _mm256_mul_ps(planeY[i], centerY)), _mm256_add_ps(_mm256_mul_ps(planeZ[i], centerZ), planeW[i]));
+            __m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absPlaneX[i], extentX), _mm256_mul_ps(absPlaneY[i], extentY)), _mm256_mul_ps(absPlaneZ[i], extentZ));
+            __m256 reach = _mm256_add_ps(distance, _mm256_min_ps(boxRadius, radius));
+            isVisible = _mm256_and_ps(isVisible, _mm256_cmp_ps(reach, zero, _CMP_GE_OQ));
+        }
+
+        aOutput = WriteVisibleIndices(_mm256_movemask_ps(isVisible), first, aCount, aOutput);
+    }
+    return aOutput;
+}
+
+void FrustumCulling::Cull(const Frustum& aFrustum, const BoundsList& aBounds, std::vector<UINT32>& aVisibleIndices)
+{
+    static const bool sHasAvx = Utility::HasAvx();
+
+    const float* arrays[] = {
+        aBounds.mCenterX.data(), aBounds.mCenterY.data(), aBounds.mCenterZ.data(),
+        aBounds.mExtentX.data(), aBounds.mExtentY.data(), aBounds.mExtentZ.data(),
+        aBounds.mRadius.data()
+    };
+
+    aVisibleIndices.resize(aBounds.mCount);
+    UINT32* end = sHasAvx ? CullAvx(aFrustum, arrays, aBounds.mCount, aVisibleIndices.data()) : CullSse(aFrustum, arrays, aBounds.mCount, aVisibleIndices.data());
+    aVisibleIndices.resize(end - aVisibleIndices.data());
+}
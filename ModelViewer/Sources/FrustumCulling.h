@@ -0,0 +1,50 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// View frustum culling of many bounds at once. Bounds are kept in structure-of-arrays layout, so the kernel tests
+// 8 bounds per plane with AVX, or 4 with SSE when the CPU has no AVX, instead of one bound per plane.
+namespace FrustumCulling
+{
+    // Six planes with normalized normals pointing inwards, ax + by + cz + d >= 0 inside. Left, right, bottom, top,
+    // near, far.
+    struct Frustum
+    {
+        DirectX::XMFLOAT4 Planes[6];
+    };
+
+    // Planes of the space that aViewProjection transforms to clip space, for the row-vector DirectXMath convention
+    // and D3D depth in [0, 1]. Passing the MVP gives the frustum in the object space of the model.
+    Frustum ExtractFrustum(DirectX::FXMMATRIX aViewProjection);
+
+    // Each bound is an AABB given by center and extents together with a bounding sphere around the same center. The
+    // kernel uses the tighter of the two against every plane. Arrays are padded to a multiple of the widest SIMD
+    // width, padding lanes are never reported.
+    class BoundsList
+    {
+        static constexpr UINT32 sPadding = 8;
+
+        std::vector<float> mCenterX;
+        std::vector<float> mCenterY;
+        std::vector<float> mCenterZ;
+        std::vector<float> mExtentX;
+        std::vector<float> mExtentY;
+        std::vector<float> mExtentZ;
+        std::vector<float> mRadius;
+        UINT32 mCount = 0;
+
+        friend void Cull(const Frustum& aFrustum, const BoundsList& aBounds, std::vector<UINT32>& aVisibleIndices);
+
+    public:
+        void Clear();
+        void Add(const DirectX::XMFLOAT3& aCenter, const DirectX::XMFLOAT3& aExtents, float aRadius);
+        UINT32 GetCount() const { return mCount; }
+        DirectX::XMFLOAT3 GetCenter(UINT32 aIndex) const { return DirectX::XMFLOAT3(mCenterX[aIndex], mCenterY[aIndex], mCenterZ[aIndex]); }
+        DirectX::XMFLOAT3 GetExtents(UINT32 aIndex) const { return DirectX::XMFLOAT3(mExtentX[aIndex], mExtentY[aIndex], mExtentZ[aIndex]); }
+        float GetRadius(UINT32 aIndex) const { return mRadius[aIndex]; }
+    };
+
+    // Replaces aVisibleIndices with the indices of the bounds that intersect the frustum, in ascending order. The
+    // test is conservative, bounds near the frustum corners can be reported visible although they are outside.
+    void Cull(const Frustum& aFrustum, const BoundsList& aBounds, std::vector<UINT32>& aVisibleIndices);
+}
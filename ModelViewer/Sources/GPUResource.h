@@ -1,6 +1,7 @@
 #pragma once
 
 #include "pch.h"
+#include "Residency.h"
 
 class GpuResource
 {
@@ -22,14 +23,52 @@ public:
     {
     }
 
+    // Resources are moved, not copied, so only one object removes the resource from Residency.
+    GpuResource(GpuResource&& aOther) noexcept :
+        m_pResource(std::move(aOther.m_pResource)),
+        m_UsageState(aOther.m_UsageState),
+        m_TransitioningState(aOther.m_TransitioningState),
+        m_GpuVirtualAddress(aOther.m_GpuVirtualAddress),
+        mFormat(aOther.mFormat),
+        mResidencyHandle(aOther.mResidencyHandle)
+    {
+        aOther.m_GpuVirtualAddress = D3D12_GPU_VIRTUAL_ADDRESS_NULL;
+        aOther.mResidencyHandle = Residency::sInvalidHandle;
+    }
+
+    GpuResource& operator=(GpuResource&& aOther) noexcept
+    {
+        if (this != &aOther)
+        {
+            GpuResource::Destroy();
+            m_pResource = std::move(aOther.m_pResource);
+            m_UsageState = aOther.m_UsageState;
+            m_TransitioningState = aOther.m_TransitioningState;
+            m_GpuVirtualAddress = aOther.m_GpuVirtualAddress;
+            mFormat = aOther.mFormat;
+            mResidencyHandle = aOther.mResidencyHandle;
+            aOther.m_GpuVirtualAddress = D3D12_GPU_VIRTUAL_ADDRESS_NULL;
+            aOther.mResidencyHandle = Residency::sInvalidHandle;
+        }
+        return *this;
+    }
+
+    GpuResource(const GpuResource&) = delete;
+    GpuResource& operator=(const GpuResource&) = delete;
+
     ~GpuResource() { Destroy(); }
 
     virtual void Destroy()
     {
+        Residency::Remove(mResidencyHandle);
+        mResidencyHandle = Residency::sInvalidHandle;
         m_pResource = nullptr;
         m_GpuVirtualAddress = D3D12_GPU_VIRTUAL_ADDRESS_NULL;
     }
 
+    // Tells Residency that the current frame uses this resource, see Residency::MarkUsed.
+    void MarkUsed() const { Residency::MarkUsed(mResidencyHandle); }
+
     ID3D12Resource* operator->() { return m_pResource.Get(); }
     const ID3D12Resource* operator->() const { return m_pResource.Get(); }
 
@@ -46,10 +85,13 @@ public:
     virtual void CreateUAV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescriptorHeap, UINT offset) const {}
 
 protected:
+    // Derived classes call this once their committed resource exists, aSizeInBytes is counted if there is none.
+    void TrackResidency(UINT64 aSizeInBytes) { mResidencyHandle = Residency::Add(m_pResource.Get(), aSizeInBytes); }
 
     Microsoft::WRL::ComPtr<ID3D12Resource> m_pResource;
     D3D12_RESOURCE_STATES m_UsageState;
     D3D12_RESOURCE_STATES m_TransitioningState;
     D3D12_GPU_VIRTUAL_ADDRESS m_GpuVirtualAddress;
     DXGI_FORMAT mFormat;
+    UINT32 mResidencyHandle = Residency::sInvalidHandle;
 };
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "GeometryArena.h"
+#include "Buffer.h"
+#include "UploadBatch.h"
+#include "Utility.h"
+#include <deque>
+
+namespace GeometryArena
+{
+    struct Page
+    {
+        Buffer Resource;
+        RangeAllocator Allocator;
+    };
+
+    // A released range, kept allocated until frames that may still draw from it have finished.
+    struct PendingFree
+    {
+        Pool RangePool = Pool::Vertices;
+        UINT32 PageIndex = 0;
+        UINT64 Offset = 0;
+        UINT64 SizeInBytes = 0;
+        UINT64 Frame = 0;       // the first frame it can be reused in
+    };
+
+    static std::vector<Page> sPages[2];
+    static std::deque<PendingFree> sPendingFrees;
+    static UINT64 sFrame = 0;
+
+    static std::vector<Page>& GetPages(Pool aPool)
+    {
+        return sPages[static_cast<size_t>(aPool)];
+    }
+
+    Allocation::Allocation(Pool aPool, UINT32 aPage, UINT64 aOffset, UINT64 aSizeInBytes)
+        : mPool(aPool)
+        , mPage(aPage)
+        , mOffset(aOffset)
+        , mSizeInBytes(aSizeInBytes)
+    {
+    }
+
+    Allocation::Allocation(Allocation&& aOther) noexcept
+        : mPool(aOther.mPool)
+        , mPage(aOther.mPage)
+        , mOffset(aOther.mOffset)
+        , mSizeInBytes(aOther.mSizeInBytes)
+    {
+        aOther.mPage = UINT32_MAX;
+    }
+
+    Allocation& Allocation::operator=(Allocation&& aOther) noexcept
+    {
+        if (this != &aOther)
+        {
+            Release();
+            mPool = aOther.mPool;
+            mPage = aOther.mPage;
+            mOffset = aOther.mOffset;
+            mSizeInBytes = aOther.mSizeInBytes;
+            aOther.mPage = UINT32_MAX;
+        }
+        return *this;
+    }
+
+    void Allocation::Release()
+    {
+        if (IsValid())
+        {
+            sPendingFrees.push_back({ mPool, mPage, mOffset, mSizeInBytes, sFrame + Graphics::g_SwapChainBufferCount });
+            mPage = UINT32_MAX;
+        }
+    }
+
+    D3D12_GPU_VIRTUAL_ADDRESS Allocation::GetPageGpuVirtualAddress() const
+    {
+        return GetPages(mPool)[mPage].Resource.GetGpuVirtualAddress();
+    }
+
+    ID3D12Resource* Allocation::GetPageResource() const
+    {
+        return GetPages(mPool)[mPage].Resource.GetResource();
+    }
+
+    UINT64 Allocation::GetPageSizeInBytes() const
+    {
+        return GetPages(mPool)[mPage].Resource.GetSizeInBytes();
+    }
+
+    void Allocation::MarkPageUsed() const
+    {
+        GetPages(mPool)[mPage].Resource.MarkUsed();
+    }
+
+    Allocation Allocate(Pool aPool, UINT64 aSizeInBytes, UINT64 aAlignment)
+    {
+        std::vector<Page>& pages = GetPages(aPool);
+        for (UINT32 i = 0; i < pages.size(); ++i)
+        {
+            UINT64 offset = pages[i].Allocator.Allocate(aSizeInBytes, aAlignment);
+            if (offset != RangeAllocator::sInvalidOffset)
+            {
+                return Allocation(aPool, i, offset, aSizeInBytes);
+            }
+        }
+
+        // Buffers decay to COMMON after every ExecuteCommandLists and are promoted implicitly to COPY_DEST for
+        // uploads and to the vertex or index buffer state for draws, so the pages never need barriers.
+        UINT64 pageSize = std::max(sPageSize, aSizeInBytes);
+        const wchar_t* name = aPool == Pool::Vertices ? L"Vertex page" : L"Index page";
+        pages.push_back({ Buffer(name, pageSize, 1), RangeAllocator(pageSize) });
+
+        UINT64 offset = pages.back().Allocator.Allocate(aSizeInBytes, aAlignment);
+        ASSERT(offset != RangeAllocator::sInvalidOffset, "New geometry page is too small.");
+        return Allocation(aPool, static_cast<UINT32>(pages.size() - 1), offset, aSizeInBytes);
+    }
+
+    void Upload(const Allocation& aAllocation, const void* aData, UploadBatch& aUploadBatch)
+    {
+        ASSERT(aAllocation.IsValid(), "Upload to an invalid geometry allocation.");
+        aAllocation.MarkPageUsed();
+        aUploadBatch.UploadBuffer(aAllocation.GetPageResource(), aData, aAllocation.GetSizeInBytes(), aAllocation.GetOffset());
+    }
+
+    void Update()
+    {
+        ++sFrame;
+        while (!sPendingFrees.empty() && sPendingFrees.front().Frame <= sFrame)
+        {
+            const PendingFree& pendingFree = sPendingFrees.front();
+            GetPages(pendingFree.RangePool)[pendingFree.PageIndex].Allocator.Free(pendingFree.Offset, pendingFree.SizeInBytes);
+            sPendingFrees.pop_front();
+        }
+    }
+
+    void Shutdown()
+    {
+        for (const PendingFree& pendingFree : sPendingFrees)
+        {
+            GetPages(pendingFree.RangePool)[pendingFree.PageIndex].Allocator.Free(pendingFree.Offset, pendingFree.SizeInBytes);
+        }
+        sPendingFrees.clear();
+
+        for (Pool pool : { Pool::Vertices, Pool::Indices })
+        {
+            for (const Page& page : GetPages(pool))
+            {
+                ASSERT(page.Allocator.GetFreeSizeInBytes() == page.Allocator.GetSizeInBytes(), "Geometry arena shut down with live allocations.");
+            }
+            GetPages(pool).clear();
+        }
+    }
+
+    void PrintStatistics()
+    {
+        for (Pool pool : { Pool::Vertices, Pool::Indices })
+        {
+            UINT64 sizeInBytes = 0, freeSizeInBytes = 0, freeRangesCount = 0;
+            for (const Page& page : GetPages(pool))
+            {
+                sizeInBytes += page.Allocator.GetSizeInBytes();
+                freeSizeInBytes += page.Allocator.GetFreeSizeInBytes();
+                freeRangesCount += page.Allocator.GetFreeRangesCount();
+            }
+
+            Utility::Printf("Geometry arena %s: %zu pages, %.1f MB used of %.1f MB, %llu free ranges", pool == Pool::Vertices ? "vertices" : "indices",
+                GetPages(pool).size(), (sizeInBytes - freeSizeInBytes) / (1024.0 * 1024.0), sizeInBytes / (1024.0 * 1024.0), freeRangesCount);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "RangeAllocator.h"
+
+class UploadBatch;
+
+// Shared vertex and index memory for all meshes. Each pool is a list of large pages (one committed buffer each)
+// and meshes get ranges of a page from a RangeAllocator, so hundreds of meshes need a handful of resources and
+// consecutive draws usually keep the same vertex and index buffer bound. Freed ranges are reused only after
+// Graphics::g_SwapChainBufferCount frames, when no frame in flight can still draw from them. Render thread only.
+namespace GeometryArena
+{
+    static constexpr UINT64 sPageSize = 64ull * 1024 * 1024;
+
+    enum class Pool
+    {
+        Vertices,
+        Indices
+    };
+
+    // A range of a page, queued to be freed when it is destroyed. Draws address it with
+    // BaseVertexLocation/StartIndexLocation relative to the start of the page.
+    class Allocation
+    {
+        Pool mPool = Pool::Vertices;
+        UINT32 mPage = UINT32_MAX;
+        UINT64 mOffset = 0;
+        UINT64 mSizeInBytes = 0;
+
+    public:
+        Allocation() {}
+        Allocation(Pool aPool, UINT32 aPage, UINT64 aOffset, UINT64 aSizeInBytes);
+        Allocation(Allocation&& aOther) noexcept;
+        Allocation& operator=(Allocation&& aOther) noexcept;
+        Allocation(const Allocation&) = delete;
+        Allocation& operator=(const Allocation&) = delete;
+        ~Allocation() { Release(); }
+
+        void Release();
+
+        bool IsValid() const { return mPage != UINT32_MAX; }
+        UINT64 GetOffset() const { return mOffset; }
+        UINT64 GetSizeInBytes() const { return mSizeInBytes; }
+        ID3D12Resource* GetPageResource() const;
+        D3D12_GPU_VIRTUAL_ADDRESS GetPageGpuVirtualAddress() const;
+        UINT64 GetPageSizeInBytes() const;
+        // Marks the page for Residency, draws use the whole page.
+        void MarkPageUsed() const;
+    };
+
+    // aAlignment is the element size, so the offset divided by it is a valid base vertex or start index.
+    Allocation Allocate(Pool aPool, UINT64 aSizeInBytes, UINT64 aAlignment);
+    void Upload(const Allocation& aAllocation, const void* aData, UploadBatch& aUploadBatch);
+
+    // Once per frame, frees the ranges released g_SwapChainBufferCount frames ago.
+    void Update();
+    // Frees every queued range and releases the pages. The owner of the application calls it before the device goes
+    // away, after every allocation was destroyed.
+    void Shutdown();
+
+    void PrintStatistics();
+}
@@ -1,9 +1,12 @@
 #include "pch.h"
 #include "Graphics.h"
 #include "Application.h"
+#include "D3D12Backend.h"
+#include "NullBackend.h"
 #include "Utility.h"
 #include "dxgidebug.h"
 #include <chrono>
+#include <memory>
 
 #if _DEBUG
 #include <filesystem>
@@ -26,6 +29,7 @@ namespace Graphics
     Microsoft::WRL::ComPtr<ID3D12CommandQueue> g_GraphicsCommandQueue = nullptr;
     Microsoft::WRL::ComPtr<ID3D12CommandQueue> g_ComputeCommandQueue = nullptr;
     Microsoft::WRL::ComPtr<IDXGISwapChain3> g_SwapChain3;
+    Microsoft::WRL::ComPtr<IDXGIAdapter3> g_Adapter3;
     UINT g_RtvDescriptorSize = 0;
     UINT g_SRVDescriptorSize = 0;
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> g_RTVDescriptorHeap = nullptr;
@@ -41,6 +45,9 @@ namespace Graphics
     Microsoft::WRL::ComPtr<ID3D12Fence> g_Fence = nullptr;
     HANDLE g_FenceEvent = nullptr;
     uint64_t g_FenceValue = 0;
+    bool g_IsNullBackend = false;
+    std::unique_ptr<IGraphicsBackend> g_Backend;
+    BackendStatistics g_BackendStatistics;
     //uint64_t g_FrameFenceValues[g_SwapChainBufferCount] = {};
 	
 
@@ -221,12 +228,20 @@ namespace Graphics
 
     uint64_t Signal(Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue)
     {
+        if (g_IsNullBackend)
+        {
+            return ++g_FenceValue;
+        }
         ASSERT_HRESULT(commandQueue->Signal(g_Fence.Get(), ++g_FenceValue), "Error: ID3D12CommandQueue::Signal");
         return g_FenceValue;
     }
 
     void WaitForFenceValue()
     {
+        if (g_IsNullBackend)
+        {
+            return;
+        }
         if (g_Fence->GetCompletedValue() < g_FenceValue)
         {
             ASSERT_HRESULT(g_Fence->SetEventOnCompletion(g_FenceValue, g_FenceEvent), "Error: ID3D12Fence::SetEventOnCompletion");
@@ -347,14 +362,15 @@ namespace Graphics
 
         if (selectedDeviceIndex != UINT32_MAX)
         {
-            Microsoft::WRL::ComPtr<IDXGIAdapter3> pAdapter3;
-            if (SUCCEEDED(dxgiFactory->EnumAdapters1(selectedDeviceIndex, &pAdapter)) && SUCCEEDED(pAdapter.As(&pAdapter3)))
+            // The adapter is kept for the budget queries of Residency.
+            if (SUCCEEDED(dxgiFactory->EnumAdapters1(selectedDeviceIndex, &pAdapter)) && SUCCEEDED(pAdapter.As(&g_Adapter3)))
             {
-				// Get video memory info for both local and non-local memory segments.  This is useful for understanding the memory budget of the system and how much memory is currently being used by the application.
                 DXGI_QUERY_VIDEO_MEMORY_INFO localGroupMemoryInfo;
                 DXGI_QUERY_VIDEO_MEMORY_INFO nonLocalGroupMemoryInfo;
-                pAdapter3->QueryVideoMemoryInfo(selectedDeviceIndex, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &localGroupMemoryInfo);
-                pAdapter3->QueryVideoMemoryInfo(selectedDeviceIndex, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, &nonLocalGroupMemoryInfo);
+                if (QueryVideoMemoryInfo(DXGI_MEMORY_SEGMENT_GROUP_LOCAL, localGroupMemoryInfo) && QueryVideoMemoryInfo(DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, nonLocalGroupMemoryInfo))
+                {
+                    Utility::Printf(L"Video memory budget: %llu MB local, %llu MB non-local\n", localGroupMemoryInfo.Budget >> 20, nonLocalGroupMemoryInfo.Budget >> 20);
+                }
             }
         }
 
@@ -469,6 +485,8 @@ namespace Graphics
             }
         }
 
+        g_Backend = std::make_unique<D3D12Backend>(g_Device);
+
         //Create the command queue
         {
             D3D12_COMMAND_QUEUE_DESC queueDesc = {};
@@ -597,14 +615,50 @@ namespace Graphics
         ResizeDepthBuffer(g_DisplayWidth, g_DisplayHeight);
     }
 
+    void InitializeNull(void)
+    {
+        g_IsNullBackend = true;
+        g_Backend = std::make_unique<NullBackend>();
+        g_CurrentBackBufferIndex = 0;
+
+        // Stand-in heaps, so the views of the back buffer and the depth buffer are taken like with a device.
+        D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = { D3D12_DESCRIPTOR_HEAP_TYPE_RTV, g_SwapChainBufferCount, D3D12_DESCRIPTOR_HEAP_FLAG_NONE, 0 };
+        g_Backend->CreateDescriptorHeap(rtvHeapDesc, g_RTVDescriptorHeap);
+        D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc = { D3D12_DESCRIPTOR_HEAP_TYPE_DSV, 1, D3D12_DESCRIPTOR_HEAP_FLAG_NONE, 0 };
+        g_Backend->CreateDescriptorHeap(dsvHeapDesc, g_DSVDescriptorHeap);
+
+        Utility::Print("Null graphics backend initialized, nothing is rendered.\n");
+    }
+
+    bool QueryVideoMemoryInfo(DXGI_MEMORY_SEGMENT_GROUP aSegmentGroup, DXGI_QUERY_VIDEO_MEMORY_INFO& aInfo)
+    {
+        // Node 0, the application runs on a single GPU.
+        return g_Adapter3 && SUCCEEDED(g_Adapter3->QueryVideoMemoryInfo(0, aSegmentGroup, &aInfo));
+    }
+
+    IGraphicsBackend& GetBackend(void)
+    {
+        return *g_Backend;
+    }
+
     void Resize(int width, int height)
     {
+        if (g_IsNullBackend)
+        {
+            return;
+        }
+
         Flush();
         ResizeDepthBuffer(width, height);
     }
 
     void Shutdown(void)
     {
+        if (g_IsNullBackend)
+        {
+            return;
+        }
+
         Flush();
 
         ::CloseHandle(g_FenceEvent);
@@ -619,6 +673,8 @@ namespace Graphics
         g_GraphicsCommandList.Reset();
         g_ComputeCommandList.Reset();
         g_Fence.Reset();
+        g_Adapter3.Reset();
+        g_Backend.reset();
         g_Device.Reset();
 
 #if _DEBUG
@@ -632,6 +688,12 @@ namespace Graphics
 
     void Present(void)
     {
+        if (g_IsNullBackend)
+        {
+            g_CurrentBackBufferIndex = (g_CurrentBackBufferIndex + 1) % g_SwapChainBufferCount;
+            return;
+        }
+
         UINT syncInterval = g_VSync ? 1 : 0;
         UINT presentFlags = g_TearingSupported && !g_VSync ? DXGI_PRESENT_ALLOW_TEARING : 0;
         ASSERT_HRESULT(g_SwapChain3->Present(syncInterval, presentFlags), "Error: IDXGISwapChain3::Present");
@@ -1,8 +1,19 @@
 #pragma once
 
+#include "GraphicsBackend.h"
+#include <atomic>
+
 namespace Graphics
 {
     void Initialize(void);
+    // Null backend for headless runs: no device, window or swap chain is created, see NullBackend. Command lists only
+    // count their commands and Present, Signal and Flush return immediately, so the CPU side of a frame can be
+    // profiled without a GPU.
+    void InitializeNull(void);
+    // The backend Initialize or InitializeNull created.
+    IGraphicsBackend& GetBackend(void);
+    // Budget and usage of the process in a memory segment group of the adapter, false without an adapter.
+    bool QueryVideoMemoryInfo(DXGI_MEMORY_SEGMENT_GROUP aSegmentGroup, DXGI_QUERY_VIDEO_MEMORY_INFO& aInfo);
     void Shutdown(void);
     void Present(void);
     uint64_t Signal(Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue);
@@ -31,6 +42,16 @@ namespace Graphics
     extern Microsoft::WRL::ComPtr<ID3D12CommandAllocator> g_ComputeCommandAllocators[g_SwapChainBufferCount];
     extern Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> g_GraphicsCommandList;
     extern Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> g_ComputeCommandList;
+
+    // Counted by both backends, resources and uploads from loader threads too.
+    struct BackendStatistics
+    {
+        std::atomic<UINT64> ResourcesCount = 0;
+        std::atomic<UINT64> ResourcesBytes = 0;
+        std::atomic<UINT64> UploadedBytes = 0;
+        std::atomic<UINT64> Submits = 0;
+    };
+    extern BackendStatistics g_BackendStatistics;
 }
 
 
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <span>
+
+// Everything the renderer creates on the device and submits to its queues goes through the backend, see
+// Graphics::GetBackend. The D3D12 backend forwards to the device. The null backend of headless runs has no device:
+// its resources and descriptor heaps are CPU side stand-ins with a description, a fake GPU address and, in upload
+// heaps, memory to map, and its pipeline objects, heaps and command lists stay empty. CommandList only counts what is
+// recorded into an empty list, so the code on top of the backend is the same for both.
+class IGraphicsBackend
+{
+public:
+    virtual ~IGraphicsBackend() {}
+
+    virtual const char* GetName(void) const = 0;
+
+    // Resources. aResource is created in aInitialState, resources in upload heaps can be mapped.
+    virtual HRESULT CreateCommittedResource(D3D12_HEAP_TYPE aHeapType, const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, const D3D12_CLEAR_VALUE* aOptimizedClearValue, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource) = 0;
+    // Resource without memory, its tiles are mapped to heaps with UpdateTileMappings.
+    virtual HRESULT CreateReservedResource(const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource) = 0;
+    virtual HRESULT CreateHeap(const D3D12_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12Heap>& aHeap) = 0;
+    virtual UINT64 GetAllocationSize(const D3D12_RESOURCE_DESC& aDesc) = 0;
+    virtual void GetCopyableFootprints(const D3D12_RESOURCE_DESC& aDesc, UINT aFirstSubresource, UINT aSubresourcesCount, UINT64 aBaseOffset, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* aLayouts, UINT* aRowsCounts, UINT64* aRowSizesInBytes, UINT64* aTotalBytes) = 0;
+    // Tiling of the mips of the first array slice of a reserved resource, aSubresourceTilings has one entry per mip.
+    virtual void GetResourceTiling(ID3D12Resource* aResource, D3D12_PACKED_MIP_INFO& aPackedMipInfo, std::span<D3D12_SUBRESOURCE_TILING> aSubresourceTilings) = 0;
+    virtual bool SupportsTiledResources(void) = 0;
+    virtual void MakeResident(std::span<ID3D12Pageable* const> aObjects) = 0;
+    virtual void Evict(std::span<ID3D12Pageable* const> aObjects) = 0;
+
+    // Pipeline objects and views.
+    virtual D3D_ROOT_SIGNATURE_VERSION GetHighestRootSignatureVersion(void) = 0;
+    virtual HRESULT CreateRootSignature(ID3DBlob* aBlob, Microsoft::WRL::ComPtr<ID3D12RootSignature>& aRootSignature) = 0;
+    virtual HRESULT CreatePipelineState(const D3D12_PIPELINE_STATE_STREAM_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12PipelineState>& aPipelineState) = 0;
+    virtual HRESULT CreateDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>& aHeap) = 0;
+    virtual void CreateShaderResourceView(ID3D12Resource* aResource, const D3D12_SHADER_RESOURCE_VIEW_DESC& aDesc, D3D12_CPU_DESCRIPTOR_HANDLE aDestination) = 0;
+    virtual void CreateUnorderedAccessView(ID3D12Resource* aResource, const D3D12_UNORDERED_ACCESS_VIEW_DESC& aDesc, D3D12_CPU_DESCRIPTOR_HANDLE aDestination) = 0;
+
+    // Submission. Lists are created closed.
+    virtual HRESULT CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE aType, Microsoft::WRL::ComPtr<ID3D12CommandAllocator>& aAllocator) = 0;
+    virtual HRESULT CreateCommandList(D3D12_COMMAND_LIST_TYPE aType, ID3D12CommandAllocator* aAllocator, Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& aList) = 0;
+    // aLists are the native lists of CommandList::GetNative, the null backend has none and executes nothing.
+    virtual void ExecuteCommandLists(ID3D12CommandQueue* aQueue, std::span<ID3D12CommandList* const> aLists) = 0;
+    // Maps aTilesCount tiles of aResource from the start of aSubresource on to the start of aHeap, or unmaps them
+    // without a heap. The mapping happens on aQueue, after the work that was submitted to it before.
+    virtual void UpdateTileMappings(ID3D12CommandQueue* aQueue, ID3D12Resource* aResource, UINT aSubresource, UINT aTilesCount, ID3D12Heap* aHeap) = 0;
+};
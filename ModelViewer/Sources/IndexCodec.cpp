@@ -0,0 +1,232 @@
+#include "pch.h"
+#include "IndexCodec.h"
+#include "Utility.h"
+#include <algorithm>
+
+static constexpr UINT32 sEdgeFifoSize = 16;
+static constexpr UINT32 sNoVertex = UINT32_MAX;
+static constexpr BYTE sSharedEdgeBit = 1 << 3;
+
+// Stores the edges of the recent triangles reversed, a neighbor with the same winding walks them the other way.
+class EdgeFifo
+{
+    UINT32 mEdges[sEdgeFifoSize][2];
+    UINT32 mHead = 0;
+
+public:
+    EdgeFifo()
+    {
+        for (auto& edge : mEdges)
+        {
+            edge[0] = edge[1] = sNoVertex;
+        }
+    }
+
+    int Find(UINT32 a, UINT32 b) const
+    {
+        for (UINT32 i = 0; i < sEdgeFifoSize; ++i)
+        {
+            UINT32 slot = (mHead + sEdgeFifoSize - 1 - i) % sEdgeFifoSize;
+            if (mEdges[slot][0] == a && mEdges[slot][1] == b)
+            {
+                return static_cast<int>(slot);
+            }
+        }
+        return -1;
+    }
+
+    const UINT32* Get(UINT32 aSlot) const { return mEdges[aSlot]; }
+
+    void PushTriangle(UINT32 a, UINT32 b, UINT32 c)
+    {
+        Push(b, a);
+        Push(c, b);
+        Push(a, c);
+    }
+
+private:
+    void Push(UINT32 a, UINT32 b)
+    {
+        mEdges[mHead][0] = a;
+        mEdges[mHead][1] = b;
+        mHead = (mHead + 1) % sEdgeFifoSize;
+    }
+};
+
+static void WriteVarint(std::vector<BYTE>& aData, UINT64 aValue)
+{
+    while (aValue >= 0x80)
+    {
+        aData.push_back(static_cast<BYTE>(aValue | 0x80));
+        aValue >>= 7;
+    }
+    aData.push_back(static_cast<BYTE>(aValue));
+}
+
+static bool ReadVarint(std::span<const BYTE> aData, size_t& aOffset, UINT64& aValue)
+{
+    aValue = 0;
+    for (UINT32 shift = 0; shift < 64; shift += 7)
+    {
+        if (aOffset >= aData.size())
+        {
+            return false;
+        }
+
+        BYTE byte = aData[aOffset++];
+        aValue |= static_cast<UINT64>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<BYTE> IndexCodec::Encode(std::span<const UINT32> aIndices)
+{
+    ASSERT(aIndices.size() % 3 == 0, "Only triangle lists can be encoded.");
+
+    std::vector<BYTE> data;
+    data.reserve(aIndices.size());
+
+    EdgeFifo edges;
+    UINT32 nextVertex = 0;
+    UINT32 lastVertex = 0;
+
+    auto encodeVertex = [&](UINT32 aVertex, UINT32 aBit, BYTE& aCode)
+    {
+        if (aVertex == nextVertex)
+        {
+            ++nextVertex;
+        }
+        else
+        {
+            aCode |= 1 << aBit;
+            INT64 delta = static_cast<INT64>(aVertex) - static_cast<INT64>(lastVertex);
+            WriteVarint(data, (static_cast<UINT64>(delta) << 1) ^ static_cast<UINT64>(delta >> 63));
+            nextVertex = std::max(nextVertex, aVertex + 1);
+        }
+        lastVertex = aVertex;
+    };
+
+    for (size_t i = 0; i < aIndices.size(); i += 3)
+    {
+        UINT32 triangle[3] = { aIndices[i], aIndices[i + 1], aIndices[i + 2] };
+
+        int slot = -1;
+        for (UINT32 rotation = 0; rotation < 3 && slot < 0; ++rotation)
+        {
+            slot = edges.Find(triangle[0], triangle[1]);
+            if (slot < 0)
+            {
+                std::rotate(triangle, triangle + 1, triangle + 3);
+            }
+        }
+
+        size_t codeOffset = data.size();
+        data.push_back(0);
+
+        BYTE code = 0;
+        if (slot >= 0)
+        {
+            code = static_cast<BYTE>(slot << 4) | sSharedEdgeBit;
+            encodeVertex(triangle[2], 0, code);
+        }
+        else
+        {
+            encodeVertex(triangle[0], 0, code);
+            encodeVertex(triangle[1], 1, code);
+            encodeVertex(triangle[2], 2, code);
+        }
+        data[codeOffset] = code;
+
+        edges.PushTriangle(triangle[0], triangle[1], triangle[2]);
+    }
+
+    return data;
+}
+
+template<typename Index>
+static bool DecodeIndices(std::span<const BYTE> aData, std::span<Index> aIndices, size_t aVerticesCount)
+{
+    if (aIndices.size() % 3 != 0)
+    {
+        return false;
+    }
+
+    EdgeFifo edges;
+    UINT32 nextVertex = 0;
+    UINT32 lastVertex = 0;
+    size_t offset = 0;
+
+    auto decodeVertex = [&](BYTE aCode, UINT32 aBit, UINT32& aVertex)
+    {
+        if ((aCode & (1 << aBit)) == 0)
+        {
+            aVertex = nextVertex++;
+        }
+        else
+        {
+            UINT64 value;
+            if (!ReadVarint(aData, offset, value))
+            {
+                return false;
+            }
+
+            INT64 delta = static_cast<INT64>(value >> 1) ^ -static_cast<INT64>(value & 1);
+            aVertex = static_cast<UINT32>(lastVertex + delta);
+            nextVertex = std::max(nextVertex, aVertex + 1);
+        }
+        lastVertex = aVertex;
+        return aVertex < aVerticesCount;
+    };
+
+    for (size_t i = 0; i < aIndices.size(); i += 3)
+    {
+        if (offset >= aData.size())
+        {
+            return false;
+        }
+
+        BYTE code = aData[offset++];
+        UINT32 triangle[3];
+        if (code & sSharedEdgeBit)
+        {
+            const UINT32* edge = edges.Get(code >> 4);
+            if (edge[0] == sNoVertex)
+            {
+                return false;
+            }
+
+            triangle[0] = edge[0];
+            triangle[1] = edge[1];
+            if (!decodeVertex(code, 0, triangle[2]))
+            {
+                return false;
+            }
+        }
+        else if (!decodeVertex(code, 0, triangle[0]) || !decodeVertex(code, 1, triangle[1]) || !decodeVertex(code, 2, triangle[2]))
+        {
+            return false;
+        }
+
+        aIndices[i] = static_cast<Index>(triangle[0]);
+        aIndices[i + 1] = static_cast<Index>(triangle[1]);
+        aIndices[i + 2] = static_cast<Index>(triangle[2]);
+        edges.PushTriangle(triangle[0], triangle[1], triangle[2]);
+    }
+
+    return offset == aData.size();
+}
+
+bool IndexCodec::Decode(std::span<const BYTE> aData, std::span<UINT32> aIndices, size_t aVerticesCount)
+{
+    return DecodeIndices(aData, aIndices, aVerticesCount);
+}
+
+bool IndexCodec::Decode(std::span<const BYTE> aData, std::span<UINT16> aIndices, size_t aVerticesCount)
+{
+    ASSERT(aVerticesCount <= 0x10000, "16-bit indices cannot address all vertices.");
+    return DecodeIndices(aData, aIndices, aVerticesCount);
+}
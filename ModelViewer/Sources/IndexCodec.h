@@ -0,0 +1,21 @@
+#pragma once
+
+#include <span>
+
+// Compact encoding of triangle lists for the mesh cache. It works best on index buffers that went through
+// MeshOptimizer, where new vertices show up in increasing order and consecutive triangles share edges.
+//
+// Every triangle starts with a code byte. Bit 3 is set if the triangle shares an edge with one of the 16 most
+// recently emitted edges, and the high nibble is then the slot of that edge in the edge FIFO. Bits 0-2 have one
+// bit per vertex that is not covered by the edge: the bit is clear if the vertex is the next unused one (the
+// highest index so far + 1), otherwise a zigzag varint delta from the previously encoded vertex follows.
+// Triangles are rotated to start with the shared edge, so decoded triangles keep their winding but may start
+// with a different vertex.
+namespace IndexCodec
+{
+    std::vector<BYTE> Encode(std::span<const UINT32> aIndices);
+
+    // Returns false if the data is malformed or references a vertex outside aVerticesCount.
+    bool Decode(std::span<const BYTE> aData, std::span<UINT32> aIndices, size_t aVerticesCount);
+    bool Decode(std::span<const BYTE> aData, std::span<UINT16> aIndices, size_t aVerticesCount);
+}
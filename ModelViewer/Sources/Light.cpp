@@ -3,6 +3,7 @@
 #include "Utility.h"
 #include "Buffer.h"
 #include "Material.h"
+#include "CommandList.h"
 
 static std::vector<Light> gLights;
 
@@ -68,16 +69,13 @@ namespace Lightning
 
     void Startup()
     {
+        InitLights();
+
+        mLightsStructuredBuffer = Buffer(L"Lights Structured Buffer", GetLightsCount(), sizeof(Light), gLights.data(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
         Microsoft::WRL::ComPtr<ID3DBlob> computeShaderBlob;
         ASSERT_HRESULT(D3DReadFileToBlob(L"ComputeLightInVS.cso", &computeShaderBlob), "Compute shader compilation failed");
 
-        D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
-        featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
-        if (FAILED(Graphics::g_Device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
-        {
-            featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
-        }
-
         CD3DX12_DESCRIPTOR_RANGE1 ranges[1];
         ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE);
 
@@ -90,10 +88,10 @@ namespace Lightning
 
         Microsoft::WRL::ComPtr<ID3DBlob> rootSignatureBlob;
         Microsoft::WRL::ComPtr<ID3DBlob> errorBlob;
-        ASSERT_HRESULT(D3DX12SerializeVersionedRootSignature(&rootSignatureDescription, featureData.HighestVersion, &rootSignatureBlob, &errorBlob), "Failed to serialize versioned root signature.");
+        ASSERT_HRESULT(D3DX12SerializeVersionedRootSignature(&rootSignatureDescription, Graphics::GetBackend().GetHighestRootSignatureVersion(), &rootSignatureBlob, &errorBlob), "Failed to serialize versioned root signature.");
 
         // Create the root signature.
-        ASSERT_HRESULT(Graphics::g_Device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(), rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&g_RootSignature)), "Failed to create root signature.");
+        ASSERT_HRESULT(Graphics::GetBackend().CreateRootSignature(rootSignatureBlob.Get(), g_RootSignature), "Failed to create root signature.");
 
         struct PipelineStateStream
         {
@@ -108,45 +106,40 @@ namespace Lightning
         sizeof(PipelineStateStream), &pipelineStateStream
         };
 
-        Microsoft::WRL::ComPtr<ID3D12Device2> device2;
-        ASSERT_HRESULT(Graphics::g_Device.As<ID3D12Device2>(&device2), "Failed to receive ID3D12Device2 form ID3D12Device.");
-        ASSERT_HRESULT(device2->CreatePipelineState(&pipelineStateStreamDesc, IID_PPV_ARGS(&g_PipelineState)), "Failed to create pipline state object.");
-        
-        InitLights();
+        ASSERT_HRESULT(Graphics::GetBackend().CreatePipelineState(pipelineStateStreamDesc, g_PipelineState), "Failed to create pipline state object.");
 
-        mLightsStructuredBuffer = Buffer(L"Lights Structured Buffer", GetLightsCount(), sizeof(Light), gLights.data(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
-        mLightsStructuredBuffer.CreateSRV(Graphics::g_SRVDescriptorHeap, Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT);
-        mLightsStructuredBuffer.CreateUAV(Graphics::g_SRVDescriptorHeap, Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT + 1);
+        mLightsStructuredBuffer.CreateSRV(Graphics::g_SRVDescriptorHeap, MAX_MATERIALS_COUNT * MATERIAL_TEXTURES_COUNT);
+        mLightsStructuredBuffer.CreateUAV(Graphics::g_SRVDescriptorHeap, MAX_MATERIALS_COUNT * MATERIAL_TEXTURES_COUNT + 1);
     }
 
     void Update(const DirectX::XMMATRIX& MV)
     {
         g_CSLightRootConstants.LightsCount = GetLightsCount();
         g_CSLightRootConstants.MV = MV;
+        mLightsStructuredBuffer.MarkUsed();
 
-        Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator = Graphics::g_ComputeCommandAllocators[Graphics::g_CurrentBackBufferIndex];
-
-        commandAllocator->Reset();
-        Graphics::g_ComputeCommandList->Reset(commandAllocator.Get(), nullptr);
+        CommandList commandList(Graphics::g_ComputeCommandList.Get());
+        commandList.Reset(Graphics::g_ComputeCommandAllocators[Graphics::g_CurrentBackBufferIndex].Get());
 
-        Graphics::g_ComputeCommandList->SetPipelineState(g_PipelineState.Get());
-        Graphics::g_ComputeCommandList->SetComputeRootSignature(g_RootSignature.Get());
+        commandList.SetPipelineState(g_PipelineState.Get());
+        commandList.SetComputeRootSignature(g_RootSignature.Get());
 
-        Graphics::g_ComputeCommandList->SetComputeRoot32BitConstants(0, sizeof(CSLightRootConstants) / sizeof(float), &g_CSLightRootConstants, 0);
+        commandList.SetComputeRoot32BitConstants(0, sizeof(CSLightRootConstants) / sizeof(float), &g_CSLightRootConstants, 0);
 
         ID3D12DescriptorHeap* heaps[] = { Graphics::g_SRVDescriptorHeap.Get() };
-        Graphics::g_ComputeCommandList->SetDescriptorHeaps(1, heaps);
+        commandList.SetDescriptorHeaps(1, heaps);
 
         CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle;
-        srvHandle.InitOffsetted(Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), (Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT + 1) * Graphics::g_SRVDescriptorSize);
-        Graphics::g_ComputeCommandList->SetComputeRootDescriptorTable(1, srvHandle);
+        srvHandle.InitOffsetted(Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), (MAX_MATERIALS_COUNT * MATERIAL_TEXTURES_COUNT + 1) * Graphics::g_SRVDescriptorSize);
+        commandList.SetComputeRootDescriptorTable(1, srvHandle);
 
-        Graphics::g_ComputeCommandList->Dispatch(ceil(GetLightsCount() / 64.0), 1, 1);
+        commandList.Dispatch(ceil(GetLightsCount() / 64.0), 1, 1);
 
-        Graphics::g_ComputeCommandList->Close();
+        commandList.Close();
 
-        ID3D12CommandList* const commandLists[] = { Graphics::g_ComputeCommandList.Get() };
-        Graphics::g_ComputeCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
+        ID3D12CommandList* const commandLists[] = { commandList.GetNative() };
+        Graphics::GetBackend().ExecuteCommandLists(Graphics::g_ComputeCommandQueue.Get(), commandLists);
+        ++Graphics::g_BackendStatistics.Submits;
 
         Graphics::Signal(Graphics::g_ComputeCommandQueue);
         Graphics::WaitForFenceValue();
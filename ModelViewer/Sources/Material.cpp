@@ -1,20 +1,155 @@
 #include "pch.h"
 #include "Material.h"
 #include "Texture.h"
+#include "VirtualTexturing.h"
+#include "Utility.h"
 
 namespace Materials
 {
     static std::vector<Material> sMaterialRegister;
     static std::vector<MaterialParams> sMaterialParamsRegister;
+    static UINT64 sParamsVersion = 0;
 
-    void AddMaterial(MaterialParams&& aParams, std::vector<Texture*>&& aTextures, const char* aName)
+    using DescriptorTableViews = std::array<const Texture*, MATERIAL_TEXTURES_COUNT>;
+
+    struct DescriptorTable
+    {
+        DescriptorTableViews Views = {};
+        UINT32 MaterialsCount = 0;
+    };
+
+    static std::vector<DescriptorTable> sDescriptorTables;
+    static std::map<DescriptorTableViews, UINT32> sDescriptorTablesByViews;
+    static std::vector<UINT32> sFreeDescriptorTables;
+
+    // The texture whose view goes in every slot of the material, nullptr for an empty one. A virtual diffuse texture
+    // puts its atlas in the atlas slot, in other slots virtual textures stay unbound.
+    static DescriptorTableViews GetViews(MaterialID aMaterialID)
+    {
+        const std::vector<Texture*>& textures = sMaterialRegister[aMaterialID].mTextures;
+        Texture* diffuseTexture = textures[aiTextureType_DIFFUSE - 1];
+        DescriptorTableViews views = {};
+        for (unsigned int slot = 0; slot < textures.size(); ++slot)
+        {
+            Texture* texture = textures[slot];
+            if (slot == VIRTUAL_TEXTURE_ATLAS_SLOT && diffuseTexture && VirtualTexturing::IsVirtual(diffuseTexture))
+            {
+                views[slot] = diffuseTexture;
+            }
+            else if (texture && (slot == aiTextureType_DIFFUSE - 1 || !VirtualTexturing::IsVirtual(texture)))
+            {
+                views[slot] = texture->GetArrayTexture();
+            }
+        }
+        return views;
+    }
+
+    static void CreateDescriptorTableSRV(UINT32 aTable)
     {
+        // Applications that do not render, like the benchmark, have no SRV heap.
+        if (!Graphics::g_SRVDescriptorHeap)
+        {
+            return;
+        }
+
+        const DescriptorTableViews& views = sDescriptorTables[aTable].Views;
+        for (unsigned int slot = 0; slot < views.size(); ++slot)
+        {
+            UINT offset = aTable * MATERIAL_TEXTURES_COUNT + slot;
+            if (!views[slot])
+            {
+                Texture::CreateEmptySRV(Graphics::g_SRVDescriptorHeap, offset);
+            }
+            else if (slot == VIRTUAL_TEXTURE_ATLAS_SLOT && VirtualTexturing::IsVirtual(views[slot]))
+            {
+                VirtualTexturing::CreateAtlasSRV(views[slot], Graphics::g_SRVDescriptorHeap, offset);
+            }
+            else
+            {
+                views[slot]->CreateSRV(Graphics::g_SRVDescriptorHeap, offset);
+            }
+        }
+    }
+
+    // Moves the material to the table with its current views, the table is created if no other material has it. The
+    // render thread does this between frames, so a table that is reused or rewritten is not in flight.
+    static void UpdateDescriptorTable(MaterialID aMaterialID)
+    {
+        Material& material = sMaterialRegister[aMaterialID];
+        DescriptorTableViews views = GetViews(aMaterialID);
+        if (material.mDescriptorTable != UINT32_MAX)
+        {
+            DescriptorTable& table = sDescriptorTables[material.mDescriptorTable];
+            if (table.Views == views)
+            {
+                return;
+            }
+            if (--table.MaterialsCount == 0)
+            {
+                sDescriptorTablesByViews.erase(table.Views);
+                sFreeDescriptorTables.push_back(material.mDescriptorTable);
+            }
+        }
+
+        auto [found, isNew] = sDescriptorTablesByViews.try_emplace(views, static_cast<UINT32>(sDescriptorTables.size()));
+        if (isNew)
+        {
+            if (!sFreeDescriptorTables.empty())
+            {
+                found->second = sFreeDescriptorTables.back();
+                sFreeDescriptorTables.pop_back();
+            }
+            else
+            {
+                ASSERT(sDescriptorTables.size() < MAX_MATERIALS_COUNT, "Too many descriptor tables for the SRV heap.");
+                sDescriptorTables.emplace_back();
+            }
+            sDescriptorTables[found->second] = { views, 0 };
+            CreateDescriptorTableSRV(found->second);
+        }
+        material.mDescriptorTable = found->second;
+        ++sDescriptorTables[found->second].MaterialsCount;
+    }
+
+    // Virtual textures are only sampled in the diffuse slot, through the page table and the atlas. Packed textures
+    // are sampled in the slice of their array.
+    static void UpdateTextureParams(MaterialID aMaterialID)
+    {
+        const std::vector<Texture*>& textures = sMaterialRegister[aMaterialID].mTextures;
+        MaterialParams& params = sMaterialParamsRegister[aMaterialID];
+        params.TextureSlices = 0;
+        for (unsigned int i = 0; i < textures.size(); ++i)
+        {
+            if (textures[i] && i != aiTextureType_DIFFUSE - 1 && VirtualTexturing::IsVirtual(textures[i]))
+            {
+                SetTextureFlag(params, static_cast<aiTextureType>(i + 1), false);
+            }
+            if (textures[i] && i < aiTextureType_OPACITY)
+            {
+                params.TextureSlices |= textures[i]->GetArraySlice() << (i * 4);
+            }
+        }
+
+        Texture* diffuseTexture = textures[aiTextureType_DIFFUSE - 1];
+        bool isVirtual = diffuseTexture && VirtualTexturing::IsVirtual(diffuseTexture);
+        params.VirtualTextureSize = isVirtual ? diffuseTexture->GetWidth() | diffuseTexture->GetHeight() << 16 : 0;
+    }
+
+    MaterialID AddMaterial(MaterialParams&& aParams, std::vector<Texture*>&& aTextures, const char* aName)
+    {
+        ASSERT(sMaterialRegister.size() < MAX_MATERIALS_COUNT, "Too many materials for the materials constant buffer.");
+
+        MaterialID materialID = static_cast<MaterialID>(sMaterialRegister.size());
         sMaterialParamsRegister.push_back(aParams);
         sMaterialRegister.push_back({ aTextures });
 #ifdef _DEBUG
         sMaterialRegister.rbegin()->mName = aName;
 #endif // _DEBUG
+        UpdateTextureParams(materialID);
+        UpdateDescriptorTable(materialID);
 
+        ++sParamsVersion;
+        return materialID;
     }
 
     unsigned int GetMaterialCount()
@@ -33,19 +168,11 @@ namespace Materials
 
     void CreateMaterialTexturesSRV()
     {
-        for (unsigned int materialID = 0; materialID < sMaterialRegister.size(); ++materialID)
+        for (UINT32 table = 0; table < sDescriptorTables.size(); ++table)
         {
-            Material& materialResources = sMaterialRegister[materialID];
-            for (unsigned int i = 0; i < materialResources.mTextures.size(); ++i)
+            if (sDescriptorTables[table].MaterialsCount > 0)
             {
-                if (materialResources.mTextures[i])
-                {
-                    materialResources.mTextures[i]->CreateSRV(Graphics::g_SRVDescriptorHeap, materialID * MATERIAL_TEXTURES_COUNT + i);
-                }
-                else
-                {
-                    Texture::CreateEmptySRV(Graphics::g_SRVDescriptorHeap, materialID * MATERIAL_TEXTURES_COUNT + i);
-                }
+                CreateDescriptorTableSRV(table);
             }
         }
     }
@@ -54,4 +181,54 @@ namespace Materials
     {
         return sMaterialParamsRegister;
     }
+
+    const std::vector<Texture*>& GetTextures(MaterialID aMaterialID)
+    {
+        return sMaterialRegister[aMaterialID].mTextures;
+    }
+
+    UINT32 GetDescriptorTable(MaterialID aMaterialID)
+    {
+        return sMaterialRegister[aMaterialID].mDescriptorTable;
+    }
+
+    unsigned int GetDescriptorTablesCount()
+    {
+        return static_cast<unsigned int>(sDescriptorTablesByViews.size());
+    }
+
+    bool IsTransparent(MaterialID aMaterialID)
+    {
+        return sMaterialParamsRegister[aMaterialID].Opacity < 1.0f;
+    }
+
+    void SetTexture(MaterialID aMaterialID, aiTextureType aTextureType, Texture* aTexture)
+    {
+        sMaterialRegister[aMaterialID].mTextures[aTextureType - 1] = aTexture;
+        SetTextureFlag(sMaterialParamsRegister[aMaterialID], aTextureType, aTexture != nullptr);
+        UpdateTextureParams(aMaterialID);
+        UpdateDescriptorTable(aMaterialID);
+        ++sParamsVersion;
+    }
+
+    void SetTextureFlag(MaterialParams& aParams, aiTextureType aTextureType, bool aHasTexture)
+    {
+        switch (aTextureType)
+        {
+            case aiTextureType_AMBIENT: aParams.HasAmbientTexture = aHasTexture; break;
+            case aiTextureType_EMISSIVE: aParams.HasEmissiveTexture = aHasTexture; break;
+            case aiTextureType_DIFFUSE: aParams.HasDiffuseTexture = aHasTexture; break;
+            case aiTextureType_SPECULAR: aParams.HasSpecularTexture = aHasTexture; break;
+            case aiTextureType_SHININESS: aParams.HasSpecularPowerTexture = aHasTexture; break;
+            case aiTextureType_NORMALS: aParams.HasNormalTexture = aHasTexture; break;
+            case aiTextureType_HEIGHT: aParams.HasBumpTexture = aHasTexture; break;
+            case aiTextureType_OPACITY: aParams.HasOpacityTexture = aHasTexture; break;
+            default: break;
+        }
+    }
+
+    UINT64 GetParamsVersion()
+    {
+        return sParamsVersion;
+    }
 }
\ No newline at end of file
@@ -7,6 +7,14 @@ class Texture;
 
 #define MATERIAL_TEXTURES_COUNT aiTextureType_REFLECTION
 
+// The shader reads no reflection texture, a material with a virtual diffuse texture binds the tile atlas of that
+// texture in the slot instead, see VirtualTexturing.
+#define VIRTUAL_TEXTURE_ATLAS_SLOT (aiTextureType_REFLECTION - 1)
+
+// Capacity of the materials constant buffer, must match MAX_MATERIALS_COUNT_IN_CB in PixelShader.hlsl. The SRV
+// heap reserves texture descriptors for this many materials so models can add materials while they load.
+#define MAX_MATERIALS_COUNT 455
+
 using MaterialID = UINT32;
 
 struct MaterialParams
@@ -17,7 +25,7 @@ struct MaterialParams
     DirectX::XMFLOAT4  DiffuseColor = DirectX::XMFLOAT4();
     DirectX::XMFLOAT4  SpecularColor = DirectX::XMFLOAT4();
     DirectX::XMFLOAT4  Reflectance = DirectX::XMFLOAT4();
-    float   Opacity = 0.0f;
+    float   Opacity = 1.0f;
     float   SpecularPower = 0.0f;
     float   IndexOfRefraction = 0.0f;
     UINT32    HasAmbientTexture = 0;
@@ -31,12 +39,23 @@ struct MaterialParams
     float   BumpIntensity = 0.0f;
     float   SpecularScale = 0.0f;
     float   AlphaThreshold = 0.0f;
-    DirectX::XMFLOAT2 padding;
+    UINT32  VirtualTextureSize = 0;     // width | height << 16 of a virtual diffuse texture, zero if it is not virtual
+    UINT32  TextureSlices = 0;          // array slice of the texture in every sampled slot, 4 bits per slot from diffuse to opacity
+};
+
+// Import-time description of a material: parameters plus the texture file of every slot (empty if unused).
+// This is what the mesh cache stores, textures are resolved when the material is registered.
+struct MaterialDesc
+{
+    MaterialParams Params;
+    std::array<std::string, MATERIAL_TEXTURES_COUNT> TextureFiles;
+    std::string Name;
 };
 
 struct Material
 {
     std::vector<Texture*> mTextures;
+    UINT32 mDescriptorTable = UINT32_MAX;
 #ifdef _DEBUG
     std::string mName;
 #endif // _DEBUG
@@ -44,9 +63,26 @@ struct Material
 
 namespace Materials
 {
-    void AddMaterial(MaterialParams&& aParams, std::vector<Texture*>&& aTextures, const char* aName);
+    MaterialID AddMaterial(MaterialParams&& aParams, std::vector<Texture*>&& aTextures, const char* aName);
     unsigned int GetMaterialCount();
     const char* GetMaterialName(MaterialID materialID);
+    // Rewrites the descriptors of every descriptor table, after views of their textures changed.
     void CreateMaterialTexturesSRV();
     const std::vector<MaterialParams>& GetMaterialParams();
+    // Indexed by texture type - 1, unused slots are nullptr.
+    const std::vector<Texture*>& GetTextures(MaterialID aMaterialID);
+    // Materials that bind the same views share a descriptor table, which starts at table * MATERIAL_TEXTURES_COUNT
+    // in the SRV heap. Tables follow the textures of their materials, there are never more than materials.
+    UINT32 GetDescriptorTable(MaterialID aMaterialID);
+    unsigned int GetDescriptorTablesCount();
+    // Materials with Opacity below 1 are drawn in the transparent pass, blended back to front.
+    bool IsTransparent(MaterialID aMaterialID);
+
+    // Binds a texture that finished loading after its material was added and turns its Has*Texture flag back on.
+    // Virtual textures can only be sampled from the diffuse slot, in other slots they stay unbound.
+    void SetTexture(MaterialID aMaterialID, aiTextureType aTextureType, Texture* aTexture);
+    void SetTextureFlag(MaterialParams& aParams, aiTextureType aTextureType, bool aHasTexture);
+
+    // Incremented whenever material parameters change, the materials constant buffer is rewritten when it differs.
+    UINT64 GetParamsVersion();
 }
\ No newline at end of file
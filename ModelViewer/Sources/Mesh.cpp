@@ -2,41 +2,122 @@
 #include "Mesh.h"
 #include "Utility.h"
 #include "PixEvents.h"
+#include <cfloat>
 
-Mesh::Mesh(const Buffer& aVertexBuffer, const Buffer& aIndexBuffer, MaterialID aMaterialID, const char* aName)
-	: mVertexBuffer(aVertexBuffer)
-	, mIndexBuffer(aIndexBuffer)
+Mesh::Mesh(GeometryArena::Allocation&& aVertices, UINT aVertexStride, GeometryArena::Allocation&& aIndices, UINT aIndexSize, MaterialID aMaterialID, const MeshConstants& aMeshConstants, std::span<const Meshlet> aMeshlets, std::span<const MeshLod> aLods, const MeshBounds& aBounds, const DirectX::XMFLOAT4& aTexCoordBounds, std::span<const UINT32> aInstanceNodes, const char* aName)
+	: mVertices(std::move(aVertices))
+	, mIndices(std::move(aIndices))
 	, mMaterialID(aMaterialID)
+	, mMeshConstants(aMeshConstants)
+	, mMeshlets(aMeshlets.begin(), aMeshlets.end())
+	, mLods(aLods.begin(), aLods.end())
+	, mBounds(aBounds)
+	, mTexCoordBounds(aTexCoordBounds)
+	, mInstanceNodes(aInstanceNodes.begin(), aInstanceNodes.end())
 #ifdef _DEBUG
 	, mName(aName)
 #endif // _DEBUG
 
 {
-	SetupMesh();
+	SetupMesh(aVertexStride, aIndexSize);
 }
 
-void Mesh::SetupMesh()
+void Mesh::SetupMesh(UINT aVertexStride, UINT aIndexSize)
 {
-	m_VertexBufferView.BufferLocation = mVertexBuffer.GetGpuVirtualAddress();
-	m_VertexBufferView.SizeInBytes = mVertexBuffer.GetSizeInBytes();
-	m_VertexBufferView.StrideInBytes = mVertexBuffer.GetElementSizeInBytes();
+	// Allocations are aligned to the element size, so their offsets convert exactly to a base vertex and a start index.
+	m_VertexBufferView.BufferLocation = mVertices.GetPageGpuVirtualAddress();
+	m_VertexBufferView.SizeInBytes = static_cast<UINT>(mVertices.GetPageSizeInBytes());
+	m_VertexBufferView.StrideInBytes = aVertexStride;
+	mBaseVertex = static_cast<UINT>(mVertices.GetOffset() / aVertexStride);
 
-	m_IndexBufferView.BufferLocation = mIndexBuffer.GetGpuVirtualAddress();
-	m_IndexBufferView.Format = DXGI_FORMAT_R32_UINT;
-	m_IndexBufferView.SizeInBytes = mIndexBuffer.GetSizeInBytes();
+	// Index width is chosen per mesh, 16-bit indices are used whenever the mesh has few enough vertices.
+	ASSERT(aIndexSize == sizeof(UINT16) || aIndexSize == sizeof(UINT32), "Unsupported index size.");
+	m_IndexBufferView.BufferLocation = mIndices.GetPageGpuVirtualAddress();
+	m_IndexBufferView.Format = aIndexSize == sizeof(UINT16) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	m_IndexBufferView.SizeInBytes = static_cast<UINT>(mIndices.GetPageSizeInBytes());
+	mStartIndex = static_cast<UINT>(mIndices.GetOffset() / aIndexSize);
+	mIndicesCount = static_cast<UINT>(mIndices.GetSizeInBytes() / aIndexSize);
+
+	if (mLods.empty())
+	{
+		mLods.push_back({ 0, mIndicesCount, 0.0f });
+	}
+	ASSERT(mLods.back().IndexOffset + mLods.back().IndicesCount <= mIndicesCount, "LOD is outside of the index buffer.");
+}
+
+void Mesh::SelectLod(const DirectX::XMFLOAT3& aCameraPosition, std::span<const DirectX::XMFLOAT4X4A> aInstanceTransforms, float aPixelsPerUnit, float aMaxScreenError)
+{
+	UINT32 lastLod = static_cast<UINT32>(mLods.size() - 1);
+	mCurrentLod = lastLod;
+	mNearestDistance = FLT_MAX;
+	mProjectedSize = 0.0f;
+	for (const DirectX::XMFLOAT4X4A& instanceTransform : aInstanceTransforms)
+	{
+		// Bounds and errors are in mesh space, the instance transform moves the bounds and scales both by its largest axis scale.
+		DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4A(&instanceTransform);
+		float scale = std::max({ DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[0])), DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[1])), DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[2])) });
+		DirectX::XMVECTOR center = DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&mBounds.Center), world);
+		DirectX::XMVECTOR offset = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&aCameraPosition), center);
+		float distance = std::max(DirectX::XMVectorGetX(DirectX::XMVector3Length(offset)) - mBounds.Radius * scale, 1e-3f);
+		mNearestDistance = std::min(mNearestDistance, distance);
+		mProjectedSize = std::max(mProjectedSize, 2.0f * mBounds.Radius * scale * aPixelsPerUnit / distance);
+
+		// Errors grow with the level, so the last level that passes is the coarsest acceptable one.
+		UINT32 lod = 0;
+		while (lod < lastLod && mLods[lod + 1].Error * scale * aPixelsPerUnit / distance <= aMaxScreenError)
+		{
+			++lod;
+		}
+		mCurrentLod = std::min(mCurrentLod, lod);
+	}
+}
+
+void Mesh::SetInstances(UINT32 aFirstInstance, UINT32 aInstancesCount)
+{
+	mMeshConstants.FirstInstance = aFirstInstance;
+	mInstancesCount = aInstancesCount;
 }
 
-void Mesh::Render(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList, UINT aSRVRootParameterIndex, UINT aMaterialIDRootParameterIndex) const
+void Mesh::MarkUsedResources() const
 {
-	commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	commandList->IASetVertexBuffers(0, 1, &m_VertexBufferView);
-	commandList->IASetIndexBuffer(&m_IndexBufferView);
+	mVertices.MarkPageUsed();
+	mIndices.MarkPageUsed();
+}
+
+D3D12_INPUT_LAYOUT_DESC Mesh::GetInputLayout(VertexFormat aVertexFormat)
+{
+	static const D3D12_INPUT_ELEMENT_DESC fullInputLayout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+
+	static const D3D12_INPUT_ELEMENT_DESC compactInputLayout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 
-	commandList->SetGraphicsRoot32BitConstant(aMaterialIDRootParameterIndex, mMaterialID, 0);
+	if (aVertexFormat == VertexFormat::Compact)
+	{
+		return { compactInputLayout, _countof(compactInputLayout) };
+	}
+
+	return { fullInputLayout, _countof(fullInputLayout) };
+}
+
+void Mesh::Render(CommandList& commandList, UINT aMeshConstantsRootParameterIndex) const
+{
+	if (mInstancesCount == 0)
+	{
+		return;
+	}
 
-	CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle;
-	srvHandle.InitOffsetted(Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), mMaterialID * MATERIAL_TEXTURES_COUNT * Graphics::g_SRVDescriptorSize);
-	Graphics::g_GraphicsCommandList->SetGraphicsRootDescriptorTable(aSRVRootParameterIndex, srvHandle);
+	commandList.SetGraphicsRoot32BitConstants(aMeshConstantsRootParameterIndex, sizeof(MeshConstants) / sizeof(float), &mMeshConstants, 0);
 
-	PIX_SCOPED_EVENT(commandList->DrawIndexedInstanced(m_IndexBufferView.SizeInBytes / sizeof(unsigned int), 1, 0, 0, 0), commandList.Get(), 0x0000FF, "Draw mesh: %s, material %s", mName.c_str(), Materials::GetMaterialName(mMaterialID));
+	const MeshLod& lod = mLods[mCurrentLod];
+	PIX_SCOPED_EVENT(commandList.DrawIndexedInstanced(lod.IndicesCount, mInstancesCount, mStartIndex + lod.IndexOffset, mBaseVertex, 0), commandList.GetNative(), 0x0000FF, "Draw mesh: %s, LOD %u, %u instances, material %s", mName.c_str(), mCurrentLod, mInstancesCount, Materials::GetMaterialName(mMaterialID));
 }
@@ -2,8 +2,10 @@
 
 #include <DirectXMath.h>
 #include "Texture.h"
-#include "Buffer.h"
+#include "CommandList.h"
+#include "GeometryArena.h"
 #include "Material.h"
+#include <span>
 
 struct Vertex
 {
@@ -14,15 +16,101 @@ struct Vertex
 	DirectX::XMFLOAT2 texCoord;
 };
 
+enum class VertexFormat
+{
+	Full,		// Vertex, 56 bytes
+	Compact		// CompactVertex, 20 bytes
+};
+
+// Quantized vertex, see VertexCompression for the encoding.
+struct CompactVertex
+{
+	UINT16 position[4];		// xyz: unorm16 inside the mesh AABB, w: bitangent sign (0 is -1, 65535 is +1)
+	INT16 normal[2];		// octahedral snorm16
+	INT16 tangent[2];		// octahedral snorm16
+	UINT16 texCoord[2];		// half floats
+};
+
+// Per-mesh vertex shader root constants, object space position = PositionOffset + unorm position * PositionScale.
+// The transform of instance SV_InstanceID is at FirstInstance + SV_InstanceID in the model instance buffer.
+struct MeshConstants
+{
+	DirectX::XMFLOAT3 PositionOffset = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	UINT32 FirstInstance = 0;
+	DirectX::XMFLOAT3 PositionScale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+	float Padding1 = 0.0f;
+};
+
+// Cluster of at most 64 vertices and 124 triangles, a contiguous range of the mesh index buffer. Bounds are in
+// object space, see MeshletBuilder.
+struct Meshlet
+{
+	DirectX::XMFLOAT3 Center;
+	float Radius;
+	DirectX::XMFLOAT3 AabbMin;
+	UINT32 IndexOffset;
+	DirectX::XMFLOAT3 AabbMax;
+	UINT32 IndicesCount;
+	DirectX::XMFLOAT3 ConeAxis;		// average facing direction of the triangles
+	float ConeCutoff;				// sine of the cone spread, 1 if the meshlet cannot be backface culled
+	UINT32 VerticesCount;
+};
+
+// One level of detail, a range of the mesh index buffer over the shared vertex buffer. Error is the largest object
+// space distance between this level and LOD 0, see MeshSimplifier.
+struct MeshLod
+{
+	UINT32 IndexOffset;
+	UINT32 IndicesCount;
+	float Error;
+};
+
+// Mesh space bounds. The sphere shares the AABB center and encloses every vertex, so it can be tighter than the box
+// diagonal, see FrustumCulling.
+struct MeshBounds
+{
+	DirectX::XMFLOAT3 Center = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float Radius = 0.0f;
+	DirectX::XMFLOAT3 Extents = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);		// half size of the AABB
+	float Padding = 0.0f;
+};
+
+// CPU-side result of importing one aiMesh, before it is uploaded to the GPU.
+struct MeshData
+{
+	std::vector<Vertex> Vertices;
+	std::vector<UINT32> Indices;
+	std::vector<Meshlet> Meshlets;		// cover LOD 0 only
+	std::vector<MeshLod> Lods;
+	MeshBounds Bounds;
+	MaterialID MaterialIndex = 0;
+	std::vector<UINT32> NodeIndices;		// one instance per node that references the mesh
+	std::string Name;
+};
+
 class Mesh
 {
-	Buffer mVertexBuffer;
-	Buffer mIndexBuffer;
+	// Ranges of the shared geometry pages, the views cover the whole pages and draws are offset into them.
+	GeometryArena::Allocation mVertices;
+	GeometryArena::Allocation mIndices;
 
 	D3D12_VERTEX_BUFFER_VIEW m_VertexBufferView;
 	D3D12_INDEX_BUFFER_VIEW m_IndexBufferView;
+	UINT mIndicesCount = 0;
+	UINT mBaseVertex = 0;
+	UINT mStartIndex = 0;
 
 	MaterialID mMaterialID;
+	MeshConstants mMeshConstants;
+	std::vector<Meshlet> mMeshlets;
+	std::vector<MeshLod> mLods;
+	std::vector<UINT32> mInstanceNodes;
+	UINT32 mInstancesCount = 0;		// instances gathered for the current frame
+	UINT32 mCurrentLod = 0;
+	float mNearestDistance = 0.0f;		// from the camera to the bounds of the nearest instance, set by SelectLod
+	float mProjectedSize = 0.0f;		// screen size in pixels of the largest instance, set by SelectLod
+	MeshBounds mBounds;
+	DirectX::XMFLOAT4 mTexCoordBounds;		// minimum u, v and maximum u, v
 
 #ifdef _DEBUG
 	std::string mName;
@@ -30,10 +118,39 @@ class Mesh
 
 
 private:
-	inline void SetupMesh();
+	inline void SetupMesh(UINT aVertexStride, UINT aIndexSize);
 
 public:
-	Mesh(const Buffer& aVertexBuffer, const Buffer& aIndexBuffer, MaterialID aMaterialID, const char* aName);
-	void Render(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList, UINT aSRVRootParameterIndex, UINT aMaterialIDRootParameterIndex) const;
+	Mesh(GeometryArena::Allocation&& aVertices, UINT aVertexStride, GeometryArena::Allocation&& aIndices, UINT aIndexSize, MaterialID aMaterialID, const MeshConstants& aMeshConstants, std::span<const Meshlet> aMeshlets, std::span<const MeshLod> aLods, const MeshBounds& aBounds, const DirectX::XMFLOAT4& aTexCoordBounds, std::span<const UINT32> aInstanceNodes, const char* aName);
+	// Draws all instances gathered for this frame with one call. Expects the vertex and index buffer views and the
+	// material of this mesh to be bound, see Model::Render.
+	void Render(CommandList& commandList, UINT aMeshConstantsRootParameterIndex) const;
+
+	// Picks the coarsest level whose error projects to at most aMaxScreenError pixels for the nearest instance, all
+	// instances share one draw and so one level. aCameraPosition is in the object space of the model, the instance
+	// transforms place the mesh in it and aPixelsPerUnit is the screen size of one unit at distance 1. Also measures
+	// the projected size of the bounds, which drives texture streaming and virtual texturing.
+	void SelectLod(const DirectX::XMFLOAT3& aCameraPosition, std::span<const DirectX::XMFLOAT4X4A> aInstanceTransforms, float aPixelsPerUnit, float aMaxScreenError = 1.0f);
+	void SetInstances(UINT32 aFirstInstance, UINT32 aInstancesCount);
+	// Marks the geometry pages of the mesh for Residency.
+	void MarkUsedResources() const;
+
+	UINT GetIndicesCount() const { return mIndicesCount; }
+	const std::vector<MeshLod>& GetLods() const { return mLods; }
+	const MeshBounds& GetBounds() const { return mBounds; }
+	const DirectX::XMFLOAT4& GetTexCoordBounds() const { return mTexCoordBounds; }
+	UINT32 GetCurrentLod() const { return mCurrentLod; }
+	float GetNearestDistance() const { return mNearestDistance; }
+	float GetProjectedSize() const { return mProjectedSize; }
+	MaterialID GetMaterialID() const { return mMaterialID; }
+	const std::vector<UINT32>& GetInstanceNodes() const { return mInstanceNodes; }
+	UINT32 GetFirstInstance() const { return mMeshConstants.FirstInstance; }
+	UINT32 GetInstancesCount() const { return mInstancesCount; }
+	const std::vector<Meshlet>& GetMeshlets() const { return mMeshlets; }
+	UINT64 GetIndexBufferSizeInBytes() const { return mIndices.GetSizeInBytes(); }
+	const D3D12_VERTEX_BUFFER_VIEW& GetVertexBufferView() const { return m_VertexBufferView; }
+	const D3D12_INDEX_BUFFER_VIEW& GetIndexBufferView() const { return m_IndexBufferView; }
+
+	static D3D12_INPUT_LAYOUT_DESC GetInputLayout(VertexFormat aVertexFormat);
 };
 
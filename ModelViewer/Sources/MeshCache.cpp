@@ -0,0 +1,315 @@
+#include "pch.h"
+#include "MeshCache.h"
+#include "IndexCodec.h"
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+
+static constexpr UINT32 sNoString = UINT32_MAX;
+
+static UINT64 AlignUp(UINT64 aValue, UINT64 aAlignment)
+{
+    return (aValue + aAlignment - 1) & ~(aAlignment - 1);
+}
+
+// Whether aCount elements at aOffset fit a file of aFileSize bytes. Offsets and counts come from the file, so the
+// test is written so that neither the end of the range nor its size can overflow.
+static bool IsInFile(UINT64 aOffset, UINT64 aCount, UINT64 aElementSize, UINT64 aFileSize)
+{
+    return aOffset <= aFileSize && aCount <= (aFileSize - aOffset) / aElementSize;
+}
+
+bool MeshCache::Open(const std::wstring& aPath, UINT64 aSourceHash, UINT32 aImportFlags)
+{
+    mHeader = nullptr;
+
+    if (!mFile.Open(aPath))
+    {
+        return false;
+    }
+
+    const BYTE* data = mFile.GetData();
+    UINT64 size = mFile.GetSizeInBytes();
+    if (size < sizeof(Header))
+    {
+        mFile.Close();
+        return false;
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(data);
+    if (header->Magic != sMagic || header->Version != sVersion || header->SourceHash != aSourceHash || header->ImportFlags != aImportFlags)
+    {
+        Utility::Printf(L"Mesh cache is stale: %s", aPath.c_str());
+        mFile.Close();
+        return false;
+    }
+
+    if (!IsInFile(header->MaterialsOffset, header->MaterialsCount, sizeof(MaterialRecord), size) ||
+        !IsInFile(header->MeshesOffset, header->MeshesCount, sizeof(MeshRecord), size) ||
+        !IsInFile(header->NodesOffset, header->NodesCount, sizeof(NodeDesc), size) ||
+        !IsInFile(header->StringsOffset, header->StringsSizeInBytes, 1, size))
+    {
+        Utility::Printf(L"Mesh cache is corrupted: %s", aPath.c_str());
+        mFile.Close();
+        return false;
+    }
+
+    const MeshRecord* meshes = reinterpret_cast<const MeshRecord*>(data + header->MeshesOffset);
+    for (UINT32 i = 0; i < header->MeshesCount; ++i)
+    {
+        if (!IsInFile(meshes[i].VerticesOffset, meshes[i].VerticesCount, sizeof(Vertex), size) ||
+            !IsInFile(meshes[i].IndicesOffset, meshes[i].IndicesSizeInBytes, 1, size) ||
+            !IsInFile(meshes[i].MeshletsOffset, meshes[i].MeshletsCount, sizeof(Meshlet), size) ||
+            !IsInFile(meshes[i].LodsOffset, meshes[i].LodsCount, sizeof(MeshLod), size) ||
+            !IsInFile(meshes[i].InstanceNodesOffset, meshes[i].InstanceNodesCount, sizeof(UINT32), size))
+        {
+            Utility::Printf(L"Mesh cache is corrupted: %s", aPath.c_str());
+            mFile.Close();
+            return false;
+        }
+
+        const UINT32* instanceNodes = reinterpret_cast<const UINT32*>(data + meshes[i].InstanceNodesOffset);
+        if (std::any_of(instanceNodes, instanceNodes + meshes[i].InstanceNodesCount, [header](UINT32 aNodeIndex) { return aNodeIndex >= header->NodesCount; }))
+        {
+            Utility::Printf(L"Mesh cache is corrupted: %s", aPath.c_str());
+            mFile.Close();
+            return false;
+        }
+    }
+
+    mHeader = header;
+    mMaterials = reinterpret_cast<const MaterialRecord*>(data + header->MaterialsOffset);
+    mMeshes = meshes;
+    mNodes = reinterpret_cast<const NodeDesc*>(data + header->NodesOffset);
+    mStrings = reinterpret_cast<const char*>(data + header->StringsOffset);
+    return true;
+}
+
+const char* MeshCache::GetString(UINT32 aOffset) const
+{
+    return aOffset == sNoString ? "" : mStrings + aOffset;
+}
+
+MaterialDesc MeshCache::GetMaterial(UINT32 aIndex) const
+{
+    const MaterialRecord& record = mMaterials[aIndex];
+
+    MaterialDesc material;
+    material.Params = record.Params;
+    material.Name = GetString(record.NameOffset);
+    for (UINT32 i = 0; i < MATERIAL_TEXTURES_COUNT; ++i)
+    {
+        material.TextureFiles[i] = GetString(record.TextureFileOffsets[i]);
+    }
+    return material;
+}
+
+std::span<const Vertex> MeshCache::GetVertices(UINT32 aMeshIndex) const
+{
+    const MeshRecord& record = mMeshes[aMeshIndex];
+    return { reinterpret_cast<const Vertex*>(mFile.GetData() + record.VerticesOffset), record.VerticesCount };
+}
+
+std::span<const BYTE> MeshCache::GetEncodedIndices(UINT32 aMeshIndex) const
+{
+    const MeshRecord& record = mMeshes[aMeshIndex];
+    return { mFile.GetData() + record.IndicesOffset, record.IndicesSizeInBytes };
+}
+
+std::span<const Meshlet> MeshCache::GetMeshlets(UINT32 aMeshIndex) const
+{
+    const MeshRecord& record = mMeshes[aMeshIndex];
+    return { reinterpret_cast<const Meshlet*>(mFile.GetData() + record.MeshletsOffset), record.MeshletsCount };
+}
+
+std::span<const MeshLod> MeshCache::GetLods(UINT32 aMeshIndex) const
+{
+    const MeshRecord& record = mMeshes[aMeshIndex];
+    return { reinterpret_cast<const MeshLod*>(mFile.GetData() + record.LodsOffset), record.LodsCount };
+}
+
+std::span<const UINT32> MeshCache::GetInstanceNodes(UINT32 aMeshIndex) const
+{
+    const MeshRecord& record = mMeshes[aMeshIndex];
+    return { reinterpret_cast<const UINT32*>(mFile.GetData() + record.InstanceNodesOffset), record.InstanceNodesCount };
+}
+
+bool MeshCache::Write(const std::wstring& aPath, UINT64 aSourceHash, UINT32 aImportFlags, const char* aModelName, const std::vector<MaterialDesc>& aMaterials, const std::vector<MeshData>& aMeshes, const std::vector<NodeDesc>& aNodes)
+{
+    std::string strings;
+    auto addString = [&strings](const std::string& aString) -> UINT32
+    {
+        if (aString.empty())
+        {
+            return sNoString;
+        }
+
+        UINT32 offset = static_cast<UINT32>(strings.size());
+        strings.append(aString);
+        strings.push_back('\0');
+        return offset;
+    };
+
+    Header header = {};
+    header.Magic = sMagic;
+    header.Version = sVersion;
+    header.SourceHash = aSourceHash;
+    header.ImportFlags = aImportFlags;
+    header.MaterialsCount = static_cast<UINT32>(aMaterials.size());
+    header.MeshesCount = static_cast<UINT32>(aMeshes.size());
+    header.NodesCount = static_cast<UINT32>(aNodes.size());
+    header.NameOffset = addString(aModelName);
+
+    std::vector<MaterialRecord> materials(aMaterials.size());
+    for (size_t i = 0; i < aMaterials.size(); ++i)
+    {
+        materials[i].Params = aMaterials[i].Params;
+        materials[i].NameOffset = addString(aMaterials[i].Name);
+        for (UINT32 j = 0; j < MATERIAL_TEXTURES_COUNT; ++j)
+        {
+            materials[i].TextureFileOffsets[j] = addString(aMaterials[i].TextureFiles[j]);
+        }
+    }
+
+    std::vector<MeshRecord> meshes(aMeshes.size());
+    std::vector<std::vector<BYTE>> encodedIndices(aMeshes.size());
+    UINT64 rawIndicesSizeInBytes = 0;
+    UINT64 encodedIndicesSizeInBytes = 0;
+    for (size_t i = 0; i < aMeshes.size(); ++i)
+    {
+        encodedIndices[i] = IndexCodec::Encode(aMeshes[i].Indices);
+        rawIndicesSizeInBytes += aMeshes[i].Indices.size() * sizeof(UINT32);
+        encodedIndicesSizeInBytes += encodedIndices[i].size();
+
+        meshes[i].VerticesCount = static_cast<UINT32>(aMeshes[i].Vertices.size());
+        meshes[i].IndicesCount = static_cast<UINT32>(aMeshes[i].Indices.size());
+        meshes[i].IndicesSizeInBytes = encodedIndices[i].size();
+        meshes[i].MeshletsCount = static_cast<UINT32>(aMeshes[i].Meshlets.size());
+        meshes[i].LodsCount = static_cast<UINT32>(aMeshes[i].Lods.size());
+        meshes[i].Bounds = aMeshes[i].Bounds;
+        meshes[i].MaterialIndex = aMeshes[i].MaterialIndex;
+        meshes[i].InstanceNodesCount = static_cast<UINT32>(aMeshes[i].NodeIndices.size());
+        meshes[i].NameOffset = addString(aMeshes[i].Name);
+    }
+
+    header.MaterialsOffset = AlignUp(sizeof(Header), 16);
+    header.MeshesOffset = AlignUp(header.MaterialsOffset + materials.size() * sizeof(MaterialRecord), 16);
+    header.NodesOffset = AlignUp(header.MeshesOffset + meshes.size() * sizeof(MeshRecord), 16);
+    header.StringsOffset = AlignUp(header.NodesOffset + aNodes.size() * sizeof(NodeDesc), 16);
+    header.StringsSizeInBytes = strings.size();
+
+    UINT64 offset = AlignUp(header.StringsOffset + header.StringsSizeInBytes, 16);
+    for (size_t i = 0; i < aMeshes.size(); ++i)
+    {
+        meshes[i].VerticesOffset = offset;
+        offset = AlignUp(offset + aMeshes[i].Vertices.size() * sizeof(Vertex), 16);
+        meshes[i].IndicesOffset = offset;
+        offset = AlignUp(offset + meshes[i].IndicesSizeInBytes, 16);
+        meshes[i].MeshletsOffset = offset;
+        offset = AlignUp(offset + aMeshes[i].Meshlets.size() * sizeof(Meshlet), 16);
+        meshes[i].LodsOffset = offset;
+        offset = AlignUp(offset + aMeshes[i].Lods.size() * sizeof(MeshLod), 16);
+        meshes[i].InstanceNodesOffset = offset;
+        offset = AlignUp(offset + aMeshes[i].NodeIndices.size() * sizeof(UINT32), 16);
+    }
+
+    std::vector<BYTE> image(offset, 0);
+    memcpy(image.data(), &header, sizeof(Header));
+    memcpy(image.data() + header.MaterialsOffset, materials.data(), materials.size() * sizeof(MaterialRecord));
+    memcpy(image.data() + header.MeshesOffset, meshes.data(), meshes.size() * sizeof(MeshRecord));
+    memcpy(image.data() + header.NodesOffset, aNodes.data(), aNodes.size() * sizeof(NodeDesc));
+    memcpy(image.data() + header.StringsOffset, strings.data(), strings.size());
+    for (size_t i = 0; i < aMeshes.size(); ++i)
+    {
+        memcpy(image.data() + meshes[i].VerticesOffset, aMeshes[i].Vertices.data(), aMeshes[i].Vertices.size() * sizeof(Vertex));
+        memcpy(image.data() + meshes[i].IndicesOffset, encodedIndices[i].data(), encodedIndices[i].size());
+        memcpy(image.data() + meshes[i].MeshletsOffset, aMeshes[i].Meshlets.data(), aMeshes[i].Meshlets.size() * sizeof(Meshlet));
+        memcpy(image.data() + meshes[i].LodsOffset, aMeshes[i].Lods.data(), aMeshes[i].Lods.size() * sizeof(MeshLod));
+        memcpy(image.data() + meshes[i].InstanceNodesOffset, aMeshes[i].NodeIndices.data(), aMeshes[i].NodeIndices.size() * sizeof(UINT32));
+    }
+
+    std::ofstream file(std::filesystem::path(aPath), std::ios::binary | std::ios::trunc);
+    if (!file || !file.write(reinterpret_cast<const char*>(image.data()), image.size()))
+    {
+        Utility::Printf(L"Failed to write mesh cache: %s", aPath.c_str());
+        return false;
+    }
+
+    Utility::Printf("Mesh cache indices: %.1f KB encoded, %.1f KB as 32-bit indices", encodedIndicesSizeInBytes / 1024.0, rawIndicesSizeInBytes / 1024.0);
+
+    return true;
+}
+
+UINT64 MeshCache::HashSourceFile(const std::wstring& aPath)
+{
+    Utility::MappedFile file;
+    if (!file.Open(aPath))
+    {
+        return 0;
+    }
+
+    return Utility::HashMemory(file.GetData(), file.GetSizeInBytes());
+}
+
+UINT64 MeshCache::HashModelSourceFiles(const std::wstring& aPath)
+{
+    Utility::MappedFile file;
+    if (!file.Open(aPath))
+    {
+        return 0;
+    }
+
+    UINT64 hash = Utility::HashMemory(file.GetData(), file.GetSizeInBytes());
+    if (std::filesystem::path(aPath).extension() != L".obj")
+    {
+        return hash;
+    }
+
+    // Material libraries are named on mtllib lines, relative to the model. The names are hashed too, so a library
+    // that is missing now changes the hash when it shows up. Names with spaces are tried whole before being split.
+    std::string_view text(reinterpret_cast<const char*>(file.GetData()), file.GetSizeInBytes());
+    std::filesystem::path directory = std::filesystem::path(aPath).parent_path();
+    auto hashLibrary = [&](std::string_view aName)
+    {
+        hash = Utility::HashMemory(aName.data(), aName.size(), hash);
+        Utility::MappedFile library;
+        if (!library.Open((directory / std::wstring(aName.begin(), aName.end())).wstring()))
+        {
+            return false;
+        }
+        hash = Utility::HashMemory(library.GetData(), library.GetSizeInBytes(), hash);
+        return true;
+    };
+
+    constexpr std::string_view keyword = "mtllib";
+    constexpr const char* whitespace = " \t\r";
+    for (size_t lineStart = 0; lineStart < text.size();)
+    {
+        size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+        std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        size_t keywordStart = line.find_first_not_of(whitespace);
+        if (keywordStart == std::string_view::npos || line.substr(keywordStart, keyword.size()) != keyword ||
+            line.find_first_of(whitespace, keywordStart) != keywordStart + keyword.size())
+        {
+            continue;
+        }
+
+        std::string_view names = line.substr(keywordStart + keyword.size());
+        names.remove_prefix(std::min(names.find_first_not_of(whitespace), names.size()));
+        names.remove_suffix(names.size() - std::min(names.find_last_not_of(whitespace) + 1, names.size()));
+        if (names.empty() || hashLibrary(names))
+        {
+            continue;
+        }
+
+        while (!names.empty())
+        {
+            size_t nameEnd = std::min(names.find_first_of(whitespace), names.size());
+            hashLibrary(names.substr(0, nameEnd));
+            names.remove_prefix(std::min(names.find_first_not_of(whitespace, nameEnd), names.size()));
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Mesh.h"
+#include "TransformHierarchy.h"
+#include "Utility.h"
+#include <span>
+
+// Cooked binary image of an imported model. It stores the final vertex/index arrays, the per-mesh material IDs,
+// the material table and the node hierarchy, so a warm start skips Assimp completely. The file is memory-mapped on
+// load and the vertex spans point straight into the mapping. Indices are stored with IndexCodec and decoded on load,
+// the index stream holds every LOD back to back.
+//
+// Layout: Header | MaterialRecord[] | MeshRecord[] | NodeDesc[] | string blob | 16-byte aligned geometry blobs.
+class MeshCache
+{
+public:
+    static constexpr UINT32 sMagic = 0x4D43564D; // "MVCM"
+    static constexpr UINT32 sVersion = 11;
+
+    struct Header
+    {
+        UINT32 Magic;
+        UINT32 Version;
+        UINT64 SourceHash;
+        UINT32 ImportFlags;
+        UINT32 MaterialsCount;
+        UINT32 MeshesCount;
+        UINT32 NodesCount;
+        UINT32 NameOffset;
+        UINT64 MaterialsOffset;
+        UINT64 MeshesOffset;
+        UINT64 NodesOffset;
+        UINT64 StringsOffset;
+        UINT64 StringsSizeInBytes;
+    };
+
+    struct MaterialRecord
+    {
+        MaterialParams Params;
+        UINT32 NameOffset;
+        UINT32 TextureFileOffsets[MATERIAL_TEXTURES_COUNT];
+    };
+
+    struct MeshRecord
+    {
+        UINT64 VerticesOffset;
+        UINT64 IndicesOffset;
+        UINT64 IndicesSizeInBytes;
+        UINT64 MeshletsOffset;
+        UINT64 LodsOffset;
+        UINT64 InstanceNodesOffset;
+        MeshBounds Bounds;
+        UINT32 VerticesCount;
+        UINT32 IndicesCount;
+        UINT32 MeshletsCount;
+        UINT32 LodsCount;
+        UINT32 InstanceNodesCount;
+        MaterialID MaterialIndex;
+        UINT32 NameOffset;
+    };
+
+private:
+    Utility::MappedFile mFile;
+    const Header* mHeader = nullptr;
+    const MaterialRecord* mMaterials = nullptr;
+    const MeshRecord* mMeshes = nullptr;
+    const NodeDesc* mNodes = nullptr;
+    const char* mStrings = nullptr;
+
+    const char* GetString(UINT32 aOffset) const;
+
+public:
+    // Maps the cache file and validates it against the source hash and import flags. Returns false if the cache
+    // is missing, corrupted or stale, in which case the model has to be imported again.
+    bool Open(const std::wstring& aPath, UINT64 aSourceHash, UINT32 aImportFlags);
+    bool IsOpen() const { return mHeader != nullptr; }
+
+    const char* GetModelName() const { return GetString(mHeader->NameOffset); }
+
+    UINT32 GetMaterialsCount() const { return mHeader->MaterialsCount; }
+    MaterialDesc GetMaterial(UINT32 aIndex) const;
+
+    UINT32 GetMeshesCount() const { return mHeader->MeshesCount; }
+    std::span<const Vertex> GetVertices(UINT32 aMeshIndex) const;
+    UINT32 GetIndicesCount(UINT32 aMeshIndex) const { return mMeshes[aMeshIndex].IndicesCount; }
+    std::span<const BYTE> GetEncodedIndices(UINT32 aMeshIndex) const;
+    std::span<const Meshlet> GetMeshlets(UINT32 aMeshIndex) const;
+    std::span<const MeshLod> GetLods(UINT32 aMeshIndex) const;
+    const MeshBounds& GetBounds(UINT32 aMeshIndex) const { return mMeshes[aMeshIndex].Bounds; }
+    MaterialID GetMaterialIndex(UINT32 aMeshIndex) const { return mMeshes[aMeshIndex].MaterialIndex; }
+    std::span<const UINT32> GetInstanceNodes(UINT32 aMeshIndex) const;
+    const char* GetMeshName(UINT32 aMeshIndex) const { return GetString(mMeshes[aMeshIndex].NameOffset); }
+
+    std::span<const NodeDesc> GetNodes() const { return { mNodes, mHeader->NodesCount }; }
+
+    static bool Write(const std::wstring& aPath, UINT64 aSourceHash, UINT32 aImportFlags, const char* aModelName, const std::vector<MaterialDesc>& aMaterials, const std::vector<MeshData>& aMeshes, const std::vector<NodeDesc>& aNodes);
+    static UINT64 HashSourceFile(const std::wstring& aPath);
+    // Hash of the model file and, for OBJ, of the material libraries it references.
+    static UINT64 HashModelSourceFiles(const std::wstring& aPath);
+};
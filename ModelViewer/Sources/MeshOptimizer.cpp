@@ -0,0 +1,361 @@
+#include "pch.h"
+#include "MeshOptimizer.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+static XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+MeshOptimizer::VertexCacheStatistics MeshOptimizer::AnalyzeVertexCache(std::span<const UINT32> aIndices, size_t aVerticesCount, UINT32 aCacheSize)
+{
+    VertexCacheStatistics statistics;
+    if (aIndices.size() < 3)
+    {
+        return statistics;
+    }
+
+    // A vertex is in the FIFO cache while fewer than aCacheSize vertices were inserted after it.
+    std::vector<UINT32> cacheTimestamps(aVerticesCount, 0);
+    std::vector<bool> isReferenced(aVerticesCount, false);
+    UINT32 time = aCacheSize + 1;
+    UINT32 misses = 0;
+    UINT32 referencedVerticesCount = 0;
+    for (UINT32 index : aIndices)
+    {
+        if (time - cacheTimestamps[index] > aCacheSize)
+        {
+            cacheTimestamps[index] = time++;
+            ++misses;
+        }
+
+        if (!isReferenced[index])
+        {
+            isReferenced[index] = true;
+            ++referencedVerticesCount;
+        }
+    }
+
+    statistics.ACMR = static_cast<float>(misses) / (aIndices.size() / 3);
+    statistics.ATVR = static_cast<float>(misses) / referencedVerticesCount;
+    return statistics;
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<UINT32>& aIndices, size_t aVerticesCount, std::vector<UINT32>* aClusters)
+{
+    if (aClusters)
+    {
+        aClusters->clear();
+    }
+
+    size_t trianglesCount = aIndices.size() / 3;
+    if (trianglesCount == 0 || aIndices.size() % 3 != 0)
+    {
+        return;
+    }
+
+    // Vertex to triangle adjacency in compressed rows, liveTriangles counts the triangles not emitted yet.
+    std::vector<UINT32> liveTriangles(aVerticesCount, 0);
+    for (UINT32 index : aIndices)
+    {
+        ++liveTriangles[index];
+    }
+
+    std::vector<UINT32> adjacencyOffsets(aVerticesCount + 1, 0);
+    for (size_t i = 0; i < aVerticesCount; ++i)
+    {
+        adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+    }
+
+    std::vector<UINT32> adjacency(aIndices.size());
+    std::vector<UINT32> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < aIndices.size(); ++i)
+    {
+        adjacency[fillOffsets[aIndices[i]]++] = static_cast<UINT32>(i / 3);
+    }
+
+    static constexpr UINT32 sNoVertex = UINT32_MAX;
+
+    std::vector<UINT32> cacheTimestamps(aVerticesCount, 0);
+    std::vector<bool> isEmitted(trianglesCount, false);
+    std::vector<UINT32> deadEndStack;
+    std::vector<UINT32> candidates;
+    std::vector<UINT32> output;
+    output.reserve(aIndices.size());
+
+    UINT32 time = sCacheSize + 1;
+    UINT32 cursor = 0;
+    UINT32 fanningVertex = aIndices[0];
+
+    if (aClusters)
+    {
+        aClusters->push_back(0);
+    }
+
+    while (fanningVertex != sNoVertex)
+    {
+        // Emit every remaining triangle around the fanning vertex.
+        candidates.clear();
+        for (UINT32 i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex + 1]; ++i)
+        {
+            UINT32 triangle = adjacency[i];
+            if (isEmitted[triangle])
+            {
+                continue;
+            }
+
+            for (UINT32 j = 0; j < 3; ++j)
+            {
+                UINT32 vertex = aIndices[triangle * 3 + j];
+                output.push_back(vertex);
+                deadEndStack.push_back(vertex);
+                candidates.push_back(vertex);
+                --liveTriangles[vertex];
+                if (time - cacheTimestamps[vertex] > sCacheSize)
+                {
+                    cacheTimestamps[vertex] = time++;
+                }
+            }
+            isEmitted[triangle] = true;
+        }
+
+        // Prefer the candidate that stays in the cache while all its remaining triangles are emitted, the oldest
+        // one first. Candidates that would fall out of the cache get priority 0.
+        UINT32 nextVertex = sNoVertex;
+        INT64 bestPriority = -1;
+        for (UINT32 vertex : candidates)
+        {
+            if (liveTriangles[vertex] == 0)
+            {
+                continue;
+            }
+
+            INT64 priority = 0;
+            if (time - cacheTimestamps[vertex] + 2 * liveTriangles[vertex] <= sCacheSize)
+            {
+                priority = time - cacheTimestamps[vertex];
+            }
+
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                nextVertex = vertex;
+            }
+        }
+
+        // Dead end: go back to recently emitted vertices, then to the first vertex with triangles left.
+        if (nextVertex == sNoVertex)
+        {
+            while (!deadEndStack.empty() && nextVertex == sNoVertex)
+            {
+                UINT32 vertex = deadEndStack.back();
+                deadEndStack.pop_back();
+                if (liveTriangles[vertex] > 0)
+                {
+                    nextVertex = vertex;
+                }
+            }
+
+            while (cursor < aVerticesCount && nextVertex == sNoVertex)
+            {
+                if (liveTriangles[cursor] > 0)
+                {
+                    nextVertex = cursor;
+                }
+                ++cursor;
+            }
+
+            if (aClusters && nextVertex != sNoVertex)
+            {
+                aClusters->push_back(static_cast<UINT32>(output.size()));
+            }
+        }
+
+        fanningVertex = nextVertex;
+    }
+
+    ASSERT(output.size() == aIndices.size(), "Vertex cache optimization lost triangles.");
+    aIndices.swap(output);
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::vector<UINT32>& aIndices, std::span<const Vertex> aVertices, const std::vector<UINT32>& aClusters, float aThreshold)
+{
+    size_t trianglesCount = aIndices.size() / 3;
+    if (trianglesCount == 0 || aIndices.size() % 3 != 0 || aClusters.empty())
+    {
+        return;
+    }
+
+    std::vector<UINT32> cacheTimestamps(aVertices.size(), 0);
+    UINT32 time = sCacheSize + 1;
+    auto flushCache = [&time]() { time += sCacheSize + 1; };
+    auto countMisses = [&](size_t aTriangle)
+    {
+        UINT32 misses = 0;
+        for (size_t i = aTriangle * 3; i < aTriangle * 3 + 3; ++i)
+        {
+            if (time - cacheTimestamps[aIndices[i]] > sCacheSize)
+            {
+                cacheTimestamps[aIndices[i]] = time++;
+                ++misses;
+            }
+        }
+        return misses;
+    };
+
+    // Split the clusters into parts that are cheap enough for the cache to start cold.
+    std::vector<size_t> splits;
+    for (size_t i = 0; i < aClusters.size(); ++i)
+    {
+        size_t start = aClusters[i] / 3;
+        size_t end = i + 1 < aClusters.size() ? aClusters[i + 1] / 3 : trianglesCount;
+
+        flushCache();
+        UINT32 clusterMisses = 0;
+        for (size_t triangle = start; triangle < end; ++triangle)
+        {
+            clusterMisses += countMisses(triangle);
+        }
+        float targetACMR = static_cast<float>(clusterMisses) / (end - start) * aThreshold;
+
+        flushCache();
+        splits.push_back(start);
+        size_t splitStart = start;
+        UINT32 misses = 0;
+        for (size_t triangle = start; triangle < end; ++triangle)
+        {
+            misses += countMisses(triangle);
+            if (triangle + 1 < end && misses <= targetACMR * (triangle + 1 - splitStart))
+            {
+                splits.push_back(triangle + 1);
+                splitStart = triangle + 1;
+                misses = 0;
+                flushCache();
+            }
+        }
+    }
+
+    struct Cluster
+    {
+        size_t Start;
+        size_t End;
+        float SortKey;
+    };
+
+    // Area weighted centroids and normals, the cross product length is twice the triangle area.
+    auto accumulate = [&](size_t aStart, size_t aEnd, XMFLOAT3& aCentroid, XMFLOAT3& aNormal)
+    {
+        aCentroid = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        aNormal = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        float area = 0.0f;
+        for (size_t triangle = aStart; triangle < aEnd; ++triangle)
+        {
+            const XMFLOAT3& a = aVertices[aIndices[triangle * 3 + 0]].position;
+            const XMFLOAT3& b = aVertices[aIndices[triangle * 3 + 1]].position;
+            const XMFLOAT3& c = aVertices[aIndices[triangle * 3 + 2]].position;
+            XMFLOAT3 normal = Cross(Subtract(b, a), Subtract(c, a));
+            float triangleArea = std::sqrt(Dot(normal, normal));
+
+            aCentroid.x += (a.x + b.x + c.x) / 3.0f * triangleArea;
+            aCentroid.y += (a.y + b.y + c.y) / 3.0f * triangleArea;
+            aCentroid.z += (a.z + b.z + c.z) / 3.0f * triangleArea;
+            aNormal.x += normal.x;
+            aNormal.y += normal.y;
+            aNormal.z += normal.z;
+            area += triangleArea;
+        }
+
+        if (area > 0.0f)
+        {
+            aCentroid = XMFLOAT3(aCentroid.x / area, aCentroid.y / area, aCentroid.z / area);
+        }
+    };
+
+    XMFLOAT3 meshCentroid, meshNormal;
+    accumulate(0, trianglesCount, meshCentroid, meshNormal);
+
+    std::vector<Cluster> clusters(splits.size());
+    for (size_t i = 0; i < splits.size(); ++i)
+    {
+        Cluster& cluster = clusters[i];
+        cluster.Start = splits[i];
+        cluster.End = i + 1 < splits.size() ? splits[i + 1] : trianglesCount;
+
+        XMFLOAT3 centroid, normal;
+        accumulate(cluster.Start, cluster.End, centroid, normal);
+
+        float normalLength = std::sqrt(Dot(normal, normal));
+        cluster.SortKey = normalLength > 0.0f ? Dot(Subtract(centroid, meshCentroid), normal) / normalLength : 0.0f;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.SortKey > b.SortKey; });
+
+    std::vector<UINT32> output;
+    output.reserve(aIndices.size());
+    for (const Cluster& cluster : clusters)
+    {
+        output.insert(output.end(), aIndices.begin() + cluster.Start * 3, aIndices.begin() + cluster.End * 3);
+    }
+    aIndices.swap(output);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& aVertices, std::vector<UINT32>& aIndices)
+{
+    static constexpr UINT32 sUnused = UINT32_MAX;
+
+    std::vector<UINT32> remap(aVertices.size(), sUnused);
+    UINT32 verticesCount = 0;
+    for (UINT32& index : aIndices)
+    {
+        if (remap[index] == sUnused)
+        {
+            remap[index] = verticesCount++;
+        }
+        index = remap[index];
+    }
+
+    std::vector<Vertex> vertices(verticesCount);
+    for (size_t i = 0; i < aVertices.size(); ++i)
+    {
+        if (remap[i] != sUnused)
+        {
+            vertices[remap[i]] = aVertices[i];
+        }
+    }
+    aVertices.swap(vertices);
+}
+
+MeshOptimizer::OptimizationReport MeshOptimizer::OptimizeMesh(MeshData& aMesh)
+{
+    OptimizationReport report;
+    report.Before = AnalyzeVertexCache(aMesh.Indices, aMesh.Vertices.size());
+
+    // Meshes with point or line primitives are left alone.
+    if (aMesh.Indices.empty() || aMesh.Indices.size() % 3 != 0)
+    {
+        report.After = report.Before;
+        return report;
+    }
+
+    std::vector<UINT32> clusters;
+    OptimizeVertexCache(aMesh.Indices, aMesh.Vertices.size(), &clusters);
+    OptimizeOverdraw(aMesh.Indices, aMesh.Vertices, clusters);
+    OptimizeVertexFetch(aMesh.Vertices, aMesh.Indices);
+
+    report.After = AnalyzeVertexCache(aMesh.Indices, aMesh.Vertices.size());
+    return report;
+}
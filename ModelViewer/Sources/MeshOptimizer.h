@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Mesh.h"
+#include <span>
+
+// Import-time reordering of triangle lists. The triangle order is optimized for the post-transform vertex cache
+// with Tipsify (Sander et al. 2007), then its clusters are optionally sorted to draw outer surfaces first and
+// reduce overdraw, and finally the vertices are renumbered in first-use order for fetch locality.
+namespace MeshOptimizer
+{
+    // Size of the simulated FIFO post-transform cache. It is the cache size Tipsify optimizes for as well.
+    static constexpr UINT32 sCacheSize = 16;
+
+    struct VertexCacheStatistics
+    {
+        float ACMR = 0.0f;      // average cache misses per triangle, 0.5 at best, 3 at worst
+        float ATVR = 0.0f;      // average transforms per referenced vertex, 1 at best
+    };
+
+    struct OptimizationReport
+    {
+        VertexCacheStatistics Before;
+        VertexCacheStatistics After;
+    };
+
+    VertexCacheStatistics AnalyzeVertexCache(std::span<const UINT32> aIndices, size_t aVerticesCount, UINT32 aCacheSize = sCacheSize);
+
+    // Reorders the triangles of aIndices. aClusters receives the index offset of every cluster that starts at a dead
+    // end, where Tipsify jumps to a vertex that is unlikely to be cached. OptimizeOverdraw can move these clusters
+    // around without hurting the cache much.
+    void OptimizeVertexCache(std::vector<UINT32>& aIndices, size_t aVerticesCount, std::vector<UINT32>* aClusters = nullptr);
+
+    // Sorts the clusters so that outward-facing surfaces far from the mesh center, the likely occluders, are drawn
+    // first. Clusters are split further where the ACMR of a part stays within aThreshold times the cluster ACMR.
+    void OptimizeOverdraw(std::vector<UINT32>& aIndices, std::span<const Vertex> aVertices, const std::vector<UINT32>& aClusters, float aThreshold = 1.05f);
+
+    // Renumbers the vertices in the order the indices first reference them. Unreferenced vertices are dropped.
+    void OptimizeVertexFetch(std::vector<Vertex>& aVertices, std::vector<UINT32>& aIndices);
+
+    // Runs all passes on a triangle list and measures the cache behavior before and after.
+    OptimizationReport OptimizeMesh(MeshData& aMesh);
+}
@@ -0,0 +1,341 @@
+#include "pch.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <numeric>
+
+using namespace DirectX;
+
+// Sum of squared distances to a set of planes, stored as the upper triangle of the symmetric 4x4 matrix.
+struct Quadric
+{
+    double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+    double b2 = 0.0, bc = 0.0, bd = 0.0;
+    double c2 = 0.0, cd = 0.0;
+    double d2 = 0.0;
+
+    void AddPlane(double a, double b, double c, double d)
+    {
+        a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+        b2 += b * b; bc += b * c; bd += b * d;
+        c2 += c * c; cd += c * d;
+        d2 += d * d;
+    }
+
+    void Add(const Quadric& aOther)
+    {
+        a2 += aOther.a2; ab += aOther.ab; ac += aOther.ac; ad += aOther.ad;
+        b2 += aOther.b2; bc += aOther.bc; bd += aOther.bd;
+        c2 += aOther.c2; cd += aOther.cd;
+        d2 += aOther.d2;
+    }
+
+    double Evaluate(const XMFLOAT3& aPoint) const
+    {
+        double x = aPoint.x, y = aPoint.y, z = aPoint.z;
+        double value = a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+                     + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+                     + c2 * z * z + 2.0 * cd * z
+                     + d2;
+        return std::max(value, 0.0);
+    }
+};
+
+struct Collapse
+{
+    UINT32 From;
+    UINT32 To;
+    double Cost;
+};
+
+static XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static XMFLOAT3 TriangleNormal(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+{
+    return Cross(Subtract(b, a), Subtract(c, a));
+}
+
+static UINT64 EdgeKey(UINT32 a, UINT32 b)
+{
+    return a < b ? (static_cast<UINT64>(a) << 32) | b : (static_cast<UINT64>(b) << 32) | a;
+}
+
+// Marks the vertices of edges that belong to one triangle only.
+static std::vector<bool> FindOpenEdgeVertices(std::span<const UINT32> aIndices, size_t aVerticesCount)
+{
+    std::vector<UINT64> edges;
+    edges.reserve(aIndices.size());
+    for (size_t i = 0; i < aIndices.size(); i += 3)
+    {
+        edges.push_back(EdgeKey(aIndices[i], aIndices[i + 1]));
+        edges.push_back(EdgeKey(aIndices[i + 1], aIndices[i + 2]));
+        edges.push_back(EdgeKey(aIndices[i + 2], aIndices[i]));
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> isOpen(aVerticesCount, false);
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j] == edges[i])
+        {
+            ++j;
+        }
+
+        if (j - i == 1)
+        {
+            isOpen[edges[i] >> 32] = true;
+            isOpen[edges[i] & 0xFFFFFFFF] = true;
+        }
+        i = j;
+    }
+    return isOpen;
+}
+
+std::vector<UINT32> MeshSimplifier::Simplify(std::span<const Vertex> aVertices, std::span<const UINT32> aIndices, size_t aTargetIndicesCount, float aMaxError, float& aResultError)
+{
+    aResultError = 0.0f;
+    std::vector<UINT32> indices(aIndices.begin(), aIndices.end());
+    if (indices.size() % 3 != 0 || indices.size() <= aTargetIndicesCount)
+    {
+        return indices;
+    }
+
+    size_t verticesCount = aVertices.size();
+    std::vector<bool> isLocked = FindOpenEdgeVertices(indices, verticesCount);
+
+    // Planes are not weighted by area, so the square root of a cost bounds the distance to every merged plane.
+    std::vector<Quadric> quadrics(verticesCount);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        XMFLOAT3 normal = TriangleNormal(aVertices[indices[i]].position, aVertices[indices[i + 1]].position, aVertices[indices[i + 2]].position);
+        float length = std::sqrt(Dot(normal, normal));
+        if (length <= FLT_MIN)
+        {
+            continue;
+        }
+
+        normal = XMFLOAT3(normal.x / length, normal.y / length, normal.z / length);
+        double d = -Dot(normal, aVertices[indices[i]].position);
+        for (size_t j = i; j < i + 3; ++j)
+        {
+            quadrics[indices[j]].AddPlane(normal.x, normal.y, normal.z, d);
+        }
+    }
+
+    double maxCost = static_cast<double>(aMaxError) * aMaxError;
+    std::vector<UINT32> remap(verticesCount);
+    std::vector<bool> isTouched(verticesCount);
+    std::vector<UINT32> adjacencyOffsets(verticesCount + 1);
+    std::vector<UINT32> adjacency;
+    std::vector<UINT64> edges;
+    std::vector<Collapse> collapses;
+
+    // Every pass collapses a batch of the cheapest edges. A collapse marks all vertices around it as touched, so
+    // no triangle is changed twice in a pass and the flip tests always see the current triangles.
+    while (indices.size() > aTargetIndicesCount)
+    {
+        edges.clear();
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            edges.push_back(EdgeKey(indices[i], indices[i + 1]));
+            edges.push_back(EdgeKey(indices[i + 1], indices[i + 2]));
+            edges.push_back(EdgeKey(indices[i + 2], indices[i]));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        collapses.clear();
+        for (UINT64 edge : edges)
+        {
+            UINT32 a = static_cast<UINT32>(edge >> 32);
+            UINT32 b = static_cast<UINT32>(edge & 0xFFFFFFFF);
+            Quadric quadric = quadrics[a];
+            quadric.Add(quadrics[b]);
+
+            Collapse collapse = { 0, 0, DBL_MAX };
+            if (!isLocked[a])
+            {
+                collapse = { a, b, quadric.Evaluate(aVertices[b].position) };
+            }
+            if (!isLocked[b])
+            {
+                double cost = quadric.Evaluate(aVertices[a].position);
+                if (cost < collapse.Cost)
+                {
+                    collapse = { b, a, cost };
+                }
+            }
+
+            if (collapse.Cost <= maxCost)
+            {
+                collapses.push_back(collapse);
+            }
+        }
+
+        if (collapses.empty())
+        {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.Cost < b.Cost; });
+
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (UINT32 index : indices)
+        {
+            ++adjacencyOffsets[index + 1];
+        }
+        for (size_t i = 0; i < verticesCount; ++i)
+        {
+            adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+        }
+        adjacency.resize(indices.size());
+        std::vector<UINT32> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            adjacency[fillOffsets[indices[i]]++] = static_cast<UINT32>(i / 3);
+        }
+
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(isTouched.begin(), isTouched.end(), false);
+
+        size_t trianglesCount = indices.size() / 3;
+        size_t targetTrianglesCount = aTargetIndicesCount / 3;
+        size_t collapsesCount = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (trianglesCount <= targetTrianglesCount)
+            {
+                break;
+            }
+
+            if (isTouched[collapse.From] || isTouched[collapse.To])
+            {
+                continue;
+            }
+
+            // Reject the collapse if a remaining triangle around From would flip.
+            bool isValid = true;
+            UINT32 removedTriangles = 0;
+            for (UINT32 i = adjacencyOffsets[collapse.From]; i < adjacencyOffsets[collapse.From + 1] && isValid; ++i)
+            {
+                const UINT32* triangle = &indices[adjacency[i] * 3];
+                if (triangle[0] == collapse.To || triangle[1] == collapse.To || triangle[2] == collapse.To)
+                {
+                    ++removedTriangles;
+                    continue;
+                }
+
+                XMFLOAT3 positions[3];
+                XMFLOAT3 collapsedPositions[3];
+                for (UINT32 j = 0; j < 3; ++j)
+                {
+                    positions[j] = aVertices[triangle[j]].position;
+                    collapsedPositions[j] = triangle[j] == collapse.From ? aVertices[collapse.To].position : positions[j];
+                }
+
+                XMFLOAT3 normal = TriangleNormal(positions[0], positions[1], positions[2]);
+                XMFLOAT3 collapsedNormal = TriangleNormal(collapsedPositions[0], collapsedPositions[1], collapsedPositions[2]);
+                isValid = Dot(normal, collapsedNormal) > 0.0f;
+            }
+
+            if (!isValid)
+            {
+                continue;
+            }
+
+            for (UINT32 i = adjacencyOffsets[collapse.From]; i < adjacencyOffsets[collapse.From + 1]; ++i)
+            {
+                const UINT32* triangle = &indices[adjacency[i] * 3];
+                isTouched[triangle[0]] = isTouched[triangle[1]] = isTouched[triangle[2]] = true;
+            }
+
+            remap[collapse.From] = collapse.To;
+            quadrics[collapse.To].Add(quadrics[collapse.From]);
+            aResultError = std::max(aResultError, static_cast<float>(std::sqrt(collapse.Cost)));
+            trianglesCount -= removedTriangles;
+            ++collapsesCount;
+        }
+
+        if (collapsesCount == 0)
+        {
+            break;
+        }
+
+        size_t writeOffset = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            UINT32 a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a != b && b != c && c != a)
+            {
+                indices[writeOffset++] = a;
+                indices[writeOffset++] = b;
+                indices[writeOffset++] = c;
+            }
+        }
+        indices.resize(writeOffset);
+    }
+
+    return indices;
+}
+
+void MeshSimplifier::BuildLodChain(MeshData& aMesh)
+{
+    aMesh.Lods.clear();
+    aMesh.Lods.push_back({ 0, static_cast<UINT32>(aMesh.Indices.size()), 0.0f });
+    if (aMesh.Indices.empty() || aMesh.Indices.size() % 3 != 0)
+    {
+        return;
+    }
+
+    // The error budget grows with the mesh so that small and large meshes behave the same.
+    XMFLOAT3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+    XMFLOAT3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (const Vertex& vertex : aMesh.Vertices)
+    {
+        minimum = XMFLOAT3(std::min(minimum.x, vertex.position.x), std::min(minimum.y, vertex.position.y), std::min(minimum.z, vertex.position.z));
+        maximum = XMFLOAT3(std::max(maximum.x, vertex.position.x), std::max(maximum.y, vertex.position.y), std::max(maximum.z, vertex.position.z));
+    }
+    XMFLOAT3 extent = Subtract(maximum, minimum);
+    float maxError = 0.1f * std::sqrt(Dot(extent, extent));
+
+    // Every level is simplified from LOD 0, so its error is measured against the full detail surface.
+    std::vector<UINT32> lod0(aMesh.Indices.begin(), aMesh.Indices.end());
+    size_t previousIndicesCount = lod0.size();
+    for (UINT32 level = 1; level < sMaxLodsCount; ++level)
+    {
+        size_t targetIndicesCount = (previousIndicesCount / 2) / 3 * 3;
+        if (targetIndicesCount < 3)
+        {
+            break;
+        }
+
+        float error = 0.0f;
+        std::vector<UINT32> lod = Simplify(aMesh.Vertices, lod0, targetIndicesCount, maxError, error);
+        if (lod.empty() || lod.size() > previousIndicesCount * 9 / 10)
+        {
+            break;
+        }
+
+        MeshOptimizer::OptimizeVertexCache(lod, aMesh.Vertices.size());
+
+        aMesh.Lods.push_back({ static_cast<UINT32>(aMesh.Indices.size()), static_cast<UINT32>(lod.size()), std::max(error, aMesh.Lods.back().Error) });
+        aMesh.Indices.insert(aMesh.Indices.end(), lod.begin(), lod.end());
+        previousIndicesCount = lod.size();
+    }
+}
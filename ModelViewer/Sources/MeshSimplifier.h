@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Mesh.h"
+#include <span>
+
+// Import-time level of detail generation. Triangles are removed with half-edge collapses ordered by the quadric
+// error metric (Garland and Heckbert 1997). Collapsing onto an existing vertex keeps all vertex attributes
+// valid, so the LODs share the vertex buffer of the full detail mesh and only add index ranges.
+//
+// Vertices on open edges never move. Welding keeps the vertices of UV and normal seams split, and every seam is
+// an open edge in index space, so this also protects the seams.
+namespace MeshSimplifier
+{
+    static constexpr UINT32 sMaxLodsCount = 5;
+
+    // Simplifies aIndices until at most aTargetIndicesCount remain, or until the next collapse would exceed
+    // aMaxError. aResultError receives the largest object space error of the result.
+    std::vector<UINT32> Simplify(std::span<const Vertex> aVertices, std::span<const UINT32> aIndices, size_t aTargetIndicesCount, float aMaxError, float& aResultError);
+
+    // Appends up to sMaxLodsCount - 1 coarser levels to aMesh.Indices, each with half the triangles of the
+    // previous one, and fills aMesh.Lods with LOD 0 first. Levels that remove too little are not kept.
+    void BuildLodChain(MeshData& aMesh);
+}
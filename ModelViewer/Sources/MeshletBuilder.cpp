@@ -0,0 +1,218 @@
+#include "pch.h"
+#include "MeshletBuilder.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+using namespace DirectX;
+
+static XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static float Length(const XMFLOAT3& aVector)
+{
+    return std::sqrt(Dot(aVector, aVector));
+}
+
+// Ritter's bounding sphere: start from the two points farthest apart along a greedy search, then grow the
+// sphere for every point that is still outside.
+static void ComputeBoundingSphere(std::span<const Vertex> aVertices, const std::vector<UINT32>& aMeshletVertices, XMFLOAT3& aCenter, float& aRadius)
+{
+    auto farthestFrom = [&](const XMFLOAT3& aPoint)
+    {
+        UINT32 farthest = aMeshletVertices[0];
+        float maxDistance = -1.0f;
+        for (UINT32 vertex : aMeshletVertices)
+        {
+            float distance = Length(Subtract(aVertices[vertex].position, aPoint));
+            if (distance > maxDistance)
+            {
+                maxDistance = distance;
+                farthest = vertex;
+            }
+        }
+        return aVertices[farthest].position;
+    };
+
+    XMFLOAT3 a = farthestFrom(aVertices[aMeshletVertices[0]].position);
+    XMFLOAT3 b = farthestFrom(a);
+    aCenter = XMFLOAT3((a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f);
+    aRadius = Length(Subtract(b, a)) * 0.5f;
+
+    for (UINT32 vertex : aMeshletVertices)
+    {
+        const XMFLOAT3& position = aVertices[vertex].position;
+        XMFLOAT3 offset = Subtract(position, aCenter);
+        float distance = Length(offset);
+        if (distance > aRadius)
+        {
+            float newRadius = (aRadius + distance) * 0.5f;
+            float shift = (newRadius - aRadius) / distance;
+            aCenter = XMFLOAT3(aCenter.x + offset.x * shift, aCenter.y + offset.y * shift, aCenter.z + offset.z * shift);
+            aRadius = newRadius;
+        }
+    }
+}
+
+static Meshlet FinishMeshlet(std::span<const Vertex> aVertices, std::span<const UINT32> aIndices, UINT32 aIndexOffset, UINT32 aIndicesCount, const std::vector<UINT32>& aMeshletVertices)
+{
+    Meshlet meshlet = {};
+    meshlet.IndexOffset = aIndexOffset;
+    meshlet.IndicesCount = aIndicesCount;
+    meshlet.VerticesCount = static_cast<UINT32>(aMeshletVertices.size());
+
+    meshlet.AabbMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+    meshlet.AabbMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (UINT32 vertex : aMeshletVertices)
+    {
+        const XMFLOAT3& position = aVertices[vertex].position;
+        meshlet.AabbMin = XMFLOAT3(std::min(meshlet.AabbMin.x, position.x), std::min(meshlet.AabbMin.y, position.y), std::min(meshlet.AabbMin.z, position.z));
+        meshlet.AabbMax = XMFLOAT3(std::max(meshlet.AabbMax.x, position.x), std::max(meshlet.AabbMax.y, position.y), std::max(meshlet.AabbMax.z, position.z));
+    }
+
+    ComputeBoundingSphere(aVertices, aMeshletVertices, meshlet.Center, meshlet.Radius);
+
+    // The cone axis is the average of the unit triangle normals and its spread is set by the normal that deviates
+    // the most. Zero-area triangles have no facing and are ignored.
+    std::vector<XMFLOAT3> normals;
+    normals.reserve(aIndicesCount / 3);
+    XMFLOAT3 axis(0.0f, 0.0f, 0.0f);
+    for (UINT32 i = aIndexOffset; i < aIndexOffset + aIndicesCount; i += 3)
+    {
+        const XMFLOAT3& a = aVertices[aIndices[i]].position;
+        const XMFLOAT3& b = aVertices[aIndices[i + 1]].position;
+        const XMFLOAT3& c = aVertices[aIndices[i + 2]].position;
+        XMFLOAT3 normal = Cross(Subtract(b, a), Subtract(c, a));
+        float length = Length(normal);
+        if (length > FLT_MIN)
+        {
+            normal = XMFLOAT3(normal.x / length, normal.y / length, normal.z / length);
+            normals.push_back(normal);
+            axis = XMFLOAT3(axis.x + normal.x, axis.y + normal.y, axis.z + normal.z);
+        }
+    }
+
+    meshlet.ConeAxis = XMFLOAT3(0.0f, 0.0f, 1.0f);
+    meshlet.ConeCutoff = 1.0f;
+
+    float axisLength = Length(axis);
+    if (axisLength > FLT_MIN)
+    {
+        meshlet.ConeAxis = XMFLOAT3(axis.x / axisLength, axis.y / axisLength, axis.z / axisLength);
+
+        float minDot = 1.0f;
+        for (const XMFLOAT3& normal : normals)
+        {
+            minDot = std::min(minDot, Dot(normal, meshlet.ConeAxis));
+        }
+
+        // A spread of 90 degrees or more faces every direction and can never be culled.
+        if (minDot > 0.0f)
+        {
+            meshlet.ConeCutoff = std::sqrt(1.0f - minDot * minDot);
+        }
+    }
+
+    return meshlet;
+}
+
+std::vector<Meshlet> MeshletBuilder::Build(std::span<const Vertex> aVertices, std::span<const UINT32> aIndices)
+{
+    std::vector<Meshlet> meshlets;
+    if (aIndices.size() < 3 || aIndices.size() % 3 != 0)
+    {
+        return meshlets;
+    }
+
+    static constexpr UINT32 sNoMeshlet = UINT32_MAX;
+
+    // vertexMeshlets remembers the last meshlet that used a vertex, so membership tests need no search.
+    std::vector<UINT32> vertexMeshlets(aVertices.size(), sNoMeshlet);
+    std::vector<UINT32> meshletVertices;
+    meshletVertices.reserve(sMaxVertices);
+    UINT32 meshletStart = 0;
+    UINT32 meshletIndex = 0;
+
+    for (UINT32 i = 0; i < aIndices.size(); i += 3)
+    {
+        UINT32 a = aIndices[i], b = aIndices[i + 1], c = aIndices[i + 2];
+        UINT32 newVertices = (vertexMeshlets[a] != meshletIndex) +
+                             (vertexMeshlets[b] != meshletIndex && b != a) +
+                             (vertexMeshlets[c] != meshletIndex && c != a && c != b);
+
+        if (meshletVertices.size() + newVertices > sMaxVertices || (i - meshletStart) / 3 == sMaxTriangles)
+        {
+            meshlets.push_back(FinishMeshlet(aVertices, aIndices, meshletStart, i - meshletStart, meshletVertices));
+            meshletVertices.clear();
+            meshletStart = i;
+            ++meshletIndex;
+        }
+
+        for (UINT32 vertex : { a, b, c })
+        {
+            if (vertexMeshlets[vertex] != meshletIndex)
+            {
+                vertexMeshlets[vertex] = meshletIndex;
+                meshletVertices.push_back(vertex);
+            }
+        }
+    }
+    meshlets.push_back(FinishMeshlet(aVertices, aIndices, meshletStart, static_cast<UINT32>(aIndices.size()) - meshletStart, meshletVertices));
+
+#ifdef _DEBUG
+    UINT32 expectedOffset = 0;
+    for (const Meshlet& meshlet : meshlets)
+    {
+        ASSERT(meshlet.IndexOffset == expectedOffset, "Meshlets must cover the index buffer in order.");
+        ASSERT(meshlet.VerticesCount <= sMaxVertices && meshlet.IndicesCount / 3 <= sMaxTriangles, "Meshlet exceeds its limits.");
+        expectedOffset += meshlet.IndicesCount;
+    }
+    ASSERT(expectedOffset == aIndices.size(), "Meshlets must cover the index buffer in order.");
+#endif // _DEBUG
+
+    return meshlets;
+}
+
+bool MeshletBuilder::IsBackfacing(const Meshlet& aMeshlet, const XMFLOAT3& aCameraPosition)
+{
+    XMFLOAT3 direction = Subtract(aMeshlet.Center, aCameraPosition);
+    return Dot(direction, aMeshlet.ConeAxis) >= aMeshlet.ConeCutoff * Length(direction) + aMeshlet.Radius;
+}
+
+void MeshletBuilder::Statistics::Add(std::span<const Meshlet> aMeshlets)
+{
+    for (const Meshlet& meshlet : aMeshlets)
+    {
+        ++MeshletsCount;
+        VerticesCount += meshlet.VerticesCount;
+        TrianglesCount += meshlet.IndicesCount / 3;
+        ConeCullableCount += meshlet.ConeCutoff < 1.0f ? 1 : 0;
+    }
+}
+
+void MeshletBuilder::Statistics::Print(const char* aName) const
+{
+    if (MeshletsCount == 0)
+    {
+        return;
+    }
+
+    double verticesPerMeshlet = static_cast<double>(VerticesCount) / MeshletsCount;
+    double trianglesPerMeshlet = static_cast<double>(TrianglesCount) / MeshletsCount;
+    Utility::Printf("Meshlets of %s: %llu, %.1f vertices (%.0f%% of limit) and %.1f triangles (%.0f%% of limit) on average, %.0f%% can be backface culled",
+        aName, MeshletsCount, verticesPerMeshlet, 100.0 * verticesPerMeshlet / sMaxVertices, trianglesPerMeshlet, 100.0 * trianglesPerMeshlet / sMaxTriangles,
+        100.0 * ConeCullableCount / MeshletsCount);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Mesh.h"
+
+// Splits a triangle list into meshlets for cluster culling. Triangles are taken in index buffer order, which after
+// MeshOptimizer is already local, and a new meshlet starts when the vertex or triangle limit would be exceeded.
+// Each meshlet stays a contiguous index range and can be drawn on its own with DrawIndexedInstanced.
+namespace MeshletBuilder
+{
+    static constexpr UINT32 sMaxVertices = 64;
+    static constexpr UINT32 sMaxTriangles = 124;
+
+    struct Statistics
+    {
+        UINT64 MeshletsCount = 0;
+        UINT64 VerticesCount = 0;           // vertices referenced by the meshlets, shared ones counted per meshlet
+        UINT64 TrianglesCount = 0;
+        UINT64 ConeCullableCount = 0;       // meshlets with a normal cone narrow enough for backface culling
+
+        void Add(std::span<const Meshlet> aMeshlets);
+        void Print(const char* aName) const;
+    };
+
+    std::vector<Meshlet> Build(std::span<const Vertex> aVertices, std::span<const UINT32> aIndices);
+
+    // Conservative test with the bounding sphere, aCameraPosition is in the object space of the mesh.
+    bool IsBackfacing(const Meshlet& aMeshlet, const DirectX::XMFLOAT3& aCameraPosition);
+}
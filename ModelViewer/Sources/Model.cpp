@@ -3,103 +3,1078 @@
 #include "Utility.h"
 #include "PixEvents.h"
 #include "Material.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "VertexWelder.h"
+#include "MeshletBuilder.h"
+#include "MeshSimplifier.h"
+#include "IndexCodec.h"
+#include "UploadBatch.h"
+#include "VertexCompression.h"
+#include "Texture.h"
+#include "TextureStreaming.h"
+#include "VirtualTexturing.h"
+#include "DirectXTex.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <execution>
+#include <iterator>
+#include <mutex>
+#include <thread>
 
-Model::Model(const std::string& aPath)
+// Hand-over between the loader and the render thread. The loader appends results under the mutex and the render
+// thread takes what is ready in Model::ProcessLoadResults. The loader only holds a weak pointer, so destroying the
+// model stops the load at the next hand-over.
+struct ModelLoadState
+{
+	struct DecodedTexture
+	{
+		std::wstring Path;
+		std::wstring CachePath;		// the cooked file the image was read from, empty if it is not cached
+		aiTextureType Type = aiTextureType_NONE;		// the material slot the image was decoded for
+		std::unique_ptr<DirectX::ScratchImage> Image;
+	};
+
+	std::mutex Mutex;
+	std::string ModelName;
+	std::vector<MaterialDesc> Materials;
+	std::vector<NodeDesc> Nodes;
+	std::deque<MeshData> Meshes;
+	std::deque<DecodedTexture> Textures;
+	std::deque<std::vector<DecodedTexture>> TextureArrays;		// small textures packed into one array each
+	bool IsCached = false;
+	bool IsDone = false;
+
+	// Render thread only.
+	std::string Path;
+	std::chrono::high_resolution_clock::time_point StartTime = std::chrono::high_resolution_clock::now();
+	std::multimap<std::wstring, std::pair<MaterialID, aiTextureType>> PendingTextures;
+	bool HasFirstMesh = false;
+	UINT32 TexturesCount = 0;
+	UINT32 UploadBatchesCount = 0;
+	double UploadWaitTime = 0.0;		// ms the render thread blocked in UploadBatch::Submit
+};
+
+template<typename Function>
+static bool Publish(const std::weak_ptr<ModelLoadState>& aLoadState, Function&& aFunction)
+{
+	std::shared_ptr<ModelLoadState> loadState = aLoadState.lock();
+	if (!loadState)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(loadState->Mutex);
+	aFunction(*loadState);
+	return true;
+}
+
+static std::wstring GetDirectory(const std::string& aPath)
 {
 	std::string directory = aPath.substr(0, aPath.find_last_of('/') + 1);
-	mDirectory = std::wstring(directory.begin(), directory.end());
-	LoadModel(aPath);
+	return std::wstring(directory.begin(), directory.end());
+}
+
+// Minimum corner of the bounds of the mesh positions.
+static aiVector3D GetMinPosition(const aiMesh* aMesh)
+{
+	aiVector3D minPosition = aMesh->mNumVertices > 0 ? aMesh->mVertices[0] : aiVector3D();
+	for (unsigned int i = 1; i < aMesh->mNumVertices; ++i)
+	{
+		minPosition.x = std::min(minPosition.x, aMesh->mVertices[i].x);
+		minPosition.y = std::min(minPosition.y, aMesh->mVertices[i].y);
+		minPosition.z = std::min(minPosition.z, aMesh->mVertices[i].z);
+	}
+	return minPosition;
+}
+
+// Size of the mesh and the largest coordinate, the scale of the errors of positions made relative to aMinPosition.
+static std::pair<float, float> GetPositionScale(const aiMesh* aMesh, const aiVector3D& aMinPosition)
+{
+	float size = 0.0f, maxCoordinate = 0.0f;
+	for (unsigned int i = 0; i < aMesh->mNumVertices; ++i)
+	{
+		const aiVector3D& position = aMesh->mVertices[i];
+		size = std::max({ size, position.x - aMinPosition.x, position.y - aMinPosition.y, position.z - aMinPosition.z });
+		maxCoordinate = std::max({ maxCoordinate, std::abs(position.x), std::abs(position.y), std::abs(position.z) });
+	}
+	return { size, maxCoordinate };
 }
 
-void Model::LoadModel(const std::string& aPath)
+// Hash of everything that ends up in the imported MeshData, so meshes with equal hashes (and equal content, checked
+// by IsSameSourceMesh) import to the same geometry and can be drawn as instances of one mesh. Positions are taken
+// relative to aMinPosition, so copies that were moved by baking the offset into their vertices match too. They are
+// quantized to a thousandth of the mesh size, equal meshes that straddle a step only miss the match.
+static UINT64 HashSourceMesh(const aiMesh* aMesh, const aiVector3D& aMinPosition)
+{
+	UINT64 hash = Utility::HashMemory(&aMesh->mMaterialIndex, sizeof(aMesh->mMaterialIndex));
+	float step = std::max(GetPositionScale(aMesh, aMinPosition).first * 1e-3f, FLT_MIN);
+	for (unsigned int i = 0; i < aMesh->mNumVertices; ++i)
+	{
+		aiVector3D position = (aMesh->mVertices[i] - aMinPosition) / step;
+		INT32 quantized[3] = { static_cast<INT32>(std::lround(position.x)), static_cast<INT32>(std::lround(position.y)), static_cast<INT32>(std::lround(position.z)) };
+		hash = Utility::HashMemory(quantized, sizeof(quantized), hash);
+	}
+	if (aMesh->mNormals)
+	{
+		hash = Utility::HashMemory(aMesh->mNormals, aMesh->mNumVertices * sizeof(aiVector3D), hash);
+	}
+	if (aMesh->mTextureCoords[0])
+	{
+		hash = Utility::HashMemory(aMesh->mTextureCoords[0], aMesh->mNumVertices * sizeof(aiVector3D), hash);
+	}
+	for (unsigned int i = 0; i < aMesh->mNumFaces; ++i)
+	{
+		hash = Utility::HashMemory(aMesh->mFaces[i].mIndices, aMesh->mFaces[i].mNumIndices * sizeof(unsigned int), hash);
+	}
+	return hash;
+}
+
+// Positions are compared relative to the minimum positions, within the rounding of that subtraction. Everything else
+// has to match exactly.
+static bool IsSameSourceMesh(const aiMesh* aMesh, const aiVector3D& aMinPosition, const aiMesh* aOther, const aiVector3D& aOtherMinPosition)
+{
+	auto isSameArray = [aMesh](const aiVector3D* aArray, const aiVector3D* aOtherArray)
+	{
+		return aArray == aOtherArray || (aArray && aOtherArray && memcmp(aArray, aOtherArray, aMesh->mNumVertices * sizeof(aiVector3D)) == 0);
+	};
+
+	if (aMesh == aOther)
+	{
+		return true;
+	}
+
+	if (aMesh->mMaterialIndex != aOther->mMaterialIndex || aMesh->mNumVertices != aOther->mNumVertices || aMesh->mNumFaces != aOther->mNumFaces ||
+		!isSameArray(aMesh->mNormals, aOther->mNormals) || !isSameArray(aMesh->mTextureCoords[0], aOther->mTextureCoords[0]))
+	{
+		return false;
+	}
+
+	auto [size, maxCoordinate] = GetPositionScale(aMesh, aMinPosition);
+	auto [otherSize, otherMaxCoordinate] = GetPositionScale(aOther, aOtherMinPosition);
+	float tolerance = 1e-5f * (std::max(size, otherSize) + std::max(maxCoordinate, otherMaxCoordinate));
+	for (unsigned int i = 0; i < aMesh->mNumVertices; ++i)
+	{
+		aiVector3D difference = (aMesh->mVertices[i] - aMinPosition) - (aOther->mVertices[i] - aOtherMinPosition);
+		if (std::abs(difference.x) > tolerance || std::abs(difference.y) > tolerance || std::abs(difference.z) > tolerance)
+		{
+			return false;
+		}
+	}
+
+	for (unsigned int i = 0; i < aMesh->mNumFaces; ++i)
+	{
+		const aiFace& face = aMesh->mFaces[i];
+		const aiFace& otherFace = aOther->mFaces[i];
+		if (face.mNumIndices != otherFace.mNumIndices || memcmp(face.mIndices, otherFace.mIndices, face.mNumIndices * sizeof(unsigned int)) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Adds a child with a translation to the node of every entry of aTranslations, right after the node so the order
+// stays depth-first. Returns the new index of every old node followed by the indices of the added ones.
+static std::vector<UINT32> AddTranslationNodes(std::vector<NodeDesc>& aNodes, std::span<const std::pair<UINT32, aiVector3D>> aTranslations)
+{
+	std::vector<std::vector<UINT32>> translationsByNode(aNodes.size());
+	for (UINT32 i = 0; i < aTranslations.size(); ++i)
+	{
+		translationsByNode[aTranslations[i].first].push_back(i);
+	}
+
+	std::vector<UINT32> newIndices(aNodes.size() + aTranslations.size());
+	std::vector<NodeDesc> nodes;
+	nodes.reserve(newIndices.size());
+	for (UINT32 i = 0; i < aNodes.size(); ++i)
+	{
+		NodeDesc node = aNodes[i];
+		node.ParentIndex = node.ParentIndex == TransformHierarchy::sNoParent ? node.ParentIndex : newIndices[node.ParentIndex];
+		newIndices[i] = static_cast<UINT32>(nodes.size());
+		nodes.push_back(node);
+
+		for (UINT32 translation : translationsByNode[i])
+		{
+			const aiVector3D& offset = aTranslations[translation].second;
+			NodeDesc translationNode;
+			translationNode.ParentIndex = newIndices[i];
+			DirectX::XMStoreFloat4x4(&translationNode.LocalTransform, DirectX::XMMatrixTranslation(offset.x, offset.y, offset.z));
+			newIndices[aNodes.size() + translation] = static_cast<UINT32>(nodes.size());
+			nodes.push_back(translationNode);
+		}
+	}
+	aNodes.swap(nodes);
+	return newIndices;
+}
+
+static MeshData ReadMesh(const MeshCache& aCache, UINT32 aMeshIndex)
+{
+	MeshData mesh;
+	std::span<const Vertex> vertices = aCache.GetVertices(aMeshIndex);
+	mesh.Vertices.assign(vertices.begin(), vertices.end());
+
+	mesh.Indices.resize(aCache.GetIndicesCount(aMeshIndex));
+	bool isDecoded = IndexCodec::Decode(aCache.GetEncodedIndices(aMeshIndex), mesh.Indices, vertices.size());
+	ASSERT(isDecoded, "Mesh cache has corrupted indices.");
+
+	std::span<const Meshlet> meshlets = aCache.GetMeshlets(aMeshIndex);
+	mesh.Meshlets.assign(meshlets.begin(), meshlets.end());
+	std::span<const MeshLod> lods = aCache.GetLods(aMeshIndex);
+	mesh.Lods.assign(lods.begin(), lods.end());
+	mesh.Bounds = aCache.GetBounds(aMeshIndex);
+	mesh.MaterialIndex = aCache.GetMaterialIndex(aMeshIndex);
+	std::span<const UINT32> instanceNodes = aCache.GetInstanceNodes(aMeshIndex);
+	mesh.NodeIndices.assign(instanceNodes.begin(), instanceNodes.end());
+	mesh.Name = aCache.GetMeshName(aMeshIndex);
+	return mesh;
+}
+
+Model::Model(const std::string& aPath, VertexFormat aVertexFormat)
+	: mDirectory(GetDirectory(aPath))
+	, mVertexFormat(aVertexFormat)
+	, mLoadState(std::make_shared<ModelLoadState>())
+{
+	mLoadState->Path = aPath;
+	Load(mLoadState, aPath);
+	ProcessLoadResults(UINT64_MAX);
+	UpdateInstanceBounds();
+}
+
+Model Model::LoadAsync(const std::string& aPath, VertexFormat aVertexFormat)
+{
+	Model model;
+	model.mDirectory = GetDirectory(aPath);
+	model.mVertexFormat = aVertexFormat;
+	model.mLoadState = std::make_shared<ModelLoadState>();
+	model.mLoadState->Path = aPath;
+
+	std::thread([loadState = std::weak_ptr<ModelLoadState>(model.mLoadState), aPath]()
+	{
+		// WIC decoding needs COM on this thread.
+		HRESULT result = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+		Load(loadState, aPath);
+		if (SUCCEEDED(result))
+		{
+			CoUninitialize();
+		}
+	}).detach();
+
+	return model;
+}
+
+void Model::Load(const std::weak_ptr<ModelLoadState>& aLoadState, const std::string& aPath)
+{
+	std::wstring sourcePath(aPath.begin(), aPath.end());
+	std::wstring cachePath = sourcePath + L".meshcache";
+	UINT64 sourceHash = MeshCache::HashModelSourceFiles(sourcePath);
+
+	std::vector<MaterialDesc> materials;
+	MeshCache cache;
+	if (cache.Open(cachePath, sourceHash, sImportFlags))
+	{
+		materials.resize(cache.GetMaterialsCount());
+		for (UINT32 i = 0; i < cache.GetMaterialsCount(); ++i)
+		{
+			materials[i] = cache.GetMaterial(i);
+		}
+
+		std::string modelName = cache.GetModelName();
+		std::span<const NodeDesc> nodes = cache.GetNodes();
+		if (!Publish(aLoadState, [&](ModelLoadState& aState) { aState.ModelName = modelName; aState.Materials = materials; aState.Nodes.assign(nodes.begin(), nodes.end()); aState.IsCached = true; }))
+		{
+			return;
+		}
+
+		for (UINT32 i = 0; i < cache.GetMeshesCount(); ++i)
+		{
+			MeshData mesh = ReadMesh(cache, i);
+			if (!Publish(aLoadState, [&](ModelLoadState& aState) { aState.Meshes.push_back(std::move(mesh)); }))
+			{
+				return;
+			}
+		}
+	}
+	else if (!Import(aLoadState, aPath, cachePath, sourceHash, materials))
+	{
+		return;
+	}
+
+	// Textures come last, geometry is drawn with the material colors until they arrive. Textures that another
+	// model already created are bound directly by the render thread. A texture is cooked for the first material slot
+	// it shows up in.
+	std::wstring directory = GetDirectory(aPath);
+	std::map<std::wstring, aiTextureType> texturePaths;
+	for (const MaterialDesc& material : materials)
+	{
+		for (size_t i = 0; i < material.TextureFiles.size(); ++i)
+		{
+			const std::string& fileName = material.TextureFiles[i];
+			if (!fileName.empty())
+			{
+				texturePaths.emplace(directory + std::wstring(fileName.begin(), fileName.end()), static_cast<aiTextureType>(i + 1));
+			}
+		}
+	}
+
+	// Decoding fans out over the worker pool and every texture is handed over as soon as it is ready. The pool threads
+	// are not initialized for COM, WIC runs on them as implicit members of the multithreaded apartment of this thread.
+	// Small textures wait for the others, they are packed into arrays once all sizes are known.
+	std::vector<std::pair<std::wstring, aiTextureType>> decodePaths;
+	std::copy_if(texturePaths.begin(), texturePaths.end(), std::back_inserter(decodePaths), [](const auto& aEntry) { return Texture::FindTexture(aEntry.first) == nullptr; });
+	std::vector<ModelLoadState::DecodedTexture> smallTextures;
+	std::mutex smallTexturesMutex;
+	std::for_each(std::execution::par, decodePaths.begin(), decodePaths.end(), [&](const std::pair<std::wstring, aiTextureType>& aEntry)
+	{
+		if (aLoadState.expired())
+		{
+			return;
+		}
+
+		std::wstring cachePath;
+		std::unique_ptr<DirectX::ScratchImage> image = Texture::Decode(aEntry.first, aEntry.second, &cachePath);
+		if (image && Texture::CanPack(*image))
+		{
+			std::lock_guard<std::mutex> lock(smallTexturesMutex);
+			smallTextures.push_back({ aEntry.first, std::move(cachePath), aEntry.second, std::move(image) });
+			return;
+		}
+		Publish(aLoadState, [&](ModelLoadState& aState) { aState.Textures.push_back({ aEntry.first, std::move(cachePath), aEntry.second, std::move(image) }); });
+	});
+
+	std::vector<const DirectX::ScratchImage*> smallImages(smallTextures.size());
+	std::transform(smallTextures.begin(), smallTextures.end(), smallImages.begin(), [](const ModelLoadState::DecodedTexture& aTexture) { return aTexture.Image.get(); });
+	std::vector<std::vector<uint32_t>> groups = Texture::GroupForPacking(smallImages);
+	std::vector<std::vector<ModelLoadState::DecodedTexture>> textureArrays;
+	for (const std::vector<uint32_t>& group : groups)
+	{
+		std::vector<ModelLoadState::DecodedTexture>& textureArray = textureArrays.emplace_back();
+		for (uint32_t index : group)
+		{
+			textureArray.push_back(std::move(smallTextures[index]));
+		}
+	}
+	Publish(aLoadState, [&](ModelLoadState& aState)
+	{
+		// Textures without a partner are moved out of smallTextures only here, they are created on their own.
+		for (ModelLoadState::DecodedTexture& texture : smallTextures)
+		{
+			if (texture.Image)
+			{
+				aState.Textures.push_back(std::move(texture));
+			}
+		}
+		std::move(textureArrays.begin(), textureArrays.end(), std::back_inserter(aState.TextureArrays));
+		aState.IsDone = true;
+	});
+}
+
+bool Model::Import(const std::weak_ptr<ModelLoadState>& aLoadState, const std::string& aPath, const std::wstring& aCachePath, UINT64 aSourceHash, std::vector<MaterialDesc>& aMaterials)
 {
 	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(aPath.data(), aiProcess_Triangulate | aiProcess_ConvertToLeftHanded | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+	const aiScene* scene = importer.ReadFile(aPath.data(), sImportFlags);
 
 	ASSERT(scene != nullptr && (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) == 0 && scene->mRootNode != nullptr, "Model is not loaded.");
 
+	// Gather the meshes in node order first so the cache order stays deterministic, then convert them in parallel.
+	// Every mesh is handed over as soon as it is ready, so the first ones can be drawn while the rest converts.
+	std::vector<NodeDesc> nodes;
+	std::vector<std::pair<const aiMesh*, UINT32>> meshNodes;
+	ProcessNode(scene->mRootNode, scene, TransformHierarchy::sNoParent, nodes, meshNodes);
+
+	// A mesh referenced by several nodes, or repeated with the same content, is converted once and gets one instance
+	// per node. A copy that only differs by a translation baked into its vertices is an instance too, under a new
+	// child of its node that holds the translation. Such instances are numbered after the nodes until the children
+	// are added.
+	std::vector<const aiMesh*> sourceMeshes;
+	std::vector<aiVector3D> sourceMeshMinPositions;
+	std::vector<std::vector<UINT32>> sourceMeshNodes;
+	std::multimap<UINT64, size_t> sourceMeshesByHash;
+	std::vector<std::pair<UINT32, aiVector3D>> translations;
+	for (const auto& [sourceMesh, nodeIndex] : meshNodes)
+	{
+		aiVector3D minPosition = GetMinPosition(sourceMesh);
+		UINT64 hash = HashSourceMesh(sourceMesh, minPosition);
+		auto [first, last] = sourceMeshesByHash.equal_range(hash);
+		auto sameMesh = std::find_if(first, last, [&](const auto& aEntry) { return IsSameSourceMesh(sourceMeshes[aEntry.second], sourceMeshMinPositions[aEntry.second], sourceMesh, minPosition); });
+		if (sameMesh != last)
+		{
+			aiVector3D offset = minPosition - sourceMeshMinPositions[sameMesh->second];
+			if (sourceMeshes[sameMesh->second] == sourceMesh || offset == aiVector3D())
+			{
+				sourceMeshNodes[sameMesh->second].push_back(nodeIndex);
+			}
+			else
+			{
+				sourceMeshNodes[sameMesh->second].push_back(static_cast<UINT32>(nodes.size() + translations.size()));
+				translations.emplace_back(nodeIndex, offset);
+			}
+			continue;
+		}
+
+		sourceMeshesByHash.emplace(hash, sourceMeshes.size());
+		sourceMeshes.push_back(sourceMesh);
+		sourceMeshMinPositions.push_back(minPosition);
+		sourceMeshNodes.push_back({ nodeIndex });
+	}
+	std::vector<UINT32> newNodeIndices = AddTranslationNodes(nodes, translations);
+	for (std::vector<UINT32>& instanceNodes : sourceMeshNodes)
+	{
+		std::transform(instanceNodes.begin(), instanceNodes.end(), instanceNodes.begin(), [&](UINT32 aNodeIndex) { return newNodeIndices[aNodeIndex]; });
+	}
+	Utility::Printf("Model %s: %zu mesh instances share %zu unique meshes, %zu instances are translated copies", aPath.c_str(), meshNodes.size(), sourceMeshes.size(), translations.size());
+
+	aMaterials = ProcessMaterials(scene);
+	if (!Publish(aLoadState, [&](ModelLoadState& aState) { aState.ModelName = scene->mRootNode->mName.C_Str(); aState.Materials = aMaterials; aState.Nodes = nodes; }))
+	{
+		return false;
+	}
+
+	std::vector<MeshData> meshes(sourceMeshes.size());
+	std::vector<VertexWelder::WeldReport> weldReports(sourceMeshes.size());
+	std::vector<MeshOptimizer::OptimizationReport> optimizationReports(sourceMeshes.size());
+	std::vector<size_t> meshIndices(sourceMeshes.size());
+	std::iota(meshIndices.begin(), meshIndices.end(), 0);
+	// Meshes finish in any order but are published in source order, so a model gets the same mesh indices on every
+	// load, like one read from the mesh cache. A finished mesh waits until all meshes before it are published, the
+	// flags and the cursor are guarded by the state mutex.
+	std::vector<bool> isMeshProcessed(sourceMeshes.size(), false);
+	size_t nextMeshToPublish = 0;
+	std::for_each(std::execution::par, meshIndices.begin(), meshIndices.end(), [&](size_t aIndex)
+	{
+		if (aLoadState.expired())
+		{
+			return;
+		}
+
+		meshes[aIndex] = ProcessMesh(sourceMeshes[aIndex], scene);
+		meshes[aIndex].NodeIndices = sourceMeshNodes[aIndex];
+		weldReports[aIndex] = VertexWelder::Weld(meshes[aIndex]);
+		optimizationReports[aIndex] = MeshOptimizer::OptimizeMesh(meshes[aIndex]);
+		meshes[aIndex].Meshlets = MeshletBuilder::Build(meshes[aIndex].Vertices, meshes[aIndex].Indices);
+		MeshSimplifier::BuildLodChain(meshes[aIndex]);
+		Publish(aLoadState, [&](ModelLoadState& aState)
+		{
+			isMeshProcessed[aIndex] = true;
+			for (; nextMeshToPublish < meshes.size() && isMeshProcessed[nextMeshToPublish]; ++nextMeshToPublish)
+			{
+				aState.Meshes.push_back(meshes[nextMeshToPublish]);
+			}
+		});
+	});
+
+	if (aLoadState.expired())
+	{
+		return false;
+	}
+
+	PrintImportReports(meshes, weldReports, optimizationReports);
+
+	if (aSourceHash != 0)
+	{
+		MeshCache::Write(aCachePath, aSourceHash, sImportFlags, scene->mRootNode->mName.C_Str(), aMaterials, meshes, nodes);
+	}
+
+	return true;
+}
+
+void Model::Update()
+{
+	ProcessLoadResults(sFrameUploadBudget);
+	UpdateInstanceBounds();
+}
+
+void Model::UpdateInstanceBounds()
+{
+	// Bounds only change when a node moves or meshes arrive.
+	bool hasMeshesChanged = mBoundsMeshesCount != mMeshes.size();
+	bool hasNodesMoved = mNodes.Update();
+	if (hasMeshesChanged || hasNodesMoved)
+	{
+		mInstanceBounds.Clear();
+		mMeshFirstBounds.clear();
+		for (const Mesh& mesh : mMeshes)
+		{
+			mMeshFirstBounds.push_back(mInstanceBounds.GetCount());
+			const MeshBounds& bounds = mesh.GetBounds();
+			DirectX::XMVECTOR center = DirectX::XMLoadFloat3(&bounds.Center);
+			DirectX::XMVECTOR extents = DirectX::XMLoadFloat3(&bounds.Extents);
+			for (UINT32 nodeIndex : mesh.GetInstanceNodes())
+			{
+				// The box of the transformed box takes the absolute values of the rotation and scale part, the sphere
+				// grows with the largest axis scale.
+				DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4A(&mNodes.GetWorldTransform(nodeIndex));
+				DirectX::XMVECTOR worldExtents = DirectX::XMVectorMultiply(DirectX::XMVectorSplatX(extents), DirectX::XMVectorAbs(world.r[0]));
+				worldExtents = DirectX::XMVectorMultiplyAdd(DirectX::XMVectorSplatY(extents), DirectX::XMVectorAbs(world.r[1]), worldExtents);
+				worldExtents = DirectX::XMVectorMultiplyAdd(DirectX::XMVectorSplatZ(extents), DirectX::XMVectorAbs(world.r[2]), worldExtents);
+				float scale = std::max({ DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[0])), DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[1])), DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[2])) });
+
+				DirectX::XMFLOAT3 worldCenter;
+				DirectX::XMFLOAT3 worldExtents3;
+				DirectX::XMStoreFloat3(&worldCenter, DirectX::XMVector3TransformCoord(center, world));
+				DirectX::XMStoreFloat3(&worldExtents3, worldExtents);
+				mInstanceBounds.Add(worldCenter, worldExtents3, bounds.Radius * scale);
+			}
+		}
+		mBoundsMeshesCount = mMeshes.size();
+	}
+
+	// The hierarchy is built once the model has loaded, moving nodes only refit it.
+	if (IsLoading())
+	{
+		return;
+	}
+
+	if (hasMeshesChanged || mInstanceHierarchy.GetPrimitivesCount() != mInstanceBounds.GetCount())
+	{
+		mInstanceHierarchy.Build(mInstanceBounds);
+		SelectOccluders();
+	}
+	else if (hasNodesMoved)
+	{
+		mInstanceHierarchy.Refit(mInstanceBounds);
+	}
+}
+
+// Large instances hide the most, so instances are taken by the surface of their bounds until the triangle budget is
+// spent. Blended and alpha tested materials let the scene show through and never occlude. Runs once the model has
+// loaded, moving nodes keep the selection.
+void Model::SelectOccluders()
+{
+	std::vector<std::pair<float, UINT32>> candidates;
+	for (UINT32 meshIndex = 0; meshIndex < mMeshes.size(); ++meshIndex)
+	{
+		MaterialID materialID = mMeshes[meshIndex].GetMaterialID();
+		if (Materials::IsTransparent(materialID) || Materials::GetMaterialParams()[materialID].HasOpacityTexture)
+		{
+			continue;
+		}
+
+		UINT32 endBound = mMeshFirstBounds[meshIndex] + static_cast<UINT32>(mMeshes[meshIndex].GetInstanceNodes().size());
+		for (UINT32 bound = mMeshFirstBounds[meshIndex]; bound < endBound; ++bound)
+		{
+			DirectX::XMFLOAT3 extents = mInstanceBounds.GetExtents(bound);
+			candidates.emplace_back(extents.x * extents.y + extents.y * extents.z + extents.z * extents.x, bound);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), std::greater<>());
+
+	mOccluders.clear();
+	UINT32 trianglesCount = 0;
+	for (const auto& [area, bound] : candidates)
+	{
+		UINT32 occluderTrianglesCount = static_cast<UINT32>(mOccluderMeshes[GetBoundMesh(bound)].Indices.size() / 3);
+		if (trianglesCount + occluderTrianglesCount <= sOccluderTrianglesBudget)
+		{
+			mOccluders.push_back(bound);
+			trianglesCount += occluderTrianglesCount;
+		}
+	}
+	std::sort(mOccluders.begin(), mOccluders.end());
+
+	Utility::Printf("Occlusion culling: %zu occluders with %u triangles out of %u instances", mOccluders.size(), trianglesCount, mInstanceBounds.GetCount());
+}
+
+void Model::Cull(DirectX::FXMMATRIX aViewProjection)
+{
+	// While the model loads the hierarchy is not built yet and every bound is tested.
+	FrustumCulling::Frustum frustum = FrustumCulling::ExtractFrustum(aViewProjection);
+	if (mInstanceHierarchy.GetPrimitivesCount() == mInstanceBounds.GetCount())
+	{
+		mInstanceHierarchy.CullFrustum(frustum, mVisibleInstances);
+		std::sort(mVisibleInstances.begin(), mVisibleInstances.end());
+	}
+	else
+	{
+		FrustumCulling::Cull(frustum, mInstanceBounds, mVisibleInstances);
+	}
+
+	// Occluders outside the frustum cannot hide anything inside it. Both lists are sorted, so one pass finds the
+	// visible ones. Occluders test themselves against the buffer too, but their own triangles are never in front of
+	// their bounds.
+	if (mIsOcclusionCullingEnabled && !mOccluders.empty())
+	{
+		mOcclusionBuffer.Clear();
+		auto visibleInstance = mVisibleInstances.begin();
+		for (UINT32 occluder : mOccluders)
+		{
+			visibleInstance = std::lower_bound(visibleInstance, mVisibleInstances.end(), occluder);
+			if (visibleInstance == mVisibleInstances.end())
+			{
+				break;
+			}
+			if (*visibleInstance != occluder)
+			{
+				continue;
+			}
+
+			UINT32 meshIndex = GetBoundMesh(occluder);
+			UINT32 nodeIndex = mMeshes[meshIndex].GetInstanceNodes()[occluder - mMeshFirstBounds[meshIndex]];
+			DirectX::XMMATRIX objectToClip = DirectX::XMMatrixMultiply(DirectX::XMLoadFloat4x4A(&mNodes.GetWorldTransform(nodeIndex)), aViewProjection);
+			const OcclusionCulling::OccluderMesh& occluderMesh = mOccluderMeshes[meshIndex];
+			mOcclusionBuffer.RenderOccluder(occluderMesh.Positions, occluderMesh.Indices, objectToClip);
+		}
+		mOcclusionBuffer.Cull(mInstanceBounds, mVisibleInstances, aViewProjection);
+	}
+
+	// Bounds are grouped by mesh in mesh order and the visible indices are sorted, so one pass gathers the visible
+	// instances of every mesh. They stay contiguous in the instance buffer, every mesh is one instanced draw.
+	mInstanceTransforms.clear();
+	auto visibleInstance = mVisibleInstances.begin();
+	UINT32 firstBound = 0;
+	for (Mesh& mesh : mMeshes)
+	{
+		const std::vector<UINT32>& instanceNodes = mesh.GetInstanceNodes();
+		UINT32 endBound = firstBound + static_cast<UINT32>(instanceNodes.size());
+		UINT32 firstInstance = static_cast<UINT32>(mInstanceTransforms.size());
+		for (; visibleInstance != mVisibleInstances.end() && *visibleInstance < endBound; ++visibleInstance)
+		{
+			mInstanceTransforms.push_back(mNodes.GetWorldTransform(instanceNodes[*visibleInstance - firstBound]));
+		}
+		mesh.SetInstances(firstInstance, static_cast<UINT32>(mInstanceTransforms.size()) - firstInstance);
+		firstBound = endBound;
+	}
+
+	if (!mInstanceTransforms.empty())
+	{
+		UINT64 sizeInBytes = mInstanceTransforms.size() * sizeof(DirectX::XMFLOAT4X4A);
+		mInstanceBuffer.Reserve(L"Instance transforms", sizeInBytes);
+		memcpy(mInstanceBuffer.GetCpuAddress(), mInstanceTransforms.data(), sizeInBytes);
+	}
+}
+
+UINT32 Model::GetBoundMesh(UINT32 aBoundIndex) const
+{
+	return static_cast<UINT32>(std::upper_bound(mMeshFirstBounds.begin(), mMeshFirstBounds.end(), aBoundIndex) - mMeshFirstBounds.begin()) - 1;
+}
+
+bool Model::Pick(const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, PickResult& aResult)
+{
+	if (IsLoading() || mInstanceHierarchy.GetPrimitivesCount() != mInstanceBounds.GetCount())
+	{
+		return false;
+	}
+
+	// The ray is moved into the space of every candidate instance without normalizing the direction, so distances
+	// stay comparable between instances.
+	DirectX::XMVECTOR origin = DirectX::XMLoadFloat3(&aOrigin);
+	DirectX::XMVECTOR direction = DirectX::XMLoadFloat3(&aDirection);
+	bool isHit = false;
+	mInstanceHierarchy.IntersectRay(aOrigin, aDirection, FLT_MAX, [&](std::span<const UINT32> aInstances, float aMaxDistance)
+	{
+		for (UINT32 instance : aInstances)
+		{
+			UINT32 meshIndex = GetBoundMesh(instance);
+			UINT32 nodeIndex = mMeshes[meshIndex].GetInstanceNodes()[instance - mMeshFirstBounds[meshIndex]];
+			DirectX::XMMATRIX toMesh = DirectX::XMMatrixInverse(nullptr, DirectX::XMLoadFloat4x4A(&mNodes.GetWorldTransform(nodeIndex)));
+
+			DirectX::XMFLOAT3 meshOrigin, meshDirection;
+			DirectX::XMStoreFloat3(&meshOrigin, DirectX::XMVector3TransformCoord(origin, toMesh));
+			DirectX::XMStoreFloat3(&meshDirection, DirectX::XMVector3TransformNormal(direction, toMesh));
+			RayPicking::TriangleHit hit;
+			if (mPickMeshes[meshIndex].Intersect(meshOrigin, meshDirection, aMaxDistance, hit))
+			{
+				aMaxDistance = hit.Distance;
+				aResult = { meshIndex, nodeIndex, mMeshes[meshIndex].GetMaterialID(), hit.Triangle, DirectX::XMFLOAT3(1.0f - hit.U - hit.V, hit.U, hit.V), hit.Distance };
+				isHit = true;
+			}
+		}
+		return aMaxDistance;
+	});
+	return isHit;
+}
+
+void Model::ProcessLoadResults(UINT64 aUploadBudgetInBytes)
+{
+	if (!mLoadState)
+	{
+		return;
+	}
+
+	// Take what fits into the budget and release the lock before touching the GPU.
+	std::vector<MaterialDesc> materials;
+	std::vector<NodeDesc> nodes;
+	std::vector<MeshData> meshes;
+	std::vector<ModelLoadState::DecodedTexture> textures;
+	std::vector<std::vector<ModelLoadState::DecodedTexture>> textureArrays;
+	bool isDone = false;
+	{
+		std::lock_guard<std::mutex> lock(mLoadState->Mutex);
 #ifdef _DEBUG
-	mName = scene->mRootNode->mName.C_Str();
+		mName = mLoadState->ModelName;
 #endif // _DEBUG
+		materials.swap(mLoadState->Materials);
+		nodes.swap(mLoadState->Nodes);
+
+		UINT64 uploadSizeInBytes = 0;
+		while (!mLoadState->Meshes.empty() && uploadSizeInBytes < aUploadBudgetInBytes)
+		{
+			const MeshData& mesh = mLoadState->Meshes.front();
+			uploadSizeInBytes += mesh.Vertices.size() * sizeof(Vertex) + mesh.Indices.size() * sizeof(UINT32);
+			meshes.push_back(std::move(mLoadState->Meshes.front()));
+			mLoadState->Meshes.pop_front();
+		}
+
+		while (!mLoadState->Textures.empty() && uploadSizeInBytes < aUploadBudgetInBytes)
+		{
+			const ModelLoadState::DecodedTexture& texture = mLoadState->Textures.front();
+			uploadSizeInBytes += texture.Image ? texture.Image->GetPixelsSize() : 0;
+			textures.push_back(std::move(mLoadState->Textures.front()));
+			mLoadState->Textures.pop_front();
+		}
+
+		while (!mLoadState->TextureArrays.empty() && uploadSizeInBytes < aUploadBudgetInBytes)
+		{
+			for (const ModelLoadState::DecodedTexture& texture : mLoadState->TextureArrays.front())
+			{
+				uploadSizeInBytes += texture.Image->GetPixelsSize();
+			}
+			textureArrays.push_back(std::move(mLoadState->TextureArrays.front()));
+			mLoadState->TextureArrays.pop_front();
+		}
+
+		isDone = mLoadState->IsDone && mLoadState->Meshes.empty() && mLoadState->Textures.empty() && mLoadState->TextureArrays.empty();
+	}
+
+	if (!materials.empty())
+	{
+		RegisterMaterials(materials);
+	}
+
+	// Nodes are published together with the materials, before any mesh that refers to them.
+	for (const NodeDesc& node : nodes)
+	{
+		mNodes.AddNode(node.ParentIndex, node.LocalTransform);
+	}
+
+	// Meshes and textures taken this frame share one upload batch, so they cost one submit and one fence wait.
+	UploadBatch uploadBatch;
+	if (!meshes.empty())
+	{
+		for (const MeshData& mesh : meshes)
+		{
+			AddMesh(mesh.Vertices, CreateIndexBuffer(mesh.Indices, mesh.Vertices.size(), uploadBatch), mesh.Meshlets, mesh.Lods, mesh.Bounds, mesh.MaterialIndex, mesh.NodeIndices, mesh.Name.c_str(), uploadBatch);
+
+			std::vector<DirectX::XMFLOAT3> positions(mesh.Vertices.size());
+			std::transform(mesh.Vertices.begin(), mesh.Vertices.end(), positions.begin(), [](const Vertex& aVertex) { return aVertex.position; });
+			auto lod0Indices = mesh.Indices.begin() + mesh.Lods[0].IndexOffset;
+			mPickMeshes.emplace_back(std::move(positions), std::vector<UINT32>(lod0Indices, lod0Indices + mesh.Lods[0].IndicesCount));
+
+			// Occluders use the coarsest LOD that stays within a percent of the mesh size, with only the vertices it
+			// references.
+			const MeshLod* occluderLod = &mesh.Lods[0];
+			for (const MeshLod& lod : mesh.Lods)
+			{
+				if (lod.Error <= 0.01f * mesh.Bounds.Radius)
+				{
+					occluderLod = &lod;
+				}
+			}
+			OcclusionCulling::OccluderMesh& occluderMesh = mOccluderMeshes.emplace_back();
+			std::vector<UINT32> remap(mesh.Vertices.size(), UINT32_MAX);
+			for (UINT32 i = 0; i < occluderLod->IndicesCount; ++i)
+			{
+				UINT32 vertex = mesh.Indices[occluderLod->IndexOffset + i];
+				if (remap[vertex] == UINT32_MAX)
+				{
+					remap[vertex] = static_cast<UINT32>(occluderMesh.Positions.size());
+					occluderMesh.Positions.push_back(mesh.Vertices[vertex].position);
+				}
+				occluderMesh.Indices.push_back(remap[vertex]);
+			}
+		}
+	}
+
+	auto bindTexture = [&](const std::wstring& aPath, Texture* aTexture)
+	{
+		auto [first, last] = mLoadState->PendingTextures.equal_range(aPath);
+		for (auto it = first; it != last && aTexture; ++it)
+		{
+			Materials::SetTexture(it->second.first, it->second.second, aTexture);
+		}
+		mLoadState->PendingTextures.erase(first, last);
+	};
+	for (const ModelLoadState::DecodedTexture& decodedTexture : textures)
+	{
+		const std::wstring* streamPath = decodedTexture.CachePath.empty() ? nullptr : &decodedTexture.CachePath;
+		bindTexture(decodedTexture.Path, decodedTexture.Image ? Texture::CreateTexture(decodedTexture.Path, decodedTexture.Image.get(), &uploadBatch, streamPath, decodedTexture.Type) : nullptr);
+	}
+	for (const std::vector<ModelLoadState::DecodedTexture>& textureArray : textureArrays)
+	{
+		std::vector<std::wstring> paths;
+		std::vector<const DirectX::ScratchImage*> images;
+		for (const ModelLoadState::DecodedTexture& decodedTexture : textureArray)
+		{
+			paths.push_back(decodedTexture.Path);
+			images.push_back(decodedTexture.Image.get());
+		}
+		std::vector<Texture*> arrayTextures = Texture::CreateTextureArray(paths, images, uploadBatch);
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			bindTexture(paths[i], arrayTextures[i]);
+		}
+	}
+	if (!meshes.empty() || !textures.empty() || !textureArrays.empty())
+	{
+		auto submitStartTime = std::chrono::high_resolution_clock::now();
+		uploadBatch.Submit();
+		std::chrono::duration<double, std::milli> submitTime = std::chrono::high_resolution_clock::now() - submitStartTime;
+		mLoadState->UploadWaitTime += submitTime.count();
+		++mLoadState->UploadBatchesCount;
+	}
+	mLoadState->TexturesCount += static_cast<UINT32>(textures.size());
+	for (const std::vector<ModelLoadState::DecodedTexture>& textureArray : textureArrays)
+	{
+		mLoadState->TexturesCount += static_cast<UINT32>(textureArray.size());
+	}
+
+	if (!meshes.empty() && !mLoadState->HasFirstMesh)
+	{
+		mLoadState->HasFirstMesh = true;
+		std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - mLoadState->StartTime;
+		Utility::Printf("Model %s: first meshes renderable after %.2f ms", mLoadState->Path.c_str(), time.count());
+	}
+
+	if (isDone)
+	{
+		// The loader skips textures that exist when it starts decoding, some of them may have been created by another
+		// model only after this one registered its materials. They are in the register by now.
+		while (!mLoadState->PendingTextures.empty())
+		{
+			std::wstring path = mLoadState->PendingTextures.begin()->first;
+			bindTexture(path, Texture::FindTexture(path));
+		}
+
+		std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - mLoadState->StartTime;
+		Utility::Printf("Model %s loaded %s in %.2f ms", mLoadState->Path.c_str(), mLoadState->IsCached ? "from mesh cache" : "with Assimp", loadTime.count());
+		Utility::Printf("    Uploads: %u textures, %u upload batches, %.2f ms waiting for them", mLoadState->TexturesCount, mLoadState->UploadBatchesCount, mLoadState->UploadWaitTime);
+		PrintLoadStatistics(mLoadState->Path);
+		mLoadState.reset();
+	}
+}
 
-	ProcessMaterials(scene);
-	ProcessNode(scene->mRootNode, scene);
+void Model::PrintLoadStatistics(const std::string& aPath) const
+{
+	UINT64 indexBufferBytes = 0, wideIndexBufferBytes = 0, instancesCount = 0;
+	UINT64 lodTrianglesCounts[MeshSimplifier::sMaxLodsCount] = {};
+	MeshletBuilder::Statistics meshletStatistics;
+	for (const Mesh& mesh : mMeshes)
+	{
+		indexBufferBytes += mesh.GetIndexBufferSizeInBytes();
+		wideIndexBufferBytes += mesh.GetIndicesCount() * sizeof(UINT32);
+		meshletStatistics.Add(mesh.GetMeshlets());
+		instancesCount += mesh.GetInstanceNodes().size();
+
+		// Meshes that stop simplifying early draw their last level at every coarser one.
+		for (UINT32 i = 0; i < MeshSimplifier::sMaxLodsCount; ++i)
+		{
+			const std::vector<MeshLod>& lods = mesh.GetLods();
+			lodTrianglesCounts[i] += lods[std::min<size_t>(i, lods.size() - 1)].IndicesCount / 3;
+		}
+	}
+	Utility::Printf("Model %s index buffers: %.1f KB, %.1f KB with 32-bit indices", aPath.c_str(), indexBufferBytes / 1024.0, wideIndexBufferBytes / 1024.0);
+	Utility::Printf("Model %s triangles per LOD: %llu, %llu, %llu, %llu, %llu", aPath.c_str(),
+		lodTrianglesCounts[0], lodTrianglesCounts[1], lodTrianglesCounts[2], lodTrianglesCounts[3], lodTrianglesCounts[4]);
+	meshletStatistics.Print(aPath.c_str());
+	Utility::Printf("Model %s draws: %zu instanced draws for %llu instances", aPath.c_str(), mMeshes.size(), instancesCount);
+	GeometryArena::PrintStatistics();
 }
 
-void Model::ProcessNode(const aiNode* aNode, const aiScene* aScene)
+void Model::PrintImportReports(const std::vector<MeshData>& aMeshes, const std::vector<VertexWelder::WeldReport>& aWeldReports, const std::vector<MeshOptimizer::OptimizationReport>& aOptimizationReports)
 {
+	// Totals are weighted by triangles for the ACMR and by vertices for the ATVR.
+	double trianglesCount = 0.0, verticesCount = 0.0;
+	double acmrBefore = 0.0, acmrAfter = 0.0, atvrBefore = 0.0, atvrAfter = 0.0;
+	UINT64 verticesBeforeWelding = 0, verticesAfterWelding = 0;
+	for (size_t i = 0; i < aMeshes.size(); ++i)
+	{
+		const VertexWelder::WeldReport& weldReport = aWeldReports[i];
+		const MeshOptimizer::OptimizationReport& report = aOptimizationReports[i];
+		Utility::Printf("Mesh %s: vertices %u -> %u (duplication %.2fx, %u degenerate triangles), ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", aMeshes[i].Name.c_str(),
+			weldReport.VerticesBefore, weldReport.VerticesAfter, weldReport.GetDuplicationRatio(), weldReport.DegenerateTriangles,
+			report.Before.ACMR, report.After.ACMR, report.Before.ATVR, report.After.ATVR);
+
+		double triangles = static_cast<double>(aMeshes[i].Indices.size() / 3);
+		double vertices = static_cast<double>(aMeshes[i].Vertices.size());
+		trianglesCount += triangles;
+		verticesCount += vertices;
+		acmrBefore += report.Before.ACMR * triangles;
+		acmrAfter += report.After.ACMR * triangles;
+		atvrBefore += report.Before.ATVR * vertices;
+		atvrAfter += report.After.ATVR * vertices;
+		verticesBeforeWelding += weldReport.VerticesBefore;
+		verticesAfterWelding += weldReport.VerticesAfter;
+	}
+
+	if (trianglesCount > 0.0 && verticesCount > 0.0)
+	{
+		Utility::Printf("Model total: vertices %llu -> %llu (duplication %.2fx), ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", verticesBeforeWelding, verticesAfterWelding,
+			static_cast<double>(verticesBeforeWelding) / verticesAfterWelding, acmrBefore / trianglesCount, acmrAfter / trianglesCount, atvrBefore / verticesCount, atvrAfter / verticesCount);
+	}
+}
+
+void Model::ProcessNode(const aiNode* aNode, const aiScene* aScene, UINT32 aParentIndex, std::vector<NodeDesc>& aNodes, std::vector<std::pair<const aiMesh*, UINT32>>& aMeshes)
+{
+	// Assimp matrices transform column vectors and DirectXMath ones row vectors, so the local transform is transposed.
+	NodeDesc node;
+	node.ParentIndex = aParentIndex;
+	for (unsigned int row = 0; row < 4; ++row)
+	{
+		for (unsigned int column = 0; column < 4; ++column)
+		{
+			node.LocalTransform.m[row][column] = aNode->mTransformation[column][row];
+		}
+	}
+
+	UINT32 nodeIndex = static_cast<UINT32>(aNodes.size());
+	aNodes.push_back(node);
+
 	for (unsigned int i = 0; i < aNode->mNumMeshes; ++i)
 	{
-		aiMesh* mesh = aScene->mMeshes[aNode->mMeshes[i]];
-		mMeshes.push_back(ProcessMesh(mesh, aScene));
+		aMeshes.emplace_back(aScene->mMeshes[aNode->mMeshes[i]], nodeIndex);
 	}
 	
 	for (unsigned int i = 0; i < aNode->mNumChildren; i++)
 	{
-		ProcessNode(aNode->mChildren[i], aScene);
+		ProcessNode(aNode->mChildren[i], aScene, nodeIndex, aNodes, aMeshes);
 	}
 }
 
-Mesh Model::ProcessMesh(const aiMesh* aMesh, const aiScene* aScene)
+static MeshBounds ComputeBounds(std::span<const Vertex> aVertices)
 {
-	std::vector<Vertex> vertices(aMesh->mNumVertices);
-	std::vector<unsigned int> indices;
-	std::vector<Texture*> textures(MATERIAL_TEXTURES_COUNT);
+	MeshBounds bounds;
+	if (aVertices.empty())
+	{
+		return bounds;
+	}
 
-	for (unsigned int i = 0; i < aMesh->mNumVertices; ++i)
+	DirectX::XMVECTOR minimum = DirectX::XMLoadFloat3(&aVertices[0].position);
+	DirectX::XMVECTOR maximum = minimum;
+	for (const Vertex& vertex : aVertices)
 	{
-		Vertex& vertex = vertices[i];
+		DirectX::XMVECTOR position = DirectX::XMLoadFloat3(&vertex.position);
+		minimum = DirectX::XMVectorMin(minimum, position);
+		maximum = DirectX::XMVectorMax(maximum, position);
+	}
 
-		vertex.position.x = aMesh->mVertices[i].x;
-		vertex.position.y = aMesh->mVertices[i].y;
-		vertex.position.z = aMesh->mVertices[i].z;
+	DirectX::XMVECTOR center = DirectX::XMVectorScale(DirectX::XMVectorAdd(minimum, maximum), 0.5f);
+	DirectX::XMStoreFloat3(&bounds.Center, center);
+	DirectX::XMStoreFloat3(&bounds.Extents, DirectX::XMVectorScale(DirectX::XMVectorSubtract(maximum, minimum), 0.5f));
 
-		vertex.normal.x = aMesh->mNormals[i].x;
-		vertex.normal.y = aMesh->mNormals[i].y;
-		vertex.normal.z = aMesh->mNormals[i].z;
+	// The farthest vertex from the box center, never more than the half diagonal.
+	float radiusSquared = 0.0f;
+	for (const Vertex& vertex : aVertices)
+	{
+		DirectX::XMVECTOR offset = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&vertex.position), center);
+		radiusSquared = std::max(radiusSquared, DirectX::XMVectorGetX(DirectX::XMVector3LengthSq(offset)));
+	}
+	bounds.Radius = std::sqrt(radiusSquared);
+	return bounds;
+}
 
-		vertex.tangent.x = aMesh->mTangents[i].x;
-		vertex.tangent.y = aMesh->mTangents[i].y;
-		vertex.tangent.z = aMesh->mTangents[i].z;
+MeshData Model::ProcessMesh(const aiMesh* aMesh, const aiScene* aScene)
+{
+	MeshData meshData;
+	std::vector<Vertex>& vertices = meshData.Vertices;
+	std::vector<UINT32>& indices = meshData.Indices;
 
-		vertex.bitangent.x = aMesh->mBitangents[i].x;
-		vertex.bitangent.y = aMesh->mBitangents[i].y;
-		vertex.bitangent.z = aMesh->mBitangents[i].z;
+	static_assert(sizeof(aiVector3D) == sizeof(DirectX::XMFLOAT3), "Vertex attributes are copied as whole aiVector3D values.");
 
-		if (aMesh->mTextureCoords[0])
-		{
-			vertex.texCoord.x = aMesh->mTextureCoords[0][i].x;
-			vertex.texCoord.y = aMesh->mTextureCoords[0][i].y;
-		}
-		else
-		{
-			vertex.texCoord = DirectX::XMFLOAT2(0.0f, 0.0f);
-		}
+	vertices.resize(aMesh->mNumVertices);
+	const aiVector3D* texCoords = aMesh->mTextureCoords[0];
+	for (unsigned int i = 0; i < aMesh->mNumVertices; ++i)
+	{
+		Vertex& vertex = vertices[i];
+
+		memcpy(&vertex.position, &aMesh->mVertices[i], sizeof(DirectX::XMFLOAT3));
+		memcpy(&vertex.normal, &aMesh->mNormals[i], sizeof(DirectX::XMFLOAT3));
+		memcpy(&vertex.tangent, &aMesh->mTangents[i], sizeof(DirectX::XMFLOAT3));
+		memcpy(&vertex.bitangent, &aMesh->mBitangents[i], sizeof(DirectX::XMFLOAT3));
+
+		vertex.texCoord = texCoords ? DirectX::XMFLOAT2(texCoords[i].x, texCoords[i].y) : DirectX::XMFLOAT2(0.0f, 0.0f);
 	}
 
-	indices.reserve(aMesh->mNumFaces);
+	// Meshes are drawn as triangle lists, point and line primitives left after triangulation are skipped.
+	indices.reserve(aMesh->mNumFaces * 3);
 	for (unsigned int i = 0; i < aMesh->mNumFaces; ++i)
 	{
 		const aiFace& face = aMesh->mFaces[i];
-		for (unsigned int j = 0; j < face.mNumIndices; ++j)
+		if (face.mNumIndices == 3)
 		{
-			indices.push_back(face.mIndices[j]);
+			indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
 		}
 	}
 
-	return Mesh(Buffer(L"Vertices", vertices.size(), sizeof(Vertex), vertices.data(), D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER),
-				Buffer(L"Indices", indices.size(), sizeof(unsigned int), indices.data(), D3D12_RESOURCE_STATE_INDEX_BUFFER),
-				aMesh->mMaterialIndex, aMesh->mName.C_Str()
-				);
+	meshData.Bounds = ComputeBounds(vertices);
+	meshData.MaterialIndex = aMesh->mMaterialIndex;
+	meshData.Name = aMesh->mName.C_Str();
+	return meshData;
+}
+
+// Meshes that fit use 16-bit indices, which halves the index memory and the index fetch bandwidth.
+static bool UseShortIndices(size_t aVerticesCount)
+{
+	return aVerticesCount <= 0x10000;
+}
+
+GeometryArena::Allocation Model::CreateIndexBuffer(std::span<const UINT32> aIndices, size_t aVerticesCount, UploadBatch& aUploadBatch)
+{
+	if (!UseShortIndices(aVerticesCount))
+	{
+		GeometryArena::Allocation indices = GeometryArena::Allocate(GeometryArena::Pool::Indices, aIndices.size_bytes(), sizeof(UINT32));
+		GeometryArena::Upload(indices, aIndices.data(), aUploadBatch);
+		return indices;
+	}
+
+	std::vector<UINT16> shortIndices(aIndices.begin(), aIndices.end());
+	GeometryArena::Allocation indices = GeometryArena::Allocate(GeometryArena::Pool::Indices, shortIndices.size() * sizeof(UINT16), sizeof(UINT16));
+	GeometryArena::Upload(indices, shortIndices.data(), aUploadBatch);
+	return indices;
+}
+
+void Model::AddMesh(std::span<const Vertex> aVertices, GeometryArena::Allocation&& aIndices, std::span<const Meshlet> aMeshlets, std::span<const MeshLod> aLods, const MeshBounds& aBounds, MaterialID aMaterialID, std::span<const UINT32> aInstanceNodes, const char* aName, UploadBatch& aUploadBatch)
+{
+	MeshConstants meshConstants;
+	UINT indexSize = UseShortIndices(aVertices.size()) ? sizeof(UINT16) : sizeof(UINT32);
+
+	// Virtual texturing requests the tiles under these bounds.
+	DirectX::XMFLOAT4 texCoordBounds(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const Vertex& vertex : aVertices)
+	{
+		texCoordBounds.x = std::min(texCoordBounds.x, vertex.texCoord.x);
+		texCoordBounds.y = std::min(texCoordBounds.y, vertex.texCoord.y);
+		texCoordBounds.z = std::max(texCoordBounds.z, vertex.texCoord.x);
+		texCoordBounds.w = std::max(texCoordBounds.w, vertex.texCoord.y);
+	}
+
+	if (mVertexFormat == VertexFormat::Full)
+	{
+		GeometryArena::Allocation vertices = GeometryArena::Allocate(GeometryArena::Pool::Vertices, aVertices.size_bytes(), sizeof(Vertex));
+		GeometryArena::Upload(vertices, aVertices.data(), aUploadBatch);
+		mMeshes.push_back(Mesh(std::move(vertices), sizeof(Vertex), std::move(aIndices), indexSize, mFirstMaterialID + aMaterialID, meshConstants, aMeshlets, aLods, aBounds, texCoordBounds, aInstanceNodes, aName));
+		return;
+	}
+
+	// The upload batch copies the data into its staging memory right away, so the compact vertices can be temporary.
+	std::vector<CompactVertex> compactVertices;
+	meshConstants = VertexCompression::EncodeMesh(aVertices, compactVertices);
+
+	GeometryArena::Allocation vertices = GeometryArena::Allocate(GeometryArena::Pool::Vertices, compactVertices.size() * sizeof(CompactVertex), sizeof(CompactVertex));
+	GeometryArena::Upload(vertices, compactVertices.data(), aUploadBatch);
+	mMeshes.push_back(Mesh(std::move(vertices), sizeof(CompactVertex), std::move(aIndices), indexSize, mFirstMaterialID + aMaterialID, meshConstants, aMeshlets, aLods, aBounds, texCoordBounds, aInstanceNodes, aName));
 }
 
-void Model::ProcessMaterials(const aiScene* aScene)
+std::vector<MaterialDesc> Model::ProcessMaterials(const aiScene* aScene)
 {
+	std::vector<MaterialDesc> materials(aScene->mNumMaterials);
+
 	for (unsigned int materialID = 0; materialID < aScene->mNumMaterials; ++materialID)
 	{
 		aiMaterial* material = aScene->mMaterials[materialID];
-
-		std::vector<Texture*> textures(MATERIAL_TEXTURES_COUNT);
+		MaterialDesc& materialDesc = materials[materialID];
 
 		for (unsigned int textureType = aiTextureType_NONE + 1; textureType <= MATERIAL_TEXTURES_COUNT; ++textureType)
 		{
@@ -108,9 +1083,7 @@ void Model::ProcessMaterials(const aiScene* aScene)
 			{
 				aiString string;
 				material->GetTexture((aiTextureType)textureType, 0, &string);
-				std::string fileName = string.C_Str();
-				std::wstring texturePath = mDirectory + std::wstring(fileName.begin(), fileName.end());
-				textures[textureType - 1] = Texture::FindOrCreateTexture(texturePath);
+				materialDesc.TextureFiles[textureType - 1] = string.C_Str();
 			}
 		}
 
@@ -128,7 +1101,7 @@ void Model::ProcessMaterials(const aiScene* aScene)
 				result = realParam; \
 		}
 
-		MaterialParams params;
+		MaterialParams& params = materialDesc.Params;
 		GET_MATERIAL_PARAM_COLOR_4D(params.DiffuseColor, AI_MATKEY_COLOR_DIFFUSE);
 		GET_MATERIAL_PARAM_COLOR_4D(params.AmbientColor, AI_MATKEY_COLOR_AMBIENT);
 		GET_MATERIAL_PARAM_COLOR_4D(params.SpecularColor, AI_MATKEY_COLOR_SPECULAR);
@@ -140,16 +1113,53 @@ void Model::ProcessMaterials(const aiScene* aScene)
 		GET_MATERIAL_PARAM_REAL(params.SpecularScale, AI_MATKEY_SHININESS_STRENGTH);
 		GET_MATERIAL_PARAM_REAL(params.BumpIntensity, AI_MATKEY_BUMPSCALING);
 
-		params.HasAmbientTexture = textures[aiTextureType_AMBIENT - 1] != nullptr;
-		params.HasEmissiveTexture = textures[aiTextureType_EMISSIVE - 1] != nullptr;
-		params.HasDiffuseTexture = textures[aiTextureType_DIFFUSE - 1] != nullptr;
-		params.HasSpecularTexture = textures[aiTextureType_SPECULAR - 1] != nullptr;
-		params.HasSpecularPowerTexture = textures[aiTextureType_SHININESS - 1] != nullptr;
-		params.HasNormalTexture = textures[aiTextureType_NORMALS - 1] != nullptr;
-		params.HasBumpTexture = textures[aiTextureType_HEIGHT - 1] != nullptr;
-		params.HasOpacityTexture = textures[aiTextureType_OPACITY - 1] != nullptr;
+		const auto& textureFiles = materialDesc.TextureFiles;
+		params.HasAmbientTexture = !textureFiles[aiTextureType_AMBIENT - 1].empty();
+		params.HasEmissiveTexture = !textureFiles[aiTextureType_EMISSIVE - 1].empty();
+		params.HasDiffuseTexture = !textureFiles[aiTextureType_DIFFUSE - 1].empty();
+		params.HasSpecularTexture = !textureFiles[aiTextureType_SPECULAR - 1].empty();
+		params.HasSpecularPowerTexture = !textureFiles[aiTextureType_SHININESS - 1].empty();
+		params.HasNormalTexture = !textureFiles[aiTextureType_NORMALS - 1].empty();
+		params.HasBumpTexture = !textureFiles[aiTextureType_HEIGHT - 1].empty();
+		params.HasOpacityTexture = !textureFiles[aiTextureType_OPACITY - 1].empty();
 
-		Materials::AddMaterial(std::move(params), std::move(textures), material->GetName().C_Str());
+		materialDesc.Name = material->GetName().C_Str();
+	}
+
+	return materials;
+}
+
+void Model::RegisterMaterials(const std::vector<MaterialDesc>& aMaterials)
+{
+	// Material indices of the meshes are local to the model, the registered IDs start after all earlier materials.
+	mFirstMaterialID = Materials::GetMaterialCount();
+
+	for (const MaterialDesc& materialDesc : aMaterials)
+	{
+		MaterialParams params = materialDesc.Params;
+		std::vector<Texture*> textures(MATERIAL_TEXTURES_COUNT);
+		std::vector<std::pair<std::wstring, aiTextureType>> pendingTextures;
+		for (unsigned int i = 0; i < MATERIAL_TEXTURES_COUNT; ++i)
+		{
+			const std::string& fileName = materialDesc.TextureFiles[i];
+			if (!fileName.empty())
+			{
+				// A texture that is still loading stays unbound and its flag off, so the material color is used.
+				std::wstring texturePath = mDirectory + std::wstring(fileName.begin(), fileName.end());
+				textures[i] = Texture::FindTexture(texturePath);
+				if (textures[i] == nullptr)
+				{
+					Materials::SetTextureFlag(params, static_cast<aiTextureType>(i + 1), false);
+					pendingTextures.emplace_back(texturePath, static_cast<aiTextureType>(i + 1));
+				}
+			}
+		}
+
+		MaterialID materialID = Materials::AddMaterial(std::move(params), std::move(textures), materialDesc.Name.c_str());
+		for (const auto& [texturePath, textureType] : pendingTextures)
+		{
+			mLoadState->PendingTextures.emplace(texturePath, std::make_pair(materialID, textureType));
+		}
 	}
 }
 
@@ -162,15 +1172,136 @@ void Model::LoadMaterialTextures(const aiMaterial* aMaterial, aiTextureType aTex
 		aMaterial->GetTexture(aTextureType, 0, &string);
 		std::string fileName = string.C_Str();
 		std::wstring texturePath = mDirectory + std::wstring(fileName.begin(), fileName.end());
-		aTextures[aTextureType - 1] = Texture::FindOrCreateTexture(texturePath);
+		aTextures[aTextureType - 1] = Texture::FindOrCreateTexture(texturePath, aTextureType);
+	}
+}
+
+void Model::SelectLods(const DirectX::XMFLOAT3& aCameraPosition, float aPixelsPerUnit)
+{
+	for (Mesh& mesh : mMeshes)
+	{
+		mesh.SelectLod(aCameraPosition, std::span(mInstanceTransforms).subspan(mesh.GetFirstInstance(), mesh.GetInstancesCount()), aPixelsPerUnit);
 	}
 }
 
-void Model::Render(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList, UINT aSRVRootParameterIndex, UINT aMaterialIDRootParameterIndex) const
+void Model::RequestTextureMips() const
 {
-	PIX_SCOPED_EVENT(void, commandList.Get(), 0x0000FF, "Draw model: %s", mName.c_str());
 	for (const Mesh& mesh : mMeshes)
 	{
-		mesh.Render(commandList, aSRVRootParameterIndex, aMaterialIDRootParameterIndex);
+		if (mesh.GetInstancesCount() == 0)
+		{
+			continue;
+		}
+		for (const Texture* texture : Materials::GetTextures(mesh.GetMaterialID()))
+		{
+			if (texture)
+			{
+				TextureStreaming::RequestMip(texture, mesh.GetProjectedSize(), mesh.GetTexCoordBounds());
+				VirtualTexturing::RequestTiles(texture, mesh.GetProjectedSize(), mesh.GetTexCoordBounds());
+			}
+		}
+	}
+}
+
+void Model::MarkUsedResources() const
+{
+	for (const Mesh& mesh : mMeshes)
+	{
+		if (mesh.GetInstancesCount() == 0)
+		{
+			continue;
+		}
+		mesh.MarkUsedResources();
+		for (const Texture* texture : Materials::GetTextures(mesh.GetMaterialID()))
+		{
+			if (texture)
+			{
+				texture->MarkUsed();
+			}
+		}
+	}
+}
+
+void Model::SortDraws()
+{
+	// One pipeline state per pass for now, the pipeline field of the key leaves room for more variants.
+	mRenderQueue.Clear();
+	for (UINT32 i = 0; i < mMeshes.size(); ++i)
+	{
+		const Mesh& mesh = mMeshes[i];
+		if (mesh.GetInstancesCount() > 0)
+		{
+			MaterialID materialID = mesh.GetMaterialID();
+			RenderQueue::Pass pass = Materials::IsTransparent(materialID) ? RenderQueue::Pass::Transparent : RenderQueue::Pass::Opaque;
+			mRenderQueue.Add(RenderQueue::MakeKey(pass, static_cast<UINT32>(pass), Materials::GetDescriptorTable(materialID), materialID, mesh.GetNearestDistance()), i);
+		}
+	}
+	mRenderQueue.Sort();
+}
+
+void Model::Render(CommandList& commandList, UINT aSRVRootParameterIndex, UINT aMaterialIDRootParameterIndex, UINT aMeshConstantsRootParameterIndex, UINT aInstancesRootParameterIndex, std::span<ID3D12PipelineState* const> aPipelineStates, UINT32 aFirstDraw, UINT32 aDrawsCount) const
+{
+	const std::vector<RenderQueue::Draw>& draws = mRenderQueue.GetDraws();
+	if (mInstanceTransforms.empty() || aFirstDraw >= draws.size())
+	{
+		return;
+	}
+	auto firstDraw = draws.begin() + aFirstDraw;
+	auto endDraw = aDrawsCount >= draws.size() - aFirstDraw ? draws.end() : firstDraw + aDrawsCount;
+
+	PIX_SCOPED_EVENT(void, commandList.GetNative(), 0x0000FF, "Draw model: %s, draws %u to %u", mName.c_str(), aFirstDraw, static_cast<UINT32>(endDraw - draws.begin()));
+	commandList.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	commandList.SetGraphicsRootShaderResourceView(aInstancesRootParameterIndex, mInstanceBuffer.GetGpuVirtualAddress());
+
+	// Draws come sorted by pipeline, descriptor table and material, and meshes share a few geometry pages, so state is
+	// only set when it differs from the previous draw. Pipelines are compared by index, the null backend has no
+	// pipeline objects.
+	UINT32 boundPipeline = UINT32_MAX;
+	MaterialID boundMaterialID = UINT32_MAX;
+	UINT32 boundDescriptorTable = UINT32_MAX;
+	D3D12_GPU_DESCRIPTOR_HANDLE descriptorHeapStart = Graphics::g_SRVDescriptorHeap ? Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart() : D3D12_GPU_DESCRIPTOR_HANDLE{};
+	D3D12_VERTEX_BUFFER_VIEW boundVertexBufferView = {};
+	D3D12_INDEX_BUFFER_VIEW boundIndexBufferView = {};
+	for (auto draw = firstDraw; draw != endDraw; ++draw)
+	{
+		const Mesh& mesh = mMeshes[draw->Index];
+
+		UINT32 pipeline = RenderQueue::GetPipeline(draw->Key);
+		if (pipeline != boundPipeline)
+		{
+			commandList.SetPipelineState(aPipelineStates[pipeline]);
+			boundPipeline = pipeline;
+		}
+
+		if (mesh.GetMaterialID() != boundMaterialID)
+		{
+			boundMaterialID = mesh.GetMaterialID();
+			commandList.SetGraphicsRoot32BitConstant(aMaterialIDRootParameterIndex, boundMaterialID, 0);
+
+			UINT32 descriptorTable = Materials::GetDescriptorTable(boundMaterialID);
+			if (descriptorTable != boundDescriptorTable)
+			{
+				boundDescriptorTable = descriptorTable;
+				CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle;
+				srvHandle.InitOffsetted(descriptorHeapStart, boundDescriptorTable * MATERIAL_TEXTURES_COUNT * Graphics::g_SRVDescriptorSize);
+				commandList.SetGraphicsRootDescriptorTable(aSRVRootParameterIndex, srvHandle);
+			}
+		}
+
+		const D3D12_VERTEX_BUFFER_VIEW& vertexBufferView = mesh.GetVertexBufferView();
+		if (vertexBufferView.BufferLocation != boundVertexBufferView.BufferLocation || vertexBufferView.StrideInBytes != boundVertexBufferView.StrideInBytes)
+		{
+			commandList.IASetVertexBuffers(0, 1, &vertexBufferView);
+			boundVertexBufferView = vertexBufferView;
+		}
+
+		const D3D12_INDEX_BUFFER_VIEW& indexBufferView = mesh.GetIndexBufferView();
+		if (indexBufferView.BufferLocation != boundIndexBufferView.BufferLocation || indexBufferView.Format != boundIndexBufferView.Format)
+		{
+			commandList.IASetIndexBuffer(&indexBufferView);
+			boundIndexBufferView = indexBufferView;
+		}
+
+		mesh.Render(commandList, aMeshConstantsRootParameterIndex);
 	}
 }
@@ -1,29 +1,130 @@
 #pragma once
 
 #include "Mesh.h"
+#include "BoundingVolumeHierarchy.h"
+#include "DynamicBuffer.h"
+#include "FrustumCulling.h"
+#include "RayPicking.h"
+#include "RenderQueue.h"
+#include "TransformHierarchy.h"
+#include "MeshOptimizer.h"
+#include "OcclusionCulling.h"
+#include "VertexWelder.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <memory>
+#include <span>
+
+class UploadBatch;
+struct ModelLoadState;
+
+// Nearest triangle under a ray, see Model::Pick.
+struct PickResult
+{
+	UINT32 MeshIndex = 0;
+	UINT32 NodeIndex = 0;		// node of the hit instance
+	MaterialID Material = 0;
+	UINT32 Triangle = 0;		// in the LOD 0 indices of the mesh
+	DirectX::XMFLOAT3 Barycentrics = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float Distance = 0.0f;
+};
 
 class Model
 {
+	static constexpr unsigned int sImportFlags = aiProcess_Triangulate | aiProcess_ConvertToLeftHanded | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
+	static constexpr UINT64 sFrameUploadBudget = 16ull * 1024 * 1024;
+	static constexpr UINT32 sOcclusionBufferWidth = 320;
+	static constexpr UINT32 sOcclusionBufferHeight = 180;
+	static constexpr UINT32 sOccluderTrianglesBudget = 16 * 1024;
+
 	std::vector<Mesh> mMeshes;
+	TransformHierarchy mNodes;
+	FrustumCulling::BoundsList mInstanceBounds;		// object space bounds of every instance, grouped by mesh
+	size_t mBoundsMeshesCount = 0;		// meshes covered by mInstanceBounds
+	std::vector<UINT32> mMeshFirstBounds;		// first bound of every mesh in mInstanceBounds
+	BoundingVolumeHierarchy mInstanceHierarchy;		// over mInstanceBounds, built when loading finishes
+	std::vector<UINT32> mVisibleInstances;		// indices into mInstanceBounds
+	std::vector<DirectX::XMFLOAT4X4A> mInstanceTransforms;		// visible instances of this frame, grouped by mesh
+	DynamicBuffer mInstanceBuffer;		// GPU copy of mInstanceTransforms, see MeshConstants::FirstInstance
+	RenderQueue mRenderQueue;			// one draw per mesh with instances, indexed into mMeshes
+	std::vector<RayPicking::TriangleMesh> mPickMeshes;		// CPU copy of the LOD 0 triangles, parallel to mMeshes
+	std::vector<OcclusionCulling::OccluderMesh> mOccluderMeshes;		// CPU copy of a coarse LOD, parallel to mMeshes
+	std::vector<UINT32> mOccluders;		// sorted indices into mInstanceBounds, chosen when loading finishes
+	OcclusionCulling::OcclusionBuffer mOcclusionBuffer = OcclusionCulling::OcclusionBuffer(sOcclusionBufferWidth, sOcclusionBufferHeight);
+	bool mIsOcclusionCullingEnabled = true;
 	std::wstring mDirectory;
+	VertexFormat mVertexFormat = VertexFormat::Compact;
+	MaterialID mFirstMaterialID = 0;
+	std::shared_ptr<ModelLoadState> mLoadState;		// set while the model is loading
 
 #ifdef _DEBUG
 	std::string mName;
 #endif // _DEBUG
 
 private:
-	void LoadModel(const std::string& aPath);
-	void ProcessNode(const aiNode* aNode, const aiScene* aScene);
-	Mesh ProcessMesh(const aiMesh* aMesh, const aiScene* aScene);
-	void ProcessMaterials(const aiScene* aScene);
+	// CPU side of loading, runs on the loader thread and hands results over through aLoadState.
+	static void Load(const std::weak_ptr<ModelLoadState>& aLoadState, const std::string& aPath);
+	static bool Import(const std::weak_ptr<ModelLoadState>& aLoadState, const std::string& aPath, const std::wstring& aCachePath, UINT64 aSourceHash, std::vector<MaterialDesc>& aMaterials);
+	static void ProcessNode(const aiNode* aNode, const aiScene* aScene, UINT32 aParentIndex, std::vector<NodeDesc>& aNodes, std::vector<std::pair<const aiMesh*, UINT32>>& aMeshes);
+	static MeshData ProcessMesh(const aiMesh* aMesh, const aiScene* aScene);
+	static void PrintImportReports(const std::vector<MeshData>& aMeshes, const std::vector<VertexWelder::WeldReport>& aWeldReports, const std::vector<MeshOptimizer::OptimizationReport>& aOptimizationReports);
+	static std::vector<MaterialDesc> ProcessMaterials(const aiScene* aScene);
+
+	// GPU side of loading, runs on the render thread.
+	void ProcessLoadResults(UINT64 aUploadBudgetInBytes);
+	void PrintLoadStatistics(const std::string& aPath) const;
+	void UpdateInstanceBounds();
+	void SelectOccluders();
+	UINT32 GetBoundMesh(UINT32 aBoundIndex) const;
+	void RegisterMaterials(const std::vector<MaterialDesc>& aMaterials);
+	GeometryArena::Allocation CreateIndexBuffer(std::span<const UINT32> aIndices, size_t aVerticesCount, UploadBatch& aUploadBatch);
+	void AddMesh(std::span<const Vertex> aVertices, GeometryArena::Allocation&& aIndices, std::span<const Meshlet> aMeshlets, std::span<const MeshLod> aLods, const MeshBounds& aBounds, MaterialID aMaterialID, std::span<const UINT32> aInstanceNodes, const char* aName, UploadBatch& aUploadBatch);
 	void LoadMaterialTextures(const aiMaterial* aMaterial, aiTextureType aTextureType, std::vector<Texture*>& aTextures);
 
 public:
 	Model() {}
-	Model(const std::string& aPath);
-	void Render(Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList, UINT aSRVRootParameterIndex, UINT aMaterialIDRootParameterIndex) const;
-};
+	// Blocks until the model is fully loaded.
+	Model(const std::string& aPath, VertexFormat aVertexFormat = VertexFormat::Compact);
+
+	// Returns right away and loads on a background thread. Meshes and textures become renderable in Update() as
+	// they arrive, materials are drawn with their colors until their textures are uploaded.
+	static Model LoadAsync(const std::string& aPath, VertexFormat aVertexFormat = VertexFormat::Compact);
+
+	// Moves finished meshes and textures to the GPU, at most sFrameUploadBudget bytes per call, then updates the node
+	// transforms, the bounds of every mesh instance and their hierarchy. Call once per frame.
+	void Update();
+	bool IsLoading() const { return mLoadState != nullptr; }
 
+	// Tests the bounds of every mesh instance against the frustum of aViewProjection, which takes the object space of
+	// the model to clip space, then renders the largest visible occluders into the occlusion buffer and drops the
+	// instances hidden behind them. Gathers the transforms of the visible instances. Call once per frame after Update
+	// and before SelectLods, meshes without visible instances are not drawn.
+	void Cull(DirectX::FXMMATRIX aViewProjection);
+	void SelectLods(const DirectX::XMFLOAT3& aCameraPosition, float aPixelsPerUnit);
+	// Requests the texture mips and virtual texture tiles the visible meshes need at their projected size, call after
+	// SelectLods.
+	void RequestTextureMips() const;
+	// Marks the geometry and textures of the meshes drawn this frame for Residency, call after Cull.
+	void MarkUsedResources() const;
+	// Builds and sorts the draws of this frame, call after SelectLods, which measures the distances.
+	void SortDraws();
+	// Records the sorted draws [aFirstDraw, aFirstDraw + aDrawsCount), all of them by default. Ranges can be recorded
+	// into separate command lists on separate threads, every range binds the state it needs itself. aPipelineStates is
+	// indexed by the pipeline field of the draw keys: the opaque, then the transparent pipeline state.
+	void Render(CommandList& commandList, UINT aSRVRootParameterIndex, UINT aMaterialIDRootParameterIndex, UINT aMeshConstantsRootParameterIndex, UINT aInstancesRootParameterIndex, std::span<ID3D12PipelineState* const> aPipelineStates, UINT32 aFirstDraw = 0, UINT32 aDrawsCount = UINT32_MAX) const;
+	UINT32 GetDrawsCount() const { return mInstanceTransforms.empty() ? 0 : static_cast<UINT32>(mRenderQueue.GetDraws().size()); }
+
+	// Casts the ray aOrigin + t * aDirection, in the object space of the model, against the triangles of every
+	// instance and returns the nearest hit. The instance hierarchy finds the candidates, the triangle hierarchy of a
+	// mesh is built the first time a ray reaches it. Returns false while the model is loading.
+	bool Pick(const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, PickResult& aResult);
+
+	VertexFormat GetVertexFormat() const { return mVertexFormat; }
+	void SetOcclusionCullingEnabled(bool aIsEnabled) { mIsOcclusionCullingEnabled = aIsEnabled; }
+	bool IsOcclusionCullingEnabled() const { return mIsOcclusionCullingEnabled; }
+	// Instances that passed the last Cull.
+	UINT32 GetVisibleInstancesCount() const { return static_cast<UINT32>(mVisibleInstances.size()); }
+	// Local transforms can be changed between frames, world transforms are recomputed in Update().
+	TransformHierarchy& GetNodes() { return mNodes; }
+};
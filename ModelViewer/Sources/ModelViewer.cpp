@@ -1,10 +1,19 @@
 #include "pch.h"
 #include "Application.h"
 #include "Model.h"
+#include "DynamicBuffer.h"
 #include "Camera.h"
+#include "CommandListPool.h"
 #include "Material.h"
 #include "Light.h"
+#include "Texture.h"
+#include "TextureStreaming.h"
+#include "VirtualTexturing.h"
+#include "Residency.h"
 #include <assimp/scene.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 #if _DEBUG
 #include "pix3.h"
@@ -23,6 +32,33 @@ struct PSRootConstants
     UINT32 LightsCount;
 };
 
+// CPU time of the stages of a frame and the commands recorded, summed over the frames after the model finished
+// loading and printed on exit. On the null backend (-headless) nothing waits for a GPU, so the stages are the whole
+// cost of a frame.
+struct FrameProfile
+{
+    enum Stage : UINT32
+    {
+        ModelUpdate,
+        Cull,
+        SelectLods,
+        Streaming,
+        SortDraws,
+        Pick,
+        Lights,
+        Residency,
+        Record,
+        Submit,
+        StagesCount
+    };
+
+    static constexpr const char* sStageNames[StagesCount] = { "Model update", "Cull", "Select LODs", "Streaming", "Sort draws", "Pick", "Lights", "Residency", "Record", "Submit" };
+
+    double Milliseconds[StagesCount] = {};
+    CommandStatistics Commands;
+    UINT64 FramesCount = 0;
+};
+
 class ModelViewer : public IApplication
 {
     DirectX::XMMATRIX m_ModelMatrix;
@@ -38,16 +74,38 @@ class ModelViewer : public IApplication
 
     Microsoft::WRL::ComPtr<ID3D12RootSignature> m_RootSignature;
     Microsoft::WRL::ComPtr<ID3D12PipelineState> m_PipelineState;
+    Microsoft::WRL::ComPtr<ID3D12PipelineState> m_TransparentPipelineState;
 
     Model m_Model;
+    VertexFormat mVertexFormat = VertexFormat::Compact;
 
-    Buffer mMaterialsCBV;
+    DynamicBuffer mMaterialsCBV;       // sized for MAX_MATERIALS_COUNT, rewritten when the params version changes
+    CommandListPool mCommandLists;      // draws are recorded on worker threads, see RenderScene
 
     float m_LastFrameTime;
     float m_CameraSpeed = 10.0f;
+    UINT64 mMaterialsVersion = 0;
+    UINT32 mPickedNode = UINT32_MAX;    // the selection, the instance under the screen center, UINT32_MAX without one
+    UINT32 mPickedMesh = UINT32_MAX;
 
+    FrameProfile mProfile;
+    std::chrono::high_resolution_clock::time_point mStageStartTime;
+    bool mIsProfiledFrame = false;
     bool mIsDone = false;
 
+    // Ranges with fewer draws are not worth a list and a thread of their own.
+    static constexpr UINT32 sMinDrawsPerList = 64;
+    // Memory for streamed texture mips beyond their packed tails.
+    static constexpr UINT64 sTextureStreamingBudget = 256ull << 20;
+    // Slots per row of the virtual texture atlases, 1024 tiles take 9.5 MB in BC1 and 19 MB in BC7.
+    static constexpr UINT32 sVirtualTextureSlotsPerRow = 32;
+
+    void CreateDeviceObjects(void);
+    void SetFrameState(CommandList& aCommandList, const D3D12_CPU_DESCRIPTOR_HANDLE& aRtv, const D3D12_CPU_DESCRIPTOR_HANDLE& aDsv) const;
+    // Adds the time since the previous stage ended to aStage, if this frame is profiled.
+    void EndStage(FrameProfile::Stage aStage);
+    void PrintProfile(void) const;
+
 public:
 
     ModelViewer();
@@ -59,6 +117,7 @@ public:
     void OnKeyEvent(const KeyEvent& keyEvent) override;
     void OnMouseMoved(int aDeltaX, int aDeltaY) override;
     bool IsDone() override { return mIsDone; }
+    bool IsLoading() override { return m_Model.IsLoading(); }
 };
 
 CREATE_APPLICATION(ModelViewer)
@@ -69,32 +128,19 @@ ModelViewer::ModelViewer()
 
 }
 
-void ModelViewer::Startup(void)
+void ModelViewer::CreateDeviceObjects(void)
 {
     // Load the vertex shader.
     Microsoft::WRL::ComPtr<ID3DBlob> vertexShaderBlob;
-    ASSERT_HRESULT(D3DReadFileToBlob(L"VertexShader.cso", &vertexShaderBlob), "Vertex shader compilation failed");
+    const wchar_t* vertexShaderFile = mVertexFormat == VertexFormat::Compact ? L"VertexShader.cso" : L"VertexShaderFull.cso";
+    ASSERT_HRESULT(D3DReadFileToBlob(vertexShaderFile, &vertexShaderBlob), "Vertex shader compilation failed");
 
     // Load the pixel shader.
     Microsoft::WRL::ComPtr<ID3DBlob> pixelShaderBlob;
     ASSERT_HRESULT(D3DReadFileToBlob(L"PixelShader.cso", &pixelShaderBlob), "Pixel shader compilation failed");
 
     // Create the vertex input layout
-    D3D12_INPUT_ELEMENT_DESC inputLayout[] = {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    };
-
-    // Create a root signature.
-    D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
-    featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
-    if (FAILED(Graphics::g_Device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
-    {
-        featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
-    }
+    D3D12_INPUT_LAYOUT_DESC inputLayout = Mesh::GetInputLayout(mVertexFormat);
 
     // Allow input layout and deny unnecessary access to certain pipeline stages.
     D3D12_ROOT_SIGNATURE_FLAGS rootSignatureFlags =
@@ -105,7 +151,7 @@ void ModelViewer::Startup(void)
         //D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
 
     // A single 32-bit constant root parameter that is used by the vertex shader.
-    CD3DX12_ROOT_PARAMETER1 rootParameters[6];
+    CD3DX12_ROOT_PARAMETER1 rootParameters[8];
     rootParameters[0].InitAsConstants(sizeof(Transform) / sizeof(float), 0, 0, D3D12_SHADER_VISIBILITY_VERTEX);
 
     CD3DX12_DESCRIPTOR_RANGE1 ranges[2];
@@ -113,7 +159,12 @@ void ModelViewer::Startup(void)
     ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, MATERIAL_TEXTURES_COUNT + 10);
     //ranges[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);
 
-    rootParameters[1].InitAsDescriptorTable(1, &ranges[0], D3D12_SHADER_VISIBILITY_PIXEL);
+    // The diffuse descriptor of the material table once more, in space 1, where the shader reads it as the integer
+    // page table of a virtual texture.
+    CD3DX12_DESCRIPTOR_RANGE1 materialRanges[2] = { ranges[0] };
+    materialRanges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 10, 1, D3D12_DESCRIPTOR_RANGE_FLAG_NONE, aiTextureType_DIFFUSE - 1);
+
+    rootParameters[1].InitAsDescriptorTable(_countof(materialRanges), materialRanges, D3D12_SHADER_VISIBILITY_PIXEL);
 
     rootParameters[2].InitAsConstantBufferView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_PIXEL); 
 
@@ -124,8 +175,13 @@ void ModelViewer::Startup(void)
 
     rootParameters[5].InitAsConstants(sizeof(PSRootConstants) / sizeof(float), 3, 0, D3D12_SHADER_VISIBILITY_PIXEL);
 
+    rootParameters[6].InitAsConstants(sizeof(MeshConstants) / sizeof(float), 4, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+
+    // Instance transforms of the model, indexed by MeshConstants::FirstInstance + SV_InstanceID.
+    rootParameters[7].InitAsShaderResourceView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+
     CD3DX12_STATIC_SAMPLER_DESC samplerDesc;
-    samplerDesc.Init(0, D3D12_FILTER_MIN_MAG_LINEAR_MIP_POINT);
+    samplerDesc.Init(0, D3D12_FILTER_MIN_MAG_MIP_LINEAR);
 
     CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescription;
     rootSignatureDescription.Init_1_1(_countof(rootParameters), rootParameters, 1, &samplerDesc, rootSignatureFlags);
@@ -133,10 +189,10 @@ void ModelViewer::Startup(void)
     // Serialize the root signature.
     Microsoft::WRL::ComPtr<ID3DBlob> rootSignatureBlob;
     Microsoft::WRL::ComPtr<ID3DBlob> errorBlob;
-    ASSERT_HRESULT(D3DX12SerializeVersionedRootSignature(&rootSignatureDescription, featureData.HighestVersion, &rootSignatureBlob, &errorBlob), "Failed to serialize versioned root signature.");
+    ASSERT_HRESULT(D3DX12SerializeVersionedRootSignature(&rootSignatureDescription, Graphics::GetBackend().GetHighestRootSignatureVersion(), &rootSignatureBlob, &errorBlob), "Failed to serialize versioned root signature.");
 
     // Create the root signature.
-    ASSERT_HRESULT(Graphics::g_Device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(), rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&m_RootSignature)), "Failed to create root signature.");
+    ASSERT_HRESULT(Graphics::GetBackend().CreateRootSignature(rootSignatureBlob.Get(), m_RootSignature), "Failed to create root signature.");
 
     struct PipelineStateStream
     {
@@ -145,6 +201,8 @@ void ModelViewer::Startup(void)
         CD3DX12_PIPELINE_STATE_STREAM_PRIMITIVE_TOPOLOGY PrimitiveTopologyType;
         CD3DX12_PIPELINE_STATE_STREAM_VS VS;
         CD3DX12_PIPELINE_STATE_STREAM_PS PS;
+        CD3DX12_PIPELINE_STATE_STREAM_BLEND_DESC BlendState;
+        CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL DepthStencilState;
         CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL_FORMAT DSVFormat;
         CD3DX12_PIPELINE_STATE_STREAM_RENDER_TARGET_FORMATS RTVFormats;
     } pipelineStateStream;
@@ -154,7 +212,7 @@ void ModelViewer::Startup(void)
     rtvFormats.RTFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
 
     pipelineStateStream.pRootSignature = m_RootSignature.Get();
-    pipelineStateStream.InputLayout = { inputLayout, _countof(inputLayout) };
+    pipelineStateStream.InputLayout = inputLayout;
     pipelineStateStream.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
     pipelineStateStream.VS = CD3DX12_SHADER_BYTECODE(vertexShaderBlob.Get());
     pipelineStateStream.PS = CD3DX12_SHADER_BYTECODE(pixelShaderBlob.Get());
@@ -165,36 +223,106 @@ void ModelViewer::Startup(void)
         sizeof(PipelineStateStream), &pipelineStateStream
     };
 
-    Microsoft::WRL::ComPtr<ID3D12Device2> device2;
-    ASSERT_HRESULT(Graphics::g_Device.As<ID3D12Device2>(&device2), "Failed to receive ID3D12Device2 form ID3D12Device.");
-    ASSERT_HRESULT(device2->CreatePipelineState(&pipelineStateStreamDesc, IID_PPV_ARGS(&m_PipelineState)), "Failed to create pipline state object.");
+    ASSERT_HRESULT(Graphics::GetBackend().CreatePipelineState(pipelineStateStreamDesc, m_PipelineState), "Failed to create pipline state object.");
+
+    // Transparent draws blend over the opaque ones back to front, depth is tested but not written.
+    CD3DX12_BLEND_DESC blendDesc(D3D12_DEFAULT);
+    blendDesc.RenderTarget[0].BlendEnable = TRUE;
+    blendDesc.RenderTarget[0].SrcBlend = D3D12_BLEND_SRC_ALPHA;
+    blendDesc.RenderTarget[0].DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
+    blendDesc.RenderTarget[0].BlendOp = D3D12_BLEND_OP_ADD;
+    CD3DX12_DEPTH_STENCIL_DESC depthStencilDesc(D3D12_DEFAULT);
+    depthStencilDesc.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+    pipelineStateStream.BlendState = blendDesc;
+    pipelineStateStream.DepthStencilState = depthStencilDesc;
+    ASSERT_HRESULT(Graphics::GetBackend().CreatePipelineState(pipelineStateStreamDesc, m_TransparentPipelineState), "Failed to create pipline state object.");
+
+    // The SRV heap reserves descriptors for the largest material count, so materials can be added while models load.
+    D3D12_DESCRIPTOR_HEAP_DESC descriptorHeapDesc = {};
+    descriptorHeapDesc.NumDescriptors = MAX_MATERIALS_COUNT * MATERIAL_TEXTURES_COUNT + 2;
+    descriptorHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+    descriptorHeapDesc.NodeMask = 0;
+    descriptorHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+    ASSERT_HRESULT(Graphics::GetBackend().CreateDescriptorHeap(descriptorHeapDesc, Graphics::g_SRVDescriptorHeap), "Failed to create SRV descriptor heap");
+}
+
+void ModelViewer::Startup(void)
+{
+    CreateDeviceObjects();
 
     m_ModelMatrix = DirectX::XMMatrixIdentity();
     //m_ModelMatrix = DirectX::XMMatrixScaling(0.01, 0.01, 0.01);
 
     m_ScissorRect = CD3DX12_RECT(0, 0, LONG_MAX, LONG_MAX);
 
-    m_Model = Model("../../Scenes/sponza/sponza.obj");
-    //m_Model = Model("../../Scenes/nanosuit/nanosuit.obj");
+    Residency::Initialize();
+    Lightning::Startup();
+    // The shader reads the whole constant buffer, so it is sized for every material up front.
+    mMaterialsCBV.Reserve(L"Materials CBV", MAX_MATERIALS_COUNT * sizeof(MaterialParams));
+    TextureStreaming::Initialize(sTextureStreamingBudget);
+    VirtualTexturing::Initialize(sVirtualTextureSlotsPerRow);
 
-    D3D12_DESCRIPTOR_HEAP_DESC descriptorHeapDesc = {};
-    descriptorHeapDesc.NumDescriptors = Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT + 2;
-    descriptorHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-    descriptorHeapDesc.NodeMask = 0;
-    descriptorHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-    ASSERT_HRESULT(Graphics::g_Device->CreateDescriptorHeap(&descriptorHeapDesc, IID_PPV_ARGS(&Graphics::g_SRVDescriptorHeap)), "Failed to create SRV descriptor heap");
+    mCommandLists.Initialize(Graphics::g_SwapChainBufferCount, std::clamp(std::thread::hardware_concurrency(), 1u, CommandListPool::sMaxListsCount));
 
-    Materials::CreateMaterialTexturesSRV();
+    m_Model = Model::LoadAsync("../../Scenes/sponza/sponza.obj", mVertexFormat);
+    //m_Model = Model::LoadAsync("../../Scenes/nanosuit/nanosuit.obj");
+}
 
-    Lightning::Startup();
+void ModelViewer::Cleanup(void)
+{
+    PrintProfile();
+    // The meshes give their geometry back before the arena releases its pages.
+    m_Model = Model();
+    GeometryArena::Shutdown();
+    TextureStreaming::Shutdown();
+    VirtualTexturing::Shutdown();
+    Residency::Shutdown();
+}
 
-    mMaterialsCBV = Buffer(L"Materials CBV", Materials::GetMaterialCount(), sizeof(MaterialParams), Materials::GetMaterialParams().data());
-    //mMaterialsCBV.CreateSRV(Graphics::g_SRVDescriptorHeap, Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT + 1);
+void ModelViewer::EndStage(FrameProfile::Stage aStage)
+{
+    std::chrono::high_resolution_clock::time_point time = std::chrono::high_resolution_clock::now();
+    if (mIsProfiledFrame)
+    {
+        mProfile.Milliseconds[aStage] += std::chrono::duration<double, std::milli>(time - mStageStartTime).count();
+    }
+    mStageStartTime = time;
 }
 
-void ModelViewer::Cleanup(void)
+void ModelViewer::PrintProfile(void) const
 {
+    if (mProfile.FramesCount == 0)
+    {
+        return;
+    }
+
+    double framesCount = static_cast<double>(mProfile.FramesCount);
+    double frameTime = std::accumulate(std::begin(mProfile.Milliseconds), std::end(mProfile.Milliseconds), 0.0) / framesCount;
+    Utility::Printf("Frame profile, %s backend, %llu frames, %.3f ms per frame:", Graphics::GetBackend().GetName(), mProfile.FramesCount, frameTime);
+    for (UINT32 i = 0; i < FrameProfile::StagesCount; ++i)
+    {
+        Utility::Printf("    %-12s %8.3f ms", FrameProfile::sStageNames[i], mProfile.Milliseconds[i] / framesCount);
+    }
 
+    const CommandStatistics& commands = mProfile.Commands;
+    Utility::Printf("    Per frame: %.0f commands, %.0f draws, %.0f instances, %.0f indices", commands.Commands / framesCount, commands.Draws / framesCount, commands.Instances / framesCount, commands.Indices / framesCount);
+    Utility::Printf("    State changes per frame: %.1f pipeline, %.1f root signature, %.1f descriptor table, %.1f root constants, %.1f vertex buffer, %.1f index buffer, %.1f barriers",
+        commands.PipelineChanges / framesCount, commands.RootSignatureChanges / framesCount, commands.DescriptorTableChanges / framesCount, commands.RootConstantsChanges / framesCount,
+        commands.VertexBufferChanges / framesCount, commands.IndexBufferChanges / framesCount, commands.Barriers / framesCount);
+    Utility::Printf("    Backend: %llu resources, %llu MB, %llu MB uploaded, %llu submits", Graphics::g_BackendStatistics.ResourcesCount.load(), Graphics::g_BackendStatistics.ResourcesBytes.load() >> 20,
+        Graphics::g_BackendStatistics.UploadedBytes.load() >> 20, Graphics::g_BackendStatistics.Submits.load());
+    Utility::Printf("    Materials: %u materials in %u descriptor tables, %u textures packed into %u arrays", Materials::GetMaterialCount(), Materials::GetDescriptorTablesCount(),
+        Texture::GetPackedTexturesCount(), Texture::GetTextureArraysCount());
+    TextureStreaming::Statistics streaming = TextureStreaming::GetStatistics();
+    Utility::Printf("    Texture streaming: %u textures, %llu of %llu MB resident, %llu mips streamed in, %llu dropped", streaming.TexturesCount, streaming.ResidentBytes >> 20, streaming.BudgetBytes >> 20,
+        streaming.StreamedInMips, streaming.DroppedMips);
+    VirtualTexturing::Statistics virtualTexturing = VirtualTexturing::GetStatistics();
+    Utility::Printf("    Virtual texturing: %u textures, %u of %u tiles used, %llu tiles uploaded, %llu evicted, %llu deferred", virtualTexturing.TexturesCount, virtualTexturing.UsedSlotsCount, virtualTexturing.SlotsCount,
+        virtualTexturing.UploadedTiles, virtualTexturing.EvictedTiles, virtualTexturing.DeferredTiles);
+    Residency::Statistics residency = Residency::GetStatistics();
+    std::string budget = residency.BudgetBytes == UINT64_MAX ? std::string("none") : std::to_string(residency.BudgetBytes >> 20) + " MB";
+    Utility::Printf("    Residency: %u resources, %llu MB resident, %llu MB evicted, budget %s, %llu evictions, %llu restores", residency.ResourcesCount, residency.ResidentBytes >> 20, residency.EvictedBytes >> 20,
+        budget.c_str(), residency.Evictions, residency.Restores);
 }
 
 void ModelViewer::OnMouseMoved(int aDeltaX, int aDeltaY)
@@ -221,6 +349,10 @@ void ModelViewer::OnKeyEvent(const KeyEvent& keyEvent)
             mCamera.processKeyboard(Camera::eMovementDirection::RIGHT, m_LastFrameTime);
             break;
 
+        case KeyEvent::KeyCode::O:
+            m_Model.SetOcclusionCullingEnabled(!m_Model.IsOcclusionCullingEnabled());
+            Utility::Printf("Occlusion culling %s", m_Model.IsOcclusionCullingEnabled() ? "on" : "off");
+            break;
         case KeyEvent::KeyCode::F4:
             if (keyEvent.Alt)
             {
@@ -239,6 +371,20 @@ void ModelViewer::Update(double deltaT)
 
     m_LastFrameTime = deltaT;
 
+    // Frames that move loaded data to the GPU are not representative, only the frames after loading are profiled.
+    mIsProfiledFrame = !m_Model.IsLoading();
+    mStageStartTime = std::chrono::high_resolution_clock::now();
+    GeometryArena::Update();
+    m_Model.Update();
+    EndStage(FrameProfile::ModelUpdate);
+
+    // Materials change while models load, the constant buffer is rewritten in place when they do.
+    if (Materials::GetParamsVersion() != mMaterialsVersion && Materials::GetMaterialCount() > 0)
+    {
+        mMaterialsVersion = Materials::GetParamsVersion();
+        memcpy(mMaterialsCBV.GetCpuAddress(), Materials::GetMaterialParams().data(), Materials::GetMaterialCount() * sizeof(MaterialParams));
+    }
+
     float aspectRatio = Graphics::g_DisplayWidth / static_cast<float>(Graphics::g_DisplayHeight);
     m_ProjectionMatrix = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(Graphics::m_FoV), aspectRatio, 10, 10000.0f);
 
@@ -246,57 +392,122 @@ void ModelViewer::Update(double deltaT)
 
     m_Transform.MV = XMMatrixMultiply(m_ModelMatrix, mCamera.getViewMatrix());
     m_Transform.MVP = XMMatrixMultiply(m_Transform.MV, m_ProjectionMatrix);
+
+    // LOD errors are in object space, so the camera is moved there instead of transforming every mesh.
+    DirectX::XMMATRIX toModel = DirectX::XMMatrixInverse(nullptr, m_ModelMatrix);
+    DirectX::XMFLOAT3 cameraPosition;
+    DirectX::XMStoreFloat3(&cameraPosition, DirectX::XMVector3TransformCoord(mCamera.getPosition(), toModel));
+    float pixelsPerUnit = 0.5f * Graphics::g_DisplayHeight * DirectX::XMVectorGetY(m_ProjectionMatrix.r[1]);
+    // The MVP includes the model matrix, so it takes the object space of the model, where the instance bounds are, to
+    // clip space.
+    mStageStartTime = std::chrono::high_resolution_clock::now();
+    m_Model.Cull(m_Transform.MVP);
+    EndStage(FrameProfile::Cull);
+    m_Model.SelectLods(cameraPosition, pixelsPerUnit);
+    EndStage(FrameProfile::SelectLods);
+    m_Model.RequestTextureMips();
+    TextureStreaming::Update();
+    VirtualTexturing::Update();
+    EndStage(FrameProfile::Streaming);
+    m_Model.SortDraws();
+    EndStage(FrameProfile::SortDraws);
+
+    // The cursor is captured for mouse look, so the object under it is the one in the middle of the screen.
+    DirectX::XMFLOAT3 viewDirection;
+    DirectX::XMStoreFloat3(&viewDirection, DirectX::XMVector3TransformNormal(mCamera.getDirection(), toModel));
+    // The pick time is in the frame profile, see FrameProfile::Pick.
+    PickResult pick;
+    mStageStartTime = std::chrono::high_resolution_clock::now();
+    bool isPicked = m_Model.Pick(cameraPosition, viewDirection, pick);
+    EndStage(FrameProfile::Pick);
+    mPickedNode = isPicked ? pick.NodeIndex : UINT32_MAX;
+    mPickedMesh = isPicked ? pick.MeshIndex : UINT32_MAX;
 }
 
-void ModelViewer::RenderScene(void)
+// Command lists start without state, so every list that draws sets up the whole frame state.
+void ModelViewer::SetFrameState(CommandList& aCommandList, const D3D12_CPU_DESCRIPTOR_HANDLE& aRtv, const D3D12_CPU_DESCRIPTOR_HANDLE& aDsv) const
 {
-    Lightning::Update(m_Transform.MV);
-
-    Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator = Graphics::g_GraphicsCommandAllocators[Graphics::g_CurrentBackBufferIndex];
-    Microsoft::WRL::ComPtr<ID3D12Resource> backBuffer = Graphics::g_BackBuffers[Graphics::g_CurrentBackBufferIndex];
+    aCommandList.SetPipelineState(m_PipelineState.Get());
+    aCommandList.SetGraphicsRootSignature(m_RootSignature.Get());
+    aCommandList.RSSetViewports(1, &m_Viewport);
+    aCommandList.RSSetScissorRects(1, &m_ScissorRect);
+    aCommandList.OMSetRenderTargets(1, &aRtv, FALSE, &aDsv);
+    aCommandList.SetGraphicsRoot32BitConstants(0, sizeof(Transform) / sizeof(float), &m_Transform, 0);
+
+    if (mMaterialsCBV.GetGpuVirtualAddress() != D3D12_GPU_VIRTUAL_ADDRESS_NULL)
+    {
+        aCommandList.SetGraphicsRootConstantBufferView(2, mMaterialsCBV.GetGpuVirtualAddress());
+    }
 
-    commandAllocator->Reset();
-    Graphics::g_GraphicsCommandList->Reset(commandAllocator.Get(), nullptr);
+    ID3D12DescriptorHeap* heaps[] = { Graphics::g_SRVDescriptorHeap.Get()  };
+    aCommandList.SetDescriptorHeaps(1, heaps);
 
-    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(backBuffer.Get(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET);
-    Graphics::g_GraphicsCommandList->ResourceBarrier(1, &barrier);
+    CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle;
+    srvHandle.InitOffsetted(Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), MAX_MATERIALS_COUNT * MATERIAL_TEXTURES_COUNT * Graphics::g_SRVDescriptorSize);
+    aCommandList.SetGraphicsRootDescriptorTable(3, srvHandle);
 
-    FLOAT clearColor[] = { 0.5f, 0.5f, 0.5f, 1.0f };
-    CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(Graphics::g_RTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), Graphics::g_CurrentBackBufferIndex, Graphics::g_RtvDescriptorSize);
-    Graphics::g_GraphicsCommandList->ClearRenderTargetView(rtv, clearColor, 0, nullptr);
+    aCommandList.SetGraphicsRoot32BitConstants(5, sizeof(PSRootConstants) / sizeof(float), &m_PSRootConstants, 0);
+}
 
-    CD3DX12_CPU_DESCRIPTOR_HANDLE dsv(Graphics::g_DSVDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
-    Graphics::g_GraphicsCommandList->ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH, 1, 0, 0, nullptr);
+// The shared command list transitions and clears the back buffer. The sorted draws are split into contiguous ranges
+// that worker threads record into lists of mCommandLists, and the last of them transitions the back buffer back.
+// All lists go to the queue in one call, in draw order.
+void ModelViewer::RenderScene(void)
+{
+    mStageStartTime = std::chrono::high_resolution_clock::now();
+    Lightning::Update(m_Transform.MV);
+    m_PSRootConstants.LightsCount = Lightning::GetLightsCount();
+    EndStage(FrameProfile::Lights);
 
-    Graphics::g_GraphicsCommandList->SetPipelineState(m_PipelineState.Get());
-    Graphics::g_GraphicsCommandList->SetGraphicsRootSignature(m_RootSignature.Get());
-    Graphics::g_GraphicsCommandList->RSSetViewports(1, &m_Viewport);
-    Graphics::g_GraphicsCommandList->RSSetScissorRects(1, &m_ScissorRect);
-    Graphics::g_GraphicsCommandList->OMSetRenderTargets(1, &rtv, FALSE, &dsv);
-    Graphics::g_GraphicsCommandList->SetGraphicsRoot32BitConstants(0, sizeof(Transform) / sizeof(float), &m_Transform, 0);
+    // Everything the frame draws with is marked before the least recently used resources are evicted.
+    m_Model.MarkUsedResources();
+    Residency::Update();
+    EndStage(FrameProfile::Residency);
 
-    Graphics::g_GraphicsCommandList->SetGraphicsRootConstantBufferView(2, mMaterialsCBV.GetGpuVirtualAddress());
+    ID3D12Resource* backBuffer = Graphics::g_BackBuffers[Graphics::g_CurrentBackBufferIndex].Get();
 
-    ID3D12DescriptorHeap* heaps[] = { Graphics::g_SRVDescriptorHeap.Get()  };
-    Graphics::g_GraphicsCommandList->SetDescriptorHeaps(1, heaps);
+    CommandList commandList(Graphics::g_GraphicsCommandList.Get());
+    commandList.Reset(Graphics::g_GraphicsCommandAllocators[Graphics::g_CurrentBackBufferIndex].Get());
 
-    CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle;
-    srvHandle.InitOffsetted(Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT * Graphics::g_SRVDescriptorSize);
-    Graphics::g_GraphicsCommandList->SetGraphicsRootDescriptorTable(3, srvHandle);
+    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(backBuffer, D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET);
+    commandList.ResourceBarrier(1, &barrier);
 
-    //srvHandle.InitOffsetted(Graphics::g_SRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), ((Materials::GetMaterialCount() * MATERIAL_TEXTURES_COUNT) + 1) * Graphics::g_SRVDescriptorSize);
-    //Graphics::g_CommandList->SetGraphicsRootDescriptorTable(4, srvHandle);
+    D3D12_CPU_DESCRIPTOR_HANDLE rtv = CD3DX12_CPU_DESCRIPTOR_HANDLE(Graphics::g_RTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), Graphics::g_CurrentBackBufferIndex, Graphics::g_RtvDescriptorSize);
+    D3D12_CPU_DESCRIPTOR_HANDLE dsv = Graphics::g_DSVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
 
-    m_PSRootConstants.LightsCount = Lightning::GetLightsCount();
-    Graphics::g_GraphicsCommandList->SetGraphicsRoot32BitConstants(5, sizeof(PSRootConstants) / sizeof(float), &m_PSRootConstants, 0);
+    FLOAT clearColor[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+    commandList.ClearRenderTargetView(rtv, clearColor, 0, nullptr);
+    commandList.ClearDepthStencilView(dsv, D3D12_CLEAR_FLAG_DEPTH, 1, 0, 0, nullptr);
 
-    m_Model.Render(Graphics::g_GraphicsCommandList, 1, 4);
+    barrier = CD3DX12_RESOURCE_BARRIER::Transition(backBuffer, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
+    std::vector<ParallelRecording::Range> ranges = ParallelRecording::Partition(m_Model.GetDrawsCount(), mCommandLists.GetListsCount(), sMinDrawsPerList);
+    if (ranges.empty())
+    {
+        commandList.ResourceBarrier(1, &barrier);
+    }
+    commandList.Close();
 
-    barrier = CD3DX12_RESOURCE_BARRIER::Transition(backBuffer.Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
-    Graphics::g_GraphicsCommandList->ResourceBarrier(1, &barrier);
+    // Indexed by the pipeline field of the draw keys, see Model::SortDraws.
+    ID3D12PipelineState* pipelineStates[] = { m_PipelineState.Get(), m_TransparentPipelineState.Get() };
+    std::span<CommandList> commandLists = mCommandLists.Begin(Graphics::g_CurrentBackBufferIndex, static_cast<UINT32>(ranges.size()));
+    ParallelRecording::Record(commandLists, std::span<const ParallelRecording::Range>(ranges), [&](CommandList& aCommandList, const ParallelRecording::Range& aRange)
+    {
+        SetFrameState(aCommandList, rtv, dsv);
+        m_Model.Render(aCommandList, 1, 4, 6, 7, pipelineStates, aRange.First, aRange.Count);
+    });
+    if (!commandLists.empty())
+    {
+        commandLists.back().ResourceBarrier(1, &barrier);
+    }
+    EndStage(FrameProfile::Record);
 
-    Graphics::g_GraphicsCommandList->Close();
+    CommandStatistics statistics = commandList.GetStatistics();
+    statistics += mCommandLists.Execute(Graphics::g_GraphicsCommandQueue.Get(), commandList.GetNative());
+    EndStage(FrameProfile::Submit);
 
-    ID3D12CommandList* const commandLists[] = { Graphics::g_GraphicsCommandList.Get() };
-    Graphics::g_GraphicsCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
+    if (mIsProfiledFrame)
+    {
+        mProfile.Commands += statistics;
+        ++mProfile.FramesCount;
+    }
 }
@@ -0,0 +1,226 @@
+#include "pch.h"
+#include "NullBackend.h"
+#include "DirectXTex.h"
+#include "Utility.h"
+#include <memory>
+
+static UINT64 AlignUp(UINT64 aValue, UINT64 aAlignment)
+{
+    return (aValue + aAlignment - 1) & ~(aAlignment - 1);
+}
+
+// The ID3D12Object and ID3D12DeviceChild part of the stand-ins, there is no device and no private data.
+template<typename Interface>
+class NullDeviceChild : public Microsoft::WRL::RuntimeClass<Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, Interface>
+{
+public:
+    HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID aGuid, UINT* aDataSize, void* aData) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID aGuid, UINT aDataSize, const void* aData) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID aGuid, const IUnknown* aData) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE SetName(LPCWSTR aName) override { return S_OK; }
+
+    HRESULT STDMETHODCALLTYPE GetDevice(REFIID aRiid, void** aDevice) override
+    {
+        *aDevice = nullptr;
+        return E_NOINTERFACE;
+    }
+};
+
+class NullResource : public NullDeviceChild<ID3D12Resource>
+{
+    D3D12_RESOURCE_DESC mDesc;
+    D3D12_HEAP_TYPE mHeapType;
+    D3D12_GPU_VIRTUAL_ADDRESS mGpuVirtualAddress;
+    std::unique_ptr<BYTE[]> mMemory;
+
+public:
+    NullResource(const D3D12_RESOURCE_DESC& aDesc, D3D12_HEAP_TYPE aHeapType, D3D12_GPU_VIRTUAL_ADDRESS aGpuVirtualAddress)
+        : mDesc(aDesc)
+        , mHeapType(aHeapType)
+        , mGpuVirtualAddress(aGpuVirtualAddress)
+    {
+        // Upload heaps only hold buffers.
+        if (aHeapType == D3D12_HEAP_TYPE_UPLOAD)
+        {
+            mMemory = std::make_unique<BYTE[]>(aDesc.Width);
+        }
+    }
+
+    HRESULT STDMETHODCALLTYPE Map(UINT aSubresource, const D3D12_RANGE* aReadRange, void** aData) override
+    {
+        if (!mMemory)
+        {
+            return E_INVALIDARG;
+        }
+        *aData = mMemory.get();
+        return S_OK;
+    }
+
+    void STDMETHODCALLTYPE Unmap(UINT aSubresource, const D3D12_RANGE* aWrittenRange) override {}
+    D3D12_RESOURCE_DESC STDMETHODCALLTYPE GetDesc(void) override { return mDesc; }
+    D3D12_GPU_VIRTUAL_ADDRESS STDMETHODCALLTYPE GetGPUVirtualAddress(void) override { return mGpuVirtualAddress; }
+    HRESULT STDMETHODCALLTYPE WriteToSubresource(UINT aDstSubresource, const D3D12_BOX* aDstBox, const void* aSrcData, UINT aSrcRowPitch, UINT aSrcDepthPitch) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE ReadFromSubresource(void* aDstData, UINT aDstRowPitch, UINT aDstDepthPitch, UINT aSrcSubresource, const D3D12_BOX* aSrcBox) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE GetHeapProperties(D3D12_HEAP_PROPERTIES* aHeapProperties, D3D12_HEAP_FLAGS* aHeapFlags) override
+    {
+        if (aHeapProperties)
+        {
+            *aHeapProperties = CD3DX12_HEAP_PROPERTIES(mHeapType);
+        }
+        if (aHeapFlags)
+        {
+            *aHeapFlags = D3D12_HEAP_FLAG_NONE;
+        }
+        return S_OK;
+    }
+};
+
+// The handles of all descriptors are zero, views are not created anyway.
+class NullDescriptorHeap : public NullDeviceChild<ID3D12DescriptorHeap>
+{
+    D3D12_DESCRIPTOR_HEAP_DESC mDesc;
+
+public:
+    explicit NullDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC& aDesc) : mDesc(aDesc) {}
+
+    D3D12_DESCRIPTOR_HEAP_DESC STDMETHODCALLTYPE GetDesc(void) override { return mDesc; }
+    D3D12_CPU_DESCRIPTOR_HANDLE STDMETHODCALLTYPE GetCPUDescriptorHandleForHeapStart(void) override { return {}; }
+    D3D12_GPU_DESCRIPTOR_HANDLE STDMETHODCALLTYPE GetGPUDescriptorHandleForHeapStart(void) override { return {}; }
+};
+
+HRESULT NullBackend::CreateCommittedResource(D3D12_HEAP_TYPE aHeapType, const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, const D3D12_CLEAR_VALUE* aOptimizedClearValue, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource)
+{
+    // Like on a device only buffers have an address. Buffer placement alignment, so the addresses look like the ones
+    // of committed resources.
+    D3D12_GPU_VIRTUAL_ADDRESS gpuVirtualAddress = D3D12_GPU_VIRTUAL_ADDRESS_NULL;
+    if (aDesc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+    {
+        gpuVirtualAddress = mGpuVirtualAddress.fetch_add(AlignUp(std::max<UINT64>(aDesc.Width, 1), D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+    }
+    aResource = Microsoft::WRL::Make<NullResource>(aDesc, aHeapType, gpuVirtualAddress);
+    return aResource ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT NullBackend::CreateReservedResource(const D3D12_RESOURCE_DESC& aDesc, D3D12_RESOURCE_STATES aInitialState, Microsoft::WRL::ComPtr<ID3D12Resource>& aResource)
+{
+    aResource = Microsoft::WRL::Make<NullResource>(aDesc, D3D12_HEAP_TYPE_DEFAULT, D3D12_GPU_VIRTUAL_ADDRESS_NULL);
+    return aResource ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT NullBackend::CreateHeap(const D3D12_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12Heap>& aHeap)
+{
+    aHeap.Reset();
+    return S_OK;
+}
+
+UINT64 NullBackend::GetAllocationSize(const D3D12_RESOURCE_DESC& aDesc)
+{
+    UINT64 sizeInBytes = aDesc.Width;
+    if (aDesc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+    {
+        UINT subresourcesCount = aDesc.MipLevels * (aDesc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? 1 : aDesc.DepthOrArraySize);
+        GetCopyableFootprints(aDesc, 0, subresourcesCount, 0, nullptr, nullptr, nullptr, &sizeInBytes);
+    }
+    return AlignUp(sizeInBytes, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+}
+
+void NullBackend::GetCopyableFootprints(const D3D12_RESOURCE_DESC& aDesc, UINT aFirstSubresource, UINT aSubresourcesCount, UINT64 aBaseOffset, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* aLayouts, UINT* aRowsCounts, UINT64* aRowSizesInBytes, UINT64* aTotalBytes)
+{
+    // Rows are aligned to the pitch alignment and subresources to the placement alignment of texture copies, rows of
+    // block compressed formats are rows of blocks.
+    UINT64 offset = aBaseOffset;
+    UINT64 endOffset = aBaseOffset;
+    for (UINT i = 0; i < aSubresourcesCount; ++i)
+    {
+        UINT mip = (aFirstSubresource + i) % std::max<UINT>(aDesc.MipLevels, 1);
+        D3D12_SUBRESOURCE_FOOTPRINT footprint = {};
+        footprint.Format = aDesc.Format;
+        footprint.Width = static_cast<UINT>(std::max<UINT64>(aDesc.Width >> mip, 1));
+        footprint.Height = std::max(aDesc.Height >> mip, 1u);
+        footprint.Depth = aDesc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? std::max(aDesc.DepthOrArraySize >> mip, 1) : 1;
+
+        size_t rowSizeInBytes = footprint.Width;
+        size_t sliceSizeInBytes = footprint.Width;
+        if (aDesc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+        {
+            ASSERT_HRESULT(DirectX::ComputePitch(aDesc.Format, footprint.Width, footprint.Height, rowSizeInBytes, sliceSizeInBytes), "Failed to compute the pitch of a texture.");
+            offset = AlignUp(offset, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+        }
+        UINT rowsCount = static_cast<UINT>(sliceSizeInBytes / rowSizeInBytes);
+        footprint.RowPitch = static_cast<UINT>(AlignUp(rowSizeInBytes, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT));
+
+        if (aLayouts)
+        {
+            aLayouts[i] = { offset, footprint };
+        }
+        if (aRowsCounts)
+        {
+            aRowsCounts[i] = rowsCount;
+        }
+        if (aRowSizesInBytes)
+        {
+            aRowSizesInBytes[i] = rowSizeInBytes;
+        }
+        endOffset = offset + UINT64(footprint.RowPitch) * (rowsCount * footprint.Depth - 1) + rowSizeInBytes;
+        offset += UINT64(footprint.RowPitch) * rowsCount * footprint.Depth;
+    }
+
+    if (aTotalBytes)
+    {
+        *aTotalBytes = endOffset - aBaseOffset;
+    }
+}
+
+void NullBackend::GetResourceTiling(ID3D12Resource* aResource, D3D12_PACKED_MIP_INFO& aPackedMipInfo, std::span<D3D12_SUBRESOURCE_TILING> aSubresourceTilings)
+{
+    // Tiles of the copy layout of the mips, the mips smaller than a tile are the packed tail.
+    UINT mipsCount = static_cast<UINT>(aSubresourceTilings.size());
+    std::vector<UINT> rowsCounts(mipsCount);
+    std::vector<UINT64> rowSizesInBytes(mipsCount);
+    GetCopyableFootprints(aResource->GetDesc(), 0, mipsCount, 0, nullptr, rowsCounts.data(), rowSizesInBytes.data(), nullptr);
+
+    UINT standardMipsCount = 0;
+    UINT tilesCount = 0;
+    for (; standardMipsCount < mipsCount && rowSizesInBytes[standardMipsCount] * rowsCounts[standardMipsCount] >= D3D12_TILED_RESOURCE_TILE_SIZE_IN_BYTES; ++standardMipsCount)
+    {
+        UINT mipTilesCount = static_cast<UINT>(AlignUp(rowSizesInBytes[standardMipsCount] * rowsCounts[standardMipsCount], D3D12_TILED_RESOURCE_TILE_SIZE_IN_BYTES) / D3D12_TILED_RESOURCE_TILE_SIZE_IN_BYTES);
+        aSubresourceTilings[standardMipsCount] = { mipTilesCount, 1, 1, tilesCount };
+        tilesCount += mipTilesCount;
+    }
+
+    aPackedMipInfo.NumStandardMips = static_cast<UINT8>(standardMipsCount);
+    aPackedMipInfo.NumPackedMips = static_cast<UINT8>(mipsCount - standardMipsCount);
+    aPackedMipInfo.NumTilesForPackedMips = standardMipsCount < mipsCount ? 1 : 0;
+    aPackedMipInfo.StartTileIndexInOverallResource = tilesCount;
+}
+
+HRESULT NullBackend::CreateRootSignature(ID3DBlob* aBlob, Microsoft::WRL::ComPtr<ID3D12RootSignature>& aRootSignature)
+{
+    aRootSignature.Reset();
+    return S_OK;
+}
+
+HRESULT NullBackend::CreatePipelineState(const D3D12_PIPELINE_STATE_STREAM_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12PipelineState>& aPipelineState)
+{
+    aPipelineState.Reset();
+    return S_OK;
+}
+
+HRESULT NullBackend::CreateDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC& aDesc, Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>& aHeap)
+{
+    aHeap = Microsoft::WRL::Make<NullDescriptorHeap>(aDesc);
+    return aHeap ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT NullBackend::CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE aType, Microsoft::WRL::ComPtr<ID3D12CommandAllocator>& aAllocator)
+{
+    aAllocator.Reset();
+    return S_OK;
+}
+
+HRESULT NullBackend::CreateCommandList(D3D12_COMMAND_LIST_TYPE aType, ID3D12CommandAllocator* aAllocator, Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& aList)
+{
+    aList.Reset();
+    return S_OK;
+}
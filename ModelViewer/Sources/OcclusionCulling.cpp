@@ -0,0 +1,429 @@
+#include "pch.h"
+#include "OcclusionCulling.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+
+using namespace DirectX;
+
+// Triangles are clipped against the near plane and against side planes this many times wider than the screen, so the
+// edge functions stay precise without clipping most triangles that only stick out a little.
+static constexpr float sGuardBand = 2.0f;
+static constexpr UINT32 sFullMask = UINT32_MAX;
+
+enum ClipPlane : UINT32
+{
+    ClipLeft = 1 << 0,
+    ClipRight = 1 << 1,
+    ClipBottom = 1 << 2,
+    ClipTop = 1 << 3,
+    ClipNear = 1 << 4,
+    ClipFar = 1 << 5
+};
+
+static UINT32 GetOutcode(const XMFLOAT4& aVertex, float aBand)
+{
+    UINT32 outcode = 0;
+    outcode |= aVertex.x < -aBand * aVertex.w ? ClipLeft : 0;
+    outcode |= aVertex.x > aBand * aVertex.w ? ClipRight : 0;
+    outcode |= aVertex.y < -aBand * aVertex.w ? ClipBottom : 0;
+    outcode |= aVertex.y > aBand * aVertex.w ? ClipTop : 0;
+    outcode |= aVertex.z < 0.0f ? ClipNear : 0;
+    outcode |= aVertex.z > aVertex.w ? ClipFar : 0;
+    return outcode;
+}
+
+// Signed distance to a clip plane of the guard band, inside is positive.
+static float GetPlaneDistance(const XMFLOAT4& aVertex, ClipPlane aPlane)
+{
+    switch (aPlane)
+    {
+    case ClipLeft: return aVertex.x + sGuardBand * aVertex.w;
+    case ClipRight: return sGuardBand * aVertex.w - aVertex.x;
+    case ClipBottom: return aVertex.y + sGuardBand * aVertex.w;
+    case ClipTop: return sGuardBand * aVertex.w - aVertex.y;
+    default: return aVertex.z;
+    }
+}
+
+// Screen positions are snapped to 1/16 pixel and the edge functions are evaluated in integers. Edges shared by two
+// triangles then have exactly opposite edge functions, so no pixel between them is lost to rounding. With the guard
+// band the values at the pixels of a tile fit in 32 bits for buffers up to 1024 pixels wide and high.
+static constexpr INT32 sSubpixelBits = 4;
+static constexpr INT32 sSubpixelScale = 1 << sSubpixelBits;
+
+// Edge functions a * x + b * y + c of a triangle in subpixels, inside is >= 0.
+struct EdgeSetup
+{
+    INT32 A[3];
+    INT32 B[3];
+    INT64 C[3];
+};
+
+// Coverage of the pixel centers of one tile, bit y * 8 + x. Along a row the edge functions only add a per pixel step,
+// so the kernels need no multiplies.
+static UINT32 CoverTileSse(const EdgeSetup& aEdges, INT32 aPixelX, INT32 aPixelY)
+{
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    __m128i rowEdges[2][3];
+    __m128i rowSteps[3];
+    for (UINT32 edge = 0; edge < 3; ++edge)
+    {
+        INT32 a = aEdges.A[edge] * sSubpixelScale;
+        INT32 value = static_cast<INT32>(aEdges.A[edge] * INT64(aPixelX * sSubpixelScale + sSubpixelScale / 2) + aEdges.B[edge] * INT64(aPixelY * sSubpixelScale + sSubpixelScale / 2) + aEdges.C[edge]);
+        rowEdges[0][edge] = _mm_add_epi32(_mm_set1_epi32(value), _mm_setr_epi32(0, a, 2 * a, 3 * a));
+        rowEdges[1][edge] = _mm_add_epi32(rowEdges[0][edge], _mm_set1_epi32(4 * a));
+        rowSteps[edge] = _mm_set1_epi32(aEdges.B[edge] * sSubpixelScale);
+    }
+
+    UINT32 mask = 0;
+    for (UINT32 row = 0; row < OcclusionCulling::OcclusionBuffer::sTileHeight; ++row)
+    {
+        for (UINT32 half = 0; half < 2; ++half)
+        {
+            __m128i* edges = rowEdges[half];
+            __m128i isInside = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(edges[0], minusOne), _mm_cmpgt_epi32(edges[1], minusOne)), _mm_cmpgt_epi32(edges[2], minusOne));
+            mask |= _mm_movemask_ps(_mm_castsi128_ps(isInside)) << (row * 8 + half * 4);
+            for (UINT32 edge = 0; edge < 3; ++edge)
+            {
+                edges[edge] = _mm_add_epi32(edges[edge], rowSteps[edge]);
+            }
+        }
+    }
+    return mask;
+}
+
+static UINT32 CoverTileAvx2(const EdgeSetup& aEdges, INT32 aPixelX, INT32 aPixelY)
+{
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    __m256i edges[3];
+    __m256i rowSteps[3];
+    for (UINT32 edge = 0; edge < 3; ++edge)
+    {
+        INT32 a = aEdges.A[edge] * sSubpixelScale;
+        INT32 value = static_cast<INT32>(aEdges.A[edge] * INT64(aPixelX * sSubpixelScale + sSubpixelScale / 2) + aEdges.B[edge] * INT64(aPixelY * sSubpixelScale + sSubpixelScale / 2) + aEdges.C[edge]);
+        edges[edge] = _mm256_add_epi32(_mm256_set1_epi32(value), _mm256_setr_epi32(0, a, 2 * a, 3 * a, 4 * a, 5 * a, 6 * a, 7 * a));
+        rowSteps[edge] = _mm256_set1_epi32(aEdges.B[edge] * sSubpixelScale);
+    }
+
+    UINT32 mask = 0;
+    for (UINT32 row = 0; row < OcclusionCulling::OcclusionBuffer::sTileHeight; ++row)
+    {
+        __m256i isInside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(edges[0], minusOne), _mm256_cmpgt_epi32(edges[1], minusOne)), _mm256_cmpgt_epi32(edges[2], minusOne));
+        mask |= _mm256_movemask_ps(_mm256_castsi256_ps(isInside)) << (row * 8);
+        for (UINT32 edge = 0; edge < 3; ++edge)
+        {
+            edges[edge] = _mm256_add_epi32(edges[edge], rowSteps[edge]);
+        }
+    }
+    return mask;
+}
+
+// Whether any of aCount consecutive tiles is at or behind aDepth, the depth arrays are padded so whole vectors can be
+// read past the end of a row.
+static bool HasTileBehindSse(const float* aDepths, UINT32 aCount, float aDepth)
+{
+    const __m128 depth = _mm_set1_ps(aDepth);
+    for (UINT32 first = 0; first < aCount; first += 4)
+    {
+        UINT32 lanesMask = aCount - first >= 4 ? 0xF : (1u << (aCount - first)) - 1;
+        if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(aDepths + first), depth)) & lanesMask)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool HasTileBehindAvx(const float* aDepths, UINT32 aCount, float aDepth)
+{
+    const __m256 depth = _mm256_set1_ps(aDepth);
+    for (UINT32 first = 0; first < aCount; first += 8)
+    {
+        UINT32 lanesMask = aCount - first >= 8 ? 0xFF : (1u << (aCount - first)) - 1;
+        if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(aDepths + first), depth, _CMP_GE_OQ)) & lanesMask)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+OcclusionCulling::OcclusionBuffer::OcclusionBuffer(UINT32 aWidth, UINT32 aHeight)
+    : mTilesX((aWidth + sTileWidth - 1) / sTileWidth)
+    , mTilesY((aHeight + sTileHeight - 1) / sTileHeight)
+{
+    ASSERT(aWidth <= 1024 && aHeight <= 1024, "Occlusion buffer too large for 32-bit edge functions");
+    mWidth = mTilesX * sTileWidth;
+    mHeight = mTilesY * sTileHeight;
+
+    // The tests read up to 8 tiles from the start of a range, the last row needs that much padding.
+    size_t tilesCount = mTilesX * mTilesY;
+    mMasks.resize(tilesCount);
+    mLayer0Depths.resize(tilesCount + 8);
+    mLayer1Depths.resize(tilesCount);
+    Clear();
+}
+
+void OcclusionCulling::OcclusionBuffer::Clear()
+{
+    std::fill(mMasks.begin(), mMasks.end(), 0);
+    std::fill(mLayer0Depths.begin(), mLayer0Depths.end(), 1.0f);
+    std::fill(mLayer1Depths.begin(), mLayer1Depths.end(), 0.0f);
+}
+
+void OcclusionCulling::OcclusionBuffer::RenderOccluder(std::span<const XMFLOAT3> aPositions, std::span<const UINT32> aIndices, FXMMATRIX aObjectToClip)
+{
+    mClipPositions.resize(aPositions.size());
+    for (size_t i = 0; i < aPositions.size(); ++i)
+    {
+        XMStoreFloat4(&mClipPositions[i], XMVector3Transform(XMLoadFloat3(&aPositions[i]), aObjectToClip));
+    }
+
+    for (size_t i = 0; i + 2 < aIndices.size(); i += 3)
+    {
+        XMFLOAT4 triangle[3] = { mClipPositions[aIndices[i]], mClipPositions[aIndices[i + 1]], mClipPositions[aIndices[i + 2]] };
+        RasterizeTriangle(triangle);
+    }
+}
+
+void OcclusionCulling::OcclusionBuffer::RasterizeTriangle(const XMFLOAT4* aClipVertices)
+{
+    UINT32 outcodes[3];
+    UINT32 guardBandOutcodes = 0;
+    for (UINT32 i = 0; i < 3; ++i)
+    {
+        outcodes[i] = GetOutcode(aClipVertices[i], 1.0f);
+        guardBandOutcodes |= GetOutcode(aClipVertices[i], sGuardBand) & ~ClipFar;
+    }
+
+    // Completely outside one frustum plane.
+    if ((outcodes[0] & outcodes[1] & outcodes[2]) != 0)
+    {
+        return;
+    }
+
+    // Sutherland-Hodgman against the planes the triangle crosses, clip space is linear so the depth of the new
+    // vertices is interpolated correctly. Every plane adds at most one vertex.
+    XMFLOAT4 polygons[2][8];
+    UINT32 verticesCount = 3;
+    std::copy(aClipVertices, aClipVertices + 3, polygons[0]);
+    UINT32 current = 0;
+    for (ClipPlane plane : { ClipNear, ClipLeft, ClipRight, ClipBottom, ClipTop })
+    {
+        if ((guardBandOutcodes & plane) == 0)
+        {
+            continue;
+        }
+
+        const XMFLOAT4* input = polygons[current];
+        XMFLOAT4* output = polygons[current ^ 1];
+        UINT32 outputCount = 0;
+        for (UINT32 i = 0; i < verticesCount; ++i)
+        {
+            const XMFLOAT4& vertex = input[i];
+            const XMFLOAT4& next = input[(i + 1) % verticesCount];
+            float distance = GetPlaneDistance(vertex, plane);
+            float nextDistance = GetPlaneDistance(next, plane);
+            if (distance >= 0.0f)
+            {
+                output[outputCount++] = vertex;
+            }
+            if ((distance >= 0.0f) != (nextDistance >= 0.0f))
+            {
+                float t = distance / (distance - nextDistance);
+                XMStoreFloat4(&output[outputCount++], XMVectorLerp(XMLoadFloat4(&vertex), XMLoadFloat4(&next), t));
+            }
+        }
+        verticesCount = outputCount;
+        current ^= 1;
+        if (verticesCount < 3)
+        {
+            return;
+        }
+    }
+
+    XMFLOAT3 screenVertices[8];
+    for (UINT32 i = 0; i < verticesCount; ++i)
+    {
+        const XMFLOAT4& vertex = polygons[current][i];
+        float inverseW = 1.0f / vertex.w;
+        screenVertices[i] = XMFLOAT3((vertex.x * inverseW * 0.5f + 0.5f) * mWidth, (0.5f - vertex.y * inverseW * 0.5f) * mHeight, vertex.z * inverseW);
+    }
+    for (UINT32 i = 2; i < verticesCount; ++i)
+    {
+        RasterizeScreenTriangle(screenVertices[0], screenVertices[i - 1], screenVertices[i]);
+    }
+}
+
+void OcclusionCulling::OcclusionBuffer::RasterizeScreenTriangle(const XMFLOAT3& aVertex0, const XMFLOAT3& aVertex1, const XMFLOAT3& aVertex2)
+{
+    static const bool sHasAvx2 = Utility::HasAvx2();
+
+    XMFLOAT3 vertices[3] = { aVertex0, aVertex1, aVertex2 };
+    INT32 x[3], y[3];
+    for (UINT32 i = 0; i < 3; ++i)
+    {
+        x[i] = static_cast<INT32>(std::lround(vertices[i].x * sSubpixelScale));
+        y[i] = static_cast<INT32>(std::lround(vertices[i].y * sSubpixelScale));
+    }
+
+    // Both faces occlude, the vertices are reordered so the area is positive.
+    INT64 area = INT64(x[1] - x[0]) * (y[2] - y[0]) - INT64(x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0)
+    {
+        return;
+    }
+    if (area < 0)
+    {
+        std::swap(vertices[1], vertices[2]);
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        area = -area;
+    }
+
+    INT32 minX = std::max(std::min({ x[0], x[1], x[2] }), 0);
+    INT32 maxX = std::min(std::max({ x[0], x[1], x[2] }), static_cast<INT32>(mWidth * sSubpixelScale) - 1);
+    INT32 minY = std::max(std::min({ y[0], y[1], y[2] }), 0);
+    INT32 maxY = std::min(std::max({ y[0], y[1], y[2] }), static_cast<INT32>(mHeight * sSubpixelScale) - 1);
+    if (minX > maxX || minY > maxY)
+    {
+        return;
+    }
+
+    EdgeSetup edges;
+    for (UINT32 edge = 0; edge < 3; ++edge)
+    {
+        UINT32 next = (edge + 1) % 3;
+        edges.A[edge] = y[edge] - y[next];
+        edges.B[edge] = x[next] - x[edge];
+        edges.C[edge] = -(INT64(edges.A[edge]) * x[edge] + INT64(edges.B[edge]) * y[edge]);
+    }
+
+    // The depth plane gives the farthest depth of the triangle inside a tile at the tile corner its gradient points
+    // to. It can never be farther than the farthest vertex.
+    float inverseArea = static_cast<float>(sSubpixelScale * sSubpixelScale) / static_cast<float>(area);
+    float x1 = static_cast<float>(x[1] - x[0]) / sSubpixelScale, y1 = static_cast<float>(y[1] - y[0]) / sSubpixelScale;
+    float x2 = static_cast<float>(x[2] - x[0]) / sSubpixelScale, y2 = static_cast<float>(y[2] - y[0]) / sSubpixelScale;
+    float z1 = vertices[1].z - vertices[0].z, z2 = vertices[2].z - vertices[0].z;
+    float depthX = (z1 * y2 - z2 * y1) * inverseArea;
+    float depthY = (z2 * x1 - z1 * x2) * inverseArea;
+    float originX = static_cast<float>(x[0]) / sSubpixelScale;
+    float originY = static_cast<float>(y[0]) / sSubpixelScale;
+    float maxDepth = std::max({ vertices[0].z, vertices[1].z, vertices[2].z });
+    float cornerX = depthX > 0.0f ? static_cast<float>(sTileWidth) : 0.0f;
+    float cornerY = depthY > 0.0f ? static_cast<float>(sTileHeight) : 0.0f;
+
+    UINT32 firstTileX = static_cast<UINT32>(minX) / (sTileWidth * sSubpixelScale);
+    UINT32 lastTileX = static_cast<UINT32>(maxX) / (sTileWidth * sSubpixelScale);
+    UINT32 firstTileY = static_cast<UINT32>(minY) / (sTileHeight * sSubpixelScale);
+    UINT32 lastTileY = static_cast<UINT32>(maxY) / (sTileHeight * sSubpixelScale);
+    for (UINT32 tileY = firstTileY; tileY <= lastTileY; ++tileY)
+    {
+        INT32 pixelY = tileY * sTileHeight;
+        for (UINT32 tileX = firstTileX; tileX <= lastTileX; ++tileX)
+        {
+            INT32 pixelX = tileX * sTileWidth;
+            UINT32 tile = tileY * mTilesX + tileX;
+            float tileDepth = std::min(maxDepth, vertices[0].z + depthX * (pixelX + cornerX - originX) + depthY * (pixelY + cornerY - originY));
+            float& layer0Depth = mLayer0Depths[tile];
+            if (tileDepth >= layer0Depth)
+            {
+                continue;
+            }
+
+            UINT32 coverage = sHasAvx2 ? CoverTileAvx2(edges, pixelX, pixelY) : CoverTileSse(edges, pixelX, pixelY);
+            if (coverage == 0)
+            {
+                continue;
+            }
+
+            // Layer 1 is dropped when the triangle is closer in depth to layer 0 than to it, merging would loosen the
+            // bound of all its pixels.
+            UINT32& mask = mMasks[tile];
+            float& layer1Depth = mLayer1Depths[tile];
+            if (std::abs(layer1Depth - tileDepth) > std::abs(layer0Depth - tileDepth))
+            {
+                mask = 0;
+                layer1Depth = 0.0f;
+            }
+
+            layer1Depth = std::max(layer1Depth, tileDepth);
+            mask |= coverage;
+            if (mask == sFullMask)
+            {
+                layer0Depth = std::min(layer0Depth, layer1Depth);
+                layer1Depth = 0.0f;
+                mask = 0;
+            }
+        }
+    }
+}
+
+bool OcclusionCulling::OcclusionBuffer::IsVisible(const XMFLOAT3& aCenter, const XMFLOAT3& aExtents, FXMMATRIX aObjectToClip) const
+{
+    static const bool sHasAvx = Utility::HasAvx();
+
+    // Corners are the clip space center plus or minus the transformed axes.
+    XMVECTOR center = XMVector3Transform(XMLoadFloat3(&aCenter), aObjectToClip);
+    XMVECTOR axisX = XMVectorScale(aObjectToClip.r[0], aExtents.x);
+    XMVECTOR axisY = XMVectorScale(aObjectToClip.r[1], aExtents.y);
+    XMVECTOR axisZ = XMVectorScale(aObjectToClip.r[2], aExtents.z);
+
+    XMVECTOR minimum = XMVectorReplicate(FLT_MAX);
+    XMVECTOR maximum = XMVectorReplicate(-FLT_MAX);
+    for (UINT32 corner = 0; corner < 8; ++corner)
+    {
+        XMVECTOR position = XMVectorAdd(center, (corner & 1) ? axisX : XMVectorNegate(axisX));
+        position = XMVectorAdd(position, (corner & 2) ? axisY : XMVectorNegate(axisY));
+        position = XMVectorAdd(position, (corner & 4) ? axisZ : XMVectorNegate(axisZ));
+
+        XMFLOAT4 clip;
+        XMStoreFloat4(&clip, position);
+        if (clip.z < 0.0f)
+        {
+            return true;
+        }
+
+        XMVECTOR projected = XMVectorDivide(position, XMVectorSplatW(position));
+        minimum = XMVectorMin(minimum, projected);
+        maximum = XMVectorMax(maximum, projected);
+    }
+
+    XMFLOAT3 ndcMin, ndcMax;
+    XMStoreFloat3(&ndcMin, minimum);
+    XMStoreFloat3(&ndcMax, maximum);
+    float minX = (ndcMin.x * 0.5f + 0.5f) * mWidth;
+    float maxX = (ndcMax.x * 0.5f + 0.5f) * mWidth;
+    float minY = (0.5f - ndcMax.y * 0.5f) * mHeight;
+    float maxY = (0.5f - ndcMin.y * 0.5f) * mHeight;
+
+    // Bounds off the screen are left to the frustum test.
+    if (maxX < 0.0f || maxY < 0.0f || minX >= mWidth || minY >= mHeight)
+    {
+        return true;
+    }
+
+    UINT32 firstTileX = static_cast<UINT32>(std::max(minX, 0.0f)) / sTileWidth;
+    UINT32 lastTileX = static_cast<UINT32>(std::min(maxX, mWidth - 1.0f)) / sTileWidth;
+    UINT32 firstTileY = static_cast<UINT32>(std::max(minY, 0.0f)) / sTileHeight;
+    UINT32 lastTileY = static_cast<UINT32>(std::min(maxY, mHeight - 1.0f)) / sTileHeight;
+    for (UINT32 tileY = firstTileY; tileY <= lastTileY; ++tileY)
+    {
+        const float* depths = mLayer0Depths.data() + tileY * mTilesX + firstTileX;
+        UINT32 count = lastTileX - firstTileX + 1;
+        if (sHasAvx ? HasTileBehindAvx(depths, count, ndcMin.z) : HasTileBehindSse(depths, count, ndcMin.z))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void OcclusionCulling::OcclusionBuffer::Cull(const FrustumCulling::BoundsList& aBounds, std::vector<UINT32>& aIndices, FXMMATRIX aObjectToClip) const
+{
+    auto isOccluded = [&](UINT32 aIndex) { return !IsVisible(aBounds.GetCenter(aIndex), aBounds.GetExtents(aIndex), aObjectToClip); };
+    aIndices.erase(std::remove_if(aIndices.begin(), aIndices.end(), isOccluded), aIndices.end());
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "FrustumCulling.h"
+#include <DirectXMath.h>
+#include <span>
+
+// CPU occlusion culling after Masked Software Occlusion Culling (Andersson et al. 2015). A few large occluders are
+// rasterized into a low resolution depth buffer and the bounds of the objects are tested against it, so hidden
+// objects are dropped in the same frame, without the latency of GPU queries.
+namespace OcclusionCulling
+{
+    // Triangles of a simplified mesh that stand in for it in the occlusion buffer.
+    struct OccluderMesh
+    {
+        std::vector<DirectX::XMFLOAT3> Positions;
+        std::vector<UINT32> Indices;
+    };
+
+    // The buffer is made of 8x4 pixel tiles without per-pixel depth. Every tile has two layers: layer 0 covers the
+    // whole tile and bounds its farthest depth, layer 1 bounds the depth of the pixels in a 32-bit coverage mask.
+    // Triangles add their coverage to layer 1 and once the mask fills the tile, layer 1 replaces layer 0. A triangle
+    // far in front of layer 1 drops the layer instead of merging with it, which keeps the bounds tight. Layer 0 of
+    // every tile is a conservative farthest depth, so the tiles form the coarse level of a hierarchical depth buffer
+    // that the bounds tests read.
+    //
+    // Depth is D3D clip depth in [0, 1]. Coverage uses integer edge functions on 8 pixels at once with AVX2, or 4 with
+    // SSE2 when the CPU has no AVX2, and the bounds tests compare 8 tiles at once with AVX.
+    class OcclusionBuffer
+    {
+    public:
+        static constexpr UINT32 sTileWidth = 8;
+        static constexpr UINT32 sTileHeight = 4;
+
+    private:
+        UINT32 mWidth = 0;
+        UINT32 mHeight = 0;
+        UINT32 mTilesX = 0;
+        UINT32 mTilesY = 0;
+        std::vector<UINT32> mMasks;             // layer 1 coverage of every tile, bit y * 8 + x
+        std::vector<float> mLayer0Depths;
+        std::vector<float> mLayer1Depths;
+        std::vector<DirectX::XMFLOAT4> mClipPositions;
+
+        void RasterizeTriangle(const DirectX::XMFLOAT4* aClipVertices);
+        void RasterizeScreenTriangle(const DirectX::XMFLOAT3& aVertex0, const DirectX::XMFLOAT3& aVertex1, const DirectX::XMFLOAT3& aVertex2);
+
+    public:
+        // The size is rounded up to whole tiles.
+        OcclusionBuffer(UINT32 aWidth, UINT32 aHeight);
+
+        void Clear();
+        // aObjectToClip takes the positions to clip space, row-vector DirectXMath convention. Both faces occlude.
+        void RenderOccluder(std::span<const DirectX::XMFLOAT3> aPositions, std::span<const UINT32> aIndices, DirectX::FXMMATRIX aObjectToClip);
+
+        // Conservative, bounds crossing the near plane are always visible.
+        bool IsVisible(const DirectX::XMFLOAT3& aCenter, const DirectX::XMFLOAT3& aExtents, DirectX::FXMMATRIX aObjectToClip) const;
+        // Removes the indices whose bounds are occluded from aIndices and keeps the order of the rest.
+        void Cull(const FrustumCulling::BoundsList& aBounds, std::vector<UINT32>& aIndices, DirectX::FXMMATRIX aObjectToClip) const;
+
+        UINT32 GetWidth() const { return mWidth; }
+        UINT32 GetHeight() const { return mHeight; }
+        // Farthest depth of the tile, 1 where nothing was drawn.
+        float GetTileDepth(UINT32 aTileX, UINT32 aTileY) const { return mLayer0Depths[aTileY * mTilesX + aTileX]; }
+    };
+}
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "Application.h"
 #include "Model.h"
+#include "Buffer.h"
 #include "Camera.h"
 
 #if _DEBUG
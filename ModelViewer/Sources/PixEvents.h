@@ -4,10 +4,33 @@
 #include "Include/WinPixEventRuntime/pix3.h"
 #endif // DEBUG
 
-class ScopedPixEvent;
-
 #ifdef _DEBUG
-#define PIX_SCOPED_EVENT(call, cmdList, color, format, ...) PIXScopedEvent(cmdList, color, format, ##__VA_ARGS__); call;
+// PIX event for the rest of the scope. The command list is null with the null graphics backend, then no event is set.
+class ScopedPixEvent
+{
+    ID3D12GraphicsCommandList* mCommandList;
+
+public:
+    template<typename... Args>
+    ScopedPixEvent(ID3D12GraphicsCommandList* aCommandList, UINT64 aColor, PCSTR aFormat, Args... aArgs)
+        : mCommandList(aCommandList)
+    {
+        if (mCommandList)
+        {
+            PIXBeginEvent(mCommandList, aColor, aFormat, aArgs...);
+        }
+    }
+
+    ~ScopedPixEvent()
+    {
+        if (mCommandList)
+        {
+            PIXEndEvent(mCommandList);
+        }
+    }
+};
+
+#define PIX_SCOPED_EVENT(call, cmdList, color, format, ...) ScopedPixEvent pixEvent(cmdList, color, format, ##__VA_ARGS__); call;
 #else
 #define PIX_SCOPED_EVENT(call, cmdList, color, format, ...) call;
 #endif // DEBUG
@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "RangeAllocator.h"
+#include "Utility.h"
+
+RangeAllocator::RangeAllocator(UINT64 aSizeInBytes)
+    : mSizeInBytes(aSizeInBytes)
+{
+    if (aSizeInBytes > 0)
+    {
+        AddFreeRange(0, aSizeInBytes);
+    }
+}
+
+void RangeAllocator::AddFreeRange(UINT64 aOffset, UINT64 aSize)
+{
+    mFreeRangesByOffset.emplace(aOffset, aSize);
+    mFreeRangesBySize.emplace(aSize, aOffset);
+    mFreeSizeInBytes += aSize;
+}
+
+void RangeAllocator::RemoveFreeRange(std::map<UINT64, UINT64>::iterator aRange)
+{
+    auto [first, last] = mFreeRangesBySize.equal_range(aRange->second);
+    for (auto it = first; it != last; ++it)
+    {
+        if (it->second == aRange->first)
+        {
+            mFreeRangesBySize.erase(it);
+            break;
+        }
+    }
+
+    mFreeSizeInBytes -= aRange->second;
+    mFreeRangesByOffset.erase(aRange);
+}
+
+UINT64 RangeAllocator::Allocate(UINT64 aSize, UINT64 aAlignment)
+{
+    ASSERT(aSize > 0 && aAlignment > 0, "Allocation size and alignment must not be zero.");
+
+    // Ranges are visited from the smallest one that could fit. With alignment the start may have to move forward,
+    // so a range of the right size is only a candidate until the aligned end is checked.
+    for (auto it = mFreeRangesBySize.lower_bound(aSize); it != mFreeRangesBySize.end(); ++it)
+    {
+        UINT64 rangeOffset = it->second;
+        UINT64 rangeSize = it->first;
+        UINT64 offset = (rangeOffset + aAlignment - 1) / aAlignment * aAlignment;
+        if (offset + aSize > rangeOffset + rangeSize)
+        {
+            continue;
+        }
+
+        RemoveFreeRange(mFreeRangesByOffset.find(rangeOffset));
+
+        // Padding in front of the aligned start and the tail after the allocation stay free.
+        if (offset > rangeOffset)
+        {
+            AddFreeRange(rangeOffset, offset - rangeOffset);
+        }
+        if (offset + aSize < rangeOffset + rangeSize)
+        {
+            AddFreeRange(offset + aSize, rangeOffset + rangeSize - offset - aSize);
+        }
+        return offset;
+    }
+
+    return sInvalidOffset;
+}
+
+void RangeAllocator::Free(UINT64 aOffset, UINT64 aSize)
+{
+    ASSERT(aOffset + aSize <= mSizeInBytes, "Freed range is outside of the allocator.");
+
+    UINT64 offset = aOffset;
+    UINT64 size = aSize;
+
+    // Merge with the free ranges that end where this one starts and start where it ends.
+    auto next = mFreeRangesByOffset.lower_bound(aOffset);
+    ASSERT(next == mFreeRangesByOffset.end() || next->first >= aOffset + aSize, "Freed range overlaps a free range.");
+    if (next != mFreeRangesByOffset.end() && next->first == aOffset + aSize)
+    {
+        size += next->second;
+        RemoveFreeRange(next);
+    }
+
+    auto previous = mFreeRangesByOffset.lower_bound(aOffset);
+    if (previous != mFreeRangesByOffset.begin())
+    {
+        --previous;
+        ASSERT(previous->first + previous->second <= aOffset, "Freed range overlaps a free range.");
+        if (previous->first + previous->second == aOffset)
+        {
+            offset = previous->first;
+            size += previous->second;
+            RemoveFreeRange(previous);
+        }
+    }
+
+    AddFreeRange(offset, size);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <map>
+
+// Sub-allocates ranges of a linear address space, like a large GPU buffer. It only does the bookkeeping and never
+// touches the memory, so it works without a device.
+//
+// Free ranges are kept twice: by offset, to merge a freed range with its neighbours, and by size, to find the
+// smallest range that fits (best fit), which keeps large ranges available for large requests.
+class RangeAllocator
+{
+public:
+    static constexpr UINT64 sInvalidOffset = UINT64_MAX;
+
+private:
+    std::map<UINT64, UINT64> mFreeRangesByOffset;       // offset -> size
+    std::multimap<UINT64, UINT64> mFreeRangesBySize;    // size -> offset
+    UINT64 mSizeInBytes = 0;
+    UINT64 mFreeSizeInBytes = 0;
+
+    void AddFreeRange(UINT64 aOffset, UINT64 aSize);
+    void RemoveFreeRange(std::map<UINT64, UINT64>::iterator aRange);
+
+public:
+    RangeAllocator() {}
+    explicit RangeAllocator(UINT64 aSizeInBytes);
+
+    // Returns the offset of a range of aSize bytes that starts at a multiple of aAlignment, which does not have to
+    // be a power of two. Returns sInvalidOffset if no free range is large enough.
+    UINT64 Allocate(UINT64 aSize, UINT64 aAlignment = 1);
+
+    // aOffset and aSize must be exactly what Allocate was called with and returned.
+    void Free(UINT64 aOffset, UINT64 aSize);
+
+    UINT64 GetSizeInBytes() const { return mSizeInBytes; }
+    UINT64 GetFreeSizeInBytes() const { return mFreeSizeInBytes; }
+    UINT64 GetLargestFreeRange() const { return mFreeRangesBySize.empty() ? 0 : mFreeRangesBySize.rbegin()->first; }
+    size_t GetFreeRangesCount() const { return mFreeRangesByOffset.size(); }
+};
@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "RayPicking.h"
+#include <bit>
+#include <cmath>
+#include <immintrin.h>
+
+using namespace DirectX;
+
+RayPicking::TriangleMesh::TriangleMesh(std::vector<XMFLOAT3>&& aPositions, std::vector<UINT32>&& aIndices)
+    : mPositions(std::move(aPositions))
+    , mIndices(std::move(aIndices))
+{
+}
+
+void RayPicking::TriangleMesh::Build()
+{
+    UINT32 trianglesCount = static_cast<UINT32>(mIndices.size() / 3);
+    mTriangles.resize(trianglesCount);
+
+    FrustumCulling::BoundsList bounds;
+    for (UINT32 i = 0; i < trianglesCount; ++i)
+    {
+        XMVECTOR vertex0 = XMLoadFloat3(&mPositions[mIndices[i * 3]]);
+        XMVECTOR vertex1 = XMLoadFloat3(&mPositions[mIndices[i * 3 + 1]]);
+        XMVECTOR vertex2 = XMLoadFloat3(&mPositions[mIndices[i * 3 + 2]]);
+        XMStoreFloat3(&mTriangles[i].Vertex0, vertex0);
+        XMStoreFloat3(&mTriangles[i].Edge1, XMVectorSubtract(vertex1, vertex0));
+        XMStoreFloat3(&mTriangles[i].Edge2, XMVectorSubtract(vertex2, vertex0));
+
+        XMVECTOR minimum = XMVectorMin(vertex0, XMVectorMin(vertex1, vertex2));
+        XMVECTOR maximum = XMVectorMax(vertex0, XMVectorMax(vertex1, vertex2));
+        XMVECTOR extents = XMVectorScale(XMVectorSubtract(maximum, minimum), 0.5f);
+        XMFLOAT3 center, extents3;
+        XMStoreFloat3(&center, XMVectorScale(XMVectorAdd(minimum, maximum), 0.5f));
+        XMStoreFloat3(&extents3, extents);
+        bounds.Add(center, extents3, XMVectorGetX(XMVector3Length(extents)));
+    }
+    mHierarchy.Build(bounds);
+
+    mPositions = {};
+    mIndices = {};
+    mIsBuilt = true;
+}
+
+// Moller-Trumbore on up to four triangles, one per lane. Unused lanes hold a degenerate triangle, whose zero
+// determinant rejects them.
+float RayPicking::TriangleMesh::IntersectTriangles(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, std::span<const UINT32> aTriangles, float aMaxDistance, TriangleHit& aHit) const
+{
+    static const Triangle sDegenerate = {};
+    const Triangle* triangles[4];
+    for (UINT32 lane = 0; lane < 4; ++lane)
+    {
+        triangles[lane] = lane < aTriangles.size() ? &mTriangles[aTriangles[lane]] : &sDegenerate;
+    }
+
+    auto gather = [&triangles](const XMFLOAT3 Triangle::* aMember, __m128& aX, __m128& aY, __m128& aZ)
+    {
+        const XMFLOAT3& lane0 = triangles[0]->*aMember;
+        const XMFLOAT3& lane1 = triangles[1]->*aMember;
+        const XMFLOAT3& lane2 = triangles[2]->*aMember;
+        const XMFLOAT3& lane3 = triangles[3]->*aMember;
+        aX = _mm_setr_ps(lane0.x, lane1.x, lane2.x, lane3.x);
+        aY = _mm_setr_ps(lane0.y, lane1.y, lane2.y, lane3.y);
+        aZ = _mm_setr_ps(lane0.z, lane1.z, lane2.z, lane3.z);
+    };
+    __m128 vertexX, vertexY, vertexZ, edge1X, edge1Y, edge1Z, edge2X, edge2Y, edge2Z;
+    gather(&Triangle::Vertex0, vertexX, vertexY, vertexZ);
+    gather(&Triangle::Edge1, edge1X, edge1Y, edge1Z);
+    gather(&Triangle::Edge2, edge2X, edge2Y, edge2Z);
+
+    const __m128 directionX = _mm_set1_ps(aDirection.x);
+    const __m128 directionY = _mm_set1_ps(aDirection.y);
+    const __m128 directionZ = _mm_set1_ps(aDirection.z);
+    auto dot = [](__m128 aX, __m128 aY, __m128 aZ, __m128 aOtherX, __m128 aOtherY, __m128 aOtherZ)
+    {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(aX, aOtherX), _mm_mul_ps(aY, aOtherY)), _mm_mul_ps(aZ, aOtherZ));
+    };
+
+    // p = d x e2, det = e1 . p
+    __m128 pX = _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y));
+    __m128 pY = _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z));
+    __m128 pZ = _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X));
+    __m128 determinant = dot(edge1X, edge1Y, edge1Z, pX, pY, pZ);
+    __m128 inverseDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+    // s = o - v0, q = s x e1
+    __m128 sX = _mm_sub_ps(_mm_set1_ps(aOrigin.x), vertexX);
+    __m128 sY = _mm_sub_ps(_mm_set1_ps(aOrigin.y), vertexY);
+    __m128 sZ = _mm_sub_ps(_mm_set1_ps(aOrigin.z), vertexZ);
+    __m128 qX = _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y));
+    __m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z));
+    __m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X));
+
+    __m128 u = _mm_mul_ps(dot(sX, sY, sZ, pX, pY, pZ), inverseDeterminant);
+    __m128 v = _mm_mul_ps(dot(directionX, directionY, directionZ, qX, qY, qZ), inverseDeterminant);
+    __m128 distance = _mm_mul_ps(dot(edge2X, edge2Y, edge2Z, qX, qY, qZ), inverseDeterminant);
+
+    const __m128 zero = _mm_setzero_ps();
+    __m128 absoluteDeterminant = _mm_andnot_ps(_mm_set1_ps(-0.0f), determinant);
+    __m128 isHit = _mm_cmpgt_ps(absoluteDeterminant, _mm_set1_ps(1e-12f));
+    isHit = _mm_and_ps(isHit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+    isHit = _mm_and_ps(isHit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    isHit = _mm_and_ps(isHit, _mm_and_ps(_mm_cmpge_ps(distance, zero), _mm_cmplt_ps(distance, _mm_set1_ps(aMaxDistance))));
+
+    UINT32 hitMask = _mm_movemask_ps(isHit);
+    if (hitMask == 0)
+    {
+        return aMaxDistance;
+    }
+
+    alignas(16) float distances[4], us[4], vs[4];
+    _mm_store_ps(distances, distance);
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    float nearest = aMaxDistance;
+    for (UINT32 mask = hitMask; mask != 0; mask &= mask - 1)
+    {
+        UINT32 lane = std::countr_zero(mask);
+        if (distances[lane] < nearest)
+        {
+            nearest = distances[lane];
+            aHit = { distances[lane], aTriangles[lane], us[lane], vs[lane] };
+        }
+    }
+    return nearest;
+}
+
+bool RayPicking::TriangleMesh::Intersect(const XMFLOAT3& aOrigin, const XMFLOAT3& aDirection, float aMaxDistance, TriangleHit& aHit)
+{
+    if (!mIsBuilt)
+    {
+        Build();
+    }
+
+    float distance = mHierarchy.IntersectRay(aOrigin, aDirection, aMaxDistance, [&](std::span<const UINT32> aTriangles, float aNearest)
+    {
+        return IntersectTriangles(aOrigin, aDirection, aTriangles, aNearest, aHit);
+    });
+    return distance < aMaxDistance;
+}
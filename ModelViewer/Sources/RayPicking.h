@@ -0,0 +1,51 @@
+#pragma once
+
+#include "BoundingVolumeHierarchy.h"
+#include <DirectXMath.h>
+#include <span>
+
+// CPU ray casts against triangle meshes, used to pick what is under the cursor. Every mesh keeps a copy of its
+// positions and LOD 0 indices from import and builds a triangle hierarchy the first time a ray reaches it, so meshes
+// that are never picked cost no build time. The hierarchy tests four child boxes at once and the leaves test four
+// triangles at once with SSE.
+namespace RayPicking
+{
+    struct TriangleHit
+    {
+        float Distance = 0.0f;      // in units of the ray direction
+        UINT32 Triangle = 0;        // index of the first index of the triangle divided by 3
+        float U = 0.0f;             // barycentric weight of the second vertex
+        float V = 0.0f;             // barycentric weight of the third vertex, the first one has 1 - U - V
+    };
+
+    class TriangleMesh
+    {
+        // First vertex and the two edges from it, precomputed for the Moller-Trumbore test.
+        struct Triangle
+        {
+            DirectX::XMFLOAT3 Vertex0;
+            DirectX::XMFLOAT3 Edge1;
+            DirectX::XMFLOAT3 Edge2;
+        };
+
+        std::vector<DirectX::XMFLOAT3> mPositions;      // released once the triangles are built
+        std::vector<UINT32> mIndices;
+        std::vector<Triangle> mTriangles;
+        BoundingVolumeHierarchy mHierarchy;
+        bool mIsBuilt = false;
+
+        void Build();
+        float IntersectTriangles(const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, std::span<const UINT32> aTriangles, float aMaxDistance, TriangleHit& aHit) const;
+
+    public:
+        TriangleMesh() {}
+        TriangleMesh(std::vector<DirectX::XMFLOAT3>&& aPositions, std::vector<UINT32>&& aIndices);
+
+        // Finds the nearest triangle hit by aOrigin + t * aDirection with t in [0, aMaxDistance), both faces count.
+        // Builds the hierarchy on the first call.
+        bool Intersect(const DirectX::XMFLOAT3& aOrigin, const DirectX::XMFLOAT3& aDirection, float aMaxDistance, TriangleHit& aHit);
+
+        UINT32 GetTrianglesCount() const { return static_cast<UINT32>(mIsBuilt ? mTriangles.size() : mIndices.size() / 3); }
+        bool IsBuilt() const { return mIsBuilt; }
+    };
+}
@@ -0,0 +1,61 @@
+#include "pch.h"
+#include "RenderQueue.h"
+#include "Utility.h"
+
+UINT64 RenderQueue::MakeKey(Pass aPass, UINT32 aPipeline, UINT32 aDescriptorTable, UINT32 aMaterial, float aDepth)
+{
+    ASSERT(aPipeline < sMaxPipelinesCount, "Pipeline index does not fit into the draw key.");
+    ASSERT(aDescriptorTable <= 0xFFFF, "Descriptor table does not fit into the draw key.");
+    ASSERT(aMaterial <= 0xFFFF, "Material ID does not fit into the draw key.");
+
+    // Sign bit dropped, the next 24 bits are exponent and mantissa and keep the order of the depths.
+    UINT32 depthBits;
+    float depth = std::max(aDepth, 0.0f);
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+    UINT64 quantizedDepth = (depthBits >> 7) & 0xFFFFFF;
+
+    UINT64 key = (static_cast<UINT64>(aPass) << 62) | (static_cast<UINT64>(aPipeline) << 56);
+    if (aPass == Pass::Transparent)
+    {
+        return key | ((0xFFFFFF - quantizedDepth) << 32) | (static_cast<UINT64>(aMaterial) << 16) | aDescriptorTable;
+    }
+    return key | (static_cast<UINT64>(aDescriptorTable) << 40) | (static_cast<UINT64>(aMaterial) << 24) | quantizedDepth;
+}
+
+void RenderQueue::Sort()
+{
+    constexpr UINT32 digitsCount = sizeof(UINT64);
+    UINT32 histograms[digitsCount][256] = {};
+    for (const Draw& draw : mDraws)
+    {
+        for (UINT32 digit = 0; digit < digitsCount; ++digit)
+        {
+            ++histograms[digit][(draw.Key >> (digit * 8)) & 0xFF];
+        }
+    }
+
+    mScratch.resize(mDraws.size());
+    for (UINT32 digit = 0; digit < digitsCount; ++digit)
+    {
+        UINT32* histogram = histograms[digit];
+        if (histogram[(mDraws.empty() ? 0 : mDraws.front().Key >> (digit * 8)) & 0xFF] == mDraws.size())
+        {
+            continue;
+        }
+
+        // Bucket counts become bucket start offsets.
+        UINT32 offset = 0;
+        for (UINT32 bucket = 0; bucket < 256; ++bucket)
+        {
+            UINT32 count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += count;
+        }
+
+        for (const Draw& draw : mDraws)
+        {
+            mScratch[histogram[(draw.Key >> (digit * 8)) & 0xFF]++] = draw;
+        }
+        mDraws.swap(mScratch);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Per-frame list of draws, sorted by a 64-bit key before recording so that draws sharing state are adjacent.
+//
+// Key layout, most significant bits first:
+//   opaque:      pass (2) | pipeline (6) | descriptor table (16) | material (16) | depth (24)
+//   transparent: pass (2) | pipeline (6) | inverted depth (24) | material (16) | descriptor table (16)
+// Opaque draws are grouped by state, materials that share a descriptor table are adjacent, and go front to back
+// inside a material for early-Z. Transparent draws go back to front so that blending is correct. Depth is the top of the float bit pattern, which orders like the value for
+// non-negative floats and needs no depth range.
+class RenderQueue
+{
+public:
+    enum class Pass : UINT32
+    {
+        Opaque,
+        Transparent
+    };
+
+    static constexpr UINT32 sPassesCount = 2;
+    static constexpr UINT32 sMaxPipelinesCount = 64;
+
+    struct Draw
+    {
+        UINT64 Key;
+        UINT32 Index;       // caller-defined, usually an index into its own array of draws
+    };
+
+private:
+    std::vector<Draw> mDraws;
+    std::vector<Draw> mScratch;
+
+public:
+    static UINT64 MakeKey(Pass aPass, UINT32 aPipeline, UINT32 aDescriptorTable, UINT32 aMaterial, float aDepth);
+    static Pass GetPass(UINT64 aKey) { return static_cast<Pass>(aKey >> 62); }
+    static UINT32 GetPipeline(UINT64 aKey) { return static_cast<UINT32>(aKey >> 56) & (sMaxPipelinesCount - 1); }
+
+    void Clear() { mDraws.clear(); }
+    void Add(UINT64 aKey, UINT32 aIndex) { mDraws.push_back({ aKey, aIndex }); }
+
+    // LSD radix sort with 8-bit digits. All digit histograms are built in one pass and digits that are equal for
+    // every key are skipped, so unused and constant key bits cost nothing. The sort is stable.
+    void Sort();
+
+    const std::vector<Draw>& GetDraws() const { return mDraws; }
+};
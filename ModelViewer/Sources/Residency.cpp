@@ -0,0 +1,251 @@
+#include "pch.h"
+#include "Residency.h"
+#include "Utility.h"
+#include <mutex>
+
+static constexpr UINT64 sBudgetQueryInterval = 30;     // frames between adapter budget queries
+
+static Residency::Tracker sTracker;
+static std::vector<ID3D12Resource*> sResources;         // by handle, owned by their GpuResource
+static std::mutex sMutex;
+static bool sIsEnabled = false;
+static UINT64 sFrame = 0;
+static UINT64 sBudgetOverrideInBytes = 0;
+static UINT64 sBudgetInBytes = UINT64_MAX;
+static UINT64 sEvictionsCount = 0;
+static UINT64 sRestoresCount = 0;
+
+namespace Residency
+{
+    void Tracker::Link(UINT32 aHandle)
+    {
+        Entry& entry = mEntries[aHandle];
+        entry.MoreRecent = sInvalidHandle;
+        entry.LessRecent = mMostRecent;
+        if (mMostRecent != sInvalidHandle)
+        {
+            mEntries[mMostRecent].MoreRecent = aHandle;
+        }
+        mMostRecent = aHandle;
+        if (mLeastRecent == sInvalidHandle)
+        {
+            mLeastRecent = aHandle;
+        }
+    }
+
+    void Tracker::Unlink(UINT32 aHandle)
+    {
+        Entry& entry = mEntries[aHandle];
+        (entry.MoreRecent != sInvalidHandle ? mEntries[entry.MoreRecent].LessRecent : mMostRecent) = entry.LessRecent;
+        (entry.LessRecent != sInvalidHandle ? mEntries[entry.LessRecent].MoreRecent : mLeastRecent) = entry.MoreRecent;
+        entry.MoreRecent = sInvalidHandle;
+        entry.LessRecent = sInvalidHandle;
+    }
+
+    UINT32 Tracker::Add(UINT64 aSizeInBytes, UINT64 aFrame)
+    {
+        UINT32 handle = static_cast<UINT32>(mEntries.size());
+        if (!mFreeHandles.empty())
+        {
+            handle = mFreeHandles.back();
+            mFreeHandles.pop_back();
+        }
+        else
+        {
+            mEntries.emplace_back();
+        }
+
+        Entry& entry = mEntries[handle];
+        entry.SizeInBytes = aSizeInBytes;
+        entry.LastUsedFrame = aFrame;
+        entry.IsResident = true;
+        entry.IsValid = true;
+        Link(handle);
+        mResidentBytes += aSizeInBytes;
+        ++mResourcesCount;
+        return handle;
+    }
+
+    void Tracker::Remove(UINT32 aHandle)
+    {
+        Entry& entry = mEntries[aHandle];
+        ASSERT(entry.IsValid, "Resource is not tracked.");
+        if (entry.IsResident)
+        {
+            Unlink(aHandle);
+            mResidentBytes -= entry.SizeInBytes;
+        }
+        else
+        {
+            mEvictedBytes -= entry.SizeInBytes;
+        }
+        entry = Entry();
+        mFreeHandles.push_back(aHandle);
+        --mResourcesCount;
+    }
+
+    bool Tracker::MarkUsed(UINT32 aHandle, UINT64 aFrame)
+    {
+        Entry& entry = mEntries[aHandle];
+        ASSERT(entry.IsValid, "Resource is not tracked.");
+        entry.LastUsedFrame = aFrame;
+        bool wasEvicted = !entry.IsResident;
+        if (wasEvicted)
+        {
+            entry.IsResident = true;
+            mEvictedBytes -= entry.SizeInBytes;
+            mResidentBytes += entry.SizeInBytes;
+        }
+        else
+        {
+            Unlink(aHandle);
+        }
+        Link(aHandle);
+        return wasEvicted;
+    }
+
+    void Tracker::Evict(UINT64 aBudgetInBytes, UINT64 aFrame, std::vector<UINT32>& aEvicted)
+    {
+        // The list is in the order of the frames the resources were last used in, so once the least recent one was
+        // used in aFrame all of them were.
+        while (mResidentBytes > aBudgetInBytes && mLeastRecent != sInvalidHandle && mEntries[mLeastRecent].LastUsedFrame < aFrame)
+        {
+            UINT32 handle = mLeastRecent;
+            Entry& entry = mEntries[handle];
+            Unlink(handle);
+            entry.IsResident = false;
+            mResidentBytes -= entry.SizeInBytes;
+            mEvictedBytes += entry.SizeInBytes;
+            aEvicted.push_back(handle);
+        }
+    }
+
+    // What the tracked resources may use: the budget of the process less its usage outside of them. Evicted resources
+    // are not part of the usage.
+    static UINT64 QueryBudget()
+    {
+        if (sBudgetOverrideInBytes > 0)
+        {
+            return sBudgetOverrideInBytes;
+        }
+
+        DXGI_QUERY_VIDEO_MEMORY_INFO memoryInfo = {};
+        if (!Graphics::QueryVideoMemoryInfo(DXGI_MEMORY_SEGMENT_GROUP_LOCAL, memoryInfo))
+        {
+            return UINT64_MAX;
+        }
+        UINT64 untrackedBytes = memoryInfo.CurrentUsage > sTracker.GetResidentBytes() ? memoryInfo.CurrentUsage - sTracker.GetResidentBytes() : 0;
+        return memoryInfo.Budget > untrackedBytes ? memoryInfo.Budget - untrackedBytes : 0;
+    }
+
+    void Initialize(UINT64 aBudgetOverrideInBytes)
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        sBudgetOverrideInBytes = aBudgetOverrideInBytes;
+        sBudgetInBytes = QueryBudget();
+        sIsEnabled = true;
+    }
+
+    void Shutdown()
+    {
+        // Resources that outlive residency keep their handles, removing them does nothing from now on.
+        std::lock_guard<std::mutex> lock(sMutex);
+        sTracker = Tracker();
+        sResources.clear();
+        sIsEnabled = false;
+    }
+
+    UINT32 Add(ID3D12Resource* aResource, UINT64 aSizeInBytes)
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        if (!sIsEnabled)
+        {
+            return sInvalidHandle;
+        }
+
+        if (aResource)
+        {
+            aSizeInBytes = Graphics::GetBackend().GetAllocationSize(aResource->GetDesc());
+        }
+        UINT32 handle = sTracker.Add(aSizeInBytes, sFrame);
+        sResources.resize(std::max<size_t>(sResources.size(), handle + 1));
+        sResources[handle] = aResource;
+        return handle;
+    }
+
+    void Remove(UINT32 aHandle)
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        if (sIsEnabled && aHandle != sInvalidHandle)
+        {
+            sTracker.Remove(aHandle);
+            sResources[aHandle] = nullptr;
+        }
+    }
+
+    void MarkUsed(UINT32 aHandle)
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        if (!sIsEnabled || aHandle == sInvalidHandle)
+        {
+            return;
+        }
+
+        // Making a resource resident blocks until its memory is back, a frame that needs many evicted resources
+        // stalls instead of faulting.
+        if (sTracker.MarkUsed(aHandle, sFrame))
+        {
+            if (ID3D12Pageable* pageable = sResources[aHandle])
+            {
+                Graphics::GetBackend().MakeResident(std::span(&pageable, 1));
+            }
+            ++sRestoresCount;
+        }
+    }
+
+    void Update()
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        if (!sIsEnabled)
+        {
+            return;
+        }
+
+        if (sFrame % sBudgetQueryInterval == 0)
+        {
+            sBudgetInBytes = QueryBudget();
+        }
+
+        // The previous frames are done on the GPU when the next one starts, see Graphics::Present, so everything the
+        // current frame does not use can be evicted.
+        std::vector<UINT32> evicted;
+        sTracker.Evict(sBudgetInBytes, sFrame, evicted);
+        std::vector<ID3D12Pageable*> pageables;
+        for (UINT32 handle : evicted)
+        {
+            if (sResources[handle])
+            {
+                pageables.push_back(sResources[handle]);
+            }
+        }
+        if (!pageables.empty())
+        {
+            Graphics::GetBackend().Evict(pageables);
+        }
+        sEvictionsCount += evicted.size();
+        ++sFrame;
+    }
+
+    Statistics GetStatistics()
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        Statistics statistics;
+        statistics.BudgetBytes = sBudgetInBytes;
+        statistics.ResidentBytes = sTracker.GetResidentBytes();
+        statistics.EvictedBytes = sTracker.GetEvictedBytes();
+        statistics.Evictions = sEvictionsCount;
+        statistics.Restores = sRestoresCount;
+        statistics.ResourcesCount = sTracker.GetResourcesCount();
+        return statistics;
+    }
+}
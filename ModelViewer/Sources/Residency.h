@@ -0,0 +1,82 @@
+#pragma once
+
+#include "pch.h"
+
+// Keeps the committed resources within the video memory budget the OS gives the process. Every GpuResource with its
+// own memory registers here, and the renderer marks the resources a frame uses. Once per frame, the least recently
+// used resources that the frame does not need are evicted until the rest fits the budget. An evicted resource keeps
+// its contents and views and is made resident again when it is marked. The budget comes from periodic adapter
+// queries, minus what the process uses outside of the tracked resources.
+namespace Residency
+{
+    static constexpr UINT32 sInvalidHandle = UINT32_MAX;
+
+    // Bookkeeping and eviction policy without any device calls, so it can be driven with a simulated budget. The
+    // resident resources are kept in least recently used order, marking and eviction are constant time per resource.
+    class Tracker
+    {
+        struct Entry
+        {
+            UINT64 SizeInBytes = 0;
+            UINT64 LastUsedFrame = 0;
+            UINT32 MoreRecent = sInvalidHandle;     // neighbours in the list of resident entries
+            UINT32 LessRecent = sInvalidHandle;
+            bool IsResident = false;
+            bool IsValid = false;
+        };
+
+        std::vector<Entry> mEntries;
+        std::vector<UINT32> mFreeHandles;
+        UINT32 mMostRecent = sInvalidHandle;
+        UINT32 mLeastRecent = sInvalidHandle;
+        UINT64 mResidentBytes = 0;
+        UINT64 mEvictedBytes = 0;
+        UINT32 mResourcesCount = 0;
+
+        void Link(UINT32 aHandle);
+        void Unlink(UINT32 aHandle);
+
+    public:
+        // New resources are resident and count as used in aFrame.
+        UINT32 Add(UINT64 aSizeInBytes, UINT64 aFrame);
+        void Remove(UINT32 aHandle);
+        // Frames passed to one tracker must not decrease. Returns true if the resource was evicted, it counts as
+        // resident again and has to be made resident before the GPU uses it.
+        bool MarkUsed(UINT32 aHandle, UINT64 aFrame);
+        // Appends the least recently used resources to aEvicted until the resident ones fit aBudgetInBytes. Resources
+        // used in aFrame are never evicted, even if that leaves the resident ones over budget.
+        void Evict(UINT64 aBudgetInBytes, UINT64 aFrame, std::vector<UINT32>& aEvicted);
+
+        bool IsResident(UINT32 aHandle) const { return mEntries[aHandle].IsResident; }
+        UINT64 GetResidentBytes() const { return mResidentBytes; }
+        UINT64 GetEvictedBytes() const { return mEvictedBytes; }
+        UINT32 GetResourcesCount() const { return mResourcesCount; }
+    };
+
+    struct Statistics
+    {
+        UINT64 BudgetBytes = 0;
+        UINT64 ResidentBytes = 0;
+        UINT64 EvictedBytes = 0;
+        UINT64 Evictions = 0;
+        UINT64 Restores = 0;            // evicted resources made resident again
+        UINT32 ResourcesCount = 0;
+    };
+
+    // Resources are only tracked between Initialize and Shutdown. A non-zero aBudgetOverrideInBytes replaces the
+    // adapter budget, which the null backend does not have, so eviction can be tried without a GPU under pressure.
+    void Initialize(UINT64 aBudgetOverrideInBytes = 0);
+    void Shutdown();
+
+    // Thread-safe. The size of the allocation of aResource is asked from the backend, aSizeInBytes is only used
+    // without a resource. Returns sInvalidHandle while residency is off.
+    UINT32 Add(ID3D12Resource* aResource, UINT64 aSizeInBytes);
+    void Remove(UINT32 aHandle);
+    // Call for every resource the current frame uses before Update, and before anything else reaches the GPU with it.
+    void MarkUsed(UINT32 aHandle);
+
+    // Render thread, once per frame after all resources of the frame were marked and before recording.
+    void Update();
+
+    Statistics GetStatistics();
+}
@@ -1,66 +1,307 @@
 #include "pch.h"
 #include "Texture.h"
 #include "DirectXTex.h"
+#include "TextureCooker.h"
+#include "TextureStreaming.h"
+#include "UploadBatch.h"
+#include "VirtualTexturing.h"
 #include "Utility.h"
+#include <algorithm>
+#include <tuple>
 
 std::map<std::wstring, Texture> Texture::sTextureRegister;
+std::deque<Texture> Texture::sTextureArrays;
+std::mutex Texture::sTextureRegisterMutex;
 
-Texture* Texture::FindOrCreateTexture(const std::wstring& aPath)
+Texture* Texture::FindOrCreateTexture(const std::wstring& aPath, aiTextureType aTextureType)
 {
+    Texture* texture = FindTexture(aPath);
+    if (texture)
+    {
+        return texture;
+    }
+
+    std::unique_ptr<DirectX::ScratchImage> image = Decode(aPath, aTextureType);
+    return CreateTexture(aPath, image.get());
+}
+
+Texture* Texture::FindTexture(const std::wstring& aPath)
+{
+    std::lock_guard<std::mutex> lock(sTextureRegisterMutex);
     auto findIt = sTextureRegister.find(aPath);
-    if (findIt != sTextureRegister.end())
+    return findIt != sTextureRegister.end() ? &findIt->second : nullptr;
+}
+
+std::unique_ptr<DirectX::ScratchImage> Texture::Decode(const std::wstring& aPath, aiTextureType aTextureType, std::wstring* aCachePath)
+{
+    std::unique_ptr<DirectX::ScratchImage> image = TextureCooker::Load(aPath, aTextureType, aCachePath);
+    if (image && aCachePath && !aCachePath->empty() && !CanPack(*image) && VirtualTexturing::CanVirtualize(*image, aTextureType))
+    {
+        VirtualTexturing::CookTileFile(*aCachePath, *image);
+    }
+    return image;
+}
+
+Texture* Texture::CreateTexture(const std::wstring& aPath, const DirectX::ScratchImage* aImage, UploadBatch* aUploadBatch, const std::wstring* aStreamPath, aiTextureType aTextureType)
+{
+    // The texture is created outside of the lock, the map is only locked to insert it. If another load created the
+    // same texture in the meantime the new one is dropped, the batch keeps its resource alive until the copy is done.
+    // Streaming keeps a pointer to the texture, so a streamed texture is registered once it is in the map.
+    Storage storage = Storage::Resident;
+    Utility::MappedFile streamFile;
+    if (aImage && aStreamPath)
+    {
+        if (VirtualTexturing::CanVirtualize(*aImage, aTextureType) && VirtualTexturing::HasTileFile(*aStreamPath, *aImage))
+        {
+            storage = Storage::Virtual;
+        }
+        else if (TextureStreaming::CanStream(*aImage, *aStreamPath, streamFile))
+        {
+            storage = Storage::Streamed;
+        }
+    }
+    UploadBatch uploadBatch;
+    UploadBatch& batch = aUploadBatch ? *aUploadBatch : uploadBatch;
+    Texture texture(aPath, aImage, batch, storage);
+
+    std::pair<std::map<std::wstring, Texture>::iterator, bool> inserted;
+    {
+        std::lock_guard<std::mutex> lock(sTextureRegisterMutex);
+        inserted = sTextureRegister.emplace(std::make_pair(aPath, std::move(texture)));
+    }
+    if (storage == Storage::Streamed && inserted.second)
+    {
+        TextureStreaming::Register(&inserted.first->second, std::move(streamFile), *aImage, batch);
+    }
+    else if (storage == Storage::Virtual && inserted.second)
+    {
+        VirtualTexturing::Register(&inserted.first->second, *aStreamPath);
+    }
+    uploadBatch.Submit();
+    return &inserted.first->second;
+}
+
+bool Texture::CanPack(const DirectX::ScratchImage& aImage)
+{
+    const DirectX::TexMetadata& metadata = aImage.GetMetadata();
+    return metadata.dimension == DirectX::TEX_DIMENSION_TEXTURE2D && metadata.arraySize == 1 && !metadata.IsCubemap() && metadata.width <= sMaxPackedSize && metadata.height <= sMaxPackedSize;
+}
+
+std::vector<std::vector<uint32_t>> Texture::GroupForPacking(std::span<const DirectX::ScratchImage* const> aImages)
+{
+    std::map<std::tuple<DXGI_FORMAT, size_t, size_t, size_t>, std::vector<uint32_t>> imagesByLayout;
+    for (uint32_t i = 0; i < aImages.size(); ++i)
     {
-        return &findIt->second;
+        if (aImages[i] && CanPack(*aImages[i]))
+        {
+            const DirectX::TexMetadata& metadata = aImages[i]->GetMetadata();
+            imagesByLayout[std::make_tuple(metadata.format, metadata.width, metadata.height, metadata.mipLevels)].push_back(i);
+        }
     }
-    else
+
+    // Full arrays first, the rest shares one more array unless it is a single image.
+    std::vector<std::vector<uint32_t>> groups;
+    for (const auto& [layout, images] : imagesByLayout)
+    {
+        for (size_t first = 0; first + 1 < images.size(); first += sMaxArraySize)
+        {
+            groups.emplace_back(images.begin() + first, images.begin() + std::min<size_t>(first + sMaxArraySize, images.size()));
+        }
+    }
+    return groups;
+}
+
+std::vector<Texture*> Texture::CreateTextureArray(std::span<const std::wstring> aPaths, std::span<const DirectX::ScratchImage* const> aImages, UploadBatch& aUploadBatch)
+{
+    ASSERT(aPaths.size() == aImages.size() && !aImages.empty() && aImages.size() <= sMaxArraySize, "Wrong number of texture array slices.");
+
+    // The array is never moved once it is in the deque, so the slices can point to it.
+    Texture array(aPaths.front(), aImages, aUploadBatch);
+    std::vector<Texture*> textures;
+    std::lock_guard<std::mutex> lock(sTextureRegisterMutex);
+    const Texture& arrayTexture = sTextureArrays.emplace_back(std::move(array));
+    for (uint32_t i = 0; i < aPaths.size(); ++i)
     {
-        return &(sTextureRegister.emplace(std::make_pair(aPath, Texture(aPath))).first->second);
+        textures.push_back(&sTextureRegister.emplace(std::make_pair(aPaths[i], Texture(aPaths[i], arrayTexture, i))).first->second);
     }
+    return textures;
 }
 
-Texture::Texture(const std::wstring& aPath)
+uint32_t Texture::GetTextureArraysCount()
+{
+    std::lock_guard<std::mutex> lock(sTextureRegisterMutex);
+    return static_cast<uint32_t>(sTextureArrays.size());
+}
+
+uint32_t Texture::GetPackedTexturesCount()
+{
+    std::lock_guard<std::mutex> lock(sTextureRegisterMutex);
+    return static_cast<uint32_t>(std::count_if(sTextureRegister.begin(), sTextureRegister.end(), [](const auto& aEntry) { return aEntry.second.mArray != nullptr; }));
+}
+
+Texture::Texture(const std::wstring& aName, std::span<const DirectX::ScratchImage* const> aImages, UploadBatch& aUploadBatch)
+{
+#ifdef _DEBUG
+    mName = L"Texture array: " + aName.substr(aName.find_last_of('\\') + 1);
+#endif
+
+    const DirectX::TexMetadata& metadata = aImages.front()->GetMetadata();
+    m_Width = static_cast<uint32_t>(metadata.width);
+    m_Height = static_cast<uint32_t>(metadata.height);
+    m_Depth = 1;
+    m_MipLevels = static_cast<uint32_t>(metadata.mipLevels);
+    m_ArraySize = static_cast<uint32_t>(aImages.size());
+    m_Format = metadata.format;
+
+    UINT64 sizeInBytes = 0;
+    for (const DirectX::ScratchImage* image : aImages)
+    {
+        sizeInBytes += image->GetPixelsSize();
+    }
+    ++Graphics::g_BackendStatistics.ResourcesCount;
+    Graphics::g_BackendStatistics.ResourcesBytes += sizeInBytes;
+
+    D3D12_RESOURCE_DESC texDesc = CD3DX12_RESOURCE_DESC::Tex2D(m_Format, m_Width, m_Height, m_ArraySize, m_MipLevels);
+    if (FAILED(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_DEFAULT, texDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, m_pResource)))
+    {
+        Utility::Printf(L"Failed to create texture array for: %s", aName.c_str());
+        return;
+    }
+#ifdef _DEBUG
+    m_pResource->SetName(mName.c_str());
+#endif
+    mFormat = m_Format;
+    TrackResidency(sizeInBytes);
+
+    // Subresources are ordered by slice, then by mip, like the images of every slice.
+    std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+    subresources.reserve(m_ArraySize * m_MipLevels);
+    for (const DirectX::ScratchImage* image : aImages)
+    {
+        for (uint32_t mip = 0; mip < m_MipLevels; ++mip)
+        {
+            const DirectX::Image& mipImage = image->GetImages()[mip];
+            subresources.push_back({ mipImage.pixels, static_cast<LONG_PTR>(mipImage.rowPitch), static_cast<LONG_PTR>(mipImage.slicePitch) });
+        }
+    }
+    aUploadBatch.UploadTexture(m_pResource.Get(), subresources);
+    aUploadBatch.Transition(m_pResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+}
+
+Texture::Texture(const std::wstring& aPath, const Texture& aArray, uint32_t aSlice)
 {
 #ifdef _DEBUG
     mName = aPath.substr(aPath.find_last_of('\\') + 1);
 #endif
 
-	auto image = std::make_unique<DirectX::ScratchImage>();
-	if (SUCCEEDED(LoadFromWICFile(aPath.c_str(), DirectX::WIC_FLAGS_NONE, nullptr, *image)))
+    m_Width = aArray.m_Width;
+    m_Height = aArray.m_Height;
+    m_Depth = 1;
+    m_MipLevels = aArray.m_MipLevels;
+    m_ArraySize = aArray.m_ArraySize;
+    m_ArraySlice = aSlice;
+    m_Format = aArray.m_Format;
+    mFormat = m_Format;
+    mArray = &aArray;
+}
+
+Texture::Texture(const std::wstring& aPath, const DirectX::ScratchImage* aImage, UploadBatch& aUploadBatch, Storage aStorage)
+{
+#ifdef _DEBUG
+    mName = aPath.substr(aPath.find_last_of('\\') + 1);
+#endif
+
+	if (aImage)
 	{
-		const DirectX::TexMetadata metaData = image->GetMetadata();
+		const DirectX::TexMetadata metaData = aImage->GetMetadata();
 		m_Width = metaData.width;
 		m_Height = metaData.height;
 		m_Depth = metaData.depth;
+        m_MipLevels = metaData.mipLevels;
         m_Format = metaData.format;
 
+        // A virtual texture keeps the size of the image, its resource and views are the page table. The tiles are in
+        // the atlas of VirtualTexturing and the page table is uploaded by it.
+        D3D12_RESOURCE_DESC pageTableDesc = {};
+        UINT64 pageTableSizeInBytes = 0;
+        if (aStorage == Storage::Virtual)
+        {
+            pageTableDesc = VirtualTexturing::GetPageTableDesc(*aImage);
+            m_MipLevels = pageTableDesc.MipLevels;
+            m_Format = pageTableDesc.Format;
+            for (UINT32 mip = 0; mip < m_MipLevels; ++mip)
+            {
+                pageTableSizeInBytes += std::max<UINT64>(pageTableDesc.Width >> mip, 1) * std::max<UINT64>(pageTableDesc.Height >> mip, 1) * sizeof(UINT32);
+            }
+        }
+
+        ++Graphics::g_BackendStatistics.ResourcesCount;
+        Graphics::g_BackendStatistics.ResourcesBytes += aStorage == Storage::Virtual ? pageTableSizeInBytes : aImage->GetPixelsSize();
+
         D3D12_RESOURCE_DESC texDesc = {};
         switch (metaData.dimension)
         {
             case DirectX::TEX_DIMENSION_TEXTURE1D:
-                texDesc = CD3DX12_RESOURCE_DESC::Tex1D(m_Format, m_Width, metaData.arraySize);
+                texDesc = CD3DX12_RESOURCE_DESC::Tex1D(m_Format, m_Width, metaData.arraySize, m_MipLevels);
                 break;
             case DirectX::TEX_DIMENSION_TEXTURE2D:
-                texDesc = CD3DX12_RESOURCE_DESC::Tex2D(m_Format, m_Width, m_Height, metaData.arraySize);
+                texDesc = CD3DX12_RESOURCE_DESC::Tex2D(m_Format, m_Width, m_Height, metaData.arraySize, m_MipLevels);
                 break;
             case DirectX::TEX_DIMENSION_TEXTURE3D:
-                texDesc = CD3DX12_RESOURCE_DESC::Tex3D(m_Format, m_Width, m_Height, m_Depth, metaData.arraySize);
+                texDesc = CD3DX12_RESOURCE_DESC::Tex3D(m_Format, m_Width, m_Height, m_Depth, m_MipLevels);
                 break;
             default:
                 ASSERT(false, "Wrong texture dimension.");
                 break;
         }
 
-        D3D12_HEAP_PROPERTIES heapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
-        if (SUCCEEDED(Graphics::g_Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &texDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_pResource))))
+        if (aStorage == Storage::Virtual)
+        {
+            if (SUCCEEDED(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_DEFAULT, pageTableDesc, D3D12_RESOURCE_STATE_COMMON, nullptr, m_pResource)))
+            {
+#ifdef _DEBUG
+                m_pResource->SetName(mName.c_str());
+#endif
+                mFormat = m_Format;
+                TrackResidency(pageTableSizeInBytes);
+            }
+            else
+            {
+                Utility::Printf(L"Failed to create page table for texture: %s", aPath.c_str());
+            }
+            return;
+        }
+
+        // Streamed textures are reserved, TextureStreaming maps memory for their resident mips and uploads them. They
+        // have no memory of their own, so Residency does not track them.
+        if (aStorage == Storage::Streamed)
+        {
+            texDesc.Layout = D3D12_TEXTURE_LAYOUT_64KB_UNDEFINED_SWIZZLE;
+            if (SUCCEEDED(Graphics::GetBackend().CreateReservedResource(texDesc, D3D12_RESOURCE_STATE_COPY_DEST, m_pResource)))
+            {
+#ifdef _DEBUG
+                m_pResource->SetName(mName.c_str());
+#endif
+                mFormat = m_Format;
+            }
+            else
+            {
+                Utility::Printf(L"Failed to create reserved resource for texture: %s", aPath.c_str());
+            }
+            return;
+        }
+
+        if (SUCCEEDED(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_DEFAULT, texDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, m_pResource)))
         {
 #ifdef _DEBUG
             m_pResource->SetName(mName.c_str());
 #endif
             mFormat = m_pResource->GetDesc().Format;
+            TrackResidency(aImage->GetPixelsSize());
 
-            UINT64 subresourcesCount = image->GetImageCount();
+            UINT64 subresourcesCount = aImage->GetImageCount();
             std::vector<D3D12_SUBRESOURCE_DATA> subresources(subresourcesCount);
-            const DirectX::Image* pImages = image->GetImages();
+            const DirectX::Image* pImages = aImage->GetImages();
 
             for (UINT64 i = 0; i < subresourcesCount; ++i)
             {
@@ -71,34 +312,12 @@ Texture::Texture(const std::wstring& aPath)
                 subresource.pData = image.pixels;
             }
 
-            UINT64 requiredSize = GetRequiredIntermediateSize(m_pResource.Get(), 0, subresourcesCount);
-            Microsoft::WRL::ComPtr<ID3D12Resource> intermediateResource;
-            heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
-            D3D12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(requiredSize);
-            if (SUCCEEDED(Graphics::g_Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&intermediateResource))))
-            {
-                Graphics::g_GraphicsCommandList->Reset(Graphics::g_GraphicsCommandAllocators[Graphics::g_CurrentBackBufferIndex].Get(), nullptr);
-
-                UpdateSubresources(Graphics::g_GraphicsCommandList.Get(), m_pResource.Get(), intermediateResource.Get(), 0, 0, subresourcesCount, subresources.data());
-
-                CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_pResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-                Graphics::g_GraphicsCommandList->ResourceBarrier(1, &barrier);
-
-                Graphics::g_GraphicsCommandList->Close();
-
-                ID3D12CommandList* const commandLists[] = { Graphics::g_GraphicsCommandList.Get() };
-                Graphics::g_GraphicsCommandQueue->ExecuteCommandLists(_countof(commandLists), commandLists);
-
-                Graphics::Flush();
+            aUploadBatch.UploadTexture(m_pResource.Get(), subresources);
+            aUploadBatch.Transition(m_pResource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
-                static unsigned texturesCount = 0;
-                ++texturesCount;
-                Utility::Printf(L"Texture resource created: %s. Textures count = %lu", aPath.c_str(), texturesCount);
-            }
-            else
-            {
-                Utility::Printf(L"Failed to create intermediate resource for texture: %s", aPath.c_str());
-            }
+            static unsigned texturesCount = 0;
+            ++texturesCount;
+            Utility::Printf(L"Texture resource created: %s. Textures count = %lu", aPath.c_str(), texturesCount);
         }
         else
         {
@@ -109,32 +328,41 @@ Texture::Texture(const std::wstring& aPath)
 
 void Texture::CreateSRV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescriptorHeap, UINT offset) const
 {
+    if (mArray)
+    {
+        mArray->CreateSRV(SRVDescriptorHeap, offset);
+        return;
+    }
+
     D3D12_SHADER_RESOURCE_VIEW_DESC shaderResourceViewDesc = {};
-    shaderResourceViewDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+    shaderResourceViewDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
     shaderResourceViewDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
     shaderResourceViewDesc.Format = m_Format;
-    shaderResourceViewDesc.Texture2D.MipLevels = 1;
-    shaderResourceViewDesc.Texture2D.MostDetailedMip = 0;
-    shaderResourceViewDesc.Texture2D.ResourceMinLODClamp = 0.0f;
+    shaderResourceViewDesc.Texture2DArray.MipLevels = m_MipLevels;
+    shaderResourceViewDesc.Texture2DArray.MostDetailedMip = 0;
+    shaderResourceViewDesc.Texture2DArray.FirstArraySlice = 0;
+    shaderResourceViewDesc.Texture2DArray.ArraySize = m_ArraySize;
+    shaderResourceViewDesc.Texture2DArray.ResourceMinLODClamp = static_cast<float>(m_ResidentMip);
 
     CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle;
     srvHandle.InitOffsetted(SRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), offset * Graphics::g_SRVDescriptorSize);
 
-    Graphics::g_Device->CreateShaderResourceView(m_pResource.Get(), &shaderResourceViewDesc, srvHandle);
+    Graphics::GetBackend().CreateShaderResourceView(m_pResource.Get(), shaderResourceViewDesc, srvHandle);
 }
 
 void Texture::CreateEmptySRV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescriptorHeap, UINT offset)
 {
     D3D12_SHADER_RESOURCE_VIEW_DESC shaderResourceViewDesc = {};
-    shaderResourceViewDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+    shaderResourceViewDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
     shaderResourceViewDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
     shaderResourceViewDesc.Format = DXGI_FORMAT_R32G32B32A32_UINT;
-    shaderResourceViewDesc.Texture2D.MipLevels = 1;
-    shaderResourceViewDesc.Texture2D.MostDetailedMip = 0;
-    shaderResourceViewDesc.Texture2D.ResourceMinLODClamp = 0.0f;
+    shaderResourceViewDesc.Texture2DArray.MipLevels = 1;
+    shaderResourceViewDesc.Texture2DArray.MostDetailedMip = 0;
+    shaderResourceViewDesc.Texture2DArray.ArraySize = 1;
+    shaderResourceViewDesc.Texture2DArray.ResourceMinLODClamp = 0.0f;
 
     CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle;
     srvHandle.InitOffsetted(SRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), offset * Graphics::g_SRVDescriptorSize);
 
-    Graphics::g_Device->CreateShaderResourceView(nullptr, &shaderResourceViewDesc, srvHandle);
+    Graphics::GetBackend().CreateShaderResourceView(nullptr, shaderResourceViewDesc, srvHandle);
 }
\ No newline at end of file
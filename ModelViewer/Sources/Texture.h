@@ -2,14 +2,57 @@
 
 #include "pch.h"
 #include "GPUResource.h"
+#include <assimp/material.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+
+namespace DirectX
+{
+    class ScratchImage;
+}
+
+class UploadBatch;
 
 class Texture : public GpuResource
 {
 public:
     //Texture() { m_hCpuDescriptorHandle.ptr = D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN; }
     //Texture(D3D12_CPU_DESCRIPTOR_HANDLE Handle) : m_hCpuDescriptorHandle(Handle) {}
-    static Texture* FindOrCreateTexture(const std::wstring& aPath);
+    static Texture* FindOrCreateTexture(const std::wstring& aPath, aiTextureType aTextureType);
+
+    // Loading is split so the slow part can run on loader threads: Decode only touches the CPU and may run on any
+    // thread, it returns the cooked image for the material slot aTextureType (see TextureCooker), CreateTexture records the upload and must run on the render thread. FindTexture is thread-safe and
+    // returns nullptr for textures that were not created yet.
+    //
+    // CreateTexture records into aUploadBatch so many textures share one submit and fence wait, the texture can only be
+    // sampled after aUploadBatch was submitted. Without a batch the texture is uploaded before CreateTexture returns.
+    // Decode returns the path of the cooked file in aCachePath if the image came from the texture cache. Passed on as
+    // aStreamPath, the texture is streamed from that file (see TextureStreaming) and only its smallest mips are
+    // uploaded. Large diffuse textures, aTextureType being the slot they were decoded for, are virtual instead (see
+    // VirtualTexturing): Decode cooks their tile file and the texture is the page table of the tiles.
+    static std::unique_ptr<DirectX::ScratchImage> Decode(const std::wstring& aPath, aiTextureType aTextureType, std::wstring* aCachePath = nullptr);
+    static Texture* CreateTexture(const std::wstring& aPath, const DirectX::ScratchImage* aImage, UploadBatch* aUploadBatch = nullptr, const std::wstring* aStreamPath = nullptr, aiTextureType aTextureType = aiTextureType_NONE);
+    static Texture* FindTexture(const std::wstring& aPath);
 
+    // Small textures are packed at load time: images of the same format, size and mips become the slices of one
+    // texture array, a single resource with a single view. Every slice is a Texture of its own that refers to the
+    // array, materials sample it with its slice index. Packed textures are always resident.
+    static constexpr uint32_t sMaxPackedSize = 512;
+    static constexpr uint32_t sMaxArraySize = 16;       // slices are 4 bits in MaterialParams::TextureSlices
+    static bool CanPack(const DirectX::ScratchImage& aImage);
+    // Groups the images that can share an array, at most sMaxArraySize per group. Images that cannot be packed or
+    // have nothing to share an array with are left out, returns indices into aImages.
+    static std::vector<std::vector<uint32_t>> GroupForPacking(std::span<const DirectX::ScratchImage* const> aImages);
+    // Creates one array from aImages, which have to be a group of GroupForPacking, and a texture for every slice.
+    // Same threading and batching rules as CreateTexture, a path that already has a texture keeps it.
+    static std::vector<Texture*> CreateTextureArray(std::span<const std::wstring> aPaths, std::span<const DirectX::ScratchImage* const> aImages, UploadBatch& aUploadBatch);
+    static uint32_t GetTextureArraysCount();
+    static uint32_t GetPackedTexturesCount();
+
+    // Views are always texture arrays, of one slice for textures that are not packed, so every material slot can
+    // hold either.
     void CreateSRV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescriptorHeap, UINT offset) const override;
     static void CreateEmptySRV(Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> SRVDescriptorHeap, UINT offset);
 
@@ -22,17 +65,44 @@ public:
     uint32_t GetWidth() const { return m_Width; }
     uint32_t GetHeight() const { return m_Height; }
     uint32_t GetDepth() const { return m_Depth; }
+    uint32_t GetMipLevels() const { return m_MipLevels; }
+    uint32_t GetArraySlice() const { return m_ArraySlice; }
+    // The texture whose resource and view this one uses: the array of a packed texture, the texture itself otherwise.
+    // Packed textures of one array have the same view.
+    const Texture* GetArrayTexture() const { return mArray ? mArray : this; }
+    // Marks the array of a packed texture, which is what Residency tracks.
+    void MarkUsed() const { GetArrayTexture()->GpuResource::MarkUsed(); }
+    // The SRV clamps sampling to the resident mips, it has to be recreated after a change.
+    uint32_t GetResidentMip() const { return m_ResidentMip; }
+    void SetResidentMip(uint32_t aResidentMip) { m_ResidentMip = aResidentMip; }
     DXGI_FORMAT GetFormat() const { return m_Format; }
     const D3D12_CPU_DESCRIPTOR_HANDLE& GetSRV() const { return m_hCpuDescriptorHandle; }
 
 private:
-    Texture(const std::wstring& aPath);
+    enum class Storage
+    {
+        Resident,
+        Streamed,
+        Virtual,
+    };
+
+    Texture(const std::wstring& aPath, const DirectX::ScratchImage* aImage, UploadBatch& aUploadBatch, Storage aStorage);
+    // A texture array of aImages and a slice of aArray.
+    Texture(const std::wstring& aName, std::span<const DirectX::ScratchImage* const> aImages, UploadBatch& aUploadBatch);
+    Texture(const std::wstring& aPath, const Texture& aArray, uint32_t aSlice);
 
     static std::map<std::wstring, Texture> sTextureRegister;
+    static std::deque<Texture> sTextureArrays;          // not registered under a path, their slices are
+    static std::mutex sTextureRegisterMutex;
 
     uint32_t m_Width;
     uint32_t m_Height;
     uint32_t m_Depth;
+    uint32_t m_MipLevels = 1;
+    uint32_t m_ResidentMip = 0;
+    uint32_t m_ArraySize = 1;
+    uint32_t m_ArraySlice = 0;
+    const Texture* mArray = nullptr;
     DXGI_FORMAT m_Format;
     D3D12_CPU_DESCRIPTOR_HANDLE m_hCpuDescriptorHandle;
 
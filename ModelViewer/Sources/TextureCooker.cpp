@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "TextureCooker.h"
+#include "MeshCache.h"
+#include "Utility.h"
+#include "DirectXTex.h"
+#include <filesystem>
+
+enum class TextureUsage
+{
+    Color,
+    Normal,
+    Channel,
+};
+
+static const wchar_t* const sUsageNames[] = { L"color", L"normal", L"channel" };
+
+static TextureUsage GetUsage(aiTextureType aTextureType)
+{
+    switch (aTextureType)
+    {
+        case aiTextureType_NORMALS:
+            return TextureUsage::Normal;
+        case aiTextureType_OPACITY:
+        case aiTextureType_SHININESS:
+        case aiTextureType_HEIGHT:
+            return TextureUsage::Channel;
+        default:
+            return TextureUsage::Color;
+    }
+}
+
+DXGI_FORMAT TextureCooker::SelectFormat(aiTextureType aTextureType, bool aIsOpaque)
+{
+    switch (GetUsage(aTextureType))
+    {
+        case TextureUsage::Normal:
+            return DXGI_FORMAT_BC5_UNORM;
+        case TextureUsage::Channel:
+            return DXGI_FORMAT_BC4_UNORM;
+        default:
+            return aIsOpaque ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC7_UNORM;
+    }
+}
+
+static std::unique_ptr<DirectX::ScratchImage> Cook(const DirectX::ScratchImage& aSource, aiTextureType aTextureType)
+{
+    // Block compressed resources need a top level that is a multiple of the 4x4 block, the smaller mips don't.
+    const DirectX::TexMetadata& metadata = aSource.GetMetadata();
+    size_t width = (metadata.width + 3) & ~size_t(3);
+    size_t height = (metadata.height + 3) & ~size_t(3);
+    const DirectX::ScratchImage* image = &aSource;
+    DirectX::ScratchImage resized;
+    if (width != metadata.width || height != metadata.height)
+    {
+        if (FAILED(DirectX::Resize(aSource.GetImages(), aSource.GetImageCount(), metadata, width, height, DirectX::TEX_FILTER_DEFAULT, resized)))
+        {
+            return nullptr;
+        }
+        image = &resized;
+    }
+
+    DirectX::ScratchImage mipChain;
+    if (FAILED(DirectX::GenerateMipMaps(image->GetImages(), image->GetImageCount(), image->GetMetadata(), DirectX::TEX_FILTER_DEFAULT, 0, mipChain)))
+    {
+        return nullptr;
+    }
+
+    DXGI_FORMAT format = TextureCooker::SelectFormat(aTextureType, image->IsAlphaAllOpaque());
+    auto cooked = std::make_unique<DirectX::ScratchImage>();
+    if (FAILED(DirectX::Compress(mipChain.GetImages(), mipChain.GetImageCount(), mipChain.GetMetadata(), format, DirectX::TEX_COMPRESS_BC7_QUICK | DirectX::TEX_COMPRESS_PARALLEL, DirectX::TEX_THRESHOLD_DEFAULT, *cooked)))
+    {
+        return nullptr;
+    }
+    return cooked;
+}
+
+std::unique_ptr<DirectX::ScratchImage> TextureCooker::Load(const std::wstring& aSourcePath, aiTextureType aTextureType, std::wstring* aCachePath)
+{
+    UINT64 sourceHash = MeshCache::HashSourceFile(aSourcePath);
+    if (sourceHash == 0)
+    {
+        Utility::Printf(L"Failed to read texture: %s", aSourcePath.c_str());
+        return nullptr;
+    }
+
+    std::filesystem::path sourcePath(aSourcePath);
+    std::filesystem::path cacheDirectory = sourcePath.parent_path() / L"TextureCache";
+    wchar_t fileName[64];
+    swprintf_s(fileName, L"%016llx-%s.dds", Utility::HashMemory(&sVersion, sizeof(sVersion), sourceHash), sUsageNames[static_cast<UINT32>(GetUsage(aTextureType))]);
+    std::filesystem::path cachePath = cacheDirectory / fileName;
+
+    auto image = std::make_unique<DirectX::ScratchImage>();
+    if (SUCCEEDED(DirectX::LoadFromDDSFile(cachePath.c_str(), DirectX::DDS_FLAGS_NONE, nullptr, *image)))
+    {
+        if (aCachePath)
+        {
+            *aCachePath = cachePath.wstring();
+        }
+        return image;
+    }
+
+    if (FAILED(DirectX::LoadFromWICFile(aSourcePath.c_str(), DirectX::WIC_FLAGS_NONE, nullptr, *image)))
+    {
+        Utility::Printf(L"Failed to decode texture: %s", aSourcePath.c_str());
+        return nullptr;
+    }
+
+    std::unique_ptr<DirectX::ScratchImage> cooked = Cook(*image, aTextureType);
+    if (!cooked)
+    {
+        Utility::Printf(L"Failed to cook texture, it stays uncompressed: %s", aSourcePath.c_str());
+        return image;
+    }
+
+    // Saved under a temporary name first, so a concurrent load of the same source never reads a partial file.
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    std::filesystem::path temporaryPath = cachePath;
+    temporaryPath += L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+    if (SUCCEEDED(DirectX::SaveToDDSFile(cooked->GetImages(), cooked->GetImageCount(), cooked->GetMetadata(), DirectX::DDS_FLAGS_NONE, temporaryPath.c_str())))
+    {
+        std::filesystem::rename(temporaryPath, cachePath, error);
+        if (!error && aCachePath)
+        {
+            *aCachePath = cachePath.wstring();
+        }
+    }
+    else
+    {
+        Utility::Printf(L"Failed to write texture cache: %s", cachePath.c_str());
+    }
+
+    Utility::Printf(L"Texture cooked: %s, %zu mips, %llu KB uncompressed, %llu KB cooked", aSourcePath.c_str(), cooked->GetMetadata().mipLevels, image->GetPixelsSize() / 1024, cooked->GetPixelsSize() / 1024);
+    return cooked;
+}
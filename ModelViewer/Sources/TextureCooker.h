@@ -0,0 +1,27 @@
+#pragma once
+
+#include <assimp/material.h>
+#include <memory>
+
+namespace DirectX
+{
+    class ScratchImage;
+}
+
+// Cooks source images into block compressed DDS files with a full mip chain. Cooked files live in a TextureCache
+// folder next to the source and are named by the hash of the source content and the codec, so an edited source
+// gets a new file and a warm start only reads the DDS.
+//
+// The codec follows the material slot the texture fills: color slots get BC1, or BC7 when the alpha is not opaque,
+// normal maps get BC5 with the shader rebuilding z, and single channel slots (opacity, gloss, height) get BC4.
+namespace TextureCooker
+{
+    static constexpr UINT32 sVersion = 1;
+
+    DXGI_FORMAT SelectFormat(aiTextureType aTextureType, bool aIsOpaque);
+
+    // Returns the cooked image of aSourcePath, cooking it first if the cache has none. Falls back to the uncompressed
+    // source image if cooking fails, returns nullptr if the source cannot be decoded. aCachePath gets the cooked file
+    // if the returned image is in the cache. Thread-safe.
+    std::unique_ptr<DirectX::ScratchImage> Load(const std::wstring& aSourcePath, aiTextureType aTextureType, std::wstring* aCachePath = nullptr);
+}
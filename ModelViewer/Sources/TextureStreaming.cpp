@@ -0,0 +1,446 @@
+#include "pch.h"
+#include "TextureStreaming.h"
+#include "Texture.h"
+#include "Material.h"
+#include "UploadBatch.h"
+#include "Utility.h"
+#include "DirectXTex.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+static constexpr UINT64 sTileSizeInBytes = D3D12_TILED_RESOURCE_TILE_SIZE_IN_BYTES;
+static constexpr UINT64 sDdsHeaderSize = sizeof(UINT32) + 124;
+static constexpr UINT64 sDdsHeaderDX10Size = sDdsHeaderSize + 20;
+static constexpr UINT32 sMaxLoadsInFlight = 8;
+static constexpr UINT64 sDropDelayFrames = 120;      // a mip that is not needed for this many frames is dropped
+
+struct StreamedTexture
+{
+    Texture* Owner = nullptr;
+    Utility::MappedFile File;
+    std::vector<D3D12_SUBRESOURCE_DATA> Mips;                   // point into File
+    std::vector<UINT64> MipSizesInBytes;                        // memory a standard mip takes when resident
+    std::vector<UINT32> MipTilesCounts;
+    std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> MipHeaps;
+    Microsoft::WRL::ComPtr<ID3D12Heap> TailHeap;
+    UINT64 TailSizeInBytes = 0;
+    UINT32 TailMip = 0;                 // the mips from here on are resident as long as the texture lives
+    UINT32 ResidentMip = 0;
+    UINT32 RequestedMip = 0;            // most detailed request of the current frame
+    UINT64 LastNeededFrame = 0;
+    bool IsLoading = false;
+};
+
+struct LoadRequest
+{
+    StreamedTexture* Texture = nullptr;
+    UINT32 Mip = 0;
+};
+
+struct LoadResult
+{
+    StreamedTexture* Texture = nullptr;
+    UINT32 Mip = 0;
+    std::vector<BYTE> Data;
+    Microsoft::WRL::ComPtr<ID3D12Heap> Heap;
+};
+
+static std::vector<std::unique_ptr<StreamedTexture>> sTextures;
+static std::unordered_map<const Texture*, StreamedTexture*> sTexturesByOwner;
+static bool sIsEnabled = false;
+static UINT64 sFrame = 0;
+static UINT64 sBudgetInBytes = 0;
+static UINT64 sResidentBytes = 0;       // standard mips, the tails are outside of the budget
+static UINT64 sLoadingBytes = 0;
+static UINT32 sLoadsInFlight = 0;
+static TextureStreaming::Statistics sStatistics;
+
+// Shared with the loading thread.
+static std::mutex sMutex;
+static std::condition_variable sCondition;
+static std::deque<LoadRequest> sRequests;
+static std::vector<LoadResult> sResults;
+static bool sIsStopping = false;
+static std::thread sThread;
+
+static Microsoft::WRL::ComPtr<ID3D12Heap> CreateHeap(UINT64 aSizeInBytes)
+{
+    Microsoft::WRL::ComPtr<ID3D12Heap> heap;
+    CD3DX12_HEAP_DESC heapDesc(aSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, 0, D3D12_HEAP_FLAG_DENY_BUFFERS | D3D12_HEAP_FLAG_DENY_RT_DS_TEXTURES);
+    ASSERT_HRESULT(Graphics::GetBackend().CreateHeap(heapDesc, heap), "Failed to create texture heap.");
+    return heap;
+}
+
+// Maps the tiles of aSubresource and the following ones to the start of aHeap, or unmaps them without a heap. The
+// mapping is a queue operation, it happens after the work that was submitted before it.
+static void MapTiles(ID3D12Resource* aResource, UINT32 aSubresource, UINT32 aTilesCount, ID3D12Heap* aHeap)
+{
+    Graphics::GetBackend().UpdateTileMappings(Graphics::g_GraphicsCommandQueue.Get(), aResource, aSubresource, aTilesCount, aHeap);
+}
+
+// Reads the requested mips and creates their heaps, so the render thread only maps and copies.
+static void LoadMips()
+{
+    std::unique_lock<std::mutex> lock(sMutex);
+    while (true)
+    {
+        sCondition.wait(lock, []() { return sIsStopping || !sRequests.empty(); });
+        if (sIsStopping)
+        {
+            return;
+        }
+
+        LoadRequest request = sRequests.front();
+        sRequests.pop_front();
+        lock.unlock();
+
+        // Copying out of the mapping is where the file is actually read.
+        LoadResult result = { request.Texture, request.Mip };
+        const D3D12_SUBRESOURCE_DATA& mip = request.Texture->Mips[request.Mip];
+        const BYTE* mipData = static_cast<const BYTE*>(mip.pData);
+        result.Data.assign(mipData, mipData + mip.SlicePitch);
+        result.Heap = CreateHeap(request.Texture->MipSizesInBytes[request.Mip]);
+
+        lock.lock();
+        sResults.push_back(std::move(result));
+    }
+}
+
+namespace TextureStreaming
+{
+    void Initialize(UINT64 aBudgetInBytes)
+    {
+        if (!Graphics::GetBackend().SupportsTiledResources())
+        {
+            Utility::Print("Texture streaming is off, the device has no tiled resources.");
+            return;
+        }
+
+        sBudgetInBytes = aBudgetInBytes;
+        sIsStopping = false;
+        sThread = std::thread(LoadMips);
+        sIsEnabled = true;
+    }
+
+    void Shutdown()
+    {
+        if (!sIsEnabled)
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sMutex);
+            sIsStopping = true;
+        }
+        sCondition.notify_all();
+        sThread.join();
+
+        // The heaps may still be in use by frames in flight.
+        Graphics::Flush();
+        sRequests.clear();
+        sResults.clear();
+        sTexturesByOwner.clear();
+        sTextures.clear();
+        sIsEnabled = false;
+    }
+
+    bool CanStream(const DirectX::ScratchImage& aImage, const std::wstring& aCachePath, Utility::MappedFile& aFile)
+    {
+        const DirectX::TexMetadata& metadata = aImage.GetMetadata();
+        if (!sIsEnabled || metadata.dimension != DirectX::TEX_DIMENSION_TEXTURE2D || metadata.arraySize != 1 || metadata.mipLevels < 2)
+        {
+            return false;
+        }
+
+        // The mips are read straight from the file, which has to hold them in the order and with the pitches of aImage.
+        if (!aFile.Open(aCachePath))
+        {
+            return false;
+        }
+        UINT64 fileSize = aFile.GetSizeInBytes();
+        if (fileSize != sDdsHeaderSize + aImage.GetPixelsSize() && fileSize != sDdsHeaderDX10Size + aImage.GetPixelsSize())
+        {
+            aFile.Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Register(Texture* aTexture, Utility::MappedFile&& aFile, const DirectX::ScratchImage& aImage, UploadBatch& aUploadBatch)
+    {
+        // The texture reported it if its reserved resource could not be created.
+        ID3D12Resource* resource = aTexture->GetResource();
+        if (resource == nullptr)
+        {
+            return;
+        }
+
+        auto streamedTexture = std::make_unique<StreamedTexture>();
+        StreamedTexture& texture = *streamedTexture;
+        texture.Owner = aTexture;
+        texture.File = std::move(aFile);
+
+        UINT32 mipLevels = static_cast<UINT32>(aImage.GetImageCount());
+        const DirectX::Image* images = aImage.GetImages();
+        UINT64 offset = texture.File.GetSizeInBytes() - aImage.GetPixelsSize();
+        for (UINT32 mip = 0; mip < mipLevels; ++mip)
+        {
+            texture.Mips.push_back({ texture.File.GetData() + offset, static_cast<LONG_PTR>(images[mip].rowPitch), static_cast<LONG_PTR>(images[mip].slicePitch) });
+            offset += images[mip].slicePitch;
+        }
+
+        D3D12_PACKED_MIP_INFO packedMipInfo = {};
+        std::vector<D3D12_SUBRESOURCE_TILING> subresourceTilings(mipLevels);
+        Graphics::GetBackend().GetResourceTiling(resource, packedMipInfo, subresourceTilings);
+
+        UINT32 standardMipsCount = packedMipInfo.NumStandardMips;
+        UINT32 tailTilesCount = packedMipInfo.NumTilesForPackedMips;
+        for (UINT32 mip = 0; mip < standardMipsCount; ++mip)
+        {
+            const D3D12_SUBRESOURCE_TILING& tiling = subresourceTilings[mip];
+            texture.MipTilesCounts.push_back(tiling.WidthInTiles * tiling.HeightInTiles * tiling.DepthInTiles);
+        }
+
+        for (UINT32 tilesCount : texture.MipTilesCounts)
+        {
+            texture.MipSizesInBytes.push_back(tilesCount * sTileSizeInBytes);
+        }
+        texture.MipHeaps.resize(standardMipsCount);
+        texture.TailSizeInBytes = tailTilesCount * sTileSizeInBytes;
+
+        // Without packed mips the smallest standard mip stands in for the tail, so something can always be sampled.
+        texture.TailMip = std::min(standardMipsCount, mipLevels - 1);
+        if (texture.TailMip < standardMipsCount)
+        {
+            texture.MipHeaps[texture.TailMip] = CreateHeap(texture.MipSizesInBytes[texture.TailMip]);
+            MapTiles(resource, texture.TailMip, texture.MipTilesCounts[texture.TailMip], texture.MipHeaps[texture.TailMip].Get());
+        }
+        if (tailTilesCount > 0)
+        {
+            texture.TailHeap = CreateHeap(texture.TailSizeInBytes);
+            MapTiles(resource, standardMipsCount, tailTilesCount, texture.TailHeap.Get());
+        }
+
+        // Once the tail is uploaded streamed textures live in the common state. Sampling promotes them implicitly
+        // and they decay back after every frame, a later copy promotes the mip it writes to copy destination and
+        // the batch transitions that mip back.
+        std::vector<D3D12_SUBRESOURCE_DATA> tailMips(mipLevels - texture.TailMip);
+        for (UINT32 mip = texture.TailMip; mip < mipLevels; ++mip)
+        {
+            tailMips[mip - texture.TailMip] = { images[mip].pixels, static_cast<LONG_PTR>(images[mip].rowPitch), static_cast<LONG_PTR>(images[mip].slicePitch) };
+        }
+        aUploadBatch.UploadTexture(resource, tailMips, texture.TailMip);
+        aUploadBatch.Transition(resource, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
+
+        if (texture.TailMip < standardMipsCount)
+        {
+            texture.TailSizeInBytes += texture.MipSizesInBytes[texture.TailMip];
+        }
+        texture.ResidentMip = texture.TailMip;
+        texture.RequestedMip = texture.TailMip;
+        texture.LastNeededFrame = sFrame;
+        aTexture->SetResidentMip(texture.ResidentMip);
+
+        ++sStatistics.TexturesCount;
+        sTexturesByOwner.emplace(aTexture, streamedTexture.get());
+        sTextures.push_back(std::move(streamedTexture));
+    }
+
+    void RequestMip(const Texture* aTexture, float aProjectedSize, const DirectX::XMFLOAT4& aTexCoordBounds)
+    {
+        auto found = sTexturesByOwner.find(aTexture);
+        if (found == sTexturesByOwner.end())
+        {
+            return;
+        }
+
+        // A surface n pixels across shows the texels its texture coordinates span, the mip with about n of them is
+        // enough.
+        float spanU = std::max(aTexCoordBounds.z - aTexCoordBounds.x, 0.0f);
+        float spanV = std::max(aTexCoordBounds.w - aTexCoordBounds.y, 0.0f);
+        float texelsCount = std::max(aTexture->GetWidth() * spanU, aTexture->GetHeight() * spanV);
+        float mip = std::floor(std::log2(std::max(texelsCount / std::max(aProjectedSize, 1.0f), 1.0f)));
+        StreamedTexture& texture = *found->second;
+        texture.RequestedMip = std::min(texture.RequestedMip, static_cast<UINT32>(mip));
+    }
+
+    void Update()
+    {
+        if (!sIsEnabled)
+        {
+            return;
+        }
+        ++sFrame;
+
+        std::vector<LoadResult> results;
+        {
+            std::lock_guard<std::mutex> lock(sMutex);
+            results.swap(sResults);
+        }
+
+        for (const LoadResult& result : results)
+        {
+            // The texture stays loading until its new mip is mapped, so it is neither dropped nor loaded again first.
+            StreamedTexture& texture = *result.Texture;
+            texture.ResidentMip = result.Mip;
+            sLoadingBytes -= texture.MipSizesInBytes[result.Mip];
+            sResidentBytes += texture.MipSizesInBytes[result.Mip];
+            --sLoadsInFlight;
+        }
+
+        // A texture keeps its mips for sDropDelayFrames after they were last needed, so turning the camera back and
+        // forth does not stream the same mips again and again.
+        std::vector<LoadRequest> drops;
+        auto drop = [&drops](StreamedTexture& aTexture)
+        {
+            drops.push_back({ &aTexture, aTexture.ResidentMip });
+            sResidentBytes -= aTexture.MipSizesInBytes[aTexture.ResidentMip];
+            ++aTexture.ResidentMip;
+        };
+        std::vector<StreamedTexture*> loadCandidates;
+        for (const std::unique_ptr<StreamedTexture>& texture : sTextures)
+        {
+            if (texture->RequestedMip <= texture->ResidentMip)
+            {
+                texture->LastNeededFrame = sFrame;
+            }
+
+            if (texture->IsLoading)
+            {
+                continue;
+            }
+
+            if (texture->RequestedMip < texture->ResidentMip)
+            {
+                loadCandidates.push_back(texture.get());
+            }
+            else if (texture->ResidentMip < texture->TailMip && sFrame - texture->LastNeededFrame > sDropDelayFrames)
+            {
+                drop(*texture);
+            }
+        }
+
+        // The textures furthest from what they need go first. Mips come in one at a time from small to large, the
+        // resident mips always have to be a contiguous chain for the LOD clamp. When the budget is full, mips that
+        // are resident but not requested are dropped, least recently needed first.
+        std::sort(loadCandidates.begin(), loadCandidates.end(), [](const StreamedTexture* aLeft, const StreamedTexture* aRight)
+        {
+            return aLeft->ResidentMip - aLeft->RequestedMip > aRight->ResidentMip - aRight->RequestedMip;
+        });
+        std::vector<LoadRequest> requests;
+        for (StreamedTexture* texture : loadCandidates)
+        {
+            if (sLoadsInFlight >= sMaxLoadsInFlight)
+            {
+                break;
+            }
+
+            UINT32 mip = texture->ResidentMip - 1;
+            UINT64 sizeInBytes = texture->MipSizesInBytes[mip];
+            while (sResidentBytes + sLoadingBytes + sizeInBytes > sBudgetInBytes)
+            {
+                StreamedTexture* leastRecentlyNeeded = nullptr;
+                for (const std::unique_ptr<StreamedTexture>& other : sTextures)
+                {
+                    if (!other->IsLoading && other->ResidentMip < other->RequestedMip && other->ResidentMip < other->TailMip &&
+                        (leastRecentlyNeeded == nullptr || other->LastNeededFrame < leastRecentlyNeeded->LastNeededFrame))
+                    {
+                        leastRecentlyNeeded = other.get();
+                    }
+                }
+                if (leastRecentlyNeeded == nullptr)
+                {
+                    break;
+                }
+                drop(*leastRecentlyNeeded);
+            }
+            if (sResidentBytes + sLoadingBytes + sizeInBytes > sBudgetInBytes)
+            {
+                break;
+            }
+
+            texture->IsLoading = true;
+            sLoadingBytes += sizeInBytes;
+            ++sLoadsInFlight;
+            requests.push_back({ texture, mip });
+        }
+
+        // Unmapping waits for the frames in flight on the queue, their SRVs still include the dropped mips. The new
+        // SRVs are written once the batch has been waited for, when no frame uses the old ones anymore.
+        if (!results.empty() || !drops.empty())
+        {
+            std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> droppedHeaps;
+            UploadBatch uploadBatch;
+            for (const LoadRequest& dropped : drops)
+            {
+                StreamedTexture& texture = *dropped.Texture;
+                MapTiles(texture.Owner->GetResource(), dropped.Mip, texture.MipTilesCounts[dropped.Mip], nullptr);
+                droppedHeaps.push_back(std::move(texture.MipHeaps[dropped.Mip]));
+            }
+
+            for (LoadResult& result : results)
+            {
+                StreamedTexture& texture = *result.Texture;
+                ID3D12Resource* resource = texture.Owner->GetResource();
+                MapTiles(resource, result.Mip, texture.MipTilesCounts[result.Mip], result.Heap.Get());
+                texture.MipHeaps[result.Mip] = std::move(result.Heap);
+                D3D12_SUBRESOURCE_DATA mip = { result.Data.data(), texture.Mips[result.Mip].RowPitch, texture.Mips[result.Mip].SlicePitch };
+                uploadBatch.UploadTexture(resource, std::span(&mip, 1), result.Mip);
+                uploadBatch.Transition(resource, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON, result.Mip);
+            }
+
+            uploadBatch.Submit();
+            if (results.empty())
+            {
+                Graphics::Flush();
+            }
+            droppedHeaps.clear();
+
+            for (const LoadResult& result : results)
+            {
+                result.Texture->IsLoading = false;
+                result.Texture->Owner->SetResidentMip(result.Texture->ResidentMip);
+            }
+            for (const LoadRequest& dropped : drops)
+            {
+                dropped.Texture->Owner->SetResidentMip(dropped.Texture->ResidentMip);
+            }
+            Materials::CreateMaterialTexturesSRV();
+
+            sStatistics.StreamedInMips += results.size();
+            sStatistics.DroppedMips += drops.size();
+        }
+
+        if (!requests.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock(sMutex);
+                sRequests.insert(sRequests.end(), requests.begin(), requests.end());
+            }
+            sCondition.notify_one();
+        }
+
+        for (const std::unique_ptr<StreamedTexture>& texture : sTextures)
+        {
+            texture->RequestedMip = texture->TailMip;
+        }
+    }
+
+    Statistics GetStatistics()
+    {
+        Statistics statistics = sStatistics;
+        statistics.ResidentBytes = sResidentBytes;
+        for (const std::unique_ptr<StreamedTexture>& texture : sTextures)
+        {
+            statistics.ResidentBytes += texture->TailSizeInBytes;
+        }
+        statistics.BudgetBytes = sBudgetInBytes;
+        return statistics;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "pch.h"
+#include "Utility.h"
+#include <DirectXMath.h>
+#include <string>
+
+class Texture;
+class UploadBatch;
+
+namespace DirectX
+{
+    class ScratchImage;
+}
+
+// Mip streaming for cooked textures. A streamed texture is a reserved resource. When it is created, only its packed
+// mip tail is backed by memory; every larger mip gets its own heap once it is streamed in. The SRVs restrict sampling
+// to the resident mips with ResourceMinLODClamp, so mips can come and go without recreating the texture.
+//
+// Every frame the renderer requests the mip each visible texture needs. A background thread reads the missing mips
+// from the cooked DDS files and creates their heaps. The render thread maps and uploads them in one batch, and drops
+// mips that have not been needed for a while. Everything beyond the packed tails stays within a fixed budget. When
+// the budget is full, the least recently needed mips are dropped first. With the null backend the heaps and tile
+// mappings are empty, the mips are still read and copied.
+namespace TextureStreaming
+{
+    struct Statistics
+    {
+        UINT64 ResidentBytes = 0;
+        UINT64 BudgetBytes = 0;
+        UINT64 StreamedInMips = 0;
+        UINT64 DroppedMips = 0;
+        UINT32 TexturesCount = 0;
+    };
+
+    // Streaming stays off until Initialize, and textures are fully resident until then. It also stays off on
+    // devices without tiled resources.
+    void Initialize(UINT64 aBudgetInBytes);
+    void Shutdown();
+    // Whether a texture created from aImage can be streamed: a 2D texture with mips that matches its cooked file.
+    // The file is opened into aFile here, so a texture is only created as a reserved resource once its mips can be read.
+    bool CanStream(const DirectX::ScratchImage& aImage, const std::wstring& aCachePath, Utility::MappedFile& aFile);
+
+    // Maps the packed mip tail of aTexture and records its upload into aUploadBatch. aTexture is a reserved resource
+    // created from aImage. aFile is the cooked DDS that CanStream opened, the larger mips are streamed from it.
+    void Register(Texture* aTexture, Utility::MappedFile&& aFile, const DirectX::ScratchImage& aImage, UploadBatch& aUploadBatch);
+
+    // Asks for the mip of aTexture that a surface aProjectedSize pixels across needs. aTexCoordBounds are the minimum
+    // and maximum texture coordinates of the surface, surfaces that repeat the texture get a coarser mip. The most
+    // detailed request of a frame wins.
+    void RequestMip(const Texture* aTexture, float aProjectedSize, const DirectX::XMFLOAT4& aTexCoordBounds);
+
+    // Runs once per frame on the render thread, after the requests and before recording.
+    void Update();
+
+    Statistics GetStatistics();
+}
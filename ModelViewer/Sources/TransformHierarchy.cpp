@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "TransformHierarchy.h"
+#include "Utility.h"
+#include <execution>
+
+UINT32 TransformHierarchy::AddNode(UINT32 aParentIndex, const DirectX::XMFLOAT4X4& aLocalTransform)
+{
+    UINT32 nodeIndex = GetNodesCount();
+    ASSERT(aParentIndex == sNoParent || aParentIndex + mSubtreeSizes[aParentIndex] == nodeIndex, "Nodes must be added in depth-first order.");
+
+    for (UINT32 ancestor = aParentIndex; ancestor != sNoParent; ancestor = mParentIndices[ancestor])
+    {
+        ++mSubtreeSizes[ancestor];
+    }
+
+    mParentIndices.push_back(aParentIndex);
+    mSubtreeSizes.push_back(1);
+    mLocalTransforms.emplace_back();
+    mWorldTransforms.emplace_back();
+    mDirtyFlags.push_back(0);
+    SetLocalTransform(nodeIndex, aLocalTransform);
+    return nodeIndex;
+}
+
+void TransformHierarchy::SetLocalTransform(UINT32 aNodeIndex, const DirectX::XMFLOAT4X4& aLocalTransform)
+{
+    DirectX::XMStoreFloat4x4A(&mLocalTransforms[aNodeIndex], DirectX::XMLoadFloat4x4(&aLocalTransform));
+    mDirtyFlags[aNodeIndex] = 1;
+    mIsDirty = true;
+}
+
+void TransformHierarchy::UpdateNode(UINT32 aNodeIndex)
+{
+    // The parent is already up to date, its flag tells whether the change has to be passed down.
+    UINT32 parentIndex = mParentIndices[aNodeIndex];
+    if (parentIndex != sNoParent)
+    {
+        mDirtyFlags[aNodeIndex] |= mDirtyFlags[parentIndex];
+    }
+
+    if (!mDirtyFlags[aNodeIndex])
+    {
+        return;
+    }
+
+    DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4A(&mLocalTransforms[aNodeIndex]);
+    if (parentIndex != sNoParent)
+    {
+        world = DirectX::XMMatrixMultiply(world, DirectX::XMLoadFloat4x4A(&mWorldTransforms[parentIndex]));
+    }
+    DirectX::XMStoreFloat4x4A(&mWorldTransforms[aNodeIndex], world);
+}
+
+void TransformHierarchy::SplitSubtree(UINT32 aNodeIndex, std::vector<UINT32>& aSubtrees)
+{
+    if (mSubtreeSizes[aNodeIndex] <= sSubtreeNodesCount)
+    {
+        aSubtrees.push_back(aNodeIndex);
+        return;
+    }
+
+    // The node is updated here, before any task reads it as a parent.
+    UpdateNode(aNodeIndex);
+    UINT32 end = aNodeIndex + mSubtreeSizes[aNodeIndex];
+    for (UINT32 child = aNodeIndex + 1; child < end; child += mSubtreeSizes[child])
+    {
+        SplitSubtree(child, aSubtrees);
+    }
+}
+
+bool TransformHierarchy::Update()
+{
+    if (!mIsDirty)
+    {
+        return false;
+    }
+
+    auto updateSubtree = [this](UINT32 aRootIndex)
+    {
+        UINT32 end = aRootIndex + mSubtreeSizes[aRootIndex];
+        for (UINT32 i = aRootIndex; i < end; ++i)
+        {
+            UpdateNode(i);
+        }
+    };
+
+    if (GetNodesCount() < sParallelNodesCount)
+    {
+        for (UINT32 root = 0; root < GetNodesCount(); root += mSubtreeSizes[root])
+        {
+            updateSubtree(root);
+        }
+    }
+    else
+    {
+        std::vector<UINT32> subtrees;
+        for (UINT32 root = 0; root < GetNodesCount(); root += mSubtreeSizes[root])
+        {
+            SplitSubtree(root, subtrees);
+        }
+        std::for_each(std::execution::par, subtrees.begin(), subtrees.end(), updateSubtree);
+    }
+
+    std::fill(mDirtyFlags.begin(), mDirtyFlags.end(), 0);
+    mIsDirty = false;
+    return true;
+}
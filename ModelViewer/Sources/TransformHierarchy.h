@@ -0,0 +1,49 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// Node of an imported scene, as stored in the mesh cache. Transforms use the DirectXMath row vector convention.
+struct NodeDesc
+{
+    UINT32 ParentIndex;
+    DirectX::XMFLOAT4X4 LocalTransform;
+};
+
+// Flattened node hierarchy of a model. Nodes are stored in depth-first order as a structure of arrays, so a parent
+// always comes before its children, every subtree is a contiguous range and the world transform pass is a linear
+// walk over the arrays.
+//
+// Only nodes whose local transform changed, and their descendants, are recomputed. Large hierarchies are split into
+// independent subtrees that are updated in parallel.
+class TransformHierarchy
+{
+public:
+    static constexpr UINT32 sNoParent = UINT32_MAX;
+    static constexpr UINT32 sParallelNodesCount = 4096;     // smaller hierarchies are updated on the calling thread
+    static constexpr UINT32 sSubtreeNodesCount = 1024;      // subtrees up to this size are updated by one task
+
+private:
+    std::vector<UINT32> mParentIndices;
+    std::vector<UINT32> mSubtreeSizes;                      // the node and all of its descendants
+    std::vector<DirectX::XMFLOAT4X4A> mLocalTransforms;
+    std::vector<DirectX::XMFLOAT4X4A> mWorldTransforms;
+    std::vector<UINT8> mDirtyFlags;                         // not std::vector<bool>, subtrees are written concurrently
+    bool mIsDirty = false;
+
+    void UpdateNode(UINT32 aNodeIndex);
+    void SplitSubtree(UINT32 aNodeIndex, std::vector<UINT32>& aSubtrees);
+
+public:
+    // Nodes must be added in depth-first order: aParentIndex is sNoParent or the previous node or one of its ancestors.
+    UINT32 AddNode(UINT32 aParentIndex, const DirectX::XMFLOAT4X4& aLocalTransform);
+    void SetLocalTransform(UINT32 aNodeIndex, const DirectX::XMFLOAT4X4& aLocalTransform);
+
+    // Recomputes the world transforms of the dirty nodes and their descendants. Returns false if nothing changed.
+    bool Update();
+
+    UINT32 GetNodesCount() const { return static_cast<UINT32>(mParentIndices.size()); }
+    UINT32 GetParentIndex(UINT32 aNodeIndex) const { return mParentIndices[aNodeIndex]; }
+    const DirectX::XMFLOAT4X4A& GetLocalTransform(UINT32 aNodeIndex) const { return mLocalTransforms[aNodeIndex]; }
+    const DirectX::XMFLOAT4X4A& GetWorldTransform(UINT32 aNodeIndex) const { return mWorldTransforms[aNodeIndex]; }
+    const std::vector<DirectX::XMFLOAT4X4A>& GetWorldTransforms() const { return mWorldTransforms; }
+};
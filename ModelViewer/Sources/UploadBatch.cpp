@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "UploadBatch.h"
+#include "Utility.h"
+
+void UploadBatch::Begin()
+{
+    if (!mIsRecording)
+    {
+        mCommandList = CommandList(Graphics::g_GraphicsCommandList.Get());
+        mCommandList.Reset(Graphics::g_GraphicsCommandAllocators[Graphics::g_CurrentBackBufferIndex].Get());
+        mIsRecording = true;
+    }
+}
+
+UploadBatch::Allocation UploadBatch::Allocate(UINT64 aSizeInBytes, UINT64 aAlignment)
+{
+    Begin();
+
+    StagingBuffer* stagingBuffer = mStagingBuffers.empty() ? nullptr : &mStagingBuffers.back();
+    UINT64 offset = stagingBuffer ? (stagingBuffer->Offset + aAlignment - 1) & ~(aAlignment - 1) : 0;
+
+    if (stagingBuffer == nullptr || offset + aSizeInBytes > stagingBuffer->SizeInBytes)
+    {
+        StagingBuffer newStagingBuffer;
+        newStagingBuffer.SizeInBytes = std::max(mStagingBufferSize, aSizeInBytes);
+
+        D3D12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(newStagingBuffer.SizeInBytes);
+        ASSERT_HRESULT(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_UPLOAD, bufferDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, newStagingBuffer.Resource), "Failed to create staging buffer.");
+
+        CD3DX12_RANGE readRange(0, 0);
+        ASSERT_HRESULT(newStagingBuffer.Resource->Map(0, &readRange, reinterpret_cast<void**>(&newStagingBuffer.CpuAddress)), "Failed to map staging buffer.");
+
+        mStagingBuffers.push_back(std::move(newStagingBuffer));
+        stagingBuffer = &mStagingBuffers.back();
+        offset = 0;
+    }
+
+    stagingBuffer->Offset = offset + aSizeInBytes;
+    mUploadedBytes += aSizeInBytes;
+
+    return { stagingBuffer->Resource.Get(), offset, stagingBuffer->CpuAddress + offset };
+}
+
+void UploadBatch::UploadBuffer(ID3D12Resource* aDestination, const void* aData, UINT64 aSizeInBytes, UINT64 aDestinationOffset)
+{
+    Allocation allocation = Allocate(aSizeInBytes, 16);
+    memcpy(allocation.CpuAddress, aData, aSizeInBytes);
+    mCommandList.CopyBufferRegion(aDestination, aDestinationOffset, allocation.Resource, allocation.Offset, aSizeInBytes);
+}
+
+void UploadBatch::UploadTexture(ID3D12Resource* aDestination, std::span<const D3D12_SUBRESOURCE_DATA> aSubresources, UINT aFirstSubresource)
+{
+    UINT subresourcesCount = static_cast<UINT>(aSubresources.size());
+    std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints(subresourcesCount);
+    std::vector<UINT> rowsCounts(subresourcesCount);
+    std::vector<UINT64> rowSizesInBytes(subresourcesCount);
+    UINT64 sizeInBytes = 0;
+    Graphics::GetBackend().GetCopyableFootprints(aDestination->GetDesc(), aFirstSubresource, subresourcesCount, 0, footprints.data(), rowsCounts.data(), rowSizesInBytes.data(), &sizeInBytes);
+
+    Allocation allocation = Allocate(sizeInBytes, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+    for (UINT i = 0; i < subresourcesCount; ++i)
+    {
+        D3D12_PLACED_SUBRESOURCE_FOOTPRINT& footprint = footprints[i];
+        D3D12_MEMCPY_DEST destination = { allocation.CpuAddress + footprint.Offset, footprint.Footprint.RowPitch, SIZE_T(footprint.Footprint.RowPitch) * rowsCounts[i] };
+        MemcpySubresource(&destination, &aSubresources[i], static_cast<SIZE_T>(rowSizesInBytes[i]), rowsCounts[i], footprint.Footprint.Depth);
+
+        footprint.Offset += allocation.Offset;
+        CD3DX12_TEXTURE_COPY_LOCATION destinationLocation(aDestination, aFirstSubresource + i);
+        CD3DX12_TEXTURE_COPY_LOCATION sourceLocation(allocation.Resource, footprint);
+        mCommandList.CopyTextureRegion(&destinationLocation, 0, 0, 0, &sourceLocation, nullptr);
+    }
+    mTextures.emplace_back(aDestination);
+}
+
+void UploadBatch::UploadTextureRegion(ID3D12Resource* aDestination, UINT aSubresource, UINT aX, UINT aY, UINT aWidth, UINT aHeight, const D3D12_SUBRESOURCE_DATA& aData)
+{
+    // The footprint of a texture of the size of the region is the footprint of the region.
+    D3D12_RESOURCE_DESC desc = aDestination->GetDesc();
+    desc.Width = aWidth;
+    desc.Height = aHeight;
+    desc.DepthOrArraySize = 1;
+    desc.MipLevels = 1;
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
+    UINT rowsCount = 0;
+    UINT64 rowSizeInBytes = 0;
+    UINT64 sizeInBytes = 0;
+    Graphics::GetBackend().GetCopyableFootprints(desc, 0, 1, 0, &footprint, &rowsCount, &rowSizeInBytes, &sizeInBytes);
+
+    Allocation allocation = Allocate(sizeInBytes, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+    D3D12_MEMCPY_DEST destination = { allocation.CpuAddress, footprint.Footprint.RowPitch, SIZE_T(footprint.Footprint.RowPitch) * rowsCount };
+    MemcpySubresource(&destination, &aData, static_cast<SIZE_T>(rowSizeInBytes), rowsCount, 1);
+
+    footprint.Offset = allocation.Offset;
+    CD3DX12_TEXTURE_COPY_LOCATION destinationLocation(aDestination, aSubresource);
+    CD3DX12_TEXTURE_COPY_LOCATION sourceLocation(allocation.Resource, footprint);
+    mCommandList.CopyTextureRegion(&destinationLocation, aX, aY, 0, &sourceLocation, nullptr);
+    mTextures.emplace_back(aDestination);
+}
+
+void UploadBatch::Transition(ID3D12Resource* aResource, D3D12_RESOURCE_STATES aStateBefore, D3D12_RESOURCE_STATES aStateAfter, UINT aSubresource)
+{
+    mBarriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(aResource, aStateBefore, aStateAfter, aSubresource));
+}
+
+void UploadBatch::Submit()
+{
+    if (!mIsRecording)
+    {
+        return;
+    }
+
+    if (!mBarriers.empty())
+    {
+        mCommandList.ResourceBarrier(static_cast<UINT>(mBarriers.size()), mBarriers.data());
+    }
+
+    mCommandList.Close();
+
+    ID3D12CommandList* const commandLists[] = { mCommandList.GetNative() };
+    Graphics::GetBackend().ExecuteCommandLists(Graphics::g_GraphicsCommandQueue.Get(), commandLists);
+    Graphics::Flush();
+    ++Graphics::g_BackendStatistics.Submits;
+    Graphics::g_BackendStatistics.UploadedBytes += mUploadedBytes;
+
+    for (StagingBuffer& stagingBuffer : mStagingBuffers)
+    {
+        stagingBuffer.Resource->Unmap(0, nullptr);
+    }
+
+    mStagingBuffers.clear();
+    mBarriers.clear();
+    mTextures.clear();
+    mUploadedBytes = 0;
+    mIsRecording = false;
+}
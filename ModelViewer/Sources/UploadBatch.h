@@ -0,0 +1,72 @@
+#pragma once
+
+#include "pch.h"
+#include "CommandList.h"
+#include <span>
+
+// Collects the uploads of many resources into one command list. Source data is staged in large, persistently
+// mapped upload buffers and everything is submitted with a single fence wait, instead of one committed upload
+// resource and one full CPU/GPU round trip per resource.
+//
+// With the null backend the staging buffers are CPU memory and nothing is executed, the data is still copied so
+// the CPU cost of loading stays the same.
+class UploadBatch
+{
+public:
+    struct Allocation
+    {
+        ID3D12Resource* Resource = nullptr;
+        UINT64 Offset = 0;
+        BYTE* CpuAddress = nullptr;
+    };
+
+private:
+    struct StagingBuffer
+    {
+        Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+        BYTE* CpuAddress = nullptr;
+        UINT64 SizeInBytes = 0;
+        UINT64 Offset = 0;
+    };
+
+    static constexpr UINT64 sStagingBufferSize = 64ull * 1024 * 1024;
+
+    UINT64 mStagingBufferSize = sStagingBufferSize;
+    std::vector<StagingBuffer> mStagingBuffers;
+    std::vector<D3D12_RESOURCE_BARRIER> mBarriers;
+    std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mTextures;     // kept alive until their copies are done
+    CommandList mCommandList;
+    UINT64 mUploadedBytes = 0;
+    bool mIsRecording = false;
+
+    // Resets the shared graphics command list on first use after construction or Submit().
+    void Begin();
+
+public:
+    UploadBatch() {}
+    // A batch for a single upload sizes its staging buffer to it.
+    explicit UploadBatch(UINT64 aStagingBufferSize) : mStagingBufferSize(aStagingBufferSize) {}
+    UploadBatch(const UploadBatch&) = delete;
+    UploadBatch& operator=(const UploadBatch&) = delete;
+    ~UploadBatch() { Submit(); }
+
+    CommandList& GetCommandList() { return mCommandList; }
+
+    // Sub-allocates staging memory, a new staging buffer is created when the current one is full.
+    Allocation Allocate(UINT64 aSizeInBytes, UINT64 aAlignment);
+
+    void UploadBuffer(ID3D12Resource* aDestination, const void* aData, UINT64 aSizeInBytes, UINT64 aDestinationOffset = 0);
+    // Copies aSubresources into the subresources of aDestination from aFirstSubresource on. aDestination must be in the
+    // copy destination state or promotable to it. The rows are staged with the pitch and alignment GetCopyableFootprints
+    // asks for.
+    void UploadTexture(ID3D12Resource* aDestination, std::span<const D3D12_SUBRESOURCE_DATA> aSubresources, UINT aFirstSubresource = 0);
+    // Copies aData, aWidth x aHeight texels, to aX, aY of aSubresource of aDestination. Same state rules as UploadTexture,
+    // block compressed regions have to be block aligned.
+    void UploadTextureRegion(ID3D12Resource* aDestination, UINT aSubresource, UINT aX, UINT aY, UINT aWidth, UINT aHeight, const D3D12_SUBRESOURCE_DATA& aData);
+    void Transition(ID3D12Resource* aResource, D3D12_RESOURCE_STATES aStateBefore, D3D12_RESOURCE_STATES aStateAfter, UINT aSubresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+
+    UINT64 GetUploadedBytes() const { return mUploadedBytes; }
+
+    // Executes the recorded copies and waits for them once. The batch can be reused after that.
+    void Submit();
+};
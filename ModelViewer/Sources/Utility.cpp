@@ -1,2 +1,95 @@
 #include "pch.h"
 #include "Utility.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+namespace Utility
+{
+    bool HasAvx()
+    {
+        // AVX needs both CPU support and the OS saving the YMM registers on context switches.
+        int cpuInfo[4];
+        __cpuid(cpuInfo, 1);
+        bool hasOsxsave = (cpuInfo[2] & (1 << 27)) != 0;
+        bool hasAvx = (cpuInfo[2] & (1 << 28)) != 0;
+        return hasOsxsave && hasAvx && (_xgetbv(0) & 0x6) == 0x6;
+    }
+
+    bool HasAvx2()
+    {
+        int cpuInfo[4];
+        __cpuidex(cpuInfo, 7, 0);
+        return HasAvx() && (cpuInfo[1] & (1 << 5)) != 0;
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& aOther) noexcept
+    {
+        if (this != &aOther)
+        {
+            Close();
+            std::swap(mFile, aOther.mFile);
+            std::swap(mMapping, aOther.mMapping);
+            std::swap(mData, aOther.mData);
+            std::swap(mSizeInBytes, aOther.mSizeInBytes);
+        }
+        return *this;
+    }
+
+    bool MappedFile::Open(const std::wstring& aPath)
+    {
+        Close();
+
+        mFile = CreateFileW(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (mFile == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+
+        mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mMapping == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        mData = static_cast<const BYTE*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        if (mData == nullptr)
+        {
+            Close();
+            return false;
+        }
+
+        mSizeInBytes = fileSize.QuadPart;
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (mData)
+        {
+            UnmapViewOfFile(mData);
+            mData = nullptr;
+        }
+
+        if (mMapping)
+        {
+            CloseHandle(mMapping);
+            mMapping = nullptr;
+        }
+
+        if (mFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(mFile);
+            mFile = INVALID_HANDLE_VALUE;
+        }
+
+        mSizeInBytes = 0;
+    }
+}
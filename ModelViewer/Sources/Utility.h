@@ -44,6 +44,59 @@ namespace Utility
         Print(buffer);
     }
 
+    // 64-bit FNV-1a over 8-byte words, used for content keys of cooked caches.
+    inline UINT64 HashMemory(const void* data, size_t sizeInBytes, UINT64 seed = 14695981039346656037ull)
+    {
+        constexpr UINT64 prime = 1099511628211ull;
+        const BYTE* bytes = static_cast<const BYTE*>(data);
+        UINT64 hash = seed;
+
+        size_t wordsCount = sizeInBytes / sizeof(UINT64);
+        for (size_t i = 0; i < wordsCount; ++i)
+        {
+            UINT64 word;
+            memcpy(&word, bytes + i * sizeof(UINT64), sizeof(UINT64));
+            hash = (hash ^ word) * prime;
+        }
+
+        for (size_t i = wordsCount * sizeof(UINT64); i < sizeInBytes; ++i)
+        {
+            hash = (hash ^ bytes[i]) * prime;
+        }
+
+        return hash;
+    }
+
+    // Whether the CPU and the OS support AVX or AVX2, for kernels that pick their SIMD width at run time.
+    bool HasAvx();
+    bool HasAvx2();
+
+    // Read-only memory mapping of a whole file.
+    class MappedFile
+    {
+        HANDLE mFile = INVALID_HANDLE_VALUE;
+        HANDLE mMapping = nullptr;
+        const BYTE* mData = nullptr;
+        UINT64 mSizeInBytes = 0;
+
+    public:
+        MappedFile() {}
+        MappedFile(const std::wstring& aPath) { Open(aPath); }
+        MappedFile(MappedFile&& aOther) noexcept { *this = std::move(aOther); }
+        MappedFile(const MappedFile&) = delete;
+        ~MappedFile() { Close(); }
+
+        MappedFile& operator=(MappedFile&& aOther) noexcept;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const std::wstring& aPath);
+        void Close();
+
+        bool IsOpen() const { return mData != nullptr; }
+        const BYTE* GetData() const { return mData; }
+        UINT64 GetSizeInBytes() const { return mSizeInBytes; }
+    };
+
 #ifdef ASSERT
 #undef ASSERT
 #endif
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "VertexCompression.h"
+#include "Utility.h"
+#include <DirectXPackedVector.h>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+using namespace DirectX;
+
+static_assert(sizeof(CompactVertex) == 20, "CompactVertex must match the compact input layout");
+static_assert(sizeof(MeshConstants) % sizeof(UINT32) == 0, "MeshConstants are set as root constants");
+
+static INT16 ToSnorm16(float aValue)
+{
+    return static_cast<INT16>(std::lround(std::clamp(aValue, -1.0f, 1.0f) * 32767.0f));
+}
+
+static float FromSnorm16(INT16 aValue)
+{
+    return std::max(aValue / 32767.0f, -1.0f);
+}
+
+static XMFLOAT3 Normalize(const XMFLOAT3& aVector)
+{
+    float length = std::sqrt(aVector.x * aVector.x + aVector.y * aVector.y + aVector.z * aVector.z);
+    if (length < FLT_EPSILON)
+    {
+        return XMFLOAT3(0.0f, 0.0f, 1.0f);
+    }
+    return XMFLOAT3(aVector.x / length, aVector.y / length, aVector.z / length);
+}
+
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static float AngleBetween(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return std::acos(std::clamp(Dot(Normalize(a), Normalize(b)), -1.0f, 1.0f));
+}
+
+void VertexCompression::EncodeOctahedral(const XMFLOAT3& aDirection, INT16 aEncoded[2])
+{
+    XMFLOAT3 direction = Normalize(aDirection);
+    float invL1Norm = 1.0f / (std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z));
+    float x = direction.x * invL1Norm;
+    float y = direction.y * invL1Norm;
+
+    // The lower hemisphere is folded over the diagonals of the square.
+    if (direction.z < 0.0f)
+    {
+        float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    aEncoded[0] = ToSnorm16(x);
+    aEncoded[1] = ToSnorm16(y);
+}
+
+XMFLOAT3 VertexCompression::DecodeOctahedral(const INT16 aEncoded[2])
+{
+    XMFLOAT3 direction(FromSnorm16(aEncoded[0]), FromSnorm16(aEncoded[1]), 0.0f);
+    direction.z = 1.0f - std::abs(direction.x) - std::abs(direction.y);
+
+    float t = std::max(-direction.z, 0.0f);
+    direction.x += direction.x >= 0.0f ? -t : t;
+    direction.y += direction.y >= 0.0f ? -t : t;
+    return Normalize(direction);
+}
+
+UINT16 VertexCompression::QuantizeUnorm16(float aValue, float aMin, float aExtent)
+{
+    if (aExtent <= 0.0f)
+    {
+        return 0;
+    }
+    return static_cast<UINT16>(std::lround(std::clamp((aValue - aMin) / aExtent, 0.0f, 1.0f) * 65535.0f));
+}
+
+float VertexCompression::DequantizeUnorm16(UINT16 aValue, float aMin, float aExtent)
+{
+    return aMin + aValue / 65535.0f * aExtent;
+}
+
+MeshConstants VertexCompression::EncodeMesh(std::span<const Vertex> aVertices, std::vector<CompactVertex>& aCompactVertices)
+{
+    XMFLOAT3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+    XMFLOAT3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (const Vertex& vertex : aVertices)
+    {
+        minimum = XMFLOAT3(std::min(minimum.x, vertex.position.x), std::min(minimum.y, vertex.position.y), std::min(minimum.z, vertex.position.z));
+        maximum = XMFLOAT3(std::max(maximum.x, vertex.position.x), std::max(maximum.y, vertex.position.y), std::max(maximum.z, vertex.position.z));
+    }
+
+    MeshConstants meshConstants;
+    if (aVertices.empty())
+    {
+        aCompactVertices.clear();
+        return meshConstants;
+    }
+
+    meshConstants.PositionOffset = minimum;
+    meshConstants.PositionScale = XMFLOAT3(maximum.x - minimum.x, maximum.y - minimum.y, maximum.z - minimum.z);
+
+    aCompactVertices.resize(aVertices.size());
+    for (size_t i = 0; i < aVertices.size(); ++i)
+    {
+        const Vertex& vertex = aVertices[i];
+        CompactVertex& compactVertex = aCompactVertices[i];
+
+        compactVertex.position[0] = QuantizeUnorm16(vertex.position.x, minimum.x, meshConstants.PositionScale.x);
+        compactVertex.position[1] = QuantizeUnorm16(vertex.position.y, minimum.y, meshConstants.PositionScale.y);
+        compactVertex.position[2] = QuantizeUnorm16(vertex.position.z, minimum.z, meshConstants.PositionScale.z);
+        compactVertex.position[3] = Dot(Cross(vertex.normal, vertex.tangent), vertex.bitangent) < 0.0f ? 0 : 65535;
+
+        EncodeOctahedral(vertex.normal, compactVertex.normal);
+        EncodeOctahedral(vertex.tangent, compactVertex.tangent);
+
+        compactVertex.texCoord[0] = PackedVector::XMConvertFloatToHalf(vertex.texCoord.x);
+        compactVertex.texCoord[1] = PackedVector::XMConvertFloatToHalf(vertex.texCoord.y);
+    }
+
+    return meshConstants;
+}
+
+Vertex VertexCompression::DecodeVertex(const CompactVertex& aVertex, const MeshConstants& aMeshConstants)
+{
+    Vertex vertex;
+    vertex.position.x = DequantizeUnorm16(aVertex.position[0], aMeshConstants.PositionOffset.x, aMeshConstants.PositionScale.x);
+    vertex.position.y = DequantizeUnorm16(aVertex.position[1], aMeshConstants.PositionOffset.y, aMeshConstants.PositionScale.y);
+    vertex.position.z = DequantizeUnorm16(aVertex.position[2], aMeshConstants.PositionOffset.z, aMeshConstants.PositionScale.z);
+
+    vertex.normal = DecodeOctahedral(aVertex.normal);
+    vertex.tangent = DecodeOctahedral(aVertex.tangent);
+
+    float bitangentSign = aVertex.position[3] / 65535.0f * 2.0f - 1.0f;
+    XMFLOAT3 bitangent = Cross(vertex.normal, vertex.tangent);
+    vertex.bitangent = XMFLOAT3(bitangent.x * bitangentSign, bitangent.y * bitangentSign, bitangent.z * bitangentSign);
+
+    vertex.texCoord.x = PackedVector::XMConvertHalfToFloat(aVertex.texCoord[0]);
+    vertex.texCoord.y = PackedVector::XMConvertHalfToFloat(aVertex.texCoord[1]);
+    return vertex;
+}
+
+VertexCompression::RoundTripError VertexCompression::MeasureRoundTripError(std::span<const Vertex> aVertices, std::span<const CompactVertex> aCompactVertices, const MeshConstants& aMeshConstants)
+{
+    ASSERT(aVertices.size() == aCompactVertices.size(), "Vertex streams have different sizes.");
+
+    RoundTripError error;
+    for (size_t i = 0; i < aVertices.size(); ++i)
+    {
+        const Vertex& source = aVertices[i];
+        Vertex decoded = DecodeVertex(aCompactVertices[i], aMeshConstants);
+
+        error.MaxPositionError = std::max({ error.MaxPositionError,
+            std::abs(source.position.x - decoded.position.x),
+            std::abs(source.position.y - decoded.position.y),
+            std::abs(source.position.z - decoded.position.z) });
+        error.MaxNormalAngle = std::max({ error.MaxNormalAngle,
+            AngleBetween(source.normal, decoded.normal),
+            AngleBetween(source.tangent, decoded.tangent) });
+        error.MaxBitangentAngle = std::max(error.MaxBitangentAngle, AngleBetween(source.bitangent, decoded.bitangent));
+        error.MaxTexCoordError = std::max({ error.MaxTexCoordError,
+            std::abs(source.texCoord.x - decoded.texCoord.x),
+            std::abs(source.texCoord.y - decoded.texCoord.y) });
+    }
+    return error;
+}
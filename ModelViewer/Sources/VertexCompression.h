@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Mesh.h"
+#include <span>
+
+// Encoding of Vertex into CompactVertex and back. Positions are quantized to unorm16 inside the mesh AABB,
+// normals and tangents use the octahedral mapping with snorm16 components, the bitangent is rebuilt in the
+// shader from cross(normal, tangent) and a sign, and texture coordinates are stored as half floats.
+// The decode functions mirror VertexShader.hlsl, the Benchmark checks the round-trip error with them.
+namespace VertexCompression
+{
+    struct RoundTripError
+    {
+        float MaxPositionError = 0.0f;      // object space units
+        float MaxNormalAngle = 0.0f;        // radians, covers normals and tangents
+        float MaxBitangentAngle = 0.0f;     // radians, includes the non-orthogonality of the source tangent frame
+        float MaxTexCoordError = 0.0f;
+    };
+
+    void EncodeOctahedral(const DirectX::XMFLOAT3& aDirection, INT16 aEncoded[2]);
+    DirectX::XMFLOAT3 DecodeOctahedral(const INT16 aEncoded[2]);
+
+    UINT16 QuantizeUnorm16(float aValue, float aMin, float aExtent);
+    float DequantizeUnorm16(UINT16 aValue, float aMin, float aExtent);
+
+    // Encodes a whole mesh, the returned constants dequantize the positions in the vertex shader.
+    MeshConstants EncodeMesh(std::span<const Vertex> aVertices, std::vector<CompactVertex>& aCompactVertices);
+    Vertex DecodeVertex(const CompactVertex& aVertex, const MeshConstants& aMeshConstants);
+
+    RoundTripError MeasureRoundTripError(std::span<const Vertex> aVertices, std::span<const CompactVertex> aCompactVertices, const MeshConstants& aMeshConstants);
+}
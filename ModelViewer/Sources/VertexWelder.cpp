@@ -0,0 +1,131 @@
+#include "pch.h"
+#include "VertexWelder.h"
+#include "Utility.h"
+#include <algorithm>
+#include <cmath>
+#include <execution>
+#include <numeric>
+
+struct WeldKey
+{
+    INT32 Values[14];
+
+    bool operator==(const WeldKey& aOther) const { return memcmp(Values, aOther.Values, sizeof(Values)) == 0; }
+};
+
+static INT32 Snap(float aValue, float aCellSize)
+{
+    double cell = std::floor(static_cast<double>(aValue) / aCellSize + 0.5);
+    return static_cast<INT32>(std::clamp(cell, static_cast<double>(INT32_MIN), static_cast<double>(INT32_MAX)));
+}
+
+static WeldKey MakeKey(const Vertex& aVertex, const VertexWelder::Tolerance& aTolerance)
+{
+    const DirectX::XMFLOAT3* directions[] = { &aVertex.normal, &aVertex.tangent, &aVertex.bitangent };
+
+    WeldKey key;
+    key.Values[0] = Snap(aVertex.position.x, aTolerance.Position);
+    key.Values[1] = Snap(aVertex.position.y, aTolerance.Position);
+    key.Values[2] = Snap(aVertex.position.z, aTolerance.Position);
+    for (UINT32 i = 0; i < 3; ++i)
+    {
+        key.Values[3 + i * 3 + 0] = Snap(directions[i]->x, aTolerance.Direction);
+        key.Values[3 + i * 3 + 1] = Snap(directions[i]->y, aTolerance.Direction);
+        key.Values[3 + i * 3 + 2] = Snap(directions[i]->z, aTolerance.Direction);
+    }
+    key.Values[12] = Snap(aVertex.texCoord.x, aTolerance.TexCoord);
+    key.Values[13] = Snap(aVertex.texCoord.y, aTolerance.TexCoord);
+    return key;
+}
+
+VertexWelder::WeldReport VertexWelder::Weld(MeshData& aMesh, const Tolerance& aTolerance)
+{
+    WeldReport report;
+    report.VerticesBefore = static_cast<UINT32>(aMesh.Vertices.size());
+    report.VerticesAfter = report.VerticesBefore;
+    if (aMesh.Vertices.empty())
+    {
+        return report;
+    }
+
+    // Snap and hash every vertex, then sort by hash so equal vertices end up next to each other. Ties are sorted
+    // by vertex index, which makes the first vertex of every group its representative.
+    size_t verticesCount = aMesh.Vertices.size();
+    std::vector<WeldKey> keys(verticesCount);
+    std::vector<std::pair<UINT64, UINT32>> hashes(verticesCount);
+    std::vector<UINT32> vertexIndices(verticesCount);
+    std::iota(vertexIndices.begin(), vertexIndices.end(), 0);
+    std::for_each(std::execution::par, vertexIndices.begin(), vertexIndices.end(), [&](UINT32 aIndex)
+    {
+        keys[aIndex] = MakeKey(aMesh.Vertices[aIndex], aTolerance);
+        hashes[aIndex] = { Utility::HashMemory(&keys[aIndex], sizeof(WeldKey)), aIndex };
+    });
+    std::sort(std::execution::par, hashes.begin(), hashes.end());
+
+    std::vector<UINT32> representatives(verticesCount);
+    for (size_t runStart = 0; runStart < verticesCount;)
+    {
+        size_t runEnd = runStart + 1;
+        while (runEnd < verticesCount && hashes[runEnd].first == hashes[runStart].first)
+        {
+            ++runEnd;
+        }
+
+        // Equal hashes almost always mean equal keys, the keys are still compared to rule out collisions.
+        for (size_t i = runStart; i < runEnd; ++i)
+        {
+            UINT32 vertex = hashes[i].second;
+            representatives[vertex] = vertex;
+            for (size_t j = runStart; j < i; ++j)
+            {
+                UINT32 candidate = hashes[j].second;
+                if (representatives[candidate] == candidate && keys[candidate] == keys[vertex])
+                {
+                    representatives[vertex] = candidate;
+                    break;
+                }
+            }
+        }
+        runStart = runEnd;
+    }
+
+    // Representatives come before the vertices they replace, so one pass assigns the new indices.
+    std::vector<UINT32> remap(verticesCount);
+    std::vector<Vertex> vertices;
+    vertices.reserve(verticesCount);
+    for (UINT32 i = 0; i < verticesCount; ++i)
+    {
+        if (representatives[i] == i)
+        {
+            remap[i] = static_cast<UINT32>(vertices.size());
+            vertices.push_back(aMesh.Vertices[i]);
+        }
+        else
+        {
+            remap[i] = remap[representatives[i]];
+        }
+    }
+
+    std::vector<UINT32>& indices = aMesh.Indices;
+    size_t writeOffset = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        UINT32 a = remap[indices[i]];
+        UINT32 b = remap[indices[i + 1]];
+        UINT32 c = remap[indices[i + 2]];
+        if (a == b || b == c || c == a)
+        {
+            ++report.DegenerateTriangles;
+            continue;
+        }
+
+        indices[writeOffset++] = a;
+        indices[writeOffset++] = b;
+        indices[writeOffset++] = c;
+    }
+    indices.resize(writeOffset);
+
+    aMesh.Vertices.swap(vertices);
+    report.VerticesAfter = static_cast<UINT32>(aMesh.Vertices.size());
+    return report;
+}
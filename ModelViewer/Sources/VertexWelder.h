@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Mesh.h"
+
+// Import-time deduplication of vertices. OBJ files store one vertex per face corner, so most vertices of a
+// smooth mesh exist several times. Every attribute is snapped to a grid with the tolerance as cell size and the
+// vertices with identical snapped attributes are merged, which keeps the pass a hash and a sort.
+namespace VertexWelder
+{
+    struct Tolerance
+    {
+        float Position = 1e-4f;     // object space units
+        float Direction = 1e-3f;    // normal, tangent and bitangent components
+        float TexCoord = 1e-5f;
+    };
+
+    struct WeldReport
+    {
+        UINT32 VerticesBefore = 0;
+        UINT32 VerticesAfter = 0;
+        UINT32 DegenerateTriangles = 0;     // triangles that collapsed and were removed
+
+        float GetDuplicationRatio() const { return VerticesAfter > 0 ? static_cast<float>(VerticesBefore) / VerticesAfter : 1.0f; }
+    };
+
+    // Rebuilds aMesh with unique vertices, in the order of their first occurrence, and remapped indices.
+    WeldReport Weld(MeshData& aMesh, const Tolerance& aTolerance = Tolerance());
+}
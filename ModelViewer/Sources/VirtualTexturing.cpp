@@ -0,0 +1,671 @@
+#include "pch.h"
+#include "VirtualTexturing.h"
+#include "Texture.h"
+#include "UploadBatch.h"
+#include "Utility.h"
+#include "DirectXTex.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+static constexpr UINT32 sMaxTileUploadsPerFrame = 32;
+static constexpr UINT32 sBlocksPerTile = VirtualTexturing::sPaddedTileSize / 4;
+
+// Atlases are plain resources, not GpuResources, so Residency never evicts them. They are few, sized by the tile
+// cache rather than by the scene, and every frame that samples a virtual texture needs its atlas.
+struct Atlas
+{
+    Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+    VirtualTexturing::TileCache Cache;
+    DXGI_FORMAT Format = DXGI_FORMAT_UNKNOWN;
+};
+
+struct VirtualTexture
+{
+    Texture* Owner = nullptr;
+    UINT32 Index = 0;                   // in sTextures
+    VirtualTexturing::TileFile File;
+    VirtualTexturing::PageTable Table;
+    Atlas* TileAtlas = nullptr;
+};
+
+static std::vector<std::unique_ptr<VirtualTexture>> sTextures;     // indexed by TileId::Texture
+static std::unordered_map<const Texture*, VirtualTexture*> sTexturesByOwner;
+static std::map<DXGI_FORMAT, std::unique_ptr<Atlas>> sAtlases;
+static std::vector<UINT64> sRequests;
+static std::vector<UINT64> sPinnedUploads;     // coarsest tiles of new textures, uploaded by the next Update
+static std::atomic<bool> sIsEnabled = false;
+static UINT32 sSlotsPerRow = 0;
+static UINT64 sFrame = 0;
+static VirtualTexturing::Statistics sStatistics;
+
+static std::wstring GetTileFilePath(const std::wstring& aCachePath)
+{
+    return std::filesystem::path(aCachePath).replace_extension(L".tiles").wstring();
+}
+
+// The mips down to the first one that is a single tile, sampling never needs a coarser one.
+static UINT32 GetTiledMipsCount(UINT32 aWidth, UINT32 aHeight, UINT32 aMipsCount)
+{
+    UINT32 mipsCount = 1;
+    while (mipsCount < aMipsCount && VirtualTexturing::GetTilesCount(aWidth, mipsCount - 1) * VirtualTexturing::GetTilesCount(aHeight, mipsCount - 1) > 1)
+    {
+        ++mipsCount;
+    }
+    return mipsCount;
+}
+
+static Atlas& GetAtlas(DXGI_FORMAT aFormat)
+{
+    std::unique_ptr<Atlas>& atlas = sAtlases[aFormat];
+    if (atlas)
+    {
+        return *atlas;
+    }
+
+    atlas = std::make_unique<Atlas>();
+    atlas->Format = aFormat;
+    atlas->Cache = VirtualTexturing::TileCache(sSlotsPerRow * sSlotsPerRow);
+
+    // Like streamed textures the atlas lives in the common state, copies promote it and Update transitions it back.
+    UINT32 size = sSlotsPerRow * VirtualTexturing::sPaddedTileSize;
+    D3D12_RESOURCE_DESC atlasDesc = CD3DX12_RESOURCE_DESC::Tex2D(aFormat, size, size, 1, 1);
+    ASSERT_HRESULT(Graphics::GetBackend().CreateCommittedResource(D3D12_HEAP_TYPE_DEFAULT, atlasDesc, D3D12_RESOURCE_STATE_COMMON, nullptr, atlas->Resource), "Failed to create tile atlas.");
+#ifdef _DEBUG
+    atlas->Resource->SetName(L"Virtual texture atlas");
+#endif
+    return *atlas;
+}
+
+static void UploadTile(const VirtualTexture& aTexture, const VirtualTexturing::TileId& aTile, UINT32 aSlot, UploadBatch& aUploadBatch)
+{
+    const VirtualTexturing::TileFile& file = aTexture.File;
+    D3D12_SUBRESOURCE_DATA data = { file.GetTile(aTile.Mip, aTile.X, aTile.Y), static_cast<LONG_PTR>(file.GetTileRowPitch()), static_cast<LONG_PTR>(file.GetTileSizeInBytes()) };
+    UINT32 x = aSlot % sSlotsPerRow * VirtualTexturing::sPaddedTileSize;
+    UINT32 y = aSlot / sSlotsPerRow * VirtualTexturing::sPaddedTileSize;
+    aUploadBatch.UploadTextureRegion(aTexture.TileAtlas->Resource.Get(), 0, x, y, VirtualTexturing::sPaddedTileSize, VirtualTexturing::sPaddedTileSize, data);
+}
+
+static void UploadPageTable(const VirtualTexture& aTexture, UploadBatch& aUploadBatch)
+{
+    const VirtualTexturing::PageTable& table = aTexture.Table;
+    std::vector<D3D12_SUBRESOURCE_DATA> mips(table.GetMipsCount());
+    for (UINT32 mip = 0; mip < table.GetMipsCount(); ++mip)
+    {
+        const std::vector<UINT32>& entries = table.GetEntries(mip);
+        mips[mip] = { entries.data(), static_cast<LONG_PTR>(table.GetEntriesCountX(mip) * sizeof(UINT32)), static_cast<LONG_PTR>(entries.size() * sizeof(UINT32)) };
+    }
+    // The page table is a tracked resource, it may have been evicted since a frame last drew with it.
+    aTexture.Owner->MarkUsed();
+    aUploadBatch.UploadTexture(aTexture.Owner->GetResource(), mips);
+    aUploadBatch.Transition(aTexture.Owner->GetResource(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
+}
+
+namespace VirtualTexturing
+{
+    UINT32 TileFile::GetBlockSizeInBytes(DXGI_FORMAT aFormat)
+    {
+        switch (aFormat)
+        {
+            case DXGI_FORMAT_BC1_UNORM:
+            case DXGI_FORMAT_BC1_UNORM_SRGB:
+            case DXGI_FORMAT_BC4_UNORM:
+            case DXGI_FORMAT_BC4_SNORM:
+                return 8;
+            case DXGI_FORMAT_BC2_UNORM:
+            case DXGI_FORMAT_BC2_UNORM_SRGB:
+            case DXGI_FORMAT_BC3_UNORM:
+            case DXGI_FORMAT_BC3_UNORM_SRGB:
+            case DXGI_FORMAT_BC5_UNORM:
+            case DXGI_FORMAT_BC5_SNORM:
+            case DXGI_FORMAT_BC6H_UF16:
+            case DXGI_FORMAT_BC6H_SF16:
+            case DXGI_FORMAT_BC7_UNORM:
+            case DXGI_FORMAT_BC7_UNORM_SRGB:
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    UINT64 TileFile::GetFileSizeInBytes(DXGI_FORMAT aFormat, UINT32 aWidth, UINT32 aHeight, UINT32 aMipsCount)
+    {
+        UINT64 tilesCount = 0;
+        for (UINT32 mip = 0; mip < aMipsCount; ++mip)
+        {
+            tilesCount += UINT64(GetTilesCount(aWidth, mip)) * GetTilesCount(aHeight, mip);
+        }
+        return sizeof(Header) + tilesCount * GetTileSizeInBytes(aFormat);
+    }
+
+    bool TileFile::Write(const std::wstring& aPath, DXGI_FORMAT aFormat, UINT32 aWidth, UINT32 aHeight, std::span<const MipBlocks> aMips)
+    {
+        UINT32 blockSize = GetBlockSizeInBytes(aFormat);
+        ASSERT(blockSize > 0, "Tile files hold block compressed textures only.");
+
+        Header header = { sMagic, sVersion, aFormat, aWidth, aHeight, static_cast<UINT32>(aMips.size()) };
+        std::vector<BYTE> image(GetFileSizeInBytes(aFormat, aWidth, aHeight, header.MipsCount));
+        memcpy(image.data(), &header, sizeof(Header));
+
+        // A tile starts one block before its first texel, block x of tile t is mip block t * 32 + x - 1, wrapped.
+        BYTE* tile = image.data() + sizeof(Header);
+        for (UINT32 mip = 0; mip < header.MipsCount; ++mip)
+        {
+            const MipBlocks& source = aMips[mip];
+            UINT32 blocksCountX = std::max((source.Width + 3) / 4, 1u);
+            UINT32 blocksCountY = std::max((source.Height + 3) / 4, 1u);
+            for (UINT32 tileY = 0; tileY < GetTilesCount(aHeight, mip); ++tileY)
+            {
+                for (UINT32 tileX = 0; tileX < GetTilesCount(aWidth, mip); ++tileX)
+                {
+                    for (UINT32 y = 0; y < sBlocksPerTile; ++y)
+                    {
+                        UINT32 sourceY = (tileY * (sTileSize / 4) + y + blocksCountY - 1) % blocksCountY;
+                        const BYTE* sourceRow = source.Blocks + sourceY * source.RowPitch;
+                        for (UINT32 x = 0; x < sBlocksPerTile; ++x)
+                        {
+                            UINT32 sourceX = (tileX * (sTileSize / 4) + x + blocksCountX - 1) % blocksCountX;
+                            memcpy(tile + (y * sBlocksPerTile + x) * blockSize, sourceRow + sourceX * blockSize, blockSize);
+                        }
+                    }
+                    tile += GetTileSizeInBytes(aFormat);
+                }
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::path path(aPath);
+        std::filesystem::path temporaryPath = path;
+        temporaryPath += L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file || !file.write(reinterpret_cast<const char*>(image.data()), image.size()))
+            {
+                Utility::Printf(L"Failed to write tile file: %s", aPath.c_str());
+                return false;
+            }
+        }
+        std::filesystem::rename(temporaryPath, path, error);
+        return !error;
+    }
+
+    bool TileFile::Open(const std::wstring& aPath)
+    {
+        mHeader = nullptr;
+        if (!mFile.Open(aPath) || mFile.GetSizeInBytes() < sizeof(Header))
+        {
+            mFile.Close();
+            return false;
+        }
+
+        const Header* header = reinterpret_cast<const Header*>(mFile.GetData());
+        if (header->Magic != sMagic || header->Version != sVersion || GetBlockSizeInBytes(header->Format) == 0 ||
+            mFile.GetSizeInBytes() != GetFileSizeInBytes(header->Format, header->Width, header->Height, header->MipsCount))
+        {
+            Utility::Printf(L"Tile file is stale: %s", aPath.c_str());
+            mFile.Close();
+            return false;
+        }
+
+        mHeader = header;
+        mTileSizeInBytes = GetTileSizeInBytes(header->Format);
+        mMipFirstTiles.assign(1, 0);
+        for (UINT32 mip = 0; mip + 1 < header->MipsCount; ++mip)
+        {
+            mMipFirstTiles.push_back(mMipFirstTiles.back() + UINT64(GetTilesCount(header->Width, mip)) * GetTilesCount(header->Height, mip));
+        }
+        return true;
+    }
+
+    const BYTE* TileFile::GetTile(UINT32 aMip, UINT32 aX, UINT32 aY) const
+    {
+        UINT64 tile = mMipFirstTiles[aMip] + aY * GetTilesCount(mHeader->Width, aMip) + aX;
+        return mFile.GetData() + sizeof(Header) + tile * mTileSizeInBytes;
+    }
+
+    PageTable::PageTable(UINT32 aWidth, UINT32 aHeight, UINT32 aMipsCount)
+        : mWidth(aWidth)
+        , mHeight(aHeight)
+        , mSlots(aMipsCount)
+        , mEntries(aMipsCount)
+    {
+        for (UINT32 mip = 0; mip < aMipsCount; ++mip)
+        {
+            mSlots[mip].assign(GetTilesCountX(mip) * GetTilesCountY(mip), sInvalidSlot);
+            mEntries[mip].assign(GetEntriesCountX(mip) * GetEntriesCountY(mip), sInvalidEntry);
+        }
+    }
+
+    // Rounding the tile grid of mip 0 up to a power of two makes every halving at least the tile grid of the next mip.
+    UINT32 PageTable::GetEntriesCountX(UINT32 aMip) const
+    {
+        return std::max(std::bit_ceil(GetTilesCountX(0)) >> aMip, 1u);
+    }
+
+    UINT32 PageTable::GetEntriesCountY(UINT32 aMip) const
+    {
+        return std::max(std::bit_ceil(GetTilesCountY(0)) >> aMip, 1u);
+    }
+
+    void PageTable::SetSlot(UINT32 aMip, UINT32 aX, UINT32 aY, UINT32 aSlot)
+    {
+        mSlots[aMip][aY * GetTilesCountX(aMip) + aX] = aSlot;
+        mIsDirty = true;
+    }
+
+    bool PageTable::Update()
+    {
+        if (!mIsDirty)
+        {
+            return false;
+        }
+
+        for (UINT32 mip = GetMipsCount(); mip-- > 0;)
+        {
+            UINT32 tilesCountX = GetTilesCountX(mip);
+            UINT32 tilesCountY = GetTilesCountY(mip);
+            UINT32 entriesCountX = GetEntriesCountX(mip);
+            UINT32 entriesCountY = GetEntriesCountY(mip);
+            const std::vector<UINT32>* parents = mip + 1 < GetMipsCount() ? &mEntries[mip + 1] : nullptr;
+            UINT32 parentsCountX = parents ? GetEntriesCountX(mip + 1) : 0;
+            for (UINT32 y = 0; y < entriesCountY; ++y)
+            {
+                for (UINT32 x = 0; x < entriesCountX; ++x)
+                {
+                    UINT32 slot = x < tilesCountX && y < tilesCountY ? mSlots[mip][y * tilesCountX + x] : sInvalidSlot;
+                    UINT32& entry = mEntries[mip][y * entriesCountX + x];
+                    if (slot != sInvalidSlot)
+                    {
+                        entry = PackEntry(slot, mip);
+                    }
+                    else
+                    {
+                        entry = parents ? (*parents)[(y / 2) * parentsCountX + x / 2] : sInvalidEntry;
+                    }
+                }
+            }
+        }
+        mIsDirty = false;
+        return true;
+    }
+
+    TileCache::TileCache(UINT32 aSlotsCount)
+        : mSlots(aSlotsCount)
+    {
+        // Free slots are the least recent ones, so they are taken first.
+        for (UINT32 slot = 0; slot < aSlotsCount; ++slot)
+        {
+            Link(slot);
+        }
+    }
+
+    void TileCache::Link(UINT32 aSlot)
+    {
+        Slot& slot = mSlots[aSlot];
+        slot.MoreRecent = sInvalidSlot;
+        slot.LessRecent = mMostRecent;
+        if (mMostRecent != sInvalidSlot)
+        {
+            mSlots[mMostRecent].MoreRecent = aSlot;
+        }
+        mMostRecent = aSlot;
+        if (mLeastRecent == sInvalidSlot)
+        {
+            mLeastRecent = aSlot;
+        }
+    }
+
+    void TileCache::Unlink(UINT32 aSlot)
+    {
+        Slot& slot = mSlots[aSlot];
+        (slot.MoreRecent != sInvalidSlot ? mSlots[slot.MoreRecent].LessRecent : mMostRecent) = slot.LessRecent;
+        (slot.LessRecent != sInvalidSlot ? mSlots[slot.LessRecent].MoreRecent : mLeastRecent) = slot.MoreRecent;
+        slot.MoreRecent = sInvalidSlot;
+        slot.LessRecent = sInvalidSlot;
+    }
+
+    UINT32 TileCache::Find(UINT64 aTile, UINT64 aFrame)
+    {
+        auto found = mSlotsByTile.find(aTile);
+        if (found == mSlotsByTile.end())
+        {
+            return sInvalidSlot;
+        }
+
+        UINT32 slot = found->second;
+        mSlots[slot].LastUsedFrame = aFrame;
+        if (!mSlots[slot].IsPinned)
+        {
+            Unlink(slot);
+            Link(slot);
+        }
+        return slot;
+    }
+
+    UINT32 TileCache::Allocate(UINT64 aTile, UINT64 aFrame, UINT64& aEvictedTile)
+    {
+        // The list is in the order of the frames the slots were last used in, so once the least recent one was used in
+        // aFrame all of them were.
+        aEvictedTile = sInvalidTile;
+        UINT32 slot = mLeastRecent;
+        if (slot == sInvalidSlot || (mSlots[slot].Tile != sInvalidTile && mSlots[slot].LastUsedFrame >= aFrame))
+        {
+            return sInvalidSlot;
+        }
+
+        Slot& entry = mSlots[slot];
+        if (entry.Tile != sInvalidTile)
+        {
+            aEvictedTile = entry.Tile;
+            mSlotsByTile.erase(entry.Tile);
+        }
+        entry.Tile = aTile;
+        entry.LastUsedFrame = aFrame;
+        mSlotsByTile.emplace(aTile, slot);
+        Unlink(slot);
+        Link(slot);
+        return slot;
+    }
+
+    void TileCache::Pin(UINT32 aSlot)
+    {
+        if (!mSlots[aSlot].IsPinned)
+        {
+            Unlink(aSlot);
+            mSlots[aSlot].IsPinned = true;
+        }
+    }
+
+    void Initialize(UINT32 aSlotsPerRow)
+    {
+        ASSERT(aSlotsPerRow * sPaddedTileSize <= D3D12_REQ_TEXTURE2D_U_OR_V_DIMENSION && aSlotsPerRow * aSlotsPerRow <= 0x10000, "Tile atlas is too large.");
+        sSlotsPerRow = aSlotsPerRow;
+        sIsEnabled = true;
+    }
+
+    void Shutdown()
+    {
+        if (!sIsEnabled)
+        {
+            return;
+        }
+
+        // The atlases may still be in use by frames in flight.
+        Graphics::Flush();
+        sIsEnabled = false;
+        sRequests.clear();
+        sPinnedUploads.clear();
+        sTexturesByOwner.clear();
+        sTextures.clear();
+        sAtlases.clear();
+    }
+
+    bool CanVirtualize(const DirectX::ScratchImage& aImage, aiTextureType aTextureType)
+    {
+        const DirectX::TexMetadata& metadata = aImage.GetMetadata();
+        if (!sIsEnabled || aTextureType != aiTextureType_DIFFUSE || metadata.dimension != DirectX::TEX_DIMENSION_TEXTURE2D || metadata.arraySize != 1 ||
+            TileFile::GetBlockSizeInBytes(metadata.format) == 0 || GetTilesCount(static_cast<UINT32>(std::max(metadata.width, metadata.height)), 0) < 2)
+        {
+            return false;
+        }
+
+        UINT32 width = static_cast<UINT32>(metadata.width);
+        UINT32 height = static_cast<UINT32>(metadata.height);
+        UINT32 mipsCount = GetTiledMipsCount(width, height, static_cast<UINT32>(metadata.mipLevels));
+        return GetTilesCount(width, mipsCount - 1) == 1 && GetTilesCount(height, mipsCount - 1) == 1;
+    }
+
+    bool HasTileFile(const std::wstring& aCachePath, const DirectX::ScratchImage& aImage)
+    {
+        const DirectX::TexMetadata& metadata = aImage.GetMetadata();
+        UINT32 width = static_cast<UINT32>(metadata.width);
+        UINT32 height = static_cast<UINT32>(metadata.height);
+        std::error_code error;
+        UINT64 fileSize = std::filesystem::file_size(GetTileFilePath(aCachePath), error);
+        return !error && fileSize == TileFile::GetFileSizeInBytes(metadata.format, width, height, GetTiledMipsCount(width, height, static_cast<UINT32>(metadata.mipLevels)));
+    }
+
+    bool CookTileFile(const std::wstring& aCachePath, const DirectX::ScratchImage& aImage)
+    {
+        if (HasTileFile(aCachePath, aImage))
+        {
+            return true;
+        }
+
+        const DirectX::TexMetadata& metadata = aImage.GetMetadata();
+        UINT32 width = static_cast<UINT32>(metadata.width);
+        UINT32 height = static_cast<UINT32>(metadata.height);
+        std::vector<MipBlocks> mips(GetTiledMipsCount(width, height, static_cast<UINT32>(metadata.mipLevels)));
+        for (UINT32 mip = 0; mip < mips.size(); ++mip)
+        {
+            const DirectX::Image& image = aImage.GetImages()[mip];
+            mips[mip] = { image.pixels, static_cast<UINT32>(image.width), static_cast<UINT32>(image.height), image.rowPitch };
+        }
+        return TileFile::Write(GetTileFilePath(aCachePath), metadata.format, width, height, mips);
+    }
+
+    D3D12_RESOURCE_DESC GetPageTableDesc(const DirectX::ScratchImage& aImage)
+    {
+        const DirectX::TexMetadata& metadata = aImage.GetMetadata();
+        UINT32 width = static_cast<UINT32>(metadata.width);
+        UINT32 height = static_cast<UINT32>(metadata.height);
+        PageTable table(width, height, 1);
+        return CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, table.GetEntriesCountX(0), table.GetEntriesCountY(0), 1, static_cast<UINT16>(GetTiledMipsCount(width, height, static_cast<UINT32>(metadata.mipLevels))));
+    }
+
+    void Register(Texture* aTexture, const std::wstring& aCachePath)
+    {
+        auto virtualTexture = std::make_unique<VirtualTexture>();
+        VirtualTexture& texture = *virtualTexture;
+        texture.Owner = aTexture;
+        texture.Index = static_cast<UINT32>(sTextures.size());
+        if (!texture.File.Open(GetTileFilePath(aCachePath)) || aTexture->GetResource() == nullptr)
+        {
+            Utility::Printf(L"Failed to open tile file of virtual texture: %s", aCachePath.c_str());
+            return;
+        }
+        texture.Table = PageTable(texture.File.GetWidth(), texture.File.GetHeight(), texture.File.GetMipsCount());
+        texture.TileAtlas = &GetAtlas(texture.File.GetFormat());
+
+        // The coarsest tile is the fallback of every other one, it stays for as long as the texture. It is allocated
+        // for the coming frame, whose Update uploads it, so a slot the last frame used can be taken as well.
+        TileId tile = { texture.Index, texture.File.GetMipsCount() - 1, 0, 0 };
+        UINT64 evictedTile = sInvalidTile;
+        UINT32 slot = texture.TileAtlas->Cache.Allocate(tile.Pack(), sFrame + 1, evictedTile);
+        if (slot != sInvalidSlot)
+        {
+            if (evictedTile != sInvalidTile)
+            {
+                TileId evicted = TileId::Unpack(evictedTile);
+                sTextures[evicted.Texture]->Table.SetSlot(evicted.Mip, evicted.X, evicted.Y, sInvalidSlot);
+            }
+            texture.TileAtlas->Cache.Pin(slot);
+            texture.Table.SetSlot(tile.Mip, tile.X, tile.Y, slot);
+            sPinnedUploads.push_back(tile.Pack());
+        }
+        else
+        {
+            Utility::Printf(L"Tile atlas is full, virtual texture has no fallback: %s", aCachePath.c_str());
+        }
+
+        ++sStatistics.TexturesCount;
+        sTexturesByOwner.emplace(aTexture, virtualTexture.get());
+        sTextures.push_back(std::move(virtualTexture));
+    }
+
+    bool IsVirtual(const Texture* aTexture)
+    {
+        return sTexturesByOwner.count(aTexture) > 0;
+    }
+
+    void CreateAtlasSRV(const Texture* aTexture, Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> aSRVDescriptorHeap, UINT aOffset)
+    {
+        const Atlas& atlas = *sTexturesByOwner.at(aTexture)->TileAtlas;
+        D3D12_SHADER_RESOURCE_VIEW_DESC shaderResourceViewDesc = {};
+        shaderResourceViewDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+        shaderResourceViewDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+        shaderResourceViewDesc.Format = atlas.Format;
+        shaderResourceViewDesc.Texture2DArray.MipLevels = 1;
+        shaderResourceViewDesc.Texture2DArray.ArraySize = 1;
+
+        CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle;
+        srvHandle.InitOffsetted(aSRVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), aOffset * Graphics::g_SRVDescriptorSize);
+        Graphics::GetBackend().CreateShaderResourceView(atlas.Resource.Get(), shaderResourceViewDesc, srvHandle);
+    }
+
+    void RequestTiles(const Texture* aTexture, float aProjectedSize, const DirectX::XMFLOAT4& aTexCoordBounds)
+    {
+        auto found = sTexturesByOwner.find(aTexture);
+        if (found == sTexturesByOwner.end())
+        {
+            return;
+        }
+
+        // A surface n pixels across shows the texels its texture coordinates span, the mip with about n of them is
+        // enough. The coarser tiles over the same area are requested as well, they are the fallbacks while the finer
+        // ones come in.
+        const VirtualTexture& texture = *found->second;
+        UINT32 width = texture.File.GetWidth();
+        UINT32 height = texture.File.GetHeight();
+        float spanU = std::max(aTexCoordBounds.z - aTexCoordBounds.x, 0.0f);
+        float spanV = std::max(aTexCoordBounds.w - aTexCoordBounds.y, 0.0f);
+        float texelsCount = std::max(width * spanU, height * spanV);
+        float mip = std::floor(std::log2(std::max(texelsCount / std::max(aProjectedSize, 1.0f), 1.0f)));
+        UINT32 firstMip = std::min(static_cast<UINT32>(mip), texture.Table.GetMipsCount() - 1);
+
+        // The bounds are wrapped into the texture, a span of a whole texture or more needs every tile.
+        auto getTileRange = [](float aMin, float aSpan, UINT32 aMipSize, UINT32 aTilesCount, UINT32& aFirst, UINT32& aCount)
+        {
+            if (aSpan >= 1.0f)
+            {
+                aFirst = 0;
+                aCount = aTilesCount;
+                return;
+            }
+            float wrappedMin = aMin - std::floor(aMin);
+            aFirst = std::min(static_cast<UINT32>(wrappedMin * aMipSize / sTileSize), aTilesCount - 1);
+            UINT32 last = static_cast<UINT32>((wrappedMin + aSpan) * aMipSize / sTileSize);
+            aCount = std::min(last - aFirst + 1, aTilesCount);
+        };
+
+        for (UINT32 tileMip = firstMip; tileMip < texture.Table.GetMipsCount(); ++tileMip)
+        {
+            UINT32 tilesCountX = texture.Table.GetTilesCountX(tileMip);
+            UINT32 tilesCountY = texture.Table.GetTilesCountY(tileMip);
+            UINT32 firstX, countX, firstY, countY;
+            getTileRange(aTexCoordBounds.x, spanU, std::max(width >> tileMip, 1u), tilesCountX, firstX, countX);
+            getTileRange(aTexCoordBounds.y, spanV, std::max(height >> tileMip, 1u), tilesCountY, firstY, countY);
+            for (UINT32 y = 0; y < countY; ++y)
+            {
+                for (UINT32 x = 0; x < countX; ++x)
+                {
+                    sRequests.push_back(TileId{ texture.Index, tileMip, (firstX + x) % tilesCountX, (firstY + y) % tilesCountY }.Pack());
+                }
+            }
+        }
+    }
+
+    void Update()
+    {
+        if (!sIsEnabled)
+        {
+            return;
+        }
+        ++sFrame;
+
+        // Requested tiles that are cached count as used this frame, so they are not taken for the missing ones.
+        std::sort(sRequests.begin(), sRequests.end());
+        sRequests.erase(std::unique(sRequests.begin(), sRequests.end()), sRequests.end());
+        std::vector<UINT64> missingTiles;
+        for (UINT64 tile : sRequests)
+        {
+            if (sTextures[TileId::Unpack(tile).Texture]->TileAtlas->Cache.Find(tile, sFrame) == sInvalidSlot)
+            {
+                missingTiles.push_back(tile);
+            }
+        }
+        sRequests.clear();
+
+        // Coarse tiles first, every one of them makes the fallback of many fine ones sharper.
+        std::stable_sort(missingTiles.begin(), missingTiles.end(), [](UINT64 aLeft, UINT64 aRight) { return TileId::Unpack(aLeft).Mip > TileId::Unpack(aRight).Mip; });
+
+        // Tiles are copied out of the mapped tile files here, so the render thread reads them from disk on a cold
+        // start. The limit per frame bounds that and the upload size.
+        UploadBatch uploadBatch;
+        std::vector<Atlas*> writtenAtlases;
+        auto upload = [&](UINT64 aTile, UINT32 aSlot)
+        {
+            TileId tile = TileId::Unpack(aTile);
+            VirtualTexture& texture = *sTextures[tile.Texture];
+            UploadTile(texture, tile, aSlot, uploadBatch);
+            if (std::find(writtenAtlases.begin(), writtenAtlases.end(), texture.TileAtlas) == writtenAtlases.end())
+            {
+                writtenAtlases.push_back(texture.TileAtlas);
+            }
+            ++sStatistics.UploadedTiles;
+        };
+
+        for (UINT64 tile : sPinnedUploads)
+        {
+            upload(tile, sTextures[TileId::Unpack(tile).Texture]->Table.GetSlot(TileId::Unpack(tile).Mip, 0, 0));
+        }
+        sPinnedUploads.clear();
+
+        UINT32 uploadsCount = 0;
+        for (UINT64 tile : missingTiles)
+        {
+            TileId id = TileId::Unpack(tile);
+            VirtualTexture& texture = *sTextures[id.Texture];
+            UINT64 evictedTile = sInvalidTile;
+            UINT32 slot = uploadsCount < sMaxTileUploadsPerFrame ? texture.TileAtlas->Cache.Allocate(tile, sFrame, evictedTile) : sInvalidSlot;
+            if (slot == sInvalidSlot)
+            {
+                ++sStatistics.DeferredTiles;
+                continue;
+            }
+
+            if (evictedTile != sInvalidTile)
+            {
+                TileId evicted = TileId::Unpack(evictedTile);
+                sTextures[evicted.Texture]->Table.SetSlot(evicted.Mip, evicted.X, evicted.Y, sInvalidSlot);
+                ++sStatistics.EvictedTiles;
+            }
+            texture.Table.SetSlot(id.Mip, id.X, id.Y, slot);
+            upload(tile, slot);
+            ++uploadsCount;
+        }
+
+        // The previous frames are done on the GPU when the next one starts, see Graphics::Present, so slots and page
+        // tables can be overwritten in place.
+        for (const std::unique_ptr<VirtualTexture>& texture : sTextures)
+        {
+            if (texture->Table.Update())
+            {
+                UploadPageTable(*texture, uploadBatch);
+            }
+        }
+        for (Atlas* atlas : writtenAtlases)
+        {
+            if (atlas->Resource)
+            {
+                uploadBatch.Transition(atlas->Resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
+            }
+        }
+        uploadBatch.Submit();
+    }
+
+    Statistics GetStatistics()
+    {
+        Statistics statistics = sStatistics;
+        for (const auto& [format, atlas] : sAtlases)
+        {
+            statistics.SlotsCount += atlas->Cache.GetSlotsCount();
+            statistics.UsedSlotsCount += atlas->Cache.GetUsedSlotsCount();
+        }
+        return statistics;
+    }
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "pch.h"
+#include "Utility.h"
+#include <DirectXMath.h>
+#include <algorithm>
+#include <assimp/material.h>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+class Texture;
+
+namespace DirectX
+{
+    class ScratchImage;
+}
+
+// Virtual texturing for large diffuse textures. The cooked mips are split into tiles of sTileSize texels, each with a
+// border of neighbouring texels for filtering, and stored in a tile file next to the cooked DDS. Only the tiles the
+// camera needs are resident, in one atlas per format whose slots are shared by all virtual textures.
+//
+// A virtual Texture is the page table of its tiles: an R32_UINT texture with one texel per tile and a mip per tiled
+// mip. Every entry names the atlas slot of its tile, or of the nearest coarser resident tile, so sampling always
+// finds something and sharpens as tiles come in. The coarsest tile of every texture stays resident.
+//
+// Every frame the renderer requests the tiles of the mip each visible surface needs, estimated on the CPU from its
+// projected size and texture coordinate bounds. A least recently used cache of the atlas slots decides what comes in
+// and what goes, and the render thread copies a limited number of missing tiles per frame into the atlas, coarse
+// tiles first. With the null backend the atlas is a stand-in, the tiles are still read and copied.
+namespace VirtualTexturing
+{
+    static constexpr UINT32 sTileSize = 128;
+    static constexpr UINT32 sTileBorder = 4;                // one block, so tiles stay block aligned in the atlas
+    static constexpr UINT32 sPaddedTileSize = sTileSize + 2 * sTileBorder;
+    static constexpr UINT32 sInvalidSlot = UINT32_MAX;
+    static constexpr UINT32 sInvalidEntry = UINT32_MAX;
+    static constexpr UINT64 sInvalidTile = UINT64_MAX;
+
+    // Tiles across a mip of a texture aSize texels across.
+    inline UINT32 GetTilesCount(UINT32 aSize, UINT32 aMip) { return (std::max(aSize >> aMip, 1u) + sTileSize - 1) / sTileSize; }
+
+    // A tile of a virtual texture, packed into one key for the cache.
+    struct TileId
+    {
+        UINT32 Texture = 0;
+        UINT32 Mip = 0;
+        UINT32 X = 0;
+        UINT32 Y = 0;
+
+        UINT64 Pack() const { return UINT64(Texture) << 40 | UINT64(Mip) << 32 | UINT64(Y) << 16 | X; }
+        static TileId Unpack(UINT64 aKey) { return { UINT32(aKey >> 40), UINT32(aKey >> 32) & 0xff, UINT32(aKey >> 16) & 0xffff, UINT32(aKey) & 0xffff }; }
+    };
+
+    // The rows of BC blocks of one mip.
+    struct MipBlocks
+    {
+        const BYTE* Blocks = nullptr;
+        UINT32 Width = 0;           // in texels
+        UINT32 Height = 0;
+        size_t RowPitch = 0;
+    };
+
+    // Tiles of the tiled mips of a block compressed texture, mip by mip and row by row. A tile is stored the way it is
+    // copied into its atlas slot, rows of sPaddedTileSize / 4 blocks. Borders and the part of a tile beyond the
+    // edge of its mip wrap around the mip, like the sampler does.
+    class TileFile
+    {
+        struct Header
+        {
+            UINT32 Magic;
+            UINT32 Version;
+            DXGI_FORMAT Format;
+            UINT32 Width;
+            UINT32 Height;
+            UINT32 MipsCount;
+        };
+
+        static constexpr UINT32 sMagic = 0x46545456; // "VTTF"
+        static constexpr UINT32 sVersion = 1;
+
+        Utility::MappedFile mFile;
+        const Header* mHeader = nullptr;
+        std::vector<UINT64> mMipFirstTiles;
+        UINT32 mTileSizeInBytes = 0;
+
+    public:
+        static UINT32 GetBlockSizeInBytes(DXGI_FORMAT aFormat);
+        static UINT32 GetTileSizeInBytes(DXGI_FORMAT aFormat) { return (sPaddedTileSize / 4) * (sPaddedTileSize / 4) * GetBlockSizeInBytes(aFormat); }
+        static UINT64 GetFileSizeInBytes(DXGI_FORMAT aFormat, UINT32 aWidth, UINT32 aHeight, UINT32 aMipsCount);
+
+        // aMips are the tiled mips, from the most detailed one on. Written under a temporary name first, so a
+        // concurrent writer of the same file never leaves a partial one behind.
+        static bool Write(const std::wstring& aPath, DXGI_FORMAT aFormat, UINT32 aWidth, UINT32 aHeight, std::span<const MipBlocks> aMips);
+
+        bool Open(const std::wstring& aPath);
+
+        DXGI_FORMAT GetFormat() const { return mHeader->Format; }
+        UINT32 GetWidth() const { return mHeader->Width; }
+        UINT32 GetHeight() const { return mHeader->Height; }
+        UINT32 GetMipsCount() const { return mHeader->MipsCount; }
+        UINT32 GetTileSizeInBytes() const { return mTileSizeInBytes; }
+        UINT32 GetTileRowPitch() const { return mTileSizeInBytes / (sPaddedTileSize / 4); }
+        const BYTE* GetTile(UINT32 aMip, UINT32 aX, UINT32 aY) const;
+    };
+
+    // CPU copy of the page table of one virtual texture. The page table texture has power of two dimensions, so that
+    // each of its mips holds the tile grid of the same texture mip.
+    class PageTable
+    {
+        UINT32 mWidth = 0;
+        UINT32 mHeight = 0;
+        std::vector<std::vector<UINT32>> mSlots;        // per tiled mip, the slot of every tile or sInvalidSlot
+        std::vector<std::vector<UINT32>> mEntries;      // per page table mip, resolved
+        bool mIsDirty = true;
+
+    public:
+        PageTable() {}
+        PageTable(UINT32 aWidth, UINT32 aHeight, UINT32 aMipsCount);
+
+        static UINT32 PackEntry(UINT32 aSlot, UINT32 aMip) { return aSlot | aMip << 16; }
+        static UINT32 GetEntryMip(UINT32 aEntry) { return aEntry >> 16; }
+        static UINT32 GetEntrySlot(UINT32 aEntry) { return aEntry & 0xffff; }
+
+        UINT32 GetMipsCount() const { return static_cast<UINT32>(mSlots.size()); }
+        UINT32 GetTilesCountX(UINT32 aMip) const { return GetTilesCount(mWidth, aMip); }
+        UINT32 GetTilesCountY(UINT32 aMip) const { return GetTilesCount(mHeight, aMip); }
+        // Size of a mip of the page table texture, at least the tile grid of that mip.
+        UINT32 GetEntriesCountX(UINT32 aMip) const;
+        UINT32 GetEntriesCountY(UINT32 aMip) const;
+
+        void SetSlot(UINT32 aMip, UINT32 aX, UINT32 aY, UINT32 aSlot);
+        UINT32 GetSlot(UINT32 aMip, UINT32 aX, UINT32 aY) const { return mSlots[aMip][aY * GetTilesCountX(aMip) + aX]; }
+
+        // Resolves every entry to its own slot or to the entry of its parent tile, coarse mips first. Returns false
+        // if no slot changed since the last update.
+        bool Update();
+        UINT32 GetEntry(UINT32 aMip, UINT32 aX, UINT32 aY) const { return mEntries[aMip][aY * GetEntriesCountX(aMip) + aX]; }
+        const std::vector<UINT32>& GetEntries(UINT32 aMip) const { return mEntries[aMip]; }
+    };
+
+    // Least recently used cache of atlas slots, keyed by packed TileId. Slots used in the current frame and pinned
+    // slots are never taken for another tile.
+    class TileCache
+    {
+        struct Slot
+        {
+            UINT64 Tile = sInvalidTile;
+            UINT64 LastUsedFrame = 0;
+            UINT32 MoreRecent = sInvalidSlot;       // neighbours in the list of slots that can be taken
+            UINT32 LessRecent = sInvalidSlot;
+            bool IsPinned = false;
+        };
+
+        std::vector<Slot> mSlots;
+        std::unordered_map<UINT64, UINT32> mSlotsByTile;
+        UINT32 mMostRecent = sInvalidSlot;
+        UINT32 mLeastRecent = sInvalidSlot;
+
+        void Link(UINT32 aSlot);
+        void Unlink(UINT32 aSlot);
+
+    public:
+        TileCache() {}
+        explicit TileCache(UINT32 aSlotsCount);
+
+        // Frames passed to one cache must not decrease. Returns the slot of aTile and marks it used in aFrame, or
+        // sInvalidSlot if the tile is not cached.
+        UINT32 Find(UINT64 aTile, UINT64 aFrame);
+        // Takes a free or the least recently used slot for aTile, aEvictedTile gets the tile the slot held or
+        // sInvalidTile. Returns sInvalidSlot if every slot is pinned or used in aFrame.
+        UINT32 Allocate(UINT64 aTile, UINT64 aFrame, UINT64& aEvictedTile);
+        void Pin(UINT32 aSlot);
+
+        UINT64 GetTile(UINT32 aSlot) const { return mSlots[aSlot].Tile; }
+        UINT32 GetSlotsCount() const { return static_cast<UINT32>(mSlots.size()); }
+        UINT32 GetUsedSlotsCount() const { return static_cast<UINT32>(mSlotsByTile.size()); }
+    };
+
+    struct Statistics
+    {
+        UINT64 UploadedTiles = 0;
+        UINT64 EvictedTiles = 0;
+        UINT64 DeferredTiles = 0;       // requested but left for a later frame
+        UINT32 TexturesCount = 0;
+        UINT32 SlotsCount = 0;
+        UINT32 UsedSlotsCount = 0;
+    };
+
+    // Textures only become virtual between Initialize and Shutdown. Every atlas has aSlotsPerRow * aSlotsPerRow
+    // slots, at most 2^16.
+    void Initialize(UINT32 aSlotsPerRow);
+    void Shutdown();
+
+    // Whether a texture decoded from aImage for the aTextureType material slot can be virtual: a block compressed
+    // diffuse texture of more than one tile with mips down to a single tile.
+    bool CanVirtualize(const DirectX::ScratchImage& aImage, aiTextureType aTextureType);
+    // Writes the tile file of the cooked file aCachePath unless it exists. Thread-safe, it runs on the loader threads.
+    bool CookTileFile(const std::wstring& aCachePath, const DirectX::ScratchImage& aImage);
+    bool HasTileFile(const std::wstring& aCachePath, const DirectX::ScratchImage& aImage);
+
+    D3D12_RESOURCE_DESC GetPageTableDesc(const DirectX::ScratchImage& aImage);
+    // Opens the tile file of aCachePath for aTexture, which was created from GetPageTableDesc, and pins its coarsest
+    // tile. The tile and the page table are uploaded by the next Update, before anything samples them.
+    void Register(Texture* aTexture, const std::wstring& aCachePath);
+    bool IsVirtual(const Texture* aTexture);
+    // The atlas that holds the tiles of aTexture.
+    void CreateAtlasSRV(const Texture* aTexture, Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> aSRVDescriptorHeap, UINT aOffset);
+
+    // Asks for the tiles of aTexture that a surface aProjectedSize pixels across needs. aTexCoordBounds are the
+    // minimum and maximum texture coordinates of the surface, surfaces that repeat the texture get a coarser mip.
+    void RequestTiles(const Texture* aTexture, float aProjectedSize, const DirectX::XMFLOAT4& aTexCoordBounds);
+
+    // Runs once per frame on the render thread, after the requests and before recording.
+    void Update();
+
+    Statistics GetStatistics();
+}
@@ -46,7 +46,10 @@ struct MaterialParams
     //-------------------------- ( 16 bytes )
     float   SpecularScale;
     float   AlphaThreshold;
-    float2  Padding;
+    // Size in texels of a virtual diffuse texture, width | height << 16, zero if the diffuse texture is not virtual.
+    uint    VirtualTextureSize;
+    // Array slice of the texture in every slot, 4 bits per slot in the order of the texture registers.
+    uint    TextureSlices;
     //--------------------------- ( 16 bytes )
 };  //--------------------------- ( 16 * 10 = 160 bytes )
 
@@ -117,17 +120,30 @@ StructuredBuffer<Light> Lights : register(t21);
 //Texture2D<float4> OpacityTexture        : register(t7);
 
 //Texture2D<float4> Texture1[18]        : register(t0);
-Texture2D<float4> DiffuseTexture        : register(t10);
-Texture2D<float4> SpecularTexture       : register(t11);
-Texture2D<float4> AmbientTexture        : register(t12);
-Texture2D<float4> EmissiveTexture       : register(t13);
-Texture2D<float4> BumpTexture           : register(t14);
-Texture2D<float4> NormalTexture         : register(t15);
-Texture2D<float4> SpecularPowerTexture  : register(t16);
-Texture2D<float4> OpacityTexture        : register(t17);
-Texture2D<float4> Texture8              : register(t18);
-Texture2D<float4> Texture9              : register(t19);
-Texture2D<float4> Texture10             : register(t20);
+// Material textures are arrays, small textures are packed into shared ones and the others have a single slice.
+Texture2DArray<float4> DiffuseTexture        : register(t10);
+Texture2DArray<float4> SpecularTexture       : register(t11);
+Texture2DArray<float4> AmbientTexture        : register(t12);
+Texture2DArray<float4> EmissiveTexture       : register(t13);
+Texture2DArray<float4> BumpTexture           : register(t14);
+Texture2DArray<float4> NormalTexture         : register(t15);
+Texture2DArray<float4> SpecularPowerTexture  : register(t16);
+Texture2DArray<float4> OpacityTexture        : register(t17);
+Texture2DArray<float4> Texture8              : register(t18);
+Texture2DArray<float4> Texture9              : register(t19);
+Texture2DArray<float4> VirtualTextureAtlas   : register(t20);
+
+// The diffuse slot seen as the page table of a virtual diffuse texture, see VirtualTexturing.h.
+Texture2DArray<uint>   DiffusePageTable      : register(t10, space1);
+
+#define DIFFUSE_SLOT 0
+#define SPECULAR_SLOT 1
+#define AMBIENT_SLOT 2
+#define EMISSIVE_SLOT 3
+#define BUMP_SLOT 4
+#define NORMAL_SLOT 5
+#define SPECULAR_POWER_SLOT 6
+#define OPACITY_SLOT 7
 
 SamplerState textureSampler : register(s0);
 
@@ -248,20 +264,66 @@ LightingResult DoLighting(StructuredBuffer<Light> lights, MaterialParams materia
     return totalResult;
 }
 
+#define VIRTUAL_TILE_SIZE 128
+#define VIRTUAL_TILE_BORDER 4
+#define VIRTUAL_INVALID_ENTRY 0xffffffff
+
+// Picks the mip from the screen derivatives, finds the resident tile of that mip or of its nearest resident parent in
+// the page table and samples it in the atlas. The border around every tile covers the bilinear footprint, there is
+// no filtering between mips.
+float4 SampleVirtualTexture(Texture2DArray<uint> pageTable, Texture2DArray atlas, sampler s, float2 uv, uint packedSize)
+{
+    float2 size = float2(packedSize & 0xffff, packedSize >> 16);
+    uint pageTableWidth, pageTableHeight, pageTableSlices, mipsCount;
+    pageTable.GetDimensions(0, pageTableWidth, pageTableHeight, pageTableSlices, mipsCount);
+
+    float2 texel = uv * size;
+    float2 dx = ddx(texel);
+    float2 dy = ddy(texel);
+    uint mip = (uint)clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy)))), 0.0, mipsCount - 1.0);
+
+    float2 wrappedUV = frac(uv);
+    float2 mipSize = max(floor(size / exp2(mip)), 1.0);
+    uint entry = pageTable.Load(int4(wrappedUV * mipSize / VIRTUAL_TILE_SIZE, 0, mip));
+    if (entry == VIRTUAL_INVALID_ENTRY)
+    {
+        return float4(0.5, 0.5, 0.5, 1.0);
+    }
+
+    uint slot = entry & 0xffff;
+    uint entryMip = entry >> 16;
+    float2 entryTexel = wrappedUV * max(floor(size / exp2(entryMip)), 1.0);
+    float2 tileTexel = entryTexel - floor(entryTexel / VIRTUAL_TILE_SIZE) * VIRTUAL_TILE_SIZE;
+
+    uint atlasWidth, atlasHeight, atlasSlices;
+    atlas.GetDimensions(atlasWidth, atlasHeight, atlasSlices);
+    uint slotsPerRow = atlasWidth / (VIRTUAL_TILE_SIZE + 2 * VIRTUAL_TILE_BORDER);
+    float2 slotTexel = float2(slot % slotsPerRow, slot / slotsPerRow) * (VIRTUAL_TILE_SIZE + 2 * VIRTUAL_TILE_BORDER) + VIRTUAL_TILE_BORDER;
+    return atlas.SampleLevel(s, float3((slotTexel + tileTexel) / float2(atlasWidth, atlasHeight), 0), 0);
+}
+
+// Texture coordinates in the array slice of the texture in aSlot.
+float3 SliceTexCoord(MaterialParams material, uint slot, float2 uv)
+{
+    return float3(uv, (material.TextureSlices >> (slot * 4)) & 0xf);
+}
+
 float3 ExpandNormal(float3 n)
 {
     return n * 2.0 - 1.0;
 }
 
-float4 DoNormalMapping(float3x3 TBN, Texture2D tex, sampler s, float2 uv)
+float4 DoNormalMapping(float3x3 TBN, Texture2DArray tex, sampler s, float3 uv)
 {
-    float3 normal = tex.Sample(s, uv).xyz;
-    normal = ExpandNormal(normal);
+    // Cooked normal maps are BC5 with only x and y, z is rebuilt from the unit length.
+    float3 normal;
+    normal.xy = tex.Sample(s, uv).xy * 2.0 - 1.0;
+    normal.z = sqrt(saturate(1.0 - dot(normal.xy, normal.xy)));
     normal = mul(normal, TBN);
     return normalize(float4(normal, 0.0));
 }
 
-float4 DoBumpMapping(float3x3 TBN, Texture2D tex, sampler s, float2 uv, float bumpScale)
+float4 DoBumpMapping(float3x3 TBN, Texture2DArray tex, sampler s, float3 uv, float bumpScale)
 {
     // Sample the heightmap at the current texture coordinate.
     float height = tex.Sample(s, uv).r * bumpScale;
@@ -292,7 +354,15 @@ float4 main(PixelShaderInput IN) : SV_Target
     float4 diffuse = material.DiffuseColor;
     if (material.HasDiffuseTexture)
     {
-        float4 diffuseTex = DiffuseTexture.Sample(textureSampler, IN.TexCoord);
+        float4 diffuseTex;
+        if (material.VirtualTextureSize != 0)
+        {
+            diffuseTex = SampleVirtualTexture(DiffusePageTable, VirtualTextureAtlas, textureSampler, IN.TexCoord, material.VirtualTextureSize);
+        }
+        else
+        {
+            diffuseTex = DiffuseTexture.Sample(textureSampler, SliceTexCoord(material, DIFFUSE_SLOT, IN.TexCoord));
+        }
         if (any(diffuse.rgb))
         {
             diffuse *= diffuseTex;
@@ -306,13 +376,13 @@ float4 main(PixelShaderInput IN) : SV_Target
     float alpha = diffuse.a;
     if (material.HasOpacityTexture)
     {
-        alpha = OpacityTexture.Sample(textureSampler, IN.TexCoord).r;
+        alpha = OpacityTexture.Sample(textureSampler, SliceTexCoord(material, OPACITY_SLOT, IN.TexCoord)).r;
     }
 
     float4 ambient = material.AmbientColor;
     if (material.HasAmbientTexture)
     {
-        float4 ambientTex = AmbientTexture.Sample(textureSampler, IN.TexCoord);
+        float4 ambientTex = AmbientTexture.Sample(textureSampler, SliceTexCoord(material, AMBIENT_SLOT, IN.TexCoord));
         if (any(ambient.rgb))
         {
             ambient *= ambientTex;
@@ -326,7 +396,7 @@ float4 main(PixelShaderInput IN) : SV_Target
     float4 emissive = material.EmissiveColor;
     if (material.HasEmissiveTexture)
     {
-        float4 emissiveTex = EmissiveTexture.Sample(textureSampler, IN.TexCoord);
+        float4 emissiveTex = EmissiveTexture.Sample(textureSampler, SliceTexCoord(material, EMISSIVE_SLOT, IN.TexCoord));
         if (any(emissive.rgb))
         {
             emissive *= emissiveTex;
@@ -340,7 +410,7 @@ float4 main(PixelShaderInput IN) : SV_Target
     float specularPower = material.SpecularPower;
     if (material.HasSpecularPowerTexture)
     {
-        specularPower = SpecularPowerTexture.Sample(textureSampler, IN.TexCoord).r * material.SpecularScale;
+        specularPower = SpecularPowerTexture.Sample(textureSampler, SliceTexCoord(material, SPECULAR_POWER_SLOT, IN.TexCoord)).r * material.SpecularScale;
     }
 
     float4 normal;
@@ -350,7 +420,7 @@ float4 main(PixelShaderInput IN) : SV_Target
                                 normalize(IN.BitangentVS),
                                 normalize(IN.NormalVS));
 
-        normal = DoNormalMapping(TBN, NormalTexture, textureSampler, IN.TexCoord);
+        normal = DoNormalMapping(TBN, NormalTexture, textureSampler, SliceTexCoord(material, NORMAL_SLOT, IN.TexCoord));
     }
     else if (material.HasBumpTexture)
     {
@@ -358,7 +428,7 @@ float4 main(PixelShaderInput IN) : SV_Target
                                 normalize(-IN.BitangentVS),
                                 normalize(IN.NormalVS));
 
-        normal = DoBumpMapping(TBN, BumpTexture, textureSampler, IN.TexCoord, material.BumpIntensity);
+        normal = DoBumpMapping(TBN, BumpTexture, textureSampler, SliceTexCoord(material, BUMP_SLOT, IN.TexCoord), material.BumpIntensity);
     }
     else
     {
@@ -377,7 +447,7 @@ float4 main(PixelShaderInput IN) : SV_Target
         specular = material.SpecularColor;
         if (material.HasSpecularTexture)
         {
-            float4 specularTex = SpecularTexture.Sample(textureSampler, IN.TexCoord);
+            float4 specularTex = SpecularTexture.Sample(textureSampler, SliceTexCoord(material, SPECULAR_SLOT, IN.TexCoord));
             if (any(specular.rgb))
             {
                 specular *= specularTex;
@@ -6,6 +6,21 @@ struct Transform
  
 ConstantBuffer<Transform> TransformCB : register(b0);
  
+// Maps the quantized positions of the compact vertex format back to mesh space and locates the instances of the draw.
+struct MeshConstants
+{
+    float3 PositionOffset;
+    uint FirstInstance;
+    float3 PositionScale;
+};
+
+ConstantBuffer<MeshConstants> MeshCB : register(b4);
+
+// Per-instance transforms gathered every frame, they place each mesh instance in the object space of the model.
+StructuredBuffer<float4x4> InstanceTransforms : register(t0);
+
+// VertexShaderFull.hlsl defines FULL_VERTEX_FORMAT to build this shader for the 56-byte Vertex.
+#ifdef FULL_VERTEX_FORMAT
 struct VertexInput
 {
     float3 Position     : POSITION;
@@ -13,7 +28,26 @@ struct VertexInput
     float3 Bitangent    : BITANGENT;
     float3 Normal       : NORMAL;
     float2 TexCoord     : TEXCOORD;
+    uint InstanceID     : SV_InstanceID;
 };
+#else
+struct VertexInput
+{
+    float4 Position     : POSITION;     // unorm16 inside the mesh AABB, w is the bitangent sign
+    float2 Normal       : NORMAL;       // octahedral
+    float2 Tangent      : TANGENT;      // octahedral
+    float2 TexCoord     : TEXCOORD;
+    uint InstanceID     : SV_InstanceID;
+};
+
+float3 DecodeOctahedral(float2 encoded)
+{
+    float3 direction = float3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float t = saturate(-direction.z);
+    direction.xy += direction.xy >= 0.0f ? -t : t;
+    return normalize(direction);
+}
+#endif
  
 struct VertexShaderOutput
 {
@@ -29,11 +63,27 @@ VertexShaderOutput main(VertexInput IN)
 {
     VertexShaderOutput OUT;
  
-    OUT.Position = mul(TransformCB.MVP, float4(IN.Position, 1.0f));
-    OUT.PositionVS = mul(TransformCB.MV, float4(IN.Position, 1.0f)).xyz;
-    OUT.TangentVS = mul((float3x3)TransformCB.MV, IN.Tangent);
-    OUT.BitangentVS = mul((float3x3)TransformCB.MV, IN.Bitangent);
-    OUT.NormalVS = mul((float3x3)TransformCB.MV, IN.Normal);
+#ifdef FULL_VERTEX_FORMAT
+    float3 position = IN.Position;
+    float3 tangent = IN.Tangent;
+    float3 bitangent = IN.Bitangent;
+    float3 normal = IN.Normal;
+#else
+    float3 position = MeshCB.PositionOffset + IN.Position.xyz * MeshCB.PositionScale;
+    float3 normal = DecodeOctahedral(IN.Normal);
+    float3 tangent = DecodeOctahedral(IN.Tangent);
+    float3 bitangent = cross(normal, tangent) * (IN.Position.w * 2.0f - 1.0f);
+#endif
+
+    // SV_InstanceID does not include StartInstanceLocation, the first instance of the draw comes from the root constants.
+    float4x4 nodeTransform = InstanceTransforms[MeshCB.FirstInstance + IN.InstanceID];
+    float4 positionOS = mul(nodeTransform, float4(position, 1.0f));
+
+    OUT.Position = mul(TransformCB.MVP, positionOS);
+    OUT.PositionVS = mul(TransformCB.MV, positionOS).xyz;
+    OUT.TangentVS = mul((float3x3)TransformCB.MV, mul((float3x3)nodeTransform, tangent));
+    OUT.BitangentVS = mul((float3x3)TransformCB.MV, mul((float3x3)nodeTransform, bitangent));
+    OUT.NormalVS = mul((float3x3)TransformCB.MV, mul((float3x3)nodeTransform, normal));
     OUT.TexCoord = IN.TexCoord;
  
     return OUT;
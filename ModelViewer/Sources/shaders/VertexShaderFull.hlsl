@@ -0,0 +1,3 @@
+// VertexShader.hlsl built for the full precision Vertex input layout (VertexFormat::Full).
+#define FULL_VERTEX_FORMAT
+#include "VertexShader.hlsl"